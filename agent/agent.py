@@ -4,6 +4,8 @@ Agent for running suspicious file and collecting metrics inside the VM.
 
 Usage:
 python3 agent.py --file /path/to/file --output /path/to/output --timeout 60
+python3 agent.py --stream --file /path/to/file --output /path/to/output --timeout 60
+python3 agent.py --format binary --file /path/to/file --output /path/to/output   (compact .sbr report, see sbr.py)
 """
 
 import argparse
@@ -14,27 +16,91 @@ import time
 import datetime
 import psutil
 import shutil
+import sys
+
+import sbr
 
 
 def now_ts():
     return datetime.datetime.utcnow().isoformat() + 'Z'
 
 
-def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
+class FileReport:
+    """Collects records in memory and writes one report when closed.
+
+    fmt 'binary' writes the compact SBR1 encoding (report-*.sbr) instead of
+    JSON, falling back to JSON if the report cannot be encoded.
+    """
+
+    def __init__(self, output_dir, fmt='json'):
+        self.output_dir = output_dir
+        self.fmt = fmt
+        self.report = {'start_time': None, 'path': None, 'events': [], 'processes': [], 'network': []}
+
+    def emit(self, kind, record):
+        if kind == 'start':
+            self.report['start_time'] = record['time']
+            self.report['path'] = record['path']
+        elif kind == 'event':
+            self.report['events'].append(record)
+        elif kind == 'process':
+            self.report['processes'].append(record)
+        elif kind == 'network':
+            self.report['network'].append(record)
+        elif kind == 'error':
+            self.report['error'] = record['error']
+        elif kind == 'end':
+            self.report['end_time'] = record['time']
+
+    def close(self):
+        stem = os.path.join(self.output_dir, f'report-{int(time.time())}')
+        if self.fmt == 'binary':
+            try:
+                data = sbr.encode(self.report)
+                with open(stem + '.sbr', 'wb') as f:
+                    f.write(data)
+                return stem + '.sbr'
+            except sbr.FormatError:
+                pass
+        fname = stem + '.json'
+        with open(fname, 'w') as f:
+            json.dump(self.report, f, indent=2)
+        return fname
+
+
+class StreamReport:
+    """Writes every record as one NDJSON line as soon as it is produced.
+
+    The host reassembles the report from the stream, so nothing accumulates
+    in the guest and there is no report file to fetch afterwards.
+    """
+
+    def __init__(self, stream=None):
+        self.stream = stream or sys.stdout
+
+    def emit(self, kind, record):
+        line = json.dumps(dict(type=kind, **record), separators=(',', ':'))
+        self.stream.write(line + '\n')
+        self.stream.flush()
+
+    def close(self):
+        return None
+
+
+def run_monitored(path, timeout, poll_interval=0.5, output_dir='.', sink=None, fmt='json'):
     os.makedirs(output_dir, exist_ok=True)
-    report = {'start_time': now_ts(), 'path': path, 'events': [], 'processes': [], 'network': []}
+    if sink is None:
+        sink = FileReport(output_dir, fmt)
+    sink.emit('start', {'time': now_ts(), 'path': path})
 
     baseline_pids = set(p.pid for p in psutil.process_iter())
 
     try:
         proc = subprocess.Popen([path], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
     except Exception as e:
-        report['error'] = f'failed to start: {e}'
-        report['end_time'] = now_ts()
-        fname = os.path.join(output_dir, f'report-{int(time.time())}.json')
-        with open(fname, 'w') as f:
-            json.dump(report, f, indent=2)
-        return fname
+        sink.emit('error', {'time': now_ts(), 'error': f'failed to start: {e}'})
+        sink.emit('end', {'time': now_ts()})
+        return sink.close()
 
     start = time.time()
     try:
@@ -42,11 +108,11 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
             elapsed = time.time() - start
             if elapsed > timeout:
                 proc.terminate()
-                report['events'].append({'time': now_ts(), 'event': 'timeout-kill'})
+                sink.emit('event', {'time': now_ts(), 'event': 'timeout-kill'})
                 break
 
             if proc.poll() is not None:
-                report['events'].append({'time': now_ts(), 'event': 'process-exited', 'returncode': proc.returncode})
+                sink.emit('event', {'time': now_ts(), 'event': 'process-exited', 'returncode': proc.returncode})
                 break
 
             # collect CPU/memory for process
@@ -54,7 +120,7 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
                 p = psutil.Process(proc.pid)
                 cpu = p.cpu_percent(interval=None)
                 mem = p.memory_info()._asdict()
-                report['processes'].append({'time': now_ts(), 'pid': proc.pid, 'cpu_percent': cpu, 'memory': mem})
+                sink.emit('process', {'time': now_ts(), 'pid': proc.pid, 'cpu_percent': cpu, 'memory': mem})
             except psutil.NoSuchProcess:
                 pass
 
@@ -65,9 +131,9 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
                 for pid in new:
                     try:
                         pp = psutil.Process(pid)
-                        report['events'].append({'time': now_ts(), 'event': 'process-created', 'pid': pid, 'cmdline': pp.cmdline()})
+                        sink.emit('event', {'time': now_ts(), 'event': 'process-created', 'pid': pid, 'cmdline': pp.cmdline()})
                     except Exception:
-                        report['events'].append({'time': now_ts(), 'event': 'process-created', 'pid': pid})
+                        sink.emit('event', {'time': now_ts(), 'event': 'process-created', 'pid': pid})
                 baseline_pids = baseline_pids.union(new)
 
             # collect network connections
@@ -75,7 +141,7 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
                 conns = []
                 for c in psutil.net_connections(kind='inet'):
                     conns.append({'fd': c.fd, 'family': str(c.family), 'type': str(c.type), 'laddr': str(c.laddr), 'raddr': str(c.raddr), 'status': c.status, 'pid': c.pid})
-                report['network'].append({'time': now_ts(), 'connections': conns})
+                sink.emit('network', {'time': now_ts(), 'connections': conns})
             except Exception:
                 pass
 
@@ -83,13 +149,11 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
 
     except KeyboardInterrupt:
         proc.terminate()
-        report['events'].append({'time': now_ts(), 'event': 'keyboard-interrupt'})
+        sink.emit('event', {'time': now_ts(), 'event': 'keyboard-interrupt'})
 
     # finalize
-    report['end_time'] = now_ts()
-    fname = os.path.join(output_dir, f'report-{int(time.time())}.json')
-    with open(fname, 'w') as f:
-        json.dump(report, f, indent=2)
+    sink.emit('end', {'time': now_ts()})
+    fname = sink.close()
 
     # collect stdout/stderr
     try:
@@ -104,6 +168,40 @@ def run_monitored(path, timeout, poll_interval=0.5, output_dir='.'):
     return fname
 
 
+READY_CHANNEL = '/dev/virtio-ports/org.safebox.agent.0'
+
+
+def notify_ready(channel=READY_CHANNEL):
+    """Tell the host the guest is up by writing READY to the virtio-serial port."""
+    if not os.path.exists(channel):
+        return False
+    try:
+        with open(channel, 'w') as f:
+            f.write('READY\n')
+        return True
+    except OSError:
+        return False
+
+
+def find_collector():
+    """The native collector (safebox-collector) if the image has one.
+
+    It is looked for in $SAFEBOX_COLLECTOR, then next to this file. It
+    streams the same records as StreamReport, from proc connector and
+    sock_diag events instead of psutil rescans.
+    """
+    candidates = [os.environ.get('SAFEBOX_COLLECTOR'),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)), 'safebox-collector')]
+    for path in candidates:
+        if path and os.path.isfile(path) and os.access(path, os.X_OK):
+            return path
+    return None
+
+
+def collector_argv(collector, path, output_dir, timeout):
+    return [collector, '--file', path, '--output', output_dir, '--timeout', str(timeout)]
+
+
 def scp_send(local_path, target):
     cmd = ['scp', '-o', 'StrictHostKeyChecking=no', local_path, target]
     return subprocess.call(cmd)
@@ -111,19 +209,39 @@ def scp_send(local_path, target):
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
-    parser.add_argument('--file', required=True, help='Path to suspicious file to execute')
-    parser.add_argument('--output', required=True, help='Directory to write output into')
+    parser.add_argument('--file', help='Path to suspicious file to execute')
+    parser.add_argument('--output', help='Directory to write output into')
     parser.add_argument('--timeout', type=int, default=60, help='Execution timeout (seconds)')
     parser.add_argument('--send-back', default=None, help='Optional scp target')
+    parser.add_argument('--stream', action='store_true',
+                        help='Stream NDJSON records to stdout instead of writing a report file')
+    parser.add_argument('--no-collector', action='store_true',
+                        help='Stream from the psutil loop even if safebox-collector is installed')
+    parser.add_argument('--format', choices=('json', 'binary'), default='json',
+                        help='Report file format: pretty JSON or compact binary .sbr')
+    parser.add_argument('--notify-ready', action='store_true',
+                        help='Signal guest readiness on the virtio-serial channel and exit (run at boot)')
     args = parser.parse_args()
 
+    if args.notify_ready:
+        raise SystemExit(0 if notify_ready() else 1)
+    if not args.file or not args.output:
+        parser.error('--file and --output are required')
+
     try:
         st = os.stat(args.file)
         os.chmod(args.file, st.st_mode | 0o111)
     except Exception:
         pass
 
-    report = run_monitored(args.file, args.timeout, output_dir=args.output)
+    if args.stream:
+        collector = None if args.no_collector else find_collector()
+        if collector:
+            os.execv(collector, collector_argv(collector, args.file, args.output, args.timeout))
+        run_monitored(args.file, args.timeout, output_dir=args.output, sink=StreamReport())
+        raise SystemExit(0)
+
+    report = run_monitored(args.file, args.timeout, output_dir=args.output, fmt=args.format)
     print(f'Report written to {report}')
 
     if args.send_back:
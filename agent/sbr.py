@@ -0,0 +1,372 @@
+#!/usr/bin/env python3
+"""
+Compact binary agent reports (SBR1).
+
+The same document as the JSON report, stored column by column with every
+string interned once, times and counters as zigzag varint deltas, and
+connections as open / close / status-change events instead of a full table
+per poll. The layout is documented in src/host/report_codec.h; safebox-lib
+reads and writes the same bytes, so keep the two in step.
+
+Usage:
+python3 sbr.py report-123.sbr            (prints the report as JSON)
+"""
+
+import calendar
+import datetime
+import json
+import struct
+import sys
+
+MAGIC = b'SBR1'
+VERSION = 1
+KNOWN = ('start_time', 'path', 'events', 'processes', 'network', 'error', 'end_time')
+
+
+class FormatError(ValueError):
+    pass
+
+
+def parse_time(text):
+    """Microseconds since the epoch of an agent timestamp (isoformat() + 'Z')."""
+    if not isinstance(text, str) or not text.endswith('Z'):
+        raise FormatError(f'unsupported time {text!r}')
+    body = text[:-1]
+    try:
+        fmt = '%Y-%m-%dT%H:%M:%S.%f' if '.' in body else '%Y-%m-%dT%H:%M:%S'
+        if '.' in body and len(body.rsplit('.', 1)[1]) != 6:
+            raise ValueError
+        dt = datetime.datetime.strptime(body, fmt)
+    except ValueError:
+        raise FormatError(f'unsupported time {text!r}')
+    return calendar.timegm(dt.timetuple()) * 1000000 + dt.microsecond
+
+
+def format_time(us):
+    secs, frac = divmod(us, 1000000)
+    dt = datetime.datetime(1970, 1, 1) + datetime.timedelta(seconds=secs, microseconds=frac)
+    return dt.isoformat() + 'Z'
+
+
+def _uvarint(out, v):
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+
+
+def _svarint(out, v):
+    _uvarint(out, (v << 1) ^ (v >> 63) if v < 0 else v << 1)
+
+
+def _int(v):
+    return int(round(v)) if isinstance(v, (int, float)) and not isinstance(v, bool) else 0
+
+
+class _Strings:
+    def __init__(self):
+        self.index = {}
+        self.strings = []
+
+    def id(self, s):
+        if s not in self.index:
+            self.index[s] = len(self.strings)
+            self.strings.append(s)
+        return self.index[s]
+
+    def put(self, out, s):
+        _uvarint(out, self.id(s))
+
+    def put_opt(self, out, s):
+        _uvarint(out, 0 if not isinstance(s, str) else self.id(s) + 1)
+
+
+def _times(out, records, base):
+    prev = base
+    for r in records:
+        us = parse_time(r.get('time'))
+        _svarint(out, us - prev)
+        prev = us
+
+
+def _deltas(out, values):
+    prev = 0
+    for v in values:
+        _svarint(out, v - prev)
+        prev = v
+
+
+def _conn_key(c):
+    pid = c.get('pid')
+    return (_int(c.get('fd')), c.get('family', ''), c.get('type', ''), c.get('laddr', ''),
+            c.get('raddr', ''), _int(pid) if isinstance(pid, (int, float)) else None)
+
+
+def encode(report):
+    """SBR1 bytes of a report dict. Raises FormatError for odd timestamps."""
+    strings = _Strings()
+    body = bytearray()
+    processes = [r for r in report.get('processes') or [] if isinstance(r, dict)]
+    events = [r for r in report.get('events') or [] if isinstance(r, dict)]
+    network = [r for r in report.get('network') or [] if isinstance(r, dict)]
+
+    base = 0
+    for section in (processes, events, network):
+        if section:
+            try:
+                base = parse_time(section[0].get('time'))
+            except FormatError:
+                pass
+            break
+
+    for key in ('start_time', 'path', 'end_time', 'error'):
+        strings.put_opt(body, report.get(key))
+    _svarint(body, base)
+    extra = {k: v for k, v in report.items() if k not in KNOWN}
+    extra_text = json.dumps(extra, separators=(',', ':')).encode() if extra else b''
+    _uvarint(body, len(extra_text))
+    body += extra_text
+
+    _uvarint(body, len(processes))
+    _times(body, processes, base)
+    _deltas(body, [_int(r.get('pid')) for r in processes])
+    cpus = [float(r.get('cpu_percent') or 0) for r in processes]
+    tenths = all(abs(c) < 1e15 and round(c * 10) / 10 == c for c in cpus)
+    if tenths:
+        _uvarint(body, 10)
+        _deltas(body, [int(round(c * 10)) for c in cpus])
+    else:
+        _uvarint(body, 0)
+        for c in cpus:
+            body += struct.pack('<d', c)
+    fields = []
+    for r in processes:
+        for name in (r.get('memory') or {}):
+            if name not in fields:
+                fields.append(name)
+    _uvarint(body, len(fields))
+    for name in fields:
+        strings.put(body, name)
+        _deltas(body, [_int((r.get('memory') or {}).get(name)) for r in processes])
+
+    _uvarint(body, len(events))
+    _times(body, events, base)
+    for r in events:
+        strings.put(body, r.get('event', ''))
+    for r in events:
+        pid, rc, cmdline = r.get('pid'), r.get('returncode'), r.get('cmdline')
+        flags = (1 if isinstance(pid, (int, float)) else 0) | (2 if isinstance(rc, (int, float)) else 0) | \
+                (4 if isinstance(cmdline, list) else 0)
+        _uvarint(body, flags)
+        if flags & 1:
+            _svarint(body, _int(pid))
+        if flags & 2:
+            _svarint(body, _int(rc))
+        if flags & 4:
+            _uvarint(body, len(cmdline))
+            for arg in cmdline:
+                strings.put(body, arg if isinstance(arg, str) else json.dumps(arg))
+
+    _uvarint(body, len(network))
+    _times(body, network, base)
+    open_conns = {}  # key -> [id, status], in open order
+    changes = bytearray()
+    count = 0
+    last = 0
+    next_id = 0
+    for s, snapshot in enumerate(network):
+        now = {}
+        for c in snapshot.get('connections') or []:
+            now.setdefault(_conn_key(c), c)
+        for key in [k for k in open_conns if k not in now]:
+            _uvarint(changes, s - last)
+            _uvarint(changes, 1)
+            _uvarint(changes, open_conns.pop(key)[0])
+            last, count = s, count + 1
+        for key, c in now.items():
+            status = c.get('status', '')
+            if key not in open_conns:
+                _uvarint(changes, s - last)
+                _uvarint(changes, 0)
+                _svarint(changes, key[0])
+                for s_ in key[1:5]:
+                    strings.put(changes, s_)
+                strings.put(changes, status)
+                _uvarint(changes, 0 if key[5] is None else key[5] + 1)
+                open_conns[key] = [next_id, status]
+                next_id += 1
+            elif open_conns[key][1] != status:
+                _uvarint(changes, s - last)
+                _uvarint(changes, 2)
+                _uvarint(changes, open_conns[key][0])
+                strings.put(changes, status)
+                open_conns[key][1] = status
+            else:
+                continue
+            last, count = s, count + 1
+    _uvarint(body, count)
+    body += changes
+
+    out = bytearray(MAGIC)
+    _uvarint(out, VERSION)
+    _uvarint(out, len(strings.strings))
+    for s in strings.strings:
+        data = s.encode()
+        _uvarint(out, len(data))
+        out += data
+    return bytes(out + body)
+
+
+class _Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def u(self):
+        v = shift = 0
+        while True:
+            if self.pos >= len(self.data) or shift >= 64:
+                raise FormatError('truncated or corrupt report')
+            b = self.data[self.pos]
+            self.pos += 1
+            v |= (b & 0x7F) << shift
+            if not b & 0x80:
+                return v
+            shift += 7
+
+    def s(self):
+        v = self.u()
+        return (v >> 1) ^ -(v & 1)
+
+    def take(self, n):
+        if n > len(self.data) - self.pos:
+            raise FormatError('truncated or corrupt report')
+        v = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return v
+
+    def count(self):
+        n = self.u()
+        if n > len(self.data) - self.pos:
+            raise FormatError('truncated or corrupt report')
+        return n
+
+
+def decode(data):
+    """The report dict of SBR1 bytes (the JSON export)."""
+    if not data.startswith(MAGIC):
+        raise FormatError('not an SBR1 report')
+    r = _Reader(data)
+    r.pos = len(MAGIC)
+    if r.u() != VERSION:
+        raise FormatError('unsupported version')
+    strings = [r.take(r.u()).decode() for _ in range(r.count())]
+
+    def string(i):
+        if i >= len(strings):
+            raise FormatError('truncated or corrupt report')
+        return strings[i]
+
+    def opt():
+        i = r.u()
+        return None if i == 0 else string(i - 1)
+
+    start, path, end, error = opt(), opt(), opt(), opt()
+    base = r.s()
+    extra_text = r.take(r.u())
+
+    def times(n):
+        out, prev = [], base
+        for _ in range(n):
+            prev += r.s()
+            out.append(prev)
+        return out
+
+    def deltas(n):
+        out, prev = [], 0
+        for _ in range(n):
+            prev += r.s()
+            out.append(prev)
+        return out
+
+    n = r.count()
+    t, pids = times(n), deltas(n)
+    scale = r.u()
+    if scale:
+        cpus = [v / scale for v in deltas(n)]
+    else:
+        cpus = [struct.unpack('<d', r.take(8))[0] for _ in range(n)]
+    memory = [(string(r.u()), deltas(n)) for _ in range(r.count())]
+    processes = []
+    for i in range(n):
+        rec = {'time': format_time(t[i]), 'pid': pids[i], 'cpu_percent': cpus[i]}
+        if memory:
+            rec['memory'] = {name: col[i] for name, col in memory}
+        processes.append(rec)
+
+    n = r.count()
+    t = times(n)
+    names = [r.u() for _ in range(n)]
+    events = []
+    for i in range(n):
+        rec = {'time': format_time(t[i]), 'event': string(names[i])}
+        flags = r.u()
+        if flags & 1:
+            rec['pid'] = r.s()
+        if flags & 2:
+            rec['returncode'] = r.s()
+        if flags & 4:
+            rec['cmdline'] = [string(r.u()) for _ in range(r.count())]
+        events.append(rec)
+
+    n = r.count()
+    t = times(n)
+    remaining = r.count()
+    conns, open_ids = [], []
+    at = r.u() if remaining else None
+    network = []
+    for s in range(n):
+        while remaining and at == s:
+            op = r.u()
+            if op == 0:
+                conn = {'fd': r.s()}
+                for key in ('family', 'type', 'laddr', 'raddr', 'status'):
+                    conn[key] = string(r.u())
+                pid = r.u()
+                conn['pid'] = None if pid == 0 else pid - 1
+                open_ids.append(len(conns))
+                conns.append(conn)
+            else:
+                i = r.u()
+                if i >= len(conns) or op not in (1, 2):
+                    raise FormatError('truncated or corrupt report')
+                if op == 1:
+                    if i not in open_ids:
+                        raise FormatError('truncated or corrupt report')
+                    open_ids.remove(i)
+                else:
+                    conns[i] = dict(conns[i], status=string(r.u()))
+            remaining -= 1
+            at = s + r.u() if remaining else None
+        network.append({'time': format_time(t[s]), 'connections': [dict(conns[i]) for i in open_ids]})
+    if remaining:
+        raise FormatError('truncated or corrupt report')
+    if r.pos != len(data):
+        raise FormatError('trailing bytes')
+
+    report = {'start_time': start, 'path': path, 'events': events, 'processes': processes, 'network': network}
+    if error is not None:
+        report['error'] = error
+    if end is not None:
+        report['end_time'] = end
+    if extra_text:
+        report.update(json.loads(extra_text))
+    return report
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        raise SystemExit('usage: sbr.py <report.sbr>')
+    with open(sys.argv[1], 'rb') as f:
+        json.dump(decode(f.read()), sys.stdout, indent=2)
+    sys.stdout.write('\n')
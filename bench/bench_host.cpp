@@ -0,0 +1,494 @@
+// safebox-bench: orchestration overhead, scheduler throughput and pool
+// scaling against a fake backend whose phases take configurable time, plus
+// an optional end-to-end run against real VMs.
+//
+//   SAFEBOX_BENCH_FAKE_LATENCY=boot=20,inject=5,agent=100,revert=10  (ms)
+//   SAFEBOX_BENCH_MAX_VMS=16            upper end of the pool scaling sweep
+//
+// Real-hypervisor mode runs when SAFEBOX_BENCH_VMS is set:
+//   SAFEBOX_BENCH_VMS=kvm=win10a:2222,kvm=win10b:2223   as --vm, comma separated
+//   SAFEBOX_BENCH_SAMPLE=/path/to/sample   SAFEBOX_BENCH_JOBS=8   SAFEBOX_BENCH_USER=safebox
+#include <benchmark/benchmark.h>
+#include "backend.h"
+#include "event_loop.h"
+#include "hash_index.h"
+#include "matcher.h"
+#include "pool.h"
+#include "report.h"
+#include "report_codec.h"
+#include "sha256.h"
+#include "telemetry.h"
+#include "triage.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+using namespace safebox;
+
+namespace {
+
+struct FakeLatency {
+    int boot_ms = 20;
+    int inject_ms = 5;
+    int agent_ms = 100;
+    int revert_ms = 10;
+};
+
+FakeLatency g_latency;
+
+void parse_latency(const char *spec) {
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = item.substr(0, eq);
+        int ms = std::atoi(item.c_str() + eq + 1);
+        if (key == "boot") g_latency.boot_ms = ms;
+        else if (key == "inject") g_latency.inject_ms = ms;
+        else if (key == "agent") g_latency.agent_ms = ms;
+        else if (key == "revert") g_latency.revert_ms = ms;
+    }
+}
+
+void pause_ms(int ms) {
+    if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Stands in for a hypervisor: lifecycle calls just take g_latency, the guest
+// is "reachable" at once and the agent is a local shell that sleeps and then
+// prints a minimal report stream. Only the pool's own work is real.
+class FakeBackend : public Backend {
+public:
+    int start(const std::string &) override {
+        pause_ms(g_latency.boot_ms);
+        return 0;
+    }
+    int revert(const std::string &) override {
+        pause_ms(g_latency.revert_ms);
+        return 0;
+    }
+    std::string guest_address(const std::string &) override { return "127.0.0.1"; }
+
+    SshSession open_session(const std::string &target, int port) override {
+        return SshSession{target, port, ""};
+    }
+    bool probe_guest(const SshSession &, int) override { return true; }
+    Argv guest_command(const SshSession &, const std::string &remote_cmd) override {
+        if (remote_cmd.find("agent.py") == std::string::npos) return {"true"};
+        std::ostringstream script;
+        script << "sleep " << g_latency.agent_ms / 1000.0 << ";"
+               << " echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"sample\"}';"
+               << " echo '{\"type\": \"process\", \"time\": \"t1\", \"pid\": 4242, \"name\": \"sample.exe\"}';"
+               << " echo '{\"type\": \"end\", \"time\": \"t2\"}'";
+        return {"sh", "-c", script.str()};
+    }
+    int inject(const std::string &, const SshSession &, const std::string &, std::string &) override {
+        pause_ms(g_latency.inject_ms);
+        return 0;
+    }
+    void release(const std::string &) override {}
+};
+
+// The pool logs every step; keep that out of the benchmark table.
+class QuietStreams {
+public:
+    QuietStreams() : out_(std::cout.rdbuf(nullptr)), err_(std::cerr.rdbuf(nullptr)) {}
+    ~QuietStreams() {
+        std::cout.rdbuf(out_);
+        std::cerr.rdbuf(err_);
+    }
+
+private:
+    std::streambuf *out_;
+    std::streambuf *err_;
+};
+
+std::filesystem::path bench_root() {
+    static std::filesystem::path root = [] {
+        auto dir = std::filesystem::temp_directory_path() / ("safebox-bench-" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir);
+        std::ofstream(dir / "sample.bin") << "MZ";
+        return dir;
+    }();
+    return root;
+}
+
+// Runs `jobs` jobs through a pool of the given VMs; returns the number that
+// completed.
+int run_pool(const std::vector<VMConfig> &vms, int jobs, const std::string &sample, int threads) {
+    PoolOptions options;
+    options.threads = threads;
+    options.ssh_timeout = 600;
+    std::filesystem::path reports = bench_root() / "reports";
+    VMPool pool(vms, options);
+    pool.start();
+    for (int i = 0; i < jobs; ++i) pool.submit(Job{sample, (reports / std::to_string(i)).string()});
+    pool.drain();
+    std::filesystem::remove_all(reports);
+    return pool.completed();
+}
+
+std::vector<VMConfig> fake_vms(int n) {
+    std::vector<VMConfig> vms;
+    for (int i = 0; i < n; ++i) vms.push_back(VMConfig{"fake", "fake" + std::to_string(i), "", "safebox", 22});
+    return vms;
+}
+
+// --- Building blocks ------------------------------------------------------
+
+void BM_ExecuteCommand(benchmark::State &state) {
+    QuietStreams quiet;
+    for (auto _ : state) benchmark::DoNotOptimize(execute_command({"true"}).return_code);
+}
+BENCHMARK(BM_ExecuteCommand)->Unit(benchmark::kMicrosecond);
+
+// Children run concurrently on one loop; the cost per child is what the
+// pool pays per ssh/agent invocation.
+void BM_EventLoopSpawn(benchmark::State &state) {
+    const int children = static_cast<int>(state.range(0));
+    QuietStreams quiet;
+    for (auto _ : state) {
+        EventLoop loop;
+        int done = 0;
+        for (int i = 0; i < children; ++i) {
+            loop.spawn({"true"}, {}, [&](CommandResult) {
+                if (++done == children) loop.stop();
+            });
+        }
+        loop.run();
+    }
+    state.SetItemsProcessed(state.iterations() * children);
+}
+BENCHMARK(BM_EventLoopSpawn)->Arg(1)->Arg(16)->Arg(64)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_ReportAssembler(benchmark::State &state) {
+    std::string stream = "{\"type\": \"start\", \"time\": \"t0\", \"path\": \"sample\"}\n";
+    for (int i = 0; i < 1000; ++i) {
+        stream += "{\"type\": \"process\", \"time\": \"t\", \"pid\": " + std::to_string(i) +
+                  ", \"name\": \"proc.exe\", \"cpu_percent\": 1.5}\n";
+    }
+    stream += "{\"type\": \"end\", \"time\": \"t1\"}\n";
+    for (auto _ : state) {
+        ReportAssembler assembler;
+        // Agent output arrives in pipe-sized chunks.
+        for (size_t off = 0; off < stream.size(); off += 4096) {
+            assembler.feed(stream.data() + off, std::min<size_t>(4096, stream.size() - off));
+        }
+        assembler.finish();
+        benchmark::DoNotOptimize(assembler.complete());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.size()));
+}
+BENCHMARK(BM_ReportAssembler);
+
+// A downloaded report with `range` process samples and network snapshots.
+std::string report_file(int samples) {
+    std::string text = "{\"start_time\": \"t0\", \"path\": \"sample\", \"events\": [], \"processes\": [";
+    for (int i = 0; i < samples; ++i) {
+        if (i) text += ",";
+        text += "{\"time\": \"2024-01-01T00:00:00.000000Z\", \"pid\": 100, \"cpu_percent\": 12.5,"
+                " \"memory\": {\"rss\": 10485760, \"vms\": 20971520, \"shared\": 0, \"text\": 0}}";
+    }
+    text += "], \"network\": [";
+    for (int i = 0; i < samples; ++i) {
+        if (i) text += ",";
+        text += "{\"time\": \"2024-01-01T00:00:00.500000Z\", \"connections\": [{\"fd\": 3, \"family\": \"AddressFamily.AF_INET\","
+                " \"type\": \"SocketKind.SOCK_STREAM\", \"laddr\": \"addr(ip='10.0.0.2', port=22)\","
+                " \"raddr\": \"addr(ip='10.0.0.1', port=51000)\", \"status\": \"ESTABLISHED\", \"pid\": null}]}";
+    }
+    return text + "], \"end_time\": \"t1\"}";
+}
+
+// Downloaded report -> verdict: streamed into AgentReport vs. a full Json
+// document.
+void BM_ScoreReport(benchmark::State &state) {
+    std::string text = report_file(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        AgentReport report;
+        parse_agent_report(text, report);
+        benchmark::DoNotOptimize(score_report(summarize_report(report)).score);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ScoreReport)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+void BM_ScoreReportDom(benchmark::State &state) {
+    std::string text = report_file(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        Json doc;
+        parse_json(text, doc);
+        benchmark::DoNotOptimize(score_report(summarize_report(agent_report_from_json(doc))).score);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ScoreReportDom)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// The same report as SBR1; bytes processed are the JSON's, so the rates
+// compare directly, and "ratio" is the binary size over the JSON size.
+void BM_ScoreReportBinary(benchmark::State &state) {
+    std::string text = report_file(static_cast<int>(state.range(0)));
+    Json doc;
+    parse_json(text, doc);
+    std::string data;
+    encode_binary_report(doc, data);
+    for (auto _ : state) {
+        AgentReport report;
+        decode_binary_report(data, report);
+        benchmark::DoNotOptimize(score_report(summarize_report(report)).score);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+    state.counters["ratio"] = static_cast<double>(data.size()) / static_cast<double>(text.size());
+}
+BENCHMARK(BM_ScoreReportBinary)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+void BM_Sha256(benchmark::State &state) {
+    std::string data(static_cast<size_t>(state.range(0)), 'x');
+    for (auto _ : state) benchmark::DoNotOptimize(sha256_hex(data));
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Sha256)->Arg(4 << 10)->Arg(1 << 20);
+
+// Lookups (half of them hits) in an index of range(0) hashes.
+void BM_HashIndexLookup(benchmark::State &state) {
+    std::string path = (bench_root() / ("known-" + std::to_string(state.range(0)) + ".sbhi")).string();
+    std::filesystem::create_directories(bench_root());
+    std::stringstream list;
+    for (int64_t i = 0; i < state.range(0); ++i) list << sha256_hex(std::to_string(i)) << " family\n";
+    build_hash_index(list, path);
+    HashIndex index;
+    index.open(path);
+    std::vector<std::string> probes;
+    for (int i = 0; i < 1024; ++i) probes.push_back(sha256_hex(std::to_string(i % 2 ? i : -i)));
+    size_t n = 0, hits = 0;
+    for (auto _ : state) hits += index.lookup(probes[n++ % probes.size()]);
+    state.counters["hits"] = static_cast<double>(hits) / static_cast<double>(n);
+}
+BENCHMARK(BM_HashIndexLookup)->Arg(1000)->Arg(1 << 20);
+
+// Static triage of a 16 MiB sample, range(0) = 0 for mostly-text data
+// (long string runs) and 1 for random bytes (no strings, high entropy).
+void BM_Triage(benchmark::State &state) {
+    std::string path = (bench_root() / ("triage-" + std::to_string(state.range(0)) + ".bin")).string();
+    std::filesystem::create_directories(bench_root());
+    std::string data(16 << 20, '\0');
+    std::mt19937 rng(1);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = state.range(0) ? char(rng()) : i % 64 == 63 ? '\n' : char('a' + i % 26);
+    }
+    std::ofstream(path, std::ios::binary) << data;
+    for (auto _ : state) {
+        TriageResult result;
+        triage_file(path, TriageOptions(), result);
+        benchmark::DoNotOptimize(result.entropy);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_Triage)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// range(0) `.*family<i>.*dropper` style rules over a 64 KiB sample.
+void BM_MatchSignatures(benchmark::State &state) {
+    Matcher m(true);
+    for (int i = 0; i < state.range(0); ++i) {
+        m.add(".*family" + std::to_string(i) + ".*dropper.*", i);
+    }
+    m.compile();
+    std::string data;
+    for (int i = 0; data.size() < (64 << 10); ++i) data += "mov eax, family" + std::to_string(i) + " ; call\n";
+    for (auto _ : state) benchmark::DoNotOptimize(m.scan(data));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data.size()));
+    state.counters["states"] = static_cast<double>(m.states());
+}
+BENCHMARK(BM_MatchSignatures)->Arg(10)->Arg(1000)->Arg(10000);
+
+// --- Scheduler ------------------------------------------------------------
+
+// Push/pop through the shared queue with half the jobs pinned to another
+// backend, so every pop also pays for the accept() scan.
+void BM_JobQueueThroughput(benchmark::State &state) {
+    const int consumers = static_cast<int>(state.range(0));
+    const int jobs = 10000;
+    for (auto _ : state) {
+        JobQueue queue;
+        std::vector<std::thread> threads;
+        std::atomic<int> taken{0};
+        for (int c = 0; c < consumers; ++c) {
+            std::string backend = c % 2 ? "kvm" : "virtualbox";
+            threads.emplace_back([&queue, &taken, backend] {
+                auto accept = [&backend](const Job &j) { return j.backend.empty() || j.backend == backend; };
+                Job job;
+                while (queue.pop(job, accept)) ++taken;
+            });
+        }
+        for (int i = 0; i < jobs; ++i) {
+            Job job{"sample.bin", "./reports"};
+            if (consumers > 1) job.backend = i % 2 ? "kvm" : "virtualbox";
+            queue.push(std::move(job));
+        }
+        queue.close();
+        for (auto &t : threads) t.join();
+        benchmark::DoNotOptimize(taken.load());
+    }
+    state.SetItemsProcessed(state.iterations() * jobs);
+}
+BENCHMARK(BM_JobQueueThroughput)->Arg(1)->Arg(2)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// range(0) submitter threads pushing into one queue that a single
+// dispatcher drains with try_pop, as VMPool's loop thread does; the mix of
+// priorities and tenants exercises the scheduling order.
+void BM_JobQueueSubmit(benchmark::State &state) {
+    const int producers = static_cast<int>(state.range(0));
+    const int jobs = 20000;
+    for (auto _ : state) {
+        JobQueue queue;
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&queue, p, producers] {
+                for (int i = p; i < jobs; i += producers) {
+                    Job job{"sample.bin", "./reports"};
+                    job.priority = static_cast<Priority>(i % 3);
+                    job.tenant = "tenant" + std::to_string(i % 8);
+                    queue.push(std::move(job));
+                }
+            });
+        }
+        int taken = 0;
+        Job job;
+        while (taken < jobs) {
+            if (queue.try_pop(job)) ++taken;
+        }
+        for (auto &t : threads) t.join();
+        benchmark::DoNotOptimize(taken);
+    }
+    state.SetItemsProcessed(state.iterations() * jobs);
+}
+BENCHMARK(BM_JobQueueSubmit)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// --- Pool -----------------------------------------------------------------
+
+// Wall-clock throughput of a pool benchmark; the work happens on the
+// pool's threads, so CPU time says nothing here.
+class Throughput {
+public:
+    Throughput() : begin_(std::chrono::steady_clock::now()) {}
+
+    void report(benchmark::State &state, int64_t samples) const {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_).count();
+        state.SetItemsProcessed(samples);
+        state.counters["samples_per_min"] = seconds > 0 ? samples * 60 / seconds : 0;
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin_;
+};
+
+// One VM, every fake phase instant: the wall time per job is the pool's
+// own per-cycle cost (state machine hops, two spawns, report + job.json).
+void BM_PoolOverhead(benchmark::State &state) {
+    FakeLatency saved = g_latency;
+    g_latency = FakeLatency{0, 0, 0, 0};
+    const int jobs = 20;
+    int64_t done = 0;
+    Throughput throughput;
+    {
+        QuietStreams quiet;
+        for (auto _ : state) done += run_pool(fake_vms(1), jobs, (bench_root() / "sample.bin").string(), 1);
+    }
+    g_latency = saved;
+    throughput.report(state, done);
+}
+BENCHMARK(BM_PoolOverhead)->Unit(benchmark::kMillisecond)->UseRealTime()->Iterations(5);
+
+// Scaling 1..N VMs at the configured latencies, four jobs per VM. args:
+// VMs, step threads.
+void BM_PoolScaling(benchmark::State &state) {
+    const int vms = static_cast<int>(state.range(0));
+    const int threads = static_cast<int>(state.range(1));
+    int64_t done = 0;
+    Throughput throughput;
+    {
+        QuietStreams quiet;
+        for (auto _ : state) done += run_pool(fake_vms(vms), vms * 4, (bench_root() / "sample.bin").string(), threads);
+    }
+    throughput.report(state, done);
+    state.counters["vms"] = vms;
+}
+
+void register_pool_scaling() {
+    int max_vms = 16;
+    if (const char *env = std::getenv("SAFEBOX_BENCH_MAX_VMS")) max_vms = std::max(1, std::atoi(env));
+    auto *bm = benchmark::RegisterBenchmark("BM_PoolScaling", BM_PoolScaling);
+    for (int vms = 1; vms <= max_vms; vms *= 2) {
+        bm->Args({vms, 4});
+        if (vms > 4) bm->Args({vms, vms});
+    }
+    bm->ArgNames({"vms", "threads"})->Unit(benchmark::kMillisecond)->UseRealTime()->Iterations(2);
+}
+
+// --- Real hypervisor ------------------------------------------------------
+
+std::vector<VMConfig> real_vms(const std::string &spec, const std::string &user) {
+    std::vector<VMConfig> vms;
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::string backend = "kvm";
+        size_t eq = item.find('=');
+        if (eq != std::string::npos) {
+            backend = item.substr(0, eq);
+            item = item.substr(eq + 1);
+        }
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) continue;
+        size_t channel = item.find(':', colon + 1);
+        VMConfig vm{backend, item.substr(0, colon), "", user,
+                    std::atoi(item.substr(colon + 1, channel - colon - 1).c_str())};
+        if (channel != std::string::npos) vm.ready_channel = item.substr(channel + 1);
+        vms.push_back(vm);
+    }
+    return vms;
+}
+
+void register_real_pool() {
+    const char *spec = std::getenv("SAFEBOX_BENCH_VMS");
+    if (!spec) return;
+    const char *sample = std::getenv("SAFEBOX_BENCH_SAMPLE");
+    const char *user = std::getenv("SAFEBOX_BENCH_USER");
+    std::vector<VMConfig> vms = real_vms(spec, user ? user : "safebox");
+    if (vms.empty() || !sample) {
+        std::cerr << "SAFEBOX_BENCH_VMS needs [<backend>=]<name>:<port>[,...] and SAFEBOX_BENCH_SAMPLE." << std::endl;
+        return;
+    }
+    int jobs = static_cast<int>(vms.size()) * 2;
+    if (const char *env = std::getenv("SAFEBOX_BENCH_JOBS")) jobs = std::max(1, std::atoi(env));
+    std::string sample_path = sample;
+    benchmark::RegisterBenchmark("BM_RealPool", [vms, jobs, sample_path](benchmark::State &state) {
+        int64_t done = 0;
+        Throughput throughput;
+        for (auto _ : state) done += run_pool(vms, jobs, sample_path, 4);
+        throughput.report(state, done);
+        state.counters["failed"] = static_cast<double>(state.iterations() * jobs - done);
+    })->Unit(benchmark::kSecond)->UseRealTime()->Iterations(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (const char *env = std::getenv("SAFEBOX_BENCH_FAKE_LATENCY")) parse_latency(env);
+    register_backend("fake", [] { return std::make_unique<FakeBackend>(); });
+    register_pool_scaling();
+    register_real_pool();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    std::filesystem::remove_all(bench_root());
+    return 0;
+}
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""
+SafeBox known-malware hash index (SBHI)
+
+Sorted fixed-width SHA-256 records behind a 65536-entry fanout table,
+memory-mapped so an index of millions of hashes opens instantly and is
+looked up without loading it. The layout is documented in
+src/host/hash_index.h; safebox-host reads the same files (--hash-index) and
+answers known samples before any VM starts.
+
+Usage:
+python3 hash_index.py build hashes.txt known.sbhi    ("<sha256> [label]" per line)
+python3 hash_index.py lookup known.sbhi <sha256>
+"""
+
+import mmap
+import os
+import struct
+import sys
+from typing import Iterable, Optional, Tuple
+
+MAGIC = b'SBHI'
+VERSION = 1
+HEADER = 24
+FANOUT = 65536
+RECORD = 36
+RECORDS_AT = HEADER + FANOUT * 4
+
+
+class FormatError(ValueError):
+    pass
+
+
+class HashIndex:
+    """Read-only view of an SBHI file."""
+
+    def __init__(self, path: str):
+        with open(path, 'rb') as f:
+            size = os.fstat(f.fileno()).st_size
+            if size < RECORDS_AT:
+                raise FormatError(f'{path}: not a hash index')
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if self._map[:4] != MAGIC:
+            raise FormatError(f'{path}: not a hash index')
+        version, count, labels, _ = struct.unpack_from('<IQII', self._map, 4)
+        if version != VERSION:
+            raise FormatError(f'{path}: unsupported hash index version')
+        if count > (size - RECORDS_AT) // RECORD:
+            raise FormatError(f'{path}: truncated hash index')
+        self._count = count
+        self._labels = labels
+        self._table = RECORDS_AT + count * RECORD
+        if labels == 0 or (size - self._table) // 4 < labels + 1:
+            raise FormatError(f'{path}: truncated label table')
+
+    def __len__(self):
+        return self._count
+
+    def __contains__(self, sha256: str):
+        return self.lookup(sha256) is not None
+
+    def close(self):
+        self._map.close()
+
+    def lookup(self, sha256: str) -> Optional[str]:
+        """The label of a hex SHA-256 in the index ('' if unlabelled), or None."""
+        try:
+            digest = bytes.fromhex(sha256)
+        except (ValueError, TypeError):
+            return None
+        if len(digest) != 32:
+            return None
+        prefix = digest[0] << 8 | digest[1]
+        lo = struct.unpack_from('<I', self._map, HEADER + (prefix - 1) * 4)[0] if prefix else 0
+        hi = struct.unpack_from('<I', self._map, HEADER + prefix * 4)[0]
+        hi = min(hi, self._count)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            at = RECORDS_AT + mid * RECORD
+            rec = self._map[at:at + 32]
+            if rec < digest:
+                lo = mid + 1
+            elif rec > digest:
+                hi = mid
+            else:
+                return self._label(struct.unpack_from('<I', self._map, at + 32)[0])
+        return None
+
+    def _label(self, i: int) -> str:
+        if i >= self._labels:
+            return ''
+        begin, end = struct.unpack_from('<II', self._map, self._table + i * 4)
+        strings = self._table + (self._labels + 1) * 4
+        return self._map[strings + begin:strings + end].decode('utf-8', 'replace')
+
+
+def build(entries: Iterable[Tuple[str, str]], path: str) -> int:
+    """Writes an index of (sha256, label) pairs; a repeated hash keeps its first label."""
+    labels, label_ids, records = [''], {'': 0}, {}
+    for sha256, label in entries:
+        digest = bytes.fromhex(sha256)
+        if len(digest) != 32:
+            raise FormatError(f'not a SHA-256: {sha256}')
+        if label not in label_ids:
+            label_ids[label] = len(labels)
+            labels.append(label)
+        records.setdefault(digest, label_ids[label])
+
+    fanout = [0] * FANOUT
+    for digest in records:
+        fanout[digest[0] << 8 | digest[1]] += 1
+    for i in range(1, FANOUT):
+        fanout[i] += fanout[i - 1]
+
+    tmp = f'{path}.tmp.{os.getpid()}'
+    with open(tmp, 'wb') as f:
+        f.write(MAGIC + struct.pack('<IQII', VERSION, len(records), len(labels), 0))
+        f.write(struct.pack(f'<{FANOUT}I', *fanout))
+        for digest in sorted(records):
+            f.write(digest + struct.pack('<I', records[digest]))
+        data = [label.encode() for label in labels]
+        offset = 0
+        for d in data:
+            f.write(struct.pack('<I', offset))
+            offset += len(d)
+        f.write(struct.pack('<I', offset))
+        f.write(b''.join(data))
+    os.replace(tmp, path)
+    return len(records)
+
+
+def read_hash_list(lines: Iterable[str]):
+    """(sha256, label) pairs of "<sha256> [label]" lines; '#' starts a comment."""
+    for line in lines:
+        line = line.split('#', 1)[0].strip()
+        if line:
+            parts = line.split(None, 1)
+            yield parts[0], parts[1].strip() if len(parts) > 1 else ''
+
+
+if __name__ == '__main__':
+    if len(sys.argv) == 4 and sys.argv[1] == 'build':
+        with open(sys.argv[2]) as f:
+            print(f'{build(read_hash_list(f), sys.argv[3])} hashes written to {sys.argv[3]}')
+    elif len(sys.argv) == 4 and sys.argv[1] == 'lookup':
+        label = HashIndex(sys.argv[2]).lookup(sys.argv[3])
+        print('not found' if label is None else f'found: {label or "(no label)"}')
+        raise SystemExit(0 if label is not None else 1)
+    else:
+        raise SystemExit('usage: hash_index.py build <hashes.txt> <out.sbhi> | lookup <index.sbhi> <sha256>')
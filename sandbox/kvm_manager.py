@@ -25,6 +25,12 @@ class VMConfig:
     disk_size_gb: int = 10
     os_type: str = "linux"  # linux, windows
     arch: str = "x86_64"
+    # Placement, as safebox-host --pin-cpus / --hugepages assign it: host
+    # cores the vCPUs are pinned to (one each, in order), the NUMA node guest
+    # memory is bound to, and hugepage-backed guest RAM.
+    cpuset: Optional[List[int]] = None
+    numa_node: Optional[int] = None
+    hugepages: bool = False
 
 @dataclass
 class VMStatus:
@@ -169,6 +175,21 @@ class KVMManager:
             print(f"❌ Error creating VM: {e}")
             return False
     
+    @staticmethod
+    def _placement_xml(config: VMConfig) -> str:
+        """<cputune>, <numatune> and <memoryBacking> for the VM's placement"""
+        parts = []
+        if config.cpuset:
+            pins = ''.join(f"\n    <vcpupin vcpu='{i}' cpuset='{cpu}'/>"
+                           for i, cpu in enumerate(config.cpuset[:config.vcpus]))
+            emulator = ','.join(str(cpu) for cpu in config.cpuset)
+            parts.append(f"<cputune>{pins}\n    <emulatorpin cpuset='{emulator}'/>\n  </cputune>")
+        if config.numa_node is not None:
+            parts.append(f"<numatune>\n    <memory mode='strict' nodeset='{config.numa_node}'/>\n  </numatune>")
+        if config.hugepages:
+            parts.append("<memoryBacking>\n    <hugepages/>\n  </memoryBacking>")
+        return ''.join(f"\n  {part}" for part in parts)
+
     def _generate_domain_xml(self, config: VMConfig, disk_path: str) -> str:
         """Generate libvirt domain XML configuration"""
         xml = f"""
@@ -176,7 +197,7 @@ class KVMManager:
   <name>{config.name}</name>
   <memory unit='MiB'>{config.memory_mb}</memory>
   <currentMemory unit='MiB'>{config.memory_mb}</currentMemory>
-  <vcpu placement='static'>{config.vcpus}</vcpu>
+  <vcpu placement='static'>{config.vcpus}</vcpu>{self._placement_xml(config)}
   <os>
     <type arch='{config.arch}'>hvm</type>
   </os>
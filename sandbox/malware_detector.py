@@ -6,11 +6,19 @@ Analyzes behavior patterns and detects malicious signatures
 
 import json
 import hashlib
+import os
 import re
 from typing import Dict, List, Tuple
 from enum import Enum
 from dataclasses import dataclass
 
+try:
+    from .native_matcher import SignatureMatcher
+    from .hash_index import HashIndex
+except ImportError:
+    from native_matcher import SignatureMatcher
+    from hash_index import HashIndex
+
 class ThreatLevel(Enum):
     SAFE = "safe"
     SUSPICIOUS = "suspicious"
@@ -81,11 +89,36 @@ class BehaviorIndicator:
 class MalwareDetector:
     """Analyzes programs and files for malware indicators"""
     
-    def __init__(self):
+    def __init__(self, hash_index: str = None):
         self.known_signatures = self._init_signatures()
+        # Bulk IOC hashes live in a memory-mapped index (hash_index.py), from
+        # the argument or $SAFEBOX_HASH_INDEX.
+        hash_index = hash_index or os.environ.get('SAFEBOX_HASH_INDEX')
+        self.hash_index = HashIndex(hash_index) if hash_index else None
         self.threat_score = 0
         self.detections = []
         self.behaviors = []
+        self._compile_signatures()
+        self._behavior_rules = (
+            [("Suspicious file operation", p, 15) for p in BehaviorIndicator.SUSPICIOUS_FILE_OPS] +
+            [("Suspicious process operation", p, 20) for p in BehaviorIndicator.SUSPICIOUS_PROC_OPS] +
+            [("Suspicious network operation", p, 25) for p in BehaviorIndicator.SUSPICIOUS_NET_OPS])
+        self._behavior_matcher = SignatureMatcher(p for _, p, _ in self._behavior_rules)
+
+    def _compile_signatures(self):
+        """Compile every signature pattern into one matcher, scanned once per input"""
+        self._signature_rules = [sig for sig in self.known_signatures for _ in sig.patterns]
+        self._hash_signatures = {}
+        for sig in self.known_signatures:
+            for h in set(sig.hashes):
+                self._hash_signatures.setdefault(h, []).append(sig)
+        self._signature_matcher = SignatureMatcher(
+            (p for sig in self.known_signatures for p in sig.patterns), ignore_case=True)
+
+    def load_signatures(self, signatures: List[MalwareSignature]):
+        """Add signatures to the known set"""
+        self.known_signatures.extend(signatures)
+        self._compile_signatures()
         
     def _init_signatures(self) -> List[MalwareSignature]:
         """Initialize known malware signatures"""
@@ -160,12 +193,11 @@ class MalwareDetector:
         
         filename_lower = filename.lower()
         
-        # Check known signatures
-        for sig in self.known_signatures:
-            for pattern in sig.patterns:
-                if re.search(pattern, filename_lower, re.IGNORECASE):
-                    detections.append(f"Signature match: {sig.name}")
-                    score += self._threat_score(sig.threat_level)
+        # Check known signatures (one detection per matching pattern)
+        for i in self._signature_matcher.scan(filename_lower):
+            sig = self._signature_rules[i]
+            detections.append(f"Signature match: {sig.name}")
+            score += self._threat_score(sig.threat_level)
         
         # Check suspicious file extensions
         if filename.endswith(('.exe', '.dll', '.sys', '.bat', '.cmd', '.scr', '.ps1')):
@@ -185,13 +217,36 @@ class MalwareDetector:
         score = 0
         
         # Check against known signatures
-        for sig in self.known_signatures:
-            if file_hash in sig.hashes:
-                detections.append(f"Hash match: {sig.name}")
-                score += self._threat_score(sig.threat_level)
+        for sig in self._hash_signatures.get(file_hash, []):
+            detections.append(f"Hash match: {sig.name}")
+            score += self._threat_score(sig.threat_level)
+        
+        # Then the bulk index (scored as safebox-host's known_hash_verdict)
+        if not detections and self.hash_index is not None:
+            label = self.hash_index.lookup(file_hash)
+            if label is not None:
+                detections.append(f"Hash match: {label or 'known malware'}")
+                score += self._threat_score(ThreatLevel.CRITICAL)
         
         return score, detections
     
+    def analyze_content(self, path: str) -> Tuple[int, List[str]]:
+        """Scan the sample's contents for signature patterns"""
+        detections = []
+        score = 0
+
+        matches = self._signature_matcher.scan_file(path) or []
+        seen = set()
+        for i in matches:
+            sig = self._signature_rules[i]
+            if sig.name in seen:
+                continue
+            seen.add(sig.name)
+            detections.append(f"Content match: {sig.name}")
+            score += self._threat_score(sig.threat_level)
+
+        return score, detections
+
     def analyze_behavior(self, behaviors: List[str]) -> Tuple[int, List[str]]:
         """Analyze behavior patterns for malware indicators"""
         detections = []
@@ -199,23 +254,11 @@ class MalwareDetector:
         
         behavior_text = ' '.join(behaviors).lower()
         
-        # Check file operations
-        for pattern in BehaviorIndicator.SUSPICIOUS_FILE_OPS:
-            if re.search(pattern, behavior_text):
-                detections.append(f"Suspicious file operation: {pattern}")
-                score += 15
-        
-        # Check process operations
-        for pattern in BehaviorIndicator.SUSPICIOUS_PROC_OPS:
-            if re.search(pattern, behavior_text):
-                detections.append(f"Suspicious process operation: {pattern}")
-                score += 20
-        
-        # Check network operations
-        for pattern in BehaviorIndicator.SUSPICIOUS_NET_OPS:
-            if re.search(pattern, behavior_text):
-                detections.append(f"Suspicious network operation: {pattern}")
-                score += 25
+        # Check file, process and network operations
+        for i in self._behavior_matcher.scan(behavior_text):
+            label, pattern, points = self._behavior_rules[i]
+            detections.append(f"{label}: {pattern}")
+            score += points
         
         # Check for persistence mechanisms
         if 'auto-start' in behavior_text or 'startup' in behavior_text:
@@ -258,7 +301,8 @@ class MalwareDetector:
     
     def scan(self, filename: str = None, file_hash: str = None, 
             behaviors: List[str] = None, cpu: float = 0, 
-            memory: float = 0, num_processes: int = 0) -> Dict:
+            memory: float = 0, num_processes: int = 0,
+            sample_path: str = None) -> Dict:
         """Comprehensive scan of file/behavior"""
         total_score = 0
         all_detections = []
@@ -275,6 +319,12 @@ class MalwareDetector:
             total_score += score
             all_detections.extend(dets)
         
+        # Analyze contents
+        if sample_path:
+            score, dets = self.analyze_content(sample_path)
+            total_score += score
+            all_detections.extend(dets)
+        
         # Analyze behaviors
         if behaviors:
             score, dets = self.analyze_behavior(behaviors)
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""
+SafeBox signature matcher bindings
+
+Compiles a whole rule set into the native Aho-Corasick matcher
+(libsafebox-match.so, src/host/matcher.h), so a file name, command line or
+sample is scanned once for all rules instead of once per regex. Patterns the
+native matcher does not support, and all patterns when the library is not
+available, are matched with re, with the same results.
+
+The library is looked for in $SAFEBOX_MATCH_LIB, next to this file, in the
+build/ directory of the source tree and then on the system library path.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import re
+from typing import Iterable, List, Optional
+
+_lib = None
+_lib_loaded = False
+
+
+def _candidates():
+    here = os.path.dirname(os.path.abspath(__file__))
+    yield os.environ.get('SAFEBOX_MATCH_LIB')
+    yield os.path.join(here, 'libsafebox-match.so')
+    yield os.path.join(here, '..', 'build', 'libsafebox-match.so')
+    yield ctypes.util.find_library('safebox-match')
+
+
+def load_library():
+    """The native library, or None. Loaded once."""
+    global _lib, _lib_loaded
+    if _lib_loaded:
+        return _lib
+    _lib_loaded = True
+    for path in _candidates():
+        if not path:
+            continue
+        try:
+            lib = ctypes.CDLL(path)
+        except OSError:
+            continue
+        lib.sbm_new.restype = ctypes.c_void_p
+        lib.sbm_new.argtypes = [ctypes.c_int]
+        lib.sbm_free.argtypes = [ctypes.c_void_p]
+        lib.sbm_add.restype = ctypes.c_int
+        lib.sbm_add.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+        lib.sbm_compile.argtypes = [ctypes.c_void_p]
+        lib.sbm_scan.restype = ctypes.c_long
+        lib.sbm_scan.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t,
+                                 ctypes.POINTER(ctypes.c_int), ctypes.c_size_t]
+        lib.sbm_scan_file.restype = ctypes.c_long
+        lib.sbm_scan_file.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                      ctypes.POINTER(ctypes.c_int), ctypes.c_size_t]
+        _lib = lib
+        break
+    return _lib
+
+
+class SignatureMatcher:
+    """Matches a list of regex patterns in one pass.
+
+    scan() returns the indexes of the matching patterns, ascending. Text is
+    matched line by line like re.search with re.MULTILINE, which is plain
+    re.search for single-line input such as file names and command lines.
+    """
+
+    def __init__(self, patterns: Iterable[str], ignore_case: bool = False, native: bool = True):
+        self.patterns = list(patterns)
+        self.flags = re.MULTILINE | (re.IGNORECASE if ignore_case else 0)
+        self._handle = None
+        self._fallback = []     # (index, regex) always matched with re
+        self._fixed_width = []  # (index, regex) rechecked with re on non-ASCII text
+        lib = load_library() if native else None
+
+        if lib is not None:
+            self._lib = lib
+            self._handle = lib.sbm_new(1 if ignore_case else 0)
+        for i, pattern in enumerate(self.patterns):
+            rc = -1
+            # Case folding is ASCII-only natively; re folds all of Unicode.
+            if self._handle is not None and (pattern.isascii() or not ignore_case):
+                rc = lib.sbm_add(self._handle, pattern.encode(), i)
+            if rc < 0:
+                self._fallback.append((i, re.compile(pattern, self.flags)))
+            elif rc == 1:
+                self._fixed_width.append((i, re.compile(pattern, self.flags)))
+        if self._handle is not None:
+            lib.sbm_compile(self._handle)
+        self._out = (ctypes.c_int * max(1, len(self.patterns)))()
+
+    @property
+    def native(self) -> bool:
+        return self._handle is not None
+
+    def __del__(self):
+        if getattr(self, '_handle', None) is not None:
+            self._lib.sbm_free(self._handle)
+            self._handle = None
+
+    def _ids(self, count) -> List[int]:
+        return list(self._out[:min(count, len(self.patterns))])
+
+    def _native(self, data: bytes) -> List[int]:
+        return self._ids(self._lib.sbm_scan(self._handle, data, len(data), self._out, len(self._out)))
+
+    def scan(self, text: str) -> List[int]:
+        found = set()
+        if self._handle is not None:
+            found.update(self._native(text.encode('utf-8', 'surrogateescape')))
+            if not text.isascii():
+                for i, regex in self._fixed_width:
+                    found.discard(i)
+                    if regex.search(text):
+                        found.add(i)
+        for i, regex in self._fallback:
+            if regex.search(text):
+                found.add(i)
+        return sorted(found)
+
+    def scan_file(self, path: str) -> Optional[List[int]]:
+        """Indexes of the patterns matching the file's contents, None if unreadable.
+
+        Contents are matched byte for byte (as Latin-1 text on the re side).
+        """
+        if self._handle is not None and not self._fallback:
+            count = self._lib.sbm_scan_file(self._handle, os.fsencode(path), self._out, len(self._out))
+            return None if count < 0 else self._ids(count)
+        try:
+            with open(path, 'rb') as f:
+                data = f.read()
+        except OSError:
+            return None
+        found = set(self._native(data)) if self._handle is not None else set()
+        text = data.decode('latin-1')
+        for i, regex in self._fallback:
+            if regex.search(text):
+                found.add(i)
+        return sorted(found)
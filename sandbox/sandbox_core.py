@@ -29,6 +29,11 @@ class SandboxConfig:
     network_enabled: bool = False
     file_access_allowed: bool = False
     processes_allowed: int = 10
+    # cgroup v2 directory to create the sandbox's cgroup under (e.g.
+    # /sys/fs/cgroup/safebox). With it the limits are enforced by the kernel
+    # and usage is read from the cgroup's stat files; without it they are
+    # only checked, from psutil.
+    cgroup_root: Optional[str] = None
     
     def to_dict(self):
         return asdict(self)
@@ -63,6 +68,26 @@ class SandboxReport:
     def to_dict(self):
         return asdict(self)
 
+CPU_PERIOD_USEC = 100000
+
+
+def read_cgroup_usage(cgroup_dir) -> Dict:
+    """usage_usec of cpu.stat, memory.current and pids.current of a cgroup:
+    one read each, covering every process in it"""
+    cgroup_dir = Path(cgroup_dir)
+    usage = {'cpu_usec': 0, 'memory_bytes': 0, 'pids': 0}
+    try:
+        for line in (cgroup_dir / 'cpu.stat').read_text().splitlines():
+            key, _, value = line.partition(' ')
+            if key == 'usage_usec':
+                usage['cpu_usec'] = int(value)
+        usage['memory_bytes'] = int((cgroup_dir / 'memory.current').read_text().split()[0])
+        usage['pids'] = int((cgroup_dir / 'pids.current').read_text().split()[0])
+    except (OSError, ValueError, IndexError):
+        pass
+    return usage
+
+
 class SandboxEnvironment:
     """Core sandbox isolation and management"""
     
@@ -75,6 +100,13 @@ class SandboxEnvironment:
         self.network_monitor = []
         self.file_access_log = []
         self.created_at = datetime.now().isoformat()
+        # psutil.Process per pid, kept so cpu_percent(interval=None) measures
+        # since the previous call instead of blocking to sample.
+        self._tracked: Dict[int, psutil.Process] = {}
+        self.cgroup_dir: Optional[Path] = None
+        self._cpu_mark = None
+        if config.cgroup_root:
+            self.cgroup_dir = self._create_cgroup()
         
     def _create_sandbox_dir(self) -> Path:
         """Create isolated filesystem for sandbox"""
@@ -89,6 +121,34 @@ class SandboxEnvironment:
         
         return sandbox_root
     
+    def _create_cgroup(self) -> Optional[Path]:
+        """cgroup_root/<sandbox_id> with the configured cpu.max, memory.max and
+        pids.max; None (psutil only) if it cannot be set up"""
+        cgroup_dir = Path(self.config.cgroup_root) / self.config.sandbox_id
+        quota = int(self.config.max_cpu_percent * CPU_PERIOD_USEC / 100)
+        try:
+            cgroup_dir.mkdir(parents=True, exist_ok=True)
+            (cgroup_dir / 'cpu.max').write_text('%d %d\n' % (max(quota, 1000), CPU_PERIOD_USEC))
+            (cgroup_dir / 'memory.max').write_text('%d\n' % (self.config.max_memory_mb << 20))
+            (cgroup_dir / 'pids.max').write_text('%d\n' % self.config.processes_allowed)
+        except OSError as e:
+            print(f"cgroup unavailable, limits are advisory: {e}")
+            return None
+        return cgroup_dir
+
+    def _enter_cgroup(self):
+        """preexec_fn of the sandboxed program: its own process group, and
+        its cgroup before exec"""
+        os.setpgrp()
+        if self.cgroup_dir is not None:
+            (self.cgroup_dir / 'cgroup.procs').write_text('0\n')
+
+    def _process(self, pid: int) -> psutil.Process:
+        proc = self._tracked.get(pid)
+        if proc is None:
+            proc = self._tracked[pid] = psutil.Process(pid)
+        return proc
+
     def set_resource_limits(self) -> bool:
         """Set resource limits for main process"""
         if not self.main_process:
@@ -136,10 +196,10 @@ class SandboxEnvironment:
                 env=sandbox_env,
                 stdout=subprocess.PIPE,
                 stderr=subprocess.PIPE,
-                preexec_fn=os.setpgrp if hasattr(os, 'setpgrp') else None
+                preexec_fn=self._enter_cgroup if hasattr(os, 'setpgrp') else None
             )
             
-            self.main_process = psutil.Process(process.pid)
+            self.main_process = self._process(process.pid)
             self.config.sandbox_id = self.config.sandbox_id
             
             # Set resource limits
@@ -171,18 +231,24 @@ class SandboxEnvironment:
         try:
             # Get all children
             children = self.main_process.children(recursive=True)
+            alive = {self.main_process.pid}
             
-            for proc in children:
+            for child in children:
                 try:
+                    proc = self._process(child.pid)
+                    alive.add(proc.pid)
                     processes.append(SandboxProcess(
                         pid=proc.pid,
                         name=proc.name(),
-                        cpu_percent=proc.cpu_percent(interval=0.1),
+                        # Since the last call; 0.0 the first time a process is seen.
+                        cpu_percent=proc.cpu_percent(interval=None),
                         memory_mb=proc.memory_info().rss / (1024 * 1024),
                         status=proc.status()
                     ))
                 except (psutil.NoSuchProcess, psutil.AccessDenied):
                     continue
+            for pid in set(self._tracked) - alive:
+                del self._tracked[pid]
                     
         except psutil.NoSuchProcess:
             pass
@@ -197,29 +263,50 @@ class SandboxEnvironment:
             'num_processes': 0
         }
         
+        if self.cgroup_dir is not None:
+            return self._cgroup_usage()
         if not self.main_process:
             return usage
             
         try:
-            usage['cpu_percent'] = self.main_process.cpu_percent(interval=0.1)
+            usage['cpu_percent'] = self.main_process.cpu_percent(interval=None)
             usage['memory_mb'] = self.main_process.memory_info().rss / (1024 * 1024)
             usage['num_processes'] = len(self.get_child_processes()) + 1
         except psutil.NoSuchProcess:
             pass
             
         return usage
+
+    def _cgroup_usage(self) -> Dict:
+        """Usage of everything in the sandbox's cgroup; CPU is the share of one
+        core used since the previous call"""
+        stats = read_cgroup_usage(self.cgroup_dir)
+        now = time.monotonic()
+        cpu_percent = 0.0
+        if self._cpu_mark is not None:
+            last_usec, last_time = self._cpu_mark
+            elapsed = now - last_time
+            if elapsed > 0:
+                cpu_percent = (stats['cpu_usec'] - last_usec) / 1e6 / elapsed * 100
+        self._cpu_mark = (stats['cpu_usec'], now)
+        return {
+            'cpu_percent': cpu_percent,
+            'memory_mb': stats['memory_bytes'] / (1024 * 1024),
+            'num_processes': stats['pids'],
+        }
     
-    def check_anomalies(self) -> List[str]:
-        """Check for anomalous behavior"""
+    def check_anomalies(self, usage: Optional[Dict] = None) -> List[str]:
+        """Check for anomalous behavior (in usage, if already sampled)"""
         anomalies = []
         
-        if not self.main_process:
+        if not self.main_process and self.cgroup_dir is None:
             return anomalies
             
         try:
-            cpu = self.main_process.cpu_percent(interval=0.1)
-            memory = self.main_process.memory_info().rss / (1024 * 1024)
-            num_procs = len(self.get_child_processes())
+            usage = usage or self.monitor_resource_usage()
+            cpu = usage['cpu_percent']
+            memory = usage['memory_mb']
+            num_procs = max(usage['num_processes'] - 1, 0)
             
             # Check for resource abuse
             if cpu > self.config.max_cpu_percent:
@@ -259,6 +346,17 @@ class SandboxEnvironment:
             except (psutil.NoSuchProcess, ProcessLookupError):
                 pass
         
+        # Nothing the program forked outside the process group survives
+        if self.cgroup_dir is not None:
+            try:
+                (self.cgroup_dir / 'cgroup.kill').write_text('1\n')
+                deadline = time.monotonic() + 2
+                while (self.cgroup_dir / 'cgroup.procs').read_text().strip() and time.monotonic() < deadline:
+                    time.sleep(0.01)
+                self.cgroup_dir.rmdir()
+            except OSError:
+                pass
+        
         # Cleanup sandbox directory
         try:
             shutil.rmtree(self.sandbox_dir)
@@ -282,17 +380,18 @@ class SandboxEnvironment:
             total_memory_used=usage['memory_mb'],
             network_activity=self.network_monitor,
             file_access_attempts=self.file_access_log,
-            anomalies_detected=self.check_anomalies()
+            anomalies_detected=self.check_anomalies(usage)
         )
 
 def create_sandbox(max_cpu: float = 20.0, max_memory_mb: int = 256,
-                   max_duration: int = 300) -> SandboxEnvironment:
+                   max_duration: int = 300, cgroup_root: Optional[str] = None) -> SandboxEnvironment:
     """Factory function to create new sandbox"""
     config = SandboxConfig(
         sandbox_id=str(uuid.uuid4())[:8],
         max_cpu_percent=max_cpu,
         max_memory_mb=max_memory_mb,
-        max_duration_seconds=max_duration
+        max_duration_seconds=max_duration,
+        cgroup_root=cgroup_root
     )
     return SandboxEnvironment(config)
 
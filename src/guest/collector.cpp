@@ -0,0 +1,334 @@
+#include "collector.h"
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+std::string socket_key(const InetSocket &s) {
+    return std::to_string(s.family) + '|' + std::to_string(s.protocol) + '|' + s.local_ip + '|' +
+           std::to_string(s.local_port) + '|' + s.remote_ip + '|' + std::to_string(s.remote_port);
+}
+
+// Popen.returncode of a waitpid() status: the exit code, or -signal.
+int python_returncode(int status) {
+    if (WIFSIGNALED(status)) return -WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+} // namespace
+
+std::string iso_now() {
+    timeval tv{};
+    gettimeofday(&tv, nullptr);
+    std::tm tm{};
+    gmtime_r(&tv.tv_sec, &tm);
+    char buf[48];
+    size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (tv.tv_usec) n += static_cast<size_t>(std::snprintf(buf + n, sizeof(buf) - n, ".%06ld", static_cast<long>(tv.tv_usec)));
+    return std::string(buf, n) + "Z";
+}
+
+Collector::Collector(CollectorOptions options, std::ostream &out) : options_(std::move(options)), out_(out) {}
+
+void Collector::emit(const std::string &type, Json record) {
+    Json line = Json::object();
+    line["type"] = Json(type);
+    for (const auto &member : record.members()) line[member.first] = member.second;
+    out_ << dump_json(line) << '\n' << std::flush;
+}
+
+void Collector::emit_event(const std::string &time, const std::string &event, int pid,
+                           const std::vector<std::string> *cmdline) {
+    Json record = Json::object();
+    record["time"] = Json(time);
+    record["event"] = Json(event);
+    record["pid"] = Json(pid);
+    if (cmdline && !cmdline->empty()) {
+        Json args = Json::array();
+        for (const std::string &arg : *cmdline) args.push_back(Json(arg));
+        record["cmdline"] = std::move(args);
+    }
+    emit("event", std::move(record));
+}
+
+int Collector::run() {
+    if (options_.argv.empty()) return 1;
+    std::error_code ec;
+    std::filesystem::create_directories(options_.output_dir, ec);
+
+    std::string error;
+    proc_events_ = proc_.open(&error);
+    if (!proc_events_) std::cerr << "[collector] " << error << "; scanning /proc instead" << std::endl;
+    sock_diag_ = sock_.open(&error);
+    if (!sock_diag_) std::cerr << "[collector] " << error << "; no network records" << std::endl;
+    if (sock_diag_ && !sock_.watch_destroyed(&error)) {
+        std::cerr << "[collector] " << error << "; short-lived sockets may be missed" << std::endl;
+    }
+    if (!proc_events_ || options_.all_processes) {
+        for (int pid : list_pids()) known_pids_.insert(pid);
+    }
+
+    Json start = Json::object();
+    start["time"] = Json(iso_now());
+    start["path"] = Json(options_.argv[0]);
+    emit("start", std::move(start));
+
+    root_ = loop_.spawn(options_.argv, ExecOptions{}, [this](CommandResult result) { finish(result); });
+    if (root_ < 0) {
+        Json err = Json::object();
+        err["time"] = Json(iso_now());
+        err["error"] = Json("failed to start: " + options_.argv[0]);
+        emit("error", std::move(err));
+        Json end = Json::object();
+        end["time"] = Json(iso_now());
+        emit("end", std::move(end));
+        return 0;
+    }
+    tracked_.insert(root_);
+    known_pids_.insert(root_);
+
+    if (proc_events_) loop_.add_fd(proc_.fd(), EPOLLIN, [this](uint32_t) { on_proc_events(); });
+    for (int fd : {sock_.tcp_fd(), sock_.udp_fd()}) {
+        if (fd >= 0) loop_.add_fd(fd, EPOLLIN, [this, fd](uint32_t) { on_destroyed(fd); });
+    }
+    loop_.add_timer(options_.timeout * 1000, [this] { timeout(); });
+    sample_tick();
+    if (sock_diag_) net_tick();
+    loop_.run();
+    return 0;
+}
+
+void Collector::on_proc_events() {
+    std::vector<ProcEvent> events;
+    bool intact = proc_.read(events);
+    for (const ProcEvent &ev : events) {
+        switch (ev.kind) {
+        case ProcEvent::Kind::Fork: {
+            if (ev.parent == getpid()) break;  // the sample itself
+            if (!tracked_.count(ev.parent) && !options_.all_processes) break;
+            if (tracked_.count(ev.pid)) break;
+            tracked_.insert(ev.pid);
+            // Announced at exec (with the new cmdline) or after a sample
+            // interval, whichever comes first.
+            pending_[ev.pid] = Pending{iso_now(), read_cmdline(ev.pid), std::chrono::steady_clock::now()};
+            break;
+        }
+        case ProcEvent::Kind::Exec: {
+            if (ev.pid == root_ || !tracked_.count(ev.pid)) break;
+            std::vector<std::string> cmdline = read_cmdline(ev.pid);
+            auto it = pending_.find(ev.pid);
+            if (it != pending_.end()) {
+                emit_event(it->second.time, "process-created", ev.pid, &cmdline);
+                pending_.erase(it);
+            } else {
+                emit_event(iso_now(), "process-exec", ev.pid, &cmdline);
+            }
+            break;
+        }
+        case ProcEvent::Kind::Exit: {
+            if (ev.pid == root_) {
+                root_status_known_ = true;
+                root_status_ = ev.exit_status;
+                break;
+            }
+            if (!tracked_.count(ev.pid)) break;
+            auto it = pending_.find(ev.pid);
+            if (it != pending_.end()) {
+                emit_event(it->second.time, "process-created", ev.pid, &it->second.cmdline);
+                pending_.erase(it);
+            }
+            Json record = Json::object();
+            record["time"] = Json(iso_now());
+            record["event"] = Json("child-exited");
+            record["pid"] = Json(ev.pid);
+            record["returncode"] = Json(python_returncode(ev.exit_status));
+            emit("event", std::move(record));
+            tracked_.erase(ev.pid);
+            break;
+        }
+        }
+    }
+    if (!intact) {
+        std::cerr << "[collector] proc events overflowed; rescanning /proc" << std::endl;
+        rescan_processes();
+    }
+}
+
+void Collector::rescan_processes() {
+    // New pids whose parent we track (or every new pid), parents first so
+    // a whole new subtree is picked up in one pass.
+    std::vector<ProcStat> fresh;
+    for (int pid : list_pids()) {
+        ProcStat st;
+        if (!known_pids_.count(pid) && !tracked_.count(pid) && read_proc_stat(pid, st)) fresh.push_back(st);
+    }
+    bool added = true;
+    while (added) {
+        added = false;
+        for (const ProcStat &st : fresh) {
+            if (tracked_.count(st.pid) || (!options_.all_processes && !tracked_.count(st.ppid))) continue;
+            tracked_.insert(st.pid);
+            known_pids_.insert(st.pid);
+            std::vector<std::string> cmdline = read_cmdline(st.pid);
+            emit_event(iso_now(), "process-created", st.pid, &cmdline);
+            added = true;
+        }
+    }
+}
+
+void Collector::flush_pending(bool all) {
+    auto cutoff = std::chrono::steady_clock::now() - std::chrono::milliseconds(options_.sample_interval_ms);
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        if (!all && it->second.forked > cutoff) {
+            ++it;
+            continue;
+        }
+        emit_event(it->second.time, "process-created", it->first, &it->second.cmdline);
+        it = pending_.erase(it);
+    }
+}
+
+void Collector::sample_tick() {
+    if (done_) return;
+    ProcStat st;
+    MemoryInfo memory;
+    if (read_proc_stat(root_, st) && st.state != 'Z' && read_memory_info(root_, memory)) {
+        Json record = Json::object();
+        record["time"] = Json(iso_now());
+        record["pid"] = Json(root_);
+        record["cpu_percent"] = Json(cpu_.percent(st.cpu_ticks));
+        Json mem = Json::object();
+        for (const auto &field : memory) mem[field.first] = Json(static_cast<double>(field.second));
+        record["memory"] = std::move(mem);
+        emit("process", std::move(record));
+    }
+    if (proc_events_) flush_pending(false);
+    else rescan_processes();
+    loop_.add_timer(options_.sample_interval_ms, [this] { sample_tick(); });
+}
+
+void Collector::resolve_owners(const std::vector<InetSocket> &sockets) {
+    bool unknown = false;
+    for (const InetSocket &s : sockets) unknown = unknown || (s.inode != 0 && !owners_.count(s.inode));
+    if (!unknown) return;
+    // Only the sample's own fd tables are read.
+    for (int pid : tracked_) {
+        std::map<uint64_t, int> inodes;
+        read_socket_inodes(pid, inodes);
+        for (const auto &entry : inodes) owners_[entry.first] = Owner{pid, entry.second};
+    }
+    for (const InetSocket &s : sockets) {
+        if (s.inode != 0) owners_.emplace(s.inode, Owner{});
+    }
+}
+
+Json Collector::connection_json(const InetSocket &s) {
+    Owner owner;
+    auto it = owners_.find(s.inode);
+    if (s.inode != 0 && it != owners_.end()) owner = it->second;
+    Json conn = Json::object();
+    conn["fd"] = Json(owner.fd);
+    conn["family"] = Json(psutil_family(s.family));
+    conn["type"] = Json(psutil_type(s.protocol));
+    conn["laddr"] = Json(psutil_addr(s.local_ip, s.local_port));
+    conn["raddr"] = Json(psutil_addr(s.remote_ip, s.remote_port));
+    conn["status"] = Json(psutil_status(s.protocol, s.state));
+    conn["pid"] = owner.pid >= 0 ? Json(owner.pid) : Json();
+    return conn;
+}
+
+void Collector::net_tick() {
+    if (done_) return;
+    std::vector<InetSocket> sockets;
+    std::string error;
+    if (sock_.dump(sockets, &error)) {
+        resolve_owners(sockets);
+        Json conns = Json::array();
+        std::set<std::string> rows;
+        for (const InetSocket &s : sockets) {
+            Json conn = connection_json(s);
+            if (rows.insert(dump_json(conn)).second) conns.push_back(std::move(conn));
+            reported_sockets_.insert(socket_key(s));
+        }
+        if (rows != last_rows_) {
+            Json record = Json::object();
+            record["time"] = Json(iso_now());
+            record["connections"] = conns;
+            emit("network", std::move(record));
+            last_rows_ = std::move(rows);
+            last_connections_ = std::move(conns);
+        }
+    } else {
+        std::cerr << "[collector] " << error << std::endl;
+    }
+    loop_.add_timer(options_.net_interval_ms, [this] { net_tick(); });
+}
+
+void Collector::on_destroyed(int fd) {
+    std::vector<InetSocket> sockets;
+    sock_.read_destroyed(fd, sockets);
+    if (done_) return;
+    for (const InetSocket &s : sockets) {
+        // Seen by a dump already: the next dump reports it gone.
+        if (!reported_sockets_.insert(socket_key(s)).second) continue;
+        // Came and went between two dumps: one snapshot with it in.
+        Json record = Json::object();
+        record["time"] = Json(iso_now());
+        Json conns = last_connections_;
+        conns.push_back(connection_json(s));
+        record["connections"] = std::move(conns);
+        emit("network", std::move(record));
+    }
+}
+
+void Collector::timeout() {
+    if (done_) return;
+    timed_out_ = true;
+    kill(root_, SIGTERM);
+    Json record = Json::object();
+    record["time"] = Json(iso_now());
+    record["event"] = Json("timeout-kill");
+    emit("event", std::move(record));
+    // agent.py leaves a sample that ignores SIGTERM behind; we have to wait
+    // for it to go, so make sure it does.
+    loop_.add_timer(1000, [this] {
+        if (!done_) kill(-root_, SIGKILL);
+    });
+}
+
+void Collector::finish(const CommandResult &result) {
+    if (root_ < 0) return;  // spawn failed; run() reports it
+    if (proc_events_) on_proc_events();
+    if (!timed_out_) {
+        int rc = root_status_known_ ? python_returncode(root_status_)
+                 : result.return_code > 128 ? 128 - result.return_code : result.return_code;
+        Json record = Json::object();
+        record["time"] = Json(iso_now());
+        record["event"] = Json("process-exited");
+        record["returncode"] = Json(rc);
+        emit("event", std::move(record));
+    }
+    flush_pending(true);
+    if (sock_diag_) net_tick();
+    done_ = true;
+    Json end = Json::object();
+    end["time"] = Json(iso_now());
+    emit("end", std::move(end));
+
+    std::string prefix = options_.output_dir + "/";
+    std::ofstream(prefix + "out-" + std::to_string(root_) + ".log", std::ios::binary) << result.stdout;
+    std::ofstream(prefix + "err-" + std::to_string(root_) + ".log", std::ios::binary) << result.stderr;
+    loop_.stop();
+}
+
+} // namespace safebox
@@ -0,0 +1,48 @@
+#include "collector.h"
+#include <iostream>
+#include <string>
+
+using namespace safebox;
+
+static void print_usage() {
+    std::cerr << "Usage: safebox-collector --file <sample> --output <dir> [--timeout <s>] [--interval <s>]" << std::endl;
+    std::cerr << "                         [--net-interval <s>] [--all-processes] [-- <sample args>]" << std::endl;
+    std::cerr << "Runs the sample and streams agent.py --stream's NDJSON records to stdout." << std::endl;
+}
+
+static int milliseconds(const char *seconds) {
+    return static_cast<int>(std::stod(seconds) * 1000);
+}
+
+int main(int argc, char **argv) {
+    CollectorOptions options;
+    std::string file;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--") {
+            args.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if (arg == "--file" && has_value) file = argv[++i];
+        else if (arg == "--output" && has_value) options.output_dir = argv[++i];
+        else if (arg == "--timeout" && has_value) options.timeout = std::stoi(argv[++i]);
+        else if (arg == "--interval" && has_value) options.sample_interval_ms = milliseconds(argv[++i]);
+        else if (arg == "--net-interval" && has_value) options.net_interval_ms = milliseconds(argv[++i]);
+        else if (arg == "--all-processes") options.all_processes = true;
+        else if (arg == "--stream") continue;  // the only mode; accepted for agent.py's argv
+        else {
+            print_usage();
+            return 2;
+        }
+    }
+    if (file.empty()) {
+        print_usage();
+        return 2;
+    }
+    options.argv.push_back(file);
+    options.argv.insert(options.argv.end(), args.begin(), args.end());
+    Collector collector(options, std::cout);
+    return collector.run();
+}
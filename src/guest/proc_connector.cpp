@@ -0,0 +1,106 @@
+#include "proc_connector.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+// Headroom for bursts (a fork bomb) between two reads.
+const int kReceiveBuffer = 4 * 1024 * 1024;
+
+bool send_listen(int fd, proc_cn_mcast_op op) {
+    alignas(nlmsghdr) char buf[NLMSG_SPACE(sizeof(cn_msg) + sizeof(op))] = {};
+    auto *nl = reinterpret_cast<nlmsghdr*>(buf);
+    nl->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(op));
+    nl->nlmsg_type = NLMSG_DONE;
+    nl->nlmsg_pid = static_cast<__u32>(getpid());
+    auto *cn = static_cast<cn_msg*>(NLMSG_DATA(nl));
+    cn->id.idx = CN_IDX_PROC;
+    cn->id.val = CN_VAL_PROC;
+    cn->len = sizeof(op);
+    std::memcpy(cn->data, &op, sizeof(op));
+    return send(fd, buf, nl->nlmsg_len, 0) == static_cast<ssize_t>(nl->nlmsg_len);
+}
+
+} // namespace
+
+ProcConnector::~ProcConnector() {
+    if (fd_ >= 0) {
+        send_listen(fd_, PROC_CN_MCAST_IGNORE);
+        close(fd_);
+    }
+}
+
+bool ProcConnector::open(std::string *error) {
+    fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd_ >= 0) {
+        if (setsockopt(fd_, SOL_SOCKET, SO_RCVBUFFORCE, &kReceiveBuffer, sizeof(kReceiveBuffer)) != 0) {
+            setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &kReceiveBuffer, sizeof(kReceiveBuffer));
+        }
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        addr.nl_pid = static_cast<__u32>(getpid());
+        if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            send_listen(fd_, PROC_CN_MCAST_LISTEN)) {
+            return true;
+        }
+    }
+    if (error) *error = std::string("proc connector: ") + std::strerror(errno);
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    return false;
+}
+
+bool ProcConnector::read(std::vector<ProcEvent> &events) {
+    alignas(nlmsghdr) char buf[16384];
+    bool intact = true;
+    for (;;) {
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                intact = false;
+                continue;
+            }
+            return intact;
+        }
+        for (auto *nl = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nl, static_cast<unsigned>(n));
+             nl = NLMSG_NEXT(nl, n)) {
+            if (nl->nlmsg_type == NLMSG_NOOP || nl->nlmsg_type == NLMSG_ERROR) continue;
+            auto *cn = static_cast<cn_msg*>(NLMSG_DATA(nl));
+            if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+            auto *ev = reinterpret_cast<proc_event*>(cn->data);
+            ProcEvent out;
+            switch (ev->what) {
+            case proc_event::PROC_EVENT_FORK:
+                if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid) continue;
+                out.kind = ProcEvent::Kind::Fork;
+                out.pid = ev->event_data.fork.child_tgid;
+                out.parent = ev->event_data.fork.parent_tgid;
+                break;
+            case proc_event::PROC_EVENT_EXEC:
+                out.kind = ProcEvent::Kind::Exec;
+                out.pid = ev->event_data.exec.process_tgid;
+                break;
+            case proc_event::PROC_EVENT_EXIT:
+                if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid) continue;
+                out.kind = ProcEvent::Kind::Exit;
+                out.pid = ev->event_data.exit.process_tgid;
+                out.exit_status = static_cast<int>(ev->event_data.exit.exit_code);
+                break;
+            default:
+                continue;
+            }
+            events.push_back(out);
+        }
+    }
+}
+
+} // namespace safebox
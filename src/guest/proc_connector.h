@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Process fork/exec/exit notifications from the kernel's netlink proc
+// connector (CONFIG_PROC_EVENTS, needs CAP_NET_ADMIN). Every event is
+// delivered as it happens, so processes that live for less than a poll
+// interval are still seen. Thread events are dropped: pid is always a
+// thread group id.
+struct ProcEvent {
+    enum class Kind { Fork, Exec, Exit };
+    Kind kind = Kind::Fork;
+    int pid = 0;
+    int parent = 0;       // Fork only
+    int exit_status = 0;  // Exit only, as from waitpid()
+};
+
+class ProcConnector {
+public:
+    ProcConnector() = default;
+    ~ProcConnector();
+
+    ProcConnector(const ProcConnector&) = delete;
+    ProcConnector &operator=(const ProcConnector&) = delete;
+
+    // Subscribes; false with *error set if the kernel or our privileges do
+    // not allow it.
+    bool open(std::string *error = nullptr);
+    // Non-blocking; poll it for readability.
+    int fd() const { return fd_; }
+
+    // Appends every event queued on the socket. Returns false once the
+    // socket overflowed: events were dropped and the caller has to rescan
+    // /proc to catch up (the flag resets on the next call).
+    bool read(std::vector<ProcEvent> &events);
+
+private:
+    int fd_ = -1;
+};
+
+} // namespace safebox
@@ -0,0 +1,124 @@
+#include "procfs.h"
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+// Whole small /proc file; empty if it cannot be read.
+std::string read_small(const std::string &path) {
+    std::string out;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) out.append(buf, static_cast<size_t>(n));
+    close(fd);
+    return out;
+}
+
+std::string proc_path(int pid, const char *file) {
+    return "/proc/" + std::to_string(pid) + "/" + file;
+}
+
+} // namespace
+
+bool read_proc_stat(int pid, ProcStat &out) {
+    std::string text = read_small(proc_path(pid, "stat"));
+    // comm is in parentheses and may itself contain spaces and ')'.
+    size_t close_paren = text.rfind(')');
+    if (close_paren == std::string::npos || close_paren + 2 >= text.size()) return false;
+    char state = 0;
+    int ppid = 0;
+    unsigned long long utime = 0, stime = 0;
+    // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime
+    if (std::sscanf(text.c_str() + close_paren + 2, "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                    &state, &ppid, &utime, &stime) != 4) {
+        return false;
+    }
+    out.pid = pid;
+    out.ppid = ppid;
+    out.state = state;
+    out.cpu_ticks = utime + stime;
+    return true;
+}
+
+bool read_memory_info(int pid, MemoryInfo &out) {
+    std::string text = read_small(proc_path(pid, "statm"));
+    unsigned long long size, resident, shared, code, lib, data, dirty;
+    if (std::sscanf(text.c_str(), "%llu %llu %llu %llu %llu %llu %llu", &size, &resident, &shared, &code, &lib,
+                    &data, &dirty) != 7) {
+        return false;
+    }
+    static const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    out = {{"rss", resident * page}, {"vms", size * page}, {"shared", shared * page}, {"text", code * page},
+           {"lib", lib * page}, {"data", data * page}, {"dirty", dirty * page}};
+    return true;
+}
+
+std::vector<std::string> read_cmdline(int pid) {
+    std::string text = read_small(proc_path(pid, "cmdline"));
+    std::vector<std::string> args;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\0', start);
+        if (end == std::string::npos) end = text.size();
+        args.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return args;
+}
+
+void read_socket_inodes(int pid, std::map<uint64_t, int> &out) {
+    std::string dir = proc_path(pid, "fd");
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    char target[64];
+    while (dirent *entry = readdir(d)) {
+        if (entry->d_name[0] == '.') continue;
+        ssize_t n = readlinkat(dirfd(d), entry->d_name, target, sizeof(target) - 1);
+        if (n <= 0) continue;
+        target[n] = '\0';
+        // "socket:[12345]"
+        if (std::strncmp(target, "socket:[", 8) != 0) continue;
+        out[std::strtoull(target + 8, nullptr, 10)] = std::atoi(entry->d_name);
+    }
+    closedir(d);
+}
+
+std::vector<int> list_pids() {
+    std::vector<int> pids;
+    DIR *d = opendir("/proc");
+    if (!d) return pids;
+    while (dirent *entry = readdir(d)) {
+        char *end = nullptr;
+        long pid = std::strtol(entry->d_name, &end, 10);
+        if (end != entry->d_name && *end == '\0' && pid > 0 && pid <= INT_MAX) pids.push_back(static_cast<int>(pid));
+    }
+    closedir(d);
+    return pids;
+}
+
+double CpuMeter::percent(uint64_t cpu_ticks) {
+    static const double ticks_per_second = static_cast<double>(sysconf(_SC_CLK_TCK));
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    double result = 0.0;
+    if (primed_ && wall > last_wall_ && cpu_ticks >= last_ticks_) {
+        double used = static_cast<double>(cpu_ticks - last_ticks_) / ticks_per_second;
+        // psutil rounds to one decimal.
+        result = static_cast<double>(static_cast<long long>(used / (wall - last_wall_) * 1000 + 0.5)) / 10;
+    }
+    primed_ = true;
+    last_ticks_ = cpu_ticks;
+    last_wall_ = wall;
+    return result;
+}
+
+} // namespace safebox
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace safebox {
+
+// Point reads of /proc for single processes, so the collector never walks
+// every pid the way psutil.process_iter() does.
+
+struct ProcStat {
+    int pid = 0;
+    int ppid = 0;
+    char state = '?';
+    uint64_t cpu_ticks = 0;  // utime + stime
+};
+
+bool read_proc_stat(int pid, ProcStat &out);
+
+// psutil's memory_info() on Linux: rss, vms, shared, text, lib, data,
+// dirty, in bytes and in that order (from /proc/<pid>/statm).
+using MemoryInfo = std::vector<std::pair<std::string, uint64_t>>;
+bool read_memory_info(int pid, MemoryInfo &out);
+
+// Empty for kernel threads and processes that are already gone.
+std::vector<std::string> read_cmdline(int pid);
+
+// Socket inode -> fd for every socket pid holds open.
+void read_socket_inodes(int pid, std::map<uint64_t, int> &out);
+
+// Every pid in /proc; the fallback when proc events are unavailable.
+std::vector<int> list_pids();
+
+// psutil's Process.cpu_percent(interval=None): CPU time used since the
+// previous call as a percentage of the wall time in between (so it can
+// exceed 100 on several cores); 0.0 on the first call.
+class CpuMeter {
+public:
+    double percent(uint64_t cpu_ticks);
+
+private:
+    bool primed_ = false;
+    uint64_t last_ticks_ = 0;
+    double last_wall_ = 0;
+};
+
+} // namespace safebox
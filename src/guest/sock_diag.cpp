@@ -0,0 +1,164 @@
+#include "sock_diag.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+int netlink_socket(unsigned groups, int flags) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | flags, NETLINK_SOCK_DIAG);
+    if (fd < 0) return -1;
+    sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+unsigned group_bit(int group) { return 1u << (group - 1); }
+
+InetSocket from_msg(const inet_diag_msg &msg, int protocol) {
+    InetSocket s;
+    s.family = msg.idiag_family;
+    s.protocol = protocol;
+    s.state = msg.idiag_state;
+    s.inode = msg.idiag_inode;
+    s.local_port = ntohs(msg.id.idiag_sport);
+    s.remote_port = ntohs(msg.id.idiag_dport);
+    char ip[INET6_ADDRSTRLEN];
+    inet_ntop(s.family, msg.id.idiag_src, ip, sizeof(ip));
+    s.local_ip = ip;
+    inet_ntop(s.family, msg.id.idiag_dst, ip, sizeof(ip));
+    s.remote_ip = ip;
+    return s;
+}
+
+// Walks the inet_diag_msg records in one datagram; false at NLMSG_DONE or
+// on an error reply.
+bool parse(const char *buf, ssize_t n, int protocol, std::vector<InetSocket> &out, int *error) {
+    for (auto *nl = reinterpret_cast<const nlmsghdr*>(buf); NLMSG_OK(nl, static_cast<unsigned>(n));
+         nl = NLMSG_NEXT(nl, n)) {
+        if (nl->nlmsg_type == NLMSG_DONE) return false;
+        if (nl->nlmsg_type == NLMSG_ERROR) {
+            if (error) *error = -static_cast<const nlmsgerr*>(NLMSG_DATA(nl))->error;
+            return false;
+        }
+        if (nl->nlmsg_type != SOCK_DIAG_BY_FAMILY) continue;
+        out.push_back(from_msg(*static_cast<const inet_diag_msg*>(NLMSG_DATA(nl)), protocol));
+    }
+    return true;
+}
+
+} // namespace
+
+SockDiag::~SockDiag() {
+    for (int fd : {fd_, tcp_fd_, udp_fd_}) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+bool SockDiag::open(std::string *error) {
+    fd_ = netlink_socket(0, 0);
+    if (fd_ < 0 && error) *error = std::string("sock_diag: ") + std::strerror(errno);
+    return fd_ >= 0;
+}
+
+bool SockDiag::dump(std::vector<InetSocket> &out, std::string *error) {
+    alignas(nlmsghdr) char buf[32768];
+    for (int family : {AF_INET, AF_INET6}) {
+        for (int protocol : {IPPROTO_TCP, IPPROTO_UDP}) {
+            struct {
+                nlmsghdr nl;
+                inet_diag_req_v2 req;
+            } msg{};
+            msg.nl.nlmsg_len = sizeof(msg);
+            msg.nl.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+            msg.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+            msg.req.sdiag_family = static_cast<__u8>(family);
+            msg.req.sdiag_protocol = static_cast<__u8>(protocol);
+            msg.req.idiag_states = ~0u;
+            if (send(fd_, &msg, sizeof(msg), 0) < 0) {
+                if (error) *error = std::string("sock_diag: ") + std::strerror(errno);
+                return false;
+            }
+            int err = 0;
+            for (;;) {
+                ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    err = n < 0 ? errno : EIO;
+                    break;
+                }
+                if (!parse(buf, n, protocol, out, &err)) break;
+            }
+            // No IPv6 in this kernel is not an error.
+            if (err && !(family == AF_INET6 && err == ENOENT)) {
+                if (error) *error = std::string("sock_diag: ") + std::strerror(err);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool SockDiag::watch_destroyed(std::string *error) {
+    tcp_fd_ = netlink_socket(group_bit(SKNLGRP_INET_TCP_DESTROY) | group_bit(SKNLGRP_INET6_TCP_DESTROY),
+                             SOCK_NONBLOCK);
+    udp_fd_ = netlink_socket(group_bit(SKNLGRP_INET_UDP_DESTROY) | group_bit(SKNLGRP_INET6_UDP_DESTROY),
+                             SOCK_NONBLOCK);
+    if (tcp_fd_ >= 0 && udp_fd_ >= 0) return true;
+    if (error) *error = std::string("sock_diag broadcasts: ") + std::strerror(errno);
+    for (int *fd : {&tcp_fd_, &udp_fd_}) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+    }
+    return false;
+}
+
+void SockDiag::read_destroyed(int fd, std::vector<InetSocket> &out) {
+    alignas(nlmsghdr) char buf[32768];
+    int protocol = fd == tcp_fd_ ? IPPROTO_TCP : IPPROTO_UDP;
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && (errno == EINTR || errno == ENOBUFS)) continue;
+        if (n <= 0) return;
+        parse(buf, n, protocol, out, nullptr);
+    }
+}
+
+std::string psutil_family(int family) {
+    return family == AF_INET6 ? "AddressFamily.AF_INET6" : "AddressFamily.AF_INET";
+}
+
+std::string psutil_type(int protocol) {
+    return protocol == IPPROTO_UDP ? "SocketKind.SOCK_DGRAM" : "SocketKind.SOCK_STREAM";
+}
+
+std::string psutil_addr(const std::string &ip, int port) {
+    if (port == 0) return "()";
+    return "addr(ip='" + ip + "', port=" + std::to_string(port) + ")";
+}
+
+std::string psutil_status(int protocol, int state) {
+    static const char *const kStates[] = {"NONE",       "ESTABLISHED", "SYN_SENT",  "SYN_RECV",
+                                          "FIN_WAIT1",  "FIN_WAIT2",   "TIME_WAIT", "CLOSE",
+                                          "CLOSE_WAIT", "LAST_ACK",    "LISTEN",    "CLOSING",
+                                          "SYN_RECV"};  // TCP_NEW_SYN_RECV
+    if (protocol != IPPROTO_TCP || state < 0 || state >= static_cast<int>(sizeof(kStates) / sizeof(kStates[0]))) {
+        return "NONE";
+    }
+    return kStates[state];
+}
+
+} // namespace safebox
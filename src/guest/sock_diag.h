@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// TCP and UDP sockets (IPv4 and IPv6) as the kernel's sock_diag netlink
+// interface reports them: one request for the whole table instead of
+// parsing /proc/net/* and walking every process' fds.
+struct InetSocket {
+    int family = 0;    // AF_INET, AF_INET6
+    int protocol = 0;  // IPPROTO_TCP, IPPROTO_UDP
+    std::string local_ip;
+    int local_port = 0;
+    std::string remote_ip;
+    int remote_port = 0;
+    int state = 0;  // TCP_* (UDP sockets are TCP_CLOSE or TCP_ESTABLISHED)
+    uint64_t inode = 0;
+};
+
+class SockDiag {
+public:
+    SockDiag() = default;
+    ~SockDiag();
+
+    SockDiag(const SockDiag&) = delete;
+    SockDiag &operator=(const SockDiag&) = delete;
+
+    bool open(std::string *error = nullptr);
+    // The current table; false with *error set if the request failed.
+    bool dump(std::vector<InetSocket> &out, std::string *error = nullptr);
+
+    // Subscribes to socket destruction broadcasts (CAP_NET_ADMIN), which
+    // carry the final addresses and state of every TCP/UDP socket as it
+    // closes, so sockets opened and closed between two dumps are not lost.
+    // tcp_fd()/udp_fd() are then non-blocking and pollable.
+    bool watch_destroyed(std::string *error = nullptr);
+    int tcp_fd() const { return tcp_fd_; }
+    int udp_fd() const { return udp_fd_; }
+    // Appends the sockets whose destruction is queued on fd (tcp_fd() or
+    // udp_fd()).
+    void read_destroyed(int fd, std::vector<InetSocket> &out);
+
+private:
+    int fd_ = -1;
+    int tcp_fd_ = -1;
+    int udp_fd_ = -1;
+};
+
+// psutil.net_connections() renditions, as agent.py reports them:
+// "AddressFamily.AF_INET", "SocketKind.SOCK_STREAM",
+// "addr(ip='10.0.0.2', port=22)" (or "()" for port 0) and
+// "ESTABLISHED" ... ("NONE" for UDP).
+std::string psutil_family(int family);
+std::string psutil_type(int protocol);
+std::string psutil_addr(const std::string &ip, int port);
+std::string psutil_status(int protocol, int state);
+
+} // namespace safebox
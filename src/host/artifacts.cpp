@@ -0,0 +1,137 @@
+#include "artifacts.h"
+#include "json.h"
+#include "sha256.h"
+#include "ssh.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Renames, or copies where from and to are on different filesystems.
+bool move_file(const fs::path &from, const fs::path &to, std::error_code &ec) {
+    fs::rename(from, to, ec);
+    if (!ec) return true;
+    ec.clear();
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+    if (ec) return false;
+    fs::remove(from, ec);
+    ec.clear();
+    return true;
+}
+
+} // namespace
+
+std::string ArtifactStore::entry_path(const std::string &sha256) const {
+    return (fs::path(dir_) / sha256.substr(0, 2) / sha256).string();
+}
+
+bool ArtifactStore::add(const std::string &file, std::string &sha256, bool &added, std::string *error) const {
+    auto fail = [&](const std::string &why) {
+        if (error) *error = why;
+        return false;
+    };
+    if (!sha256_file(file, sha256)) return fail("cannot read " + file);
+    std::string entry = entry_path(sha256);
+    std::error_code ec;
+    if (fs::is_regular_file(entry, ec)) {
+        fs::remove(file, ec);
+        added = false;
+        return true;
+    }
+    static std::atomic<unsigned> seq{0};
+    std::string tmp = entry + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq++);
+    fs::create_directories(fs::path(entry).parent_path(), ec);
+    if (ec || !move_file(file, tmp, ec)) return fail("cannot store " + file + ": " + ec.message());
+    // Report directories hard-link the entry; none of them may change it.
+    fs::permissions(tmp, fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read, ec);
+    fs::rename(tmp, entry, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return fail("cannot store " + entry + ": " + ec.message());
+    }
+    added = true;
+    return true;
+}
+
+std::string artifact_pack_command(const std::string &remote_dir) {
+    std::string dir = shell_quote(remote_dir);
+    return "mkdir -p " + dir + " && cd " + dir + " && { tar -cf - . && find . -mindepth 1 -delete; } | zstd -q -3 -c";
+}
+
+Argv artifact_unpack_command(const Argv &guest_argv, const std::string &staging_dir) {
+    Argv argv{"sh", "-c",
+              "dir=$1; shift; mkdir -p \"$dir\" && "
+              "\"$@\" | zstd -d -q -c | tar -x -f - -C \"$dir\" --no-same-owner --no-same-permissions",
+              "safebox-unpack", staging_dir};
+    argv.insert(argv.end(), guest_argv.begin(), guest_argv.end());
+    return argv;
+}
+
+bool import_artifacts(const std::string &staging_dir, const std::string &report_dir, const ArtifactStore *store,
+                      std::vector<Artifact> &artifacts, std::string *error) {
+    artifacts.clear();
+    fs::path staging(staging_dir);
+    fs::path dest = fs::path(report_dir) / "artifacts";
+    std::error_code ec;
+    std::vector<fs::path> files;
+    for (auto it = fs::recursive_directory_iterator(staging, ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        // symlink_status: a link in the guest's output must not pull in a
+        // host file.
+        if (it->symlink_status(ec).type() == fs::file_type::regular) files.push_back(it->path());
+    }
+    std::sort(files.begin(), files.end());
+
+    bool ok = true;
+    for (const fs::path &file : files) {
+        Artifact artifact;
+        artifact.path = file.lexically_relative(staging).string();
+        artifact.size = fs::file_size(file, ec);
+        fs::path target = dest / artifact.path;
+        fs::create_directories(target.parent_path(), ec);
+        fs::remove(target, ec);
+        std::string why;
+        if (store) {
+            if (!store->add(file.string(), artifact.sha256, artifact.added, &why)) {
+                if (error) *error = why;
+                ok = false;
+                continue;
+            }
+            fs::create_hard_link(store->entry_path(artifact.sha256), target, ec);
+            if (ec) fs::copy_file(store->entry_path(artifact.sha256), target, ec);
+        } else {
+            sha256_file(file.string(), artifact.sha256);
+            artifact.added = true;
+            move_file(file, target, ec);
+        }
+        if (ec) {
+            if (error) *error = "cannot write " + target.string() + ": " + ec.message();
+            ok = false;
+            continue;
+        }
+        artifacts.push_back(artifact);
+    }
+    fs::remove_all(staging, ec);
+
+    Json list = Json::array();
+    for (const Artifact &artifact : artifacts) {
+        Json entry = Json::object();
+        entry["path"] = Json(artifact.path);
+        entry["size"] = Json(static_cast<double>(artifact.size));
+        entry["sha256"] = Json(artifact.sha256);
+        entry["new"] = Json(artifact.added);
+        list.push_back(entry);
+    }
+    fs::create_directories(report_dir, ec);
+    std::ofstream(fs::path(report_dir) / "artifacts.json") << dump_json(list, 2) << std::endl;
+    return ok;
+}
+
+} // namespace safebox
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "process.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Content-addressed store of the files agents leave behind (stdout/stderr
+// logs, dropped files). Each distinct file is kept once, read-only, at
+// dir/<sha[0:2]>/<sha>, and report directories hard-link to it, so the same
+// dropper seen a thousand times takes the disk of one. Entries are written
+// atomically, so concurrent hosts can share a directory.
+class ArtifactStore {
+public:
+    explicit ArtifactStore(std::string dir = "/var/lib/safebox/artifacts") : dir_(std::move(dir)) {}
+
+    // Moves file into the store, or removes it if an identical file is there
+    // already (added false). On success sha256 names the entry.
+    bool add(const std::string &file, std::string &sha256, bool &added, std::string *error = nullptr) const;
+    std::string entry_path(const std::string &sha256) const;
+
+private:
+    std::string dir_;
+};
+
+struct Artifact {
+    std::string path;  // relative to the guest's output dir
+    uint64_t size = 0;
+    std::string sha256;
+    bool added = false;  // new to the store (false: deduplicated)
+};
+
+// Guest command that writes remote_dir, every file in it, to stdout as one
+// zstd-compressed tar, emptying it as it goes (a container-tier "guest" is
+// not reverted to a clean disk).
+std::string artifact_pack_command(const std::string &remote_dir);
+// Host argv running guest_argv (an artifact_pack_command) and unpacking its
+// output into staging_dir as it arrives: one process group for the whole
+// transfer, so an EventLoop can run many side by side.
+Argv artifact_unpack_command(const Argv &guest_argv, const std::string &staging_dir);
+
+// Moves what an unpack left in staging_dir into report_dir/artifacts,
+// deduplicated through store when one is given, writes
+// report_dir/artifacts.json and removes staging_dir. Symlinks, devices and
+// the like are dropped; only regular files count.
+bool import_artifacts(const std::string &staging_dir, const std::string &report_dir, const ArtifactStore *store,
+                      std::vector<Artifact> &artifacts, std::string *error = nullptr);
+
+} // namespace safebox
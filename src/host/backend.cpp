@@ -0,0 +1,168 @@
+#include "backend.h"
+#include "container_backend.h"
+#include "firecracker_backend.h"
+#include "kvm_backend.h"
+#include "readiness.h"
+#include "vbox_backend.h"
+#ifdef SAFEBOX_WITH_LIBVIRT
+#include "libvirt_backend.h"
+#endif
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+namespace safebox {
+
+int Backend::clone(const CloneSpec &) { return 1; }
+int Backend::reset_clone(const CloneSpec &) { return 1; }
+int Backend::delete_clone(const CloneSpec &) { return 1; }
+int Backend::snapshot(const std::string &, const SshSession &) { return 1; }
+int Backend::configure(const std::string &, const VMResources &) { return 0; }
+std::string Backend::guest_address(const std::string &) { return ""; }
+Json Backend::usage(const std::string &) { return Json(); }
+
+SshSession Backend::open_session(const std::string &target, int port) {
+    return open_ssh_session(target, port);
+}
+
+bool Backend::probe_guest(const SshSession &session, int timeout_ms) {
+    return probe_ssh_banner(ssh_host(session), session.port, timeout_ms);
+}
+
+Argv Backend::guest_command(const SshSession &session, const std::string &remote_cmd) {
+    return ssh_command(session, remote_cmd);
+}
+
+CommandResult Backend::exec(const SshSession &session, const std::string &remote_cmd,
+                            const ExecOptions &options) {
+    return execute_command(guest_command(session, remote_cmd), options);
+}
+
+int Backend::copy_in(const SshSession &session, const std::string &local_path,
+                     const std::string &remote_path) {
+    return execute_command(scp_to_guest(session, local_path, remote_path)).return_code;
+}
+
+int Backend::copy_out(const SshSession &session, const std::string &remote_path,
+                      const std::string &local_path) {
+    return execute_command(scp_from_guest(session, remote_path, local_path)).return_code;
+}
+
+int Backend::inject(const std::string &, const SshSession &session,
+                    const std::string &local_path, std::string &remote_path) {
+    return copy_in(session, local_path, remote_path);
+}
+
+std::string Backend::share_dir(const std::string &vm_name) const {
+    return (std::filesystem::path(share_root_) / vm_name).string();
+}
+
+void Backend::release(const std::string &vm_name) {
+    std::error_code ec;
+    std::filesystem::directory_iterator it(share_dir(vm_name), ec);
+    if (ec) return;
+    for (const auto &entry : it) std::filesystem::remove_all(entry.path(), ec);
+}
+
+std::string Backend::share_file(const std::string &vm_name, const std::string &local_path) {
+    namespace fs = std::filesystem;
+    Backend::release(vm_name);
+
+    std::string name = fs::path(local_path).filename().string();
+    fs::path target = fs::path(share_dir(vm_name)) / name;
+    // A copy of its own (a reflink where the filesystem has them), not a hard
+    // link: the guest sees the share read-only and cannot chmod the sample
+    // itself, and making it executable must not touch the submitter's file.
+    if (execute_command({"cp", "--reflink=auto", "--", local_path, target.string()}).return_code != 0) {
+        std::cerr << "[share] cannot share " << local_path << std::endl;
+        return "";
+    }
+    std::error_code ec;
+    fs::permissions(target, fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec |
+                                fs::perms::others_read | fs::perms::others_exec, ec);
+    if (ec) {
+        std::cerr << "[share] cannot make " << target.string() << " executable: " << ec.message() << std::endl;
+        return "";
+    }
+    return name;
+}
+
+namespace {
+
+using Factory = std::function<std::unique_ptr<Backend>()>;
+
+std::mutex &registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, Factory> &registry() {
+    static std::map<std::string, Factory> factories;
+    return factories;
+}
+
+} // namespace
+
+void register_backend(const std::string &name, Factory factory) {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    registry()[name] = std::move(factory);
+}
+
+std::unique_ptr<Backend> make_backend(const std::string &name) {
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        auto it = registry().find(name);
+        if (it != registry().end()) return it->second();
+    }
+    if (name == "kvm") return std::make_unique<KvmBackend>(false);
+    if (name == "kvm-hot") return std::make_unique<KvmBackend>(true);
+    if (name == "virtualbox") return std::make_unique<VirtualBoxBackend>(false);
+    if (name == "virtualbox-hot") return std::make_unique<VirtualBoxBackend>(true);
+    if (name == "firecracker") return std::make_unique<FirecrackerBackend>(false);
+    if (name == "firecracker-hot") return std::make_unique<FirecrackerBackend>(true);
+    if (name == "container") return std::make_unique<ContainerBackend>();
+#ifdef SAFEBOX_WITH_LIBVIRT
+    if (name == "libvirt") return std::make_unique<LibvirtBackend>(false);
+    if (name == "libvirt-hot") return std::make_unique<LibvirtBackend>(true);
+#endif
+    return nullptr;
+}
+
+Backend *find_backend(const std::string &name) {
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<Backend>> backends;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = backends.find(name);
+    if (it != backends.end()) return it->second.get();
+    std::unique_ptr<Backend> backend = make_backend(name);
+    if (!backend) return nullptr;
+    return backends.emplace(name, std::move(backend)).first->second.get();
+}
+
+std::string wait_for_guest_address(Backend &backend, const std::string &vm_name,
+                                   int timeout_seconds) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_seconds);
+    auto backoff = 50ms;
+    for (;;) {
+        std::string addr = backend.guest_address(vm_name);
+        if (!addr.empty()) return addr;
+        if (std::chrono::steady_clock::now() + backoff >= deadline) return "";
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(1000));
+    }
+}
+
+int capture_hot_snapshot(Backend &backend, const std::string &vm_name, const SshSession &session) {
+    if (!backend.hot()) return 1;
+    backend.exec(session, "python3 -c 'import psutil, json, subprocess'");
+    return backend.snapshot(vm_name, session);
+}
+
+} // namespace safebox
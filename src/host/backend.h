@@ -0,0 +1,114 @@
+#pragma once
+
+#include "clone.h"
+#include "json.h"
+#include "process.h"
+#include "resources.h"
+#include "ssh.h"
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace safebox {
+
+// One hypervisor. safebox-host resolves the --backend name to a Backend once
+// at startup and drives every VM through it, so adding a hypervisor means
+// adding a subclass rather than another branch in every VM operation.
+//
+// Operations return 0 on success and a non-zero code (usually the failing
+// tool's exit status) otherwise.
+class Backend {
+public:
+    virtual ~Backend() = default;
+
+    virtual int start(const std::string &vm_name) = 0;
+    // Powers the VM off and discards its changes, so the next start() runs
+    // a clean guest.
+    virtual int revert(const std::string &vm_name) = 0;
+
+    // Linked clones of a golden image (see CloneSpec); unsupported unless
+    // overridden.
+    virtual int clone(const CloneSpec &spec);
+    virtual int reset_clone(const CloneSpec &spec);
+    virtual int delete_clone(const CloneSpec &spec);
+
+    // Applies sizing, vCPU pinning, NUMA binding and hugepages to the VM's
+    // definition, for its following boots. Backends that cannot pin or bind
+    // apply what they can and ignore the rest; the default ignores it all.
+    virtual int configure(const std::string &vm_name, const VMResources &resources);
+
+    // Hot backends resume a running-state snapshot in start() instead of
+    // booting; snapshot() captures it from a running, reachable guest (see
+    // capture_hot_snapshot).
+    virtual bool hot() const { return false; }
+    virtual int snapshot(const std::string &vm_name, const SshSession &session);
+
+    // Address the guest's sshd is reachable on, or empty if the hypervisor
+    // does not know (yet).
+    virtual std::string guest_address(const std::string &vm_name);
+
+    // Guest I/O. The defaults go over the VM's SSH session.
+    virtual SshSession open_session(const std::string &target, int port);
+    // Cheap "is the guest's sshd up" check ahead of the first command.
+    virtual bool probe_guest(const SshSession &session, int timeout_ms);
+    // argv that runs remote_cmd in the guest; exec() runs it.
+    virtual Argv guest_command(const SshSession &session, const std::string &remote_cmd);
+    virtual CommandResult exec(const SshSession &session, const std::string &remote_cmd,
+                               const ExecOptions &options = {});
+    virtual int copy_in(const SshSession &session, const std::string &local_path,
+                        const std::string &remote_path);
+    virtual int copy_out(const SshSession &session, const std::string &remote_path,
+                         const std::string &local_path);
+
+    // Puts a sample in front of the guest. Backends that can expose a host
+    // directory to the guest read-only put an executable copy of the file
+    // there instead of sending its bytes over SSH; everything else
+    // copy_in()s it to remote_path. On success remote_path is where the
+    // guest sees the file.
+    virtual int inject(const std::string &vm_name, const SshSession &session,
+                       const std::string &local_path, std::string &remote_path);
+    // Withdraws whatever inject() shared with the guest.
+    virtual void release(const std::string &vm_name);
+
+    // What the guest as a whole used so far, if the hypervisor accounts for
+    // it (the container tier's cgroup counters); null otherwise. Read
+    // before revert().
+    virtual Json usage(const std::string &vm_name);
+
+    // Host side of the per-VM shares: share_root/<vm_name>, mounted
+    // read-only (and exec) at kGuestShareMount in the guest.
+    void set_share_root(const std::string &dir) { share_root_ = dir; }
+    std::string share_dir(const std::string &vm_name) const;
+
+    static constexpr const char *kGuestShareMount = "/mnt/safebox";
+
+protected:
+    // Copies local_path (reflinked where possible) into the VM's share after
+    // emptying it, mode 0755 so the guest can run it off the read-only
+    // mount. Returns the file's name in the share, or "" on failure.
+    std::string share_file(const std::string &vm_name, const std::string &local_path);
+
+private:
+    std::string share_root_ = "/var/lib/safebox/shares";
+};
+
+// Backend names: kvm, virtualbox, libvirt (if built with libvirt) and
+// firecracker, each with a "-hot" variant, container, plus any registered with
+// register_backend(). Returns nullptr for unknown names.
+std::unique_ptr<Backend> make_backend(const std::string &name);
+// Adds (or replaces) a backend name, e.g. the fake backend of safebox-bench.
+// Takes effect for find_backend() names not looked up yet.
+void register_backend(const std::string &name, std::function<std::unique_ptr<Backend>()> factory);
+// Process-wide instance per name, created on first use, so connection-holding
+// backends (libvirt) are opened once.
+Backend *find_backend(const std::string &name);
+
+std::string wait_for_guest_address(Backend &backend, const std::string &vm_name,
+                                   int timeout_seconds);
+
+// Backend::snapshot() after pulling the agent's interpreter and modules
+// into the guest's page cache, so they are already resident in every
+// restored guest. 1 for a backend that is not hot.
+int capture_hot_snapshot(Backend &backend, const std::string &vm_name, const SshSession &session);
+
+} // namespace safebox
@@ -0,0 +1,64 @@
+#include "cache.h"
+#include "report_codec.h"
+#include "sha256.h"
+#include <atomic>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace fs = std::filesystem;
+
+std::string config_fingerprint(const std::vector<std::string> &parts) {
+    std::string joined;
+    for (const std::string &part : parts) {
+        joined += part;
+        joined += '\0';
+    }
+    return sha256_hex(joined).substr(0, 16);
+}
+
+std::string ResultCache::entry_path(const std::string &sha256, const std::string &fingerprint) const {
+    return (fs::path(dir_) / sha256.substr(0, 2) / (sha256 + "-" + fingerprint + ".json")).string();
+}
+
+std::string ResultCache::fetch(const std::string &sha256, const std::string &fingerprint,
+                               const std::string &report_dir) const {
+    std::string entry = entry_path(sha256, fingerprint);
+    std::error_code ec;
+    if (!fs::is_regular_file(entry, ec)) return "";
+
+    fs::create_directories(report_dir, ec);
+    char magic[4] = {};
+    std::ifstream(entry, std::ios::binary).read(magic, sizeof(magic));
+    std::string out = report_dir + "/report-" + std::to_string(std::time(nullptr)) +
+                      (is_binary_report(std::string(magic, sizeof(magic))) ? ".sbr" : ".json");
+    fs::copy_file(entry, out, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        std::cerr << "[cache] cannot copy " << entry << ": " << ec.message() << std::endl;
+        return "";
+    }
+    return out;
+}
+
+int ResultCache::store(const std::string &sha256, const std::string &fingerprint,
+                       const std::string &report_path) const {
+    std::string entry = entry_path(sha256, fingerprint);
+    static std::atomic<unsigned> seq{0};
+    std::string tmp = entry + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq++);
+    std::error_code ec;
+    fs::create_directories(fs::path(entry).parent_path(), ec);
+    if (!ec) fs::copy_file(report_path, tmp, fs::copy_options::overwrite_existing, ec);
+    if (!ec) fs::rename(tmp, entry, ec);
+    if (ec) {
+        std::cerr << "[cache] cannot store " << entry << ": " << ec.message() << std::endl;
+        fs::remove(tmp, ec);
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace safebox
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// On-disk cache of finished reports, keyed by the sample's SHA-256 and a
+// fingerprint of everything else that shapes the report (backend, agent
+// timeout, agent protocol). Entries live at dir/<sha[0:2]>/<sha>-<fp>.json
+// (whichever report format the fingerprint was made for; fetch names the
+// copy .json or .sbr by its contents) and are written atomically, so
+// concurrent hosts can share a directory.
+class ResultCache {
+public:
+    explicit ResultCache(std::string dir) : dir_(std::move(dir)) {}
+
+    // Copies the cached report for (sha256, fingerprint) into report_dir and
+    // returns its path there, or "" on a miss.
+    std::string fetch(const std::string &sha256, const std::string &fingerprint,
+                      const std::string &report_dir) const;
+    // Returns 0 if report_path is now cached.
+    int store(const std::string &sha256, const std::string &fingerprint,
+              const std::string &report_path) const;
+
+    std::string entry_path(const std::string &sha256, const std::string &fingerprint) const;
+
+private:
+    std::string dir_;
+};
+
+// Short hash of the configuration parts, in order.
+std::string config_fingerprint(const std::vector<std::string> &parts);
+
+} // namespace safebox
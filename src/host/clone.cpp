@@ -0,0 +1,10 @@
+#include "clone.h"
+#include <filesystem>
+
+namespace safebox {
+
+std::string overlay_path(const CloneSpec &spec) {
+    return (std::filesystem::path(spec.overlay_dir) / (spec.clone_name + ".qcow2")).string();
+}
+
+} // namespace safebox
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+namespace safebox {
+
+// An ephemeral VM that shares the golden image read-only and keeps its own
+// writes in a throwaway layer: a qcow2 overlay whose backing file is the
+// golden disk (kvm) or a VirtualBox linked clone of the golden's "clean"
+// snapshot. Many clones can run at once off one golden image. Created and
+// recycled through Backend::clone() / reset_clone().
+struct CloneSpec {
+    std::string golden;
+    std::string clone_name;
+    // kvm only: the golden's disk and the directory overlays are created in.
+    std::string base_image;
+    std::string overlay_dir;
+    // virtualbox only: host port NAT-forwarded to the clone's sshd.
+    int ssh_port = 0;
+};
+
+std::string overlay_path(const CloneSpec &spec);
+
+} // namespace safebox
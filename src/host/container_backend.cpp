@@ -0,0 +1,237 @@
+#include "container_backend.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace safebox {
+
+namespace {
+
+constexpr int kCpuPeriodUsec = 100000;
+
+bool write_value(const std::string &path, const std::string &value) {
+    std::ofstream out(path);
+    out << value << std::endl;
+    return static_cast<bool>(out);
+}
+
+uint64_t read_number(const std::string &path) {
+    std::ifstream in(path);
+    uint64_t value = 0;
+    in >> value;
+    return value;
+}
+
+// The "<key> <n>" lines of a flat-keyed file (cpu.stat, memory.events).
+std::map<std::string, uint64_t> read_keyed(const std::string &path) {
+    std::map<std::string, uint64_t> values;
+    std::ifstream in(path);
+    std::string key;
+    uint64_t value;
+    while (in >> key >> value) values[key] = value;
+    return values;
+}
+
+// Controllers are enabled one by one: a kernel without, say, cpuset still
+// gets the others.
+void enable_controllers(const std::string &dir) {
+    for (const char *controller : {"+cpu", "+memory", "+pids", "+cpuset"}) {
+        write_value(dir + "/cgroup.subtree_control", controller);
+    }
+}
+
+// In the sandbox's own shell: $1 cgroup, $2 share, $3 user, $4 command,
+// $5 output dir. The outer shell moves itself into the cgroup before
+// unshare, so every process of the run is accounted there from the first
+// exec on. The output dir is mounted over /home/<user>/out inside the mount
+// namespace only, so each sandbox writes to its own.
+constexpr const char *kEnterSandbox =
+    "echo 0 > \"$1/cgroup.procs\" && "
+    "exec unshare --fork --kill-child --pid --mount-proc --mount --ipc --uts --net -- sh -c '"
+    "mkdir -p \"$2\" && mount --bind \"$2\" \"$2\" && mount -o remount,bind,ro \"$2\" && "
+    "mkdir -p \"$5\" \"/home/$3/out\" && chown \"$3\" \"$5\" && mount --bind \"$5\" \"/home/$3/out\" && "
+    "exec setpriv --reuid=\"$3\" --regid=\"$(id -g \"$3\")\" --clear-groups --no-new-privs -- sh -c \"$4\""
+    "' sh \"$@\"";
+
+} // namespace
+
+int create_cgroup(const std::string &path, const CgroupLimits &limits, std::string *error) {
+    auto fail = [&](const std::string &what) {
+        if (error) *error = "cannot write " + what;
+        return 1;
+    };
+    std::error_code ec;
+    std::filesystem::path dir(path);
+    enable_controllers(dir.parent_path().string());
+    std::filesystem::create_directories(dir, ec);
+    if (ec) return fail(path);
+
+    std::string cpu_max = limits.cpus > 0 ? std::to_string(limits.cpus * kCpuPeriodUsec) : "max";
+    if (!write_value(path + "/cpu.max", cpu_max + " " + std::to_string(kCpuPeriodUsec))) {
+        return fail(path + "/cpu.max");
+    }
+    std::string memory_max =
+        limits.memory_mb > 0 ? std::to_string(static_cast<uint64_t>(limits.memory_mb) << 20) : "max";
+    if (!write_value(path + "/memory.max", memory_max)) return fail(path + "/memory.max");
+    // Not there when the kernel has no swap accounting; nothing to turn off.
+    write_value(path + "/memory.swap.max", "0");
+    if (!write_value(path + "/pids.max", limits.pids > 0 ? std::to_string(limits.pids) : "max")) {
+        return fail(path + "/pids.max");
+    }
+    if (!limits.cpuset.empty() && !write_value(path + "/cpuset.cpus", format_cpu_list(limits.cpuset))) {
+        return fail(path + "/cpuset.cpus");
+    }
+    return 0;
+}
+
+bool read_cgroup_stats(const std::string &path, CgroupStats &stats) {
+    if (!std::filesystem::exists(path + "/cpu.stat")) return false;
+    std::map<std::string, uint64_t> cpu = read_keyed(path + "/cpu.stat");
+    stats.cpu_usec = cpu["usage_usec"];
+    stats.user_usec = cpu["user_usec"];
+    stats.system_usec = cpu["system_usec"];
+    stats.throttled_usec = cpu["throttled_usec"];
+    stats.memory_bytes = read_number(path + "/memory.current");
+    stats.memory_peak = read_number(path + "/memory.peak");
+    stats.oom_kills = read_keyed(path + "/memory.events")["oom_kill"];
+    stats.pids = read_number(path + "/pids.current");
+    return true;
+}
+
+Json cgroup_stats_json(const CgroupStats &stats) {
+    Json json = Json::object();
+    json["cpu_seconds"] = Json(static_cast<double>(stats.cpu_usec) / 1e6);
+    json["user_seconds"] = Json(static_cast<double>(stats.user_usec) / 1e6);
+    json["system_seconds"] = Json(static_cast<double>(stats.system_usec) / 1e6);
+    json["throttled_seconds"] = Json(static_cast<double>(stats.throttled_usec) / 1e6);
+    json["memory_mb"] = Json(static_cast<double>(stats.memory_bytes) / (1 << 20));
+    json["memory_peak_mb"] = Json(static_cast<double>(stats.memory_peak) / (1 << 20));
+    json["oom_kills"] = Json(static_cast<double>(stats.oom_kills));
+    json["pids"] = Json(static_cast<double>(stats.pids));
+    return json;
+}
+
+int remove_cgroup(const std::string &path, int timeout_ms) {
+    if (!std::filesystem::exists(path)) return 0;
+    auto procs = [&path] {
+        std::vector<pid_t> pids;
+        std::ifstream in(path + "/cgroup.procs");
+        pid_t pid;
+        while (in >> pid) pids.push_back(pid);
+        return pids;
+    };
+    if (!write_value(path + "/cgroup.kill", "1")) {
+        for (pid_t pid : procs()) kill(pid, SIGKILL);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!procs().empty()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            std::cerr << "[container] " << path << " still has processes" << std::endl;
+            return 1;
+        }
+        std::this_thread::sleep_for(5ms);
+    }
+    if (rmdir(path.c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "[container] cannot remove " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int ContainerBackend::start(const std::string &vm_name) {
+    CgroupLimits limits;
+    {
+        std::lock_guard<std::mutex> lock(limits_mutex_);
+        auto it = limits_.find(vm_name);
+        if (it != limits_.end()) limits = it->second;
+    }
+    // Whatever a crashed run left behind goes first.
+    std::string path = cgroup_path(vm_name);
+    if (remove_cgroup(path) != 0) return 1;
+    std::error_code ec;
+    std::filesystem::remove_all(output_dir(vm_name), ec);
+    std::filesystem::create_directories(cgroup_root_, ec);
+    std::filesystem::create_directories(share_dir(vm_name), ec);
+    std::string error;
+    if (create_cgroup(path, limits, &error) != 0) {
+        std::cerr << "[container] " << vm_name << ": " << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int ContainerBackend::revert(const std::string &vm_name) {
+    int rc = remove_cgroup(cgroup_path(vm_name));
+    std::error_code ec;
+    std::filesystem::remove_all(output_dir(vm_name), ec);
+    if (ec) {
+        std::cerr << "[container] cannot remove " << output_dir(vm_name) << ": " << ec.message() << std::endl;
+        rc = 1;
+    }
+    release(vm_name);
+    return rc;
+}
+
+int ContainerBackend::configure(const std::string &vm_name, const VMResources &resources) {
+    CgroupLimits limits;
+    limits.cpus = resources.vcpus;
+    limits.memory_mb = resources.memory_mb;
+    limits.cpuset = resources.cpus;
+    std::lock_guard<std::mutex> lock(limits_mutex_);
+    limits_[vm_name] = limits;
+    return 0;
+}
+
+SshSession ContainerBackend::open_session(const std::string &target, int port) {
+    return SshSession{target, port, ""};
+}
+
+bool ContainerBackend::probe_guest(const SshSession &session, int) {
+    return std::filesystem::exists(cgroup_path(ssh_host(session)) + "/cgroup.procs");
+}
+
+Argv ContainerBackend::guest_command(const SshSession &session, const std::string &remote_cmd) {
+    std::string vm_name = ssh_host(session);
+    size_t at = session.target.find('@');
+    std::string user = at == std::string::npos ? "nobody" : session.target.substr(0, at);
+    return {"sh", "-c", kEnterSandbox, "safebox-container", cgroup_path(vm_name), share_dir(vm_name), user,
+            remote_cmd, output_dir(vm_name)};
+}
+
+int ContainerBackend::copy_in(const SshSession &, const std::string &local_path,
+                              const std::string &remote_path) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(remote_path).parent_path(), ec);
+    std::filesystem::copy_file(local_path, remote_path, std::filesystem::copy_options::overwrite_existing, ec);
+    return ec ? 1 : 0;
+}
+
+int ContainerBackend::copy_out(const SshSession &, const std::string &remote_path,
+                               const std::string &local_path) {
+    // remote_path may be a glob (download_reports).
+    return execute_command({"sh", "-c", "cp -- $0 \"$1\"", remote_path, local_path}).return_code;
+}
+
+int ContainerBackend::inject(const std::string &vm_name, const SshSession &,
+                             const std::string &local_path, std::string &remote_path) {
+    std::string name = share_file(vm_name, local_path);
+    if (name.empty()) return 1;
+    remote_path = share_dir(vm_name) + "/" + name;
+    return 0;
+}
+
+Json ContainerBackend::usage(const std::string &vm_name) {
+    CgroupStats stats;
+    if (!read_cgroup_stats(cgroup_path(vm_name), stats)) return Json();
+    return cgroup_stats_json(stats);
+}
+
+} // namespace safebox
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "backend.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace safebox {
+
+// Limits of one cgroup; 0 leaves that one unlimited.
+struct CgroupLimits {
+    // cpu.max quota in CPUs per 100 ms period.
+    int cpus = 2;
+    // memory.max; swap (memory.swap.max) is always off.
+    int memory_mb = 512;
+    int pids = 256;
+    // cpuset.cpus, if any.
+    std::vector<int> cpuset;
+};
+
+// A cgroup's accounting, read from its own stat files, so it covers every
+// process that ever ran in it without looking at any one of them.
+struct CgroupStats {
+    // cpu.stat
+    uint64_t cpu_usec = 0;
+    uint64_t user_usec = 0;
+    uint64_t system_usec = 0;
+    uint64_t throttled_usec = 0;
+    // memory.current, memory.peak (0 before Linux 5.19), memory.events
+    uint64_t memory_bytes = 0;
+    uint64_t memory_peak = 0;
+    uint64_t oom_kills = 0;
+    // pids.current
+    uint64_t pids = 0;
+};
+
+// Creates the cgroup at path (a directory in a cgroup v2 hierarchy),
+// enabling the cpu, memory and pids controllers for it in its parent, and
+// writes the limits.
+int create_cgroup(const std::string &path, const CgroupLimits &limits, std::string *error = nullptr);
+// False if the cgroup's cpu.stat cannot be read.
+bool read_cgroup_stats(const std::string &path, CgroupStats &stats);
+Json cgroup_stats_json(const CgroupStats &stats);
+// Kills every process in the cgroup (cgroup.kill, or SIGKILL to each of
+// cgroup.procs before Linux 5.14), waits up to timeout_ms for it to empty
+// and removes it. A cgroup that does not exist counts as removed.
+int remove_cgroup(const std::string &path, int timeout_ms = 2000);
+
+// Container tier: a cgroup v2 group plus fresh namespaces on the host
+// itself rather than a VM. Each "VM" is the cgroup cgroup_root/<vm_name>;
+// start() only creates it and writes its limits, so a sandbox is ready in
+// milliseconds, and revert() kills whatever ran in it and removes it.
+//
+// Every guest_command() joins the cgroup and runs in new PID, mount, IPC,
+// UTS and network (no interfaces but a downed loopback) namespaces, as
+// vm_user, with the share bind-mounted read-only and output_dir() mounted
+// over /home/<vm_user>/out, the agent's output directory. revert() wipes
+// output_dir() along with the cgroup. The pool reaches each sandbox by its
+// name (guest_address), so its VMConfig::ssh_host must be empty. It runs
+// on the host's userland, so the agent must be installed on the host where
+// the guest image has it. That is far less isolation than a VM: the pool
+// only sends it samples static triage found low-risk (see
+// PoolOptions::escalate_score).
+class ContainerBackend : public Backend {
+public:
+    explicit ContainerBackend(std::string cgroup_root = "/sys/fs/cgroup/safebox")
+        : cgroup_root_(std::move(cgroup_root)) {}
+
+    int start(const std::string &vm_name) override;
+    int revert(const std::string &vm_name) override;
+    // vcpus, memory_mb and pinned cpus become cpu.max, memory.max and
+    // cpuset.cpus from the next start() on.
+    int configure(const std::string &vm_name, const VMResources &resources) override;
+
+    // The "address" is the VM name itself; there is no sshd.
+    std::string guest_address(const std::string &vm_name) override { return vm_name; }
+    SshSession open_session(const std::string &target, int port) override;
+    bool probe_guest(const SshSession &session, int timeout_ms) override;
+    Argv guest_command(const SshSession &session, const std::string &remote_cmd) override;
+    int copy_in(const SshSession &session, const std::string &local_path,
+                const std::string &remote_path) override;
+    int copy_out(const SshSession &session, const std::string &remote_path,
+                 const std::string &local_path) override;
+    // The sample goes into the (host-side) share, which the sandbox sees at
+    // the same path, read-only.
+    int inject(const std::string &vm_name, const SshSession &session,
+               const std::string &local_path, std::string &remote_path) override;
+
+    Json usage(const std::string &vm_name) override;
+
+    std::string cgroup_path(const std::string &vm_name) const { return cgroup_root_ + "/" + vm_name; }
+    // Host side of the sandbox's /home/<vm_user>/out, beside its share.
+    std::string output_dir(const std::string &vm_name) const { return share_dir(vm_name) + "-out"; }
+
+private:
+    std::string cgroup_root_;
+    std::mutex limits_mutex_;
+    std::map<std::string, CgroupLimits> limits_;
+};
+
+} // namespace safebox
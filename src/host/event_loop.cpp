@@ -0,0 +1,249 @@
+#include "event_loop.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int arm_timerfd(int delay_ms) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+    itimerspec spec{};
+    // A zero it_value would disarm the timer, so "now" is 1ns.
+    long long ns = delay_ms > 0 ? static_cast<long long>(delay_ms) * 1000000 : 1;
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    timerfd_settime(fd, 0, &spec, nullptr);
+    return fd;
+}
+
+} // namespace
+
+struct EventLoop::Child {
+    pid_t pid = -1;
+    int pidfd = -1;
+    int out_fd = -1;
+    int err_fd = -1;
+    int timer = -1;
+    // Kernels without pidfd fall back to polling waitpid on a timer.
+    int poll_timer = -1;
+    bool timed_out = false;
+    bool done = false;
+    CommandResult result{-1, "", ""};
+    std::function<void(const char*, size_t)> on_stdout;
+    ExitCallback on_exit;
+};
+
+EventLoop::EventLoop() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        std::cerr << "[loop] cannot create epoll/eventfd: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    add_fd(wake_fd_, EPOLLIN, [this](uint32_t) {
+        uint64_t n;
+        while (read(wake_fd_, &n, sizeof(n)) > 0) {
+        }
+        drain_posted();
+    });
+}
+
+EventLoop::~EventLoop() {
+    for (const auto &timer : timers_) close(timer.second);
+    if (wake_fd_ >= 0) close(wake_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+int EventLoop::add_fd(int fd, uint32_t events, FdCallback cb) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) return 1;
+    handlers_[fd] = std::make_shared<FdCallback>(std::move(cb));
+    return 0;
+}
+
+void EventLoop::remove_fd(int fd) {
+    if (handlers_.erase(fd) == 0) return;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int EventLoop::add_timer(int delay_ms, Callback cb) {
+    int fd = arm_timerfd(delay_ms);
+    if (fd < 0) return -1;
+    int id = next_timer_++;
+    auto fire = [this, id, fd, cb = std::move(cb)](uint32_t) {
+        remove_fd(fd);
+        timers_.erase(id);
+        close(fd);
+        cb();
+    };
+    if (add_fd(fd, EPOLLIN, std::move(fire)) != 0) {
+        close(fd);
+        return -1;
+    }
+    timers_[id] = fd;
+    return id;
+}
+
+void EventLoop::cancel_timer(int id) {
+    auto it = timers_.find(id);
+    if (it == timers_.end()) return;
+    remove_fd(it->second);
+    close(it->second);
+    timers_.erase(it);
+}
+
+int EventLoop::spawn(const Argv &argv, const ExecOptions &options, ExitCallback done) {
+    std::cerr << "[cmd] " << format_command(argv) << std::endl;
+    auto child = std::make_shared<Child>();
+    std::string error;
+    child->pid = spawn_piped(argv, options, child->out_fd, child->err_fd, &error);
+    if (child->pid < 0) {
+        done(CommandResult{error.empty() ? -1 : 127, "", error});
+        return -1;
+    }
+    child->on_stdout = options.on_stdout;
+    child->on_exit = std::move(done);
+
+    add_fd(child->out_fd, EPOLLIN, [this, child](uint32_t) { child_output(child, child->out_fd); });
+    add_fd(child->err_fd, EPOLLIN, [this, child](uint32_t) { child_output(child, child->err_fd); });
+
+    // As in execute_command, the child's exit ends the run, not EOF on its
+    // pipes, which background grandchildren may hold open.
+    child->pidfd = open_pidfd(child->pid);
+    if (child->pidfd >= 0) {
+        add_fd(child->pidfd, EPOLLIN, [this, child](uint32_t) { reap(child, false); });
+    } else {
+        child->poll_timer = add_timer(50, [this, child] { poll_exit(child); });
+    }
+
+    if (options.timeout_seconds > 0) {
+        child->timer = add_timer(options.timeout_seconds * 1000, [this, child] {
+            child->timer = -1;
+            child->timed_out = true;
+            kill(-child->pid, SIGKILL);
+            reap(child, true);
+        });
+    }
+    return child->pid;
+}
+
+void EventLoop::poll_exit(const std::shared_ptr<Child> &child) {
+    child->poll_timer = -1;
+    reap(child, false);
+    if (!child->done) child->poll_timer = add_timer(50, [this, child] { poll_exit(child); });
+}
+
+void EventLoop::child_output(const std::shared_ptr<Child> &child, int fd) {
+    bool open = fd == child->out_fd ? read_available(fd, child->result.stdout, child->on_stdout)
+                                    : read_available(fd, child->result.stderr);
+    if (open) return;
+    remove_fd(fd);
+    close(fd);
+    if (fd == child->out_fd) child->out_fd = -1;
+    else child->err_fd = -1;
+}
+
+void EventLoop::reap(const std::shared_ptr<Child> &child, bool force) {
+    if (child->done) return;
+    int status = 0;
+    pid_t w = waitpid(child->pid, &status, force ? 0 : WNOHANG);
+    if (w != child->pid) return;
+    child->done = true;
+
+    // Whatever the child wrote before exiting is still in the pipes.
+    if (child->out_fd >= 0) {
+        read_available(child->out_fd, child->result.stdout, child->on_stdout);
+        remove_fd(child->out_fd);
+        close(child->out_fd);
+        child->out_fd = -1;
+    }
+    if (child->err_fd >= 0) {
+        read_available(child->err_fd, child->result.stderr);
+        remove_fd(child->err_fd);
+        close(child->err_fd);
+        child->err_fd = -1;
+    }
+    if (child->pidfd >= 0) {
+        remove_fd(child->pidfd);
+        close(child->pidfd);
+        child->pidfd = -1;
+    }
+    if (child->timer >= 0) cancel_timer(child->timer);
+    if (child->poll_timer >= 0) cancel_timer(child->poll_timer);
+
+    child->result.timed_out = child->timed_out;
+    child->result.return_code = child->timed_out ? 124 : decode_exit_status(status);
+    log_command_failure(child->result);
+    ExitCallback done = std::move(child->on_exit);
+    done(std::move(child->result));
+}
+
+void EventLoop::post(Callback fn) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        posted_.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void EventLoop::drain_posted() {
+    std::vector<Callback> batch;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        batch.swap(posted_);
+    }
+    for (Callback &fn : batch) fn();
+}
+
+void EventLoop::stop() {
+    post([this] { stopping_ = true; });
+}
+
+void EventLoop::dispatch(int fd, uint32_t events) {
+    auto it = handlers_.find(fd);
+    if (it == handlers_.end()) return;
+    // Keep the handler alive even if it unregisters itself.
+    std::shared_ptr<FdCallback> handler = it->second;
+    (*handler)(events);
+}
+
+void EventLoop::run() {
+    if (epoll_fd_ < 0) return;
+    stopping_ = false;
+    epoll_event events[64];
+    while (!stopping_) {
+        int n = epoll_wait(epoll_fd_, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "[loop] epoll_wait: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        for (int i = 0; i < n; ++i) dispatch(events[i].data.fd, events[i].events);
+    }
+}
+
+} // namespace safebox
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "process.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace safebox {
+
+// Single-threaded epoll reactor for the pool: watches fds, one-shot timers
+// (timerfd) and child processes (pidfd), so one thread can keep the agent
+// runs, readiness probes and backoff waits of many VMs in flight at once.
+// Every callback runs on the thread inside run(). post() and stop() may be
+// called from any thread; everything else only from callbacks or before
+// run() starts.
+class EventLoop {
+public:
+    using Callback = std::function<void()>;
+    using FdCallback = std::function<void(uint32_t events)>;
+    using ExitCallback = std::function<void(CommandResult)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop &operator=(const EventLoop&) = delete;
+
+    // Watches fd for EPOLLIN/EPOLLOUT/...; returns 0 on success. The
+    // caller keeps ownership of fd and removes it before closing it.
+    int add_fd(int fd, uint32_t events, FdCallback cb);
+    void remove_fd(int fd);
+
+    // Runs cb once after delay_ms. Returns an id for cancel_timer, or -1.
+    int add_timer(int delay_ms, Callback cb);
+    void cancel_timer(int id);
+
+    // Runs argv like execute_command, without blocking the loop; done gets
+    // the same CommandResult once the child has exited (or been killed after
+    // options.timeout_seconds). Returns the child's pid, or -1 if it could
+    // not be started, in which case done has already been called with 127.
+    int spawn(const Argv &argv, const ExecOptions &options, ExitCallback done);
+
+    // Queues fn to run on the loop thread.
+    void post(Callback fn);
+
+    // Dispatches events until stop().
+    void run();
+    void stop();
+
+    // Children, timers and fds currently registered.
+    size_t pending() const { return handlers_.size(); }
+
+private:
+    struct Child;
+
+    void dispatch(int fd, uint32_t events);
+    void drain_posted();
+    void child_output(const std::shared_ptr<Child> &child, int fd);
+    void poll_exit(const std::shared_ptr<Child> &child);
+    void reap(const std::shared_ptr<Child> &child, bool force);
+
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    bool stopping_ = false;
+
+    std::map<int, std::shared_ptr<FdCallback>> handlers_;
+    std::map<int, int> timers_;  // timer id -> timerfd
+    int next_timer_ = 0;
+
+    std::mutex posted_mutex_;
+    std::vector<Callback> posted_;
+};
+
+} // namespace safebox
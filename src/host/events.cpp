@@ -0,0 +1,188 @@
+#include "events.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace safebox {
+
+int EventPublisher::start(const std::string &path) {
+    sockaddr_un sa{};
+    if (path.empty() || path.size() >= sizeof(sa.sun_path)) {
+        std::cerr << "[events] socket path too long: " << path << std::endl;
+        return 1;
+    }
+    sa.sun_family = AF_UNIX;
+    std::memcpy(sa.sun_path, path.c_str(), path.size() + 1);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    unlink(path.c_str());
+    if (listen_fd_ < 0 || wake_fd_ < 0 || bind(listen_fd_, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0 ||
+        listen(listen_fd_, 16) != 0) {
+        std::cerr << "[events] cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        if (listen_fd_ >= 0) close(listen_fd_);
+        if (wake_fd_ >= 0) close(wake_fd_);
+        listen_fd_ = wake_fd_ = -1;
+        return 1;
+    }
+    path_ = path;
+    running_ = true;
+    thread_ = std::thread(&EventPublisher::serve, this);
+    return 0;
+}
+
+void EventPublisher::stop() {
+    if (!running_) return;
+    running_ = false;
+    wake();
+    if (thread_.joinable()) thread_.join();
+    for (Client &client : clients_) close(client.fd);
+    clients_.clear();
+    close(listen_fd_);
+    close(wake_fd_);
+    listen_fd_ = wake_fd_ = -1;
+    unlink(path_.c_str());
+}
+
+void EventPublisher::publish(const std::string &key, Json state, bool final) {
+    double now = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    state["seq"] = Json(static_cast<double>(++seq_));
+    state["key"] = Json(key);
+    state["time"] = Json(now);
+    std::string line = dump_json(state) + "\n";
+    state_[key] = std::move(state);
+    if (final) {
+        finished_.push_back(key);
+        if (finished_.size() > kRetainedJobs) {
+            state_.erase(finished_.front());
+            finished_.pop_front();
+        }
+    }
+
+    bool pending = false;
+    for (Client &client : clients_) {
+        if (client.dropped) continue;
+        if (client.out.size() + line.size() > kMaxBacklog) {
+            // The serve thread closes it; a reconnect starts from a snapshot.
+            client.dropped = true;
+            client.out.clear();
+        } else {
+            client.out += line;
+        }
+        pending = true;
+    }
+    if (pending) wake();
+}
+
+std::vector<Json> EventPublisher::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ordered_states();
+}
+
+std::vector<Json> EventPublisher::ordered_states() const {
+    std::vector<Json> states;
+    for (const auto &entry : state_) states.push_back(entry.second);
+    std::sort(states.begin(), states.end(),
+              [](const Json &a, const Json &b) { return a.number_or("seq", 0) < b.number_or("seq", 0); });
+    return states;
+}
+
+size_t EventPublisher::clients() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return clients_.size();
+}
+
+void EventPublisher::wake() {
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+bool EventPublisher::flush(Client &client) {
+    while (!client.out.empty()) {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            client.out.erase(0, static_cast<size_t>(n));
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+    return true;
+}
+
+void EventPublisher::accept_client() {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) return;
+    Client client;
+    client.fd = fd;
+    // Under the lock, so no change falls between the snapshot and the
+    // stream that follows it.
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Json &state : ordered_states()) {
+        state["snapshot"] = Json(true);
+        client.out += dump_json(state) + "\n";
+    }
+    Json synced = Json::object();
+    synced["type"] = Json("synced");
+    synced["seq"] = Json(static_cast<double>(seq_));
+    client.out += dump_json(synced) + "\n";
+    clients_.push_back(std::move(client));
+}
+
+void EventPublisher::serve() {
+    std::vector<pollfd> fds;
+    while (running_) {
+        fds.clear();
+        fds.push_back(pollfd{listen_fd_, POLLIN, 0});
+        fds.push_back(pollfd{wake_fd_, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Client &client : clients_) {
+                short events = POLLIN;
+                if (!client.out.empty() || client.dropped) events |= POLLOUT;
+                fds.push_back(pollfd{client.fd, events, 0});
+            }
+        }
+        if (poll(fds.data(), fds.size(), 500) <= 0) continue;
+        if (fds[1].revents & POLLIN) {
+            uint64_t n;
+            while (read(wake_fd_, &n, sizeof(n)) > 0) {
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Only this thread adds or removes clients, so entry i + 2 of
+            // fds is still clients_[i].
+            for (size_t i = clients_.size(); i-- > 0;) {
+                Client &client = clients_[i];
+                short revents = i + 2 < fds.size() ? fds[i + 2].revents : 0;
+                bool alive = !client.dropped;
+                if (alive && (revents & POLLIN)) {
+                    // Subscribers have nothing to say; EOF means they left.
+                    char buf[256];
+                    ssize_t n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+                    alive = n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR));
+                }
+                if (alive && (revents & (POLLHUP | POLLERR))) alive = false;
+                if (alive) alive = flush(client);
+                if (!alive) {
+                    close(client.fd);
+                    clients_.erase(clients_.begin() + static_cast<long>(i));
+                }
+            }
+        }
+        if (fds[0].revents & POLLIN) accept_client();
+    }
+}
+
+} // namespace safebox
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "json.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace safebox {
+
+// Pushes pool state changes to local subscribers (the web dashboard) over a
+// Unix stream socket, one JSON object per line, so nothing has to poll the
+// pool, psutil or the hypervisor for them.
+//
+// Every object carries "seq" (one higher per change), "key" ("vm/<name>" or
+// "job/<id>") and the new state of that VM or job in full. A client that
+// connects first gets the current state of every key, marked
+// "snapshot": true, then a {"type": "synced"} line, then each change as it
+// happens. Clients never send anything; one that stops reading and falls
+// kMaxBacklog bytes behind is disconnected, and reconnects to a snapshot.
+class EventPublisher {
+public:
+    static constexpr size_t kMaxBacklog = 4 << 20;
+    // Finished jobs kept in the snapshot; older ones only live in job.json.
+    static constexpr size_t kRetainedJobs = 256;
+
+    ~EventPublisher() { stop(); }
+
+    // Returns 0 once listening on path (replacing a stale socket there).
+    int start(const std::string &path);
+    void stop();
+
+    // Makes state the current state of key and sends it to every client.
+    // Thread-safe and never blocks on a client. final marks a job that
+    // will not change again (see kRetainedJobs).
+    void publish(const std::string &key, Json state, bool final = false);
+
+    // Current state of every key, in the order a new client receives it.
+    std::vector<Json> snapshot();
+    size_t clients();
+
+private:
+    struct Client {
+        int fd = -1;
+        std::string out;
+        bool dropped = false;
+    };
+
+    void serve();
+    void accept_client();
+    std::vector<Json> ordered_states() const;
+    // Sends what the socket takes now; false once the client is gone.
+    static bool flush(Client &client);
+    void wake();
+
+    std::string path_;
+    int listen_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    std::mutex mutex_;
+    uint64_t seq_ = 0;
+    std::map<std::string, Json> state_;
+    std::deque<std::string> finished_;
+    std::vector<Client> clients_;
+};
+
+} // namespace safebox
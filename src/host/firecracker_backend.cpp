@@ -0,0 +1,265 @@
+#include "firecracker_backend.h"
+#include "json.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace safebox {
+
+namespace {
+
+int connect_unix(const std::string &socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) return -1;
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The monitor creates its API socket shortly after exec.
+bool wait_for_socket(const std::string &socket_path, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        int fd = connect_unix(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return true;
+        }
+        std::this_thread::sleep_for(5ms);
+    }
+    return false;
+}
+
+int copy_disk(const std::string &from, const std::string &to) {
+    // Reflinks make this O(1) on btrfs/xfs and fall back to a plain copy.
+    return execute_command({"cp", "--reflink=auto", "--sparse=always", from, to}).return_code;
+}
+
+// A pidfile outlives a host restart and its pid may have been reused, so only
+// a firecracker serving this VM's API socket is the monitor.
+bool is_monitor(int pid, const std::string &sock) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/cmdline", std::ios::binary);
+    std::string cmdline((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Argv argv;
+    for (size_t at = 0; at < cmdline.size();) {
+        size_t end = cmdline.find('\0', at);
+        if (end == std::string::npos) end = cmdline.size();
+        argv.push_back(cmdline.substr(at, end - at));
+        at = end + 1;
+    }
+    if (argv.empty() || std::filesystem::path(argv[0]).filename() != "firecracker") return false;
+    for (size_t i = 1; i + 1 < argv.size(); ++i) {
+        if (argv[i] == "--api-sock" && argv[i + 1] == sock) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int firecracker_api(const std::string &socket_path, const std::string &method,
+                    const std::string &path, const std::string &body) {
+    int fd = connect_unix(socket_path);
+    if (fd < 0) return -1;
+
+    std::string request = method + " " + path + " HTTP/1.1\r\n"
+                          "Host: localhost\r\n"
+                          "Accept: application/json\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    // Only the status line matters; error bodies are logged for diagnosis.
+    std::string response;
+    char buf[1024];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        response.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+
+    int status = -1;
+    if (response.compare(0, 5, "HTTP/") == 0) {
+        size_t sp = response.find(' ');
+        if (sp != std::string::npos) status = std::atoi(response.c_str() + sp + 1);
+    }
+    if (status < 200 || status >= 300) {
+        size_t body_at = response.find("\r\n\r\n");
+        std::cerr << "[firecracker] " << method << " " << path << " -> " << status
+                  << (body_at == std::string::npos ? "" : ": " + response.substr(body_at + 4)) << std::endl;
+    }
+    return status > 0 ? status : -1;
+}
+
+std::string FirecrackerBackend::vm_file(const std::string &vm_name, const std::string &file) const {
+    return (std::filesystem::path(state_dir_) / vm_name / file).string();
+}
+
+int FirecrackerBackend::spawn(const std::string &vm_name, bool with_config) {
+    std::string sock = vm_file(vm_name, "api.sock");
+    std::error_code ec;
+    std::filesystem::remove(sock, ec);
+
+    Argv argv;
+    {
+        std::lock_guard<std::mutex> lock(resources_mutex_);
+        auto res = resources_.find(vm_name);
+        if (res != resources_.end() && (!res->second.cpus.empty() || res->second.numa_node >= 0)) {
+            argv.push_back("numactl");
+            if (!res->second.cpus.empty()) argv.push_back("--physcpubind=" + format_cpu_list(res->second.cpus));
+            if (res->second.numa_node >= 0) argv.push_back("--membind=" + std::to_string(res->second.numa_node));
+        }
+    }
+    argv.insert(argv.end(), {"firecracker", "--api-sock", sock});
+    if (with_config) {
+        argv.push_back("--config-file");
+        argv.push_back(vm_file(vm_name, "vm.json"));
+    }
+    int pid = spawn_detached(argv, vm_file(vm_name, "firecracker.log"));
+    if (pid < 0) return 1;
+    std::ofstream(vm_file(vm_name, "firecracker.pid")) << pid << std::endl;
+
+    if (!wait_for_socket(sock, 2000)) {
+        std::cerr << "[firecracker] " << vm_name << ": API socket never appeared" << std::endl;
+        kill_monitor(vm_name);
+        return 1;
+    }
+    return 0;
+}
+
+int FirecrackerBackend::start(const std::string &vm_name) {
+    if (!hot_) {
+        if (!std::filesystem::exists(vm_file(vm_name, "rootfs.ext4"))) {
+            int rc = copy_disk(vm_file(vm_name, "golden.ext4"), vm_file(vm_name, "rootfs.ext4"));
+            if (rc != 0) return rc;
+        }
+        return spawn(vm_name, true);
+    }
+
+    // The snapshot refers to rootfs.ext4 by path, so put back the disk
+    // state that goes with its memory before loading it.
+    int rc = copy_disk(vm_file(vm_name, "hot.ext4"), vm_file(vm_name, "rootfs.ext4"));
+    if (rc != 0) return rc;
+    rc = spawn(vm_name, false);
+    if (rc != 0) return rc;
+
+    std::string body = "{\"snapshot_path\": \"" + vm_file(vm_name, "hot.snap") +
+                       "\", \"mem_backend\": {\"backend_type\": \"File\", \"backend_path\": \"" +
+                       vm_file(vm_name, "hot.mem") + "\"}, \"resume_vm\": true}";
+    int status = firecracker_api(vm_file(vm_name, "api.sock"), "PUT", "/snapshot/load", body);
+    if (status / 100 != 2) {
+        kill_monitor(vm_name);
+        return 1;
+    }
+    return 0;
+}
+
+int FirecrackerBackend::configure(const std::string &vm_name, const VMResources &res) {
+    {
+        std::lock_guard<std::mutex> lock(resources_mutex_);
+        resources_[vm_name] = res;
+    }
+    if (!res.resize && !res.hugepages) return 0;
+
+    std::string path = vm_file(vm_name, "vm.json");
+    std::ifstream in(path);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Json config;
+    if (!in || !parse_json(text, config) || !config.is_object()) {
+        std::cerr << "[firecracker] " << vm_name << ": cannot read " << path << std::endl;
+        return 1;
+    }
+    Json &machine = config["machine-config"];
+    if (res.resize) {
+        machine["vcpu_count"] = Json(res.vcpus);
+        machine["mem_size_mib"] = Json(res.memory_mb);
+    }
+    if (res.hugepages) machine["huge_pages"] = Json("2M");
+    std::string tmp = path + ".tmp";
+    std::ofstream(tmp) << dump_json(config, 2) << std::endl;
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return ec ? 1 : 0;
+}
+
+int FirecrackerBackend::kill_monitor(const std::string &vm_name) {
+    std::string pidfile = vm_file(vm_name, "firecracker.pid");
+    std::string sock = vm_file(vm_name, "api.sock");
+    std::ifstream in(pidfile);
+    int pid = 0;
+    // No pidfile means no monitor: the VM is off already.
+    if ((in >> pid) && pid > 0 && is_monitor(pid, sock)) {
+        kill(pid, SIGKILL);
+        // Reap it if we are its parent, otherwise wait for it to disappear.
+        if (waitpid(pid, nullptr, 0) != pid) {
+            for (int i = 0; i < 500 && kill(pid, 0) == 0; ++i) std::this_thread::sleep_for(10ms);
+        }
+    }
+    std::error_code ec;
+    std::filesystem::remove(pidfile, ec);
+    std::filesystem::remove(sock, ec);
+    return 0;
+}
+
+int FirecrackerBackend::revert(const std::string &vm_name) {
+    int rc = kill_monitor(vm_name);
+    if (rc != 0) return rc;
+    // start() restores the hot snapshot's own disk.
+    if (hot_) return 0;
+    return copy_disk(vm_file(vm_name, "golden.ext4"), vm_file(vm_name, "rootfs.ext4"));
+}
+
+int FirecrackerBackend::snapshot(const std::string &vm_name, const SshSession &) {
+    if (!hot_) return 1;
+    std::string sock = vm_file(vm_name, "api.sock");
+    if (firecracker_api(sock, "PATCH", "/vm", "{\"state\": \"Paused\"}") / 100 != 2) return 1;
+
+    std::string body = "{\"snapshot_type\": \"Full\", \"snapshot_path\": \"" + vm_file(vm_name, "hot.snap") +
+                       "\", \"mem_file_path\": \"" + vm_file(vm_name, "hot.mem") + "\"}";
+    int rc = firecracker_api(sock, "PUT", "/snapshot/create", body) / 100 == 2 ? 0 : 1;
+    // The disk has to be captured while the guest is still paused.
+    if (rc == 0) rc = copy_disk(vm_file(vm_name, "rootfs.ext4"), vm_file(vm_name, "hot.ext4"));
+
+    firecracker_api(sock, "PATCH", "/vm", "{\"state\": \"Resumed\"}");
+    return rc;
+}
+
+std::string FirecrackerBackend::guest_address(const std::string &vm_name) {
+    std::ifstream in(vm_file(vm_name, "address"));
+    std::string addr;
+    in >> addr;
+    return addr;
+}
+
+} // namespace safebox
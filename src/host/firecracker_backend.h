@@ -0,0 +1,54 @@
+#pragma once
+
+#include "backend.h"
+#include <map>
+#include <mutex>
+
+namespace safebox {
+
+// Firecracker microVMs. Each VM is a directory under state_dir named after
+// it, prepared once by the operator:
+//   vm.json      firecracker --config-file (kernel, rootfs.ext4 drive, tap)
+//   golden.ext4  pristine root filesystem
+//   address      the guest's IP on the tap network, for guest_address()
+// and used by safebox for rootfs.ext4 (the VM's writable copy), api.sock,
+// firecracker.pid and, for the hot variant, hot.snap/hot.mem/hot.ext4.
+//
+// Cold starts boot the kernel straight from vm.json in well under a second;
+// the hot variant loads the snapshot and resumes it. There is no snapshot
+// tree to revert, so revert() kills the monitor and restores rootfs.ext4.
+class FirecrackerBackend : public Backend {
+public:
+    explicit FirecrackerBackend(bool hot, std::string state_dir = "/var/lib/safebox/firecracker")
+        : hot_(hot), state_dir_(std::move(state_dir)) {}
+
+    int start(const std::string &vm_name) override;
+    int revert(const std::string &vm_name) override;
+
+    // Sizing and hugepages go into vm.json's machine-config; pinning and
+    // NUMA binding wrap the monitor in numactl, which covers its vCPU
+    // threads and every page it allocates.
+    int configure(const std::string &vm_name, const VMResources &resources) override;
+
+    bool hot() const override { return hot_; }
+    int snapshot(const std::string &vm_name, const SshSession &session) override;
+
+    std::string guest_address(const std::string &vm_name) override;
+
+private:
+    std::string vm_file(const std::string &vm_name, const std::string &file) const;
+    int spawn(const std::string &vm_name, bool with_config);
+    int kill_monitor(const std::string &vm_name);
+
+    bool hot_;
+    std::string state_dir_;
+    std::mutex resources_mutex_;
+    std::map<std::string, VMResources> resources_;
+};
+
+// Sends one request to a Firecracker API socket and returns the HTTP status
+// code, or -1 if the socket could not be reached or answered garbage.
+int firecracker_api(const std::string &socket_path, const std::string &method,
+                    const std::string &path, const std::string &body);
+
+} // namespace safebox
@@ -0,0 +1,257 @@
+#include "governor.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+constexpr int kHugepageMb = 2;
+
+std::string read_line(const std::string &path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+// The kB figure of a "<key>: <n> kB" line (node meminfo lines carry a
+// "Node <i>" prefix, which is skipped along with the key).
+uint64_t meminfo_mb(const std::string &path, const std::string &key) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t at = line.find(key + ":");
+        if (at == std::string::npos) continue;
+        return std::strtoull(line.c_str() + at + key.size() + 1, nullptr, 10) / 1024;
+    }
+    return 0;
+}
+
+bool write_value(const std::string &path, const std::string &value) {
+    std::ofstream out(path);
+    out << value << std::endl;
+    return static_cast<bool>(out);
+}
+
+std::string hugepages_file(const std::string &dir) {
+    return dir + "/hugepages/hugepages-2048kB/nr_hugepages";
+}
+
+// Raises the hugepage count in path to at least pages.
+bool reserve_hugepages(const std::string &path, uint64_t pages) {
+    uint64_t current = std::strtoull(read_line(path).c_str(), nullptr, 10);
+    return current >= pages || write_value(path, std::to_string(pages));
+}
+
+} // namespace
+
+size_t HostTopology::cpu_count() const {
+    size_t n = 0;
+    for (const HostNode &node : nodes) n += node.cpus.size();
+    return n;
+}
+
+uint64_t HostTopology::memory_mb() const {
+    uint64_t mb = 0;
+    for (const HostNode &node : nodes) mb += node.memory_mb;
+    return mb;
+}
+
+bool read_host_topology(HostTopology &topology, const std::string &sysfs) {
+    topology.nodes.clear();
+    std::error_code ec;
+    std::filesystem::path node_root = std::filesystem::path(sysfs) / "devices/system/node";
+    for (const auto &entry : std::filesystem::directory_iterator(node_root, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        HostNode node;
+        node.id = std::stoi(name.substr(4));
+        node.cpus = parse_cpu_list(read_line((entry.path() / "cpulist").string()));
+        node.memory_mb = meminfo_mb((entry.path() / "meminfo").string(), "MemTotal");
+        // Memory-only nodes (CXL, persistent memory) cannot host vCPUs.
+        if (!node.cpus.empty()) topology.nodes.push_back(node);
+    }
+    std::sort(topology.nodes.begin(), topology.nodes.end(),
+              [](const HostNode &a, const HostNode &b) { return a.id < b.id; });
+    if (!topology.nodes.empty()) return true;
+
+    HostNode node;
+    node.cpus = parse_cpu_list(read_line(sysfs + "/devices/system/cpu/online"));
+    if (node.cpus.empty()) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < n; ++cpu) node.cpus.push_back(static_cast<int>(cpu));
+    }
+    node.memory_mb = static_cast<uint64_t>(sysconf(_SC_PHYS_PAGES)) *
+                     static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) / (1024 * 1024);
+    topology.nodes.push_back(node);
+    return !node.cpus.empty();
+}
+
+HostLoad HostProbe::sample() {
+    HostLoad load;
+    load.available_mb = meminfo_mb(proc_ + "/meminfo", "MemAvailable");
+
+    // cpu  user nice system idle iowait irq softirq steal ...
+    std::istringstream fields(read_line(proc_ + "/stat"));
+    std::string label;
+    fields >> label;
+    uint64_t total = 0, idle = 0, value = 0;
+    for (int i = 0; i < 8 && fields >> value; ++i) {
+        total += value;
+        if (i == 3 || i == 4) idle += value;
+    }
+    uint64_t busy = total - idle;
+    // Too short an interval says nothing; keep the last reading.
+    if (total - last_total_ >= 100 || last_total_ == 0) {
+        uint64_t span = total - last_total_;
+        last_cpu_busy_ = span ? static_cast<double>(busy - last_busy_) / static_cast<double>(span) : 0;
+        last_busy_ = busy;
+        last_total_ = total;
+    }
+    load.cpu_busy = last_cpu_busy_;
+    return load;
+}
+
+ResourceGovernor::ResourceGovernor(GovernorOptions options, HostTopology topology, ProbeFn probe)
+    : options_(options), topology_(std::move(topology)), probe_(std::move(probe)) {
+    if (!probe_) {
+        auto host = std::make_shared<HostProbe>();
+        probe_ = [host] { return host->sample(); };
+    }
+}
+
+void ResourceGovernor::place(std::vector<VMConfig> &vms) const {
+    struct Pool {
+        const HostNode *node;
+        std::vector<int> free;
+        std::vector<int> usable;
+        size_t shared_next = 0;
+        int64_t memory_left;
+    };
+    // The host keeps the lowest-numbered cores.
+    std::set<int> reserved;
+    std::vector<int> all;
+    for (const HostNode &node : topology_.nodes) all.insert(all.end(), node.cpus.begin(), node.cpus.end());
+    std::sort(all.begin(), all.end());
+    for (int i = 0; i < options_.host_cpus && i < static_cast<int>(all.size()) - 1; ++i) reserved.insert(all[i]);
+
+    std::vector<Pool> pools;
+    for (const HostNode &node : topology_.nodes) {
+        Pool pool{&node, {}, {}, 0, static_cast<int64_t>(node.memory_mb)};
+        for (int cpu : node.cpus) {
+            if (!reserved.count(cpu)) pool.free.push_back(cpu);
+        }
+        pool.usable = pool.free;
+        if (!pool.usable.empty()) pools.push_back(pool);
+    }
+
+    for (VMConfig &vm : vms) {
+        VMResources &res = vm.resources;
+        res.hugepages = options_.hugepages;
+        if (!options_.pin || pools.empty()) continue;
+        Pool &pool = *std::max_element(pools.begin(), pools.end(), [](const Pool &a, const Pool &b) {
+            if (a.free.size() != b.free.size()) return a.free.size() < b.free.size();
+            return a.memory_left < b.memory_left;
+        });
+        res.cpus.clear();
+        for (int i = 0; i < std::max(1, res.vcpus); ++i) {
+            if (!pool.free.empty()) {
+                res.cpus.push_back(pool.free.front());
+                pool.free.erase(pool.free.begin());
+            } else {
+                res.cpus.push_back(pool.usable[pool.shared_next++ % pool.usable.size()]);
+            }
+        }
+        res.numa_node = topology_.nodes.size() > 1 ? pool.node->id : -1;
+        pool.memory_left -= res.memory_mb;
+    }
+}
+
+int ResourceGovernor::prepare_host(const std::vector<VMConfig> &vms, const std::string &sysfs,
+                                   std::string *error) const {
+    auto fail = [&](const std::string &path) {
+        if (error) *error = "cannot write " + path;
+        return 1;
+    };
+    if (options_.hugepages) {
+        std::map<int, uint64_t> node_pages;
+        uint64_t total_pages = 0;
+        for (const VMConfig &vm : vms) {
+            int memory = std::max(0, vm.resources.memory_mb);
+            uint64_t pages = static_cast<uint64_t>(memory + kHugepageMb - 1) / kHugepageMb;
+            total_pages += pages;
+            if (vm.resources.numa_node >= 0) node_pages[vm.resources.numa_node] += pages;
+        }
+        for (const auto &entry : node_pages) {
+            std::string path = hugepages_file(sysfs + "/devices/system/node/node" + std::to_string(entry.first));
+            if (!reserve_hugepages(path, entry.second)) return fail(path);
+        }
+        std::string path = hugepages_file(sysfs + "/kernel/mm");
+        if (!reserve_hugepages(path, total_pages)) return fail(path);
+    }
+    if (options_.ksm) {
+        std::string path = sysfs + "/kernel/mm/ksm/run";
+        if (!write_value(path, "1")) return fail(path);
+    }
+    return 0;
+}
+
+bool ResourceGovernor::admit(const VMConfig &vm, std::string *reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (admitted_.count(vm.vm_name)) return true;
+    auto refuse = [&](const std::string &why) {
+        if (reason) *reason = why;
+        return false;
+    };
+
+    uint64_t memory = static_cast<uint64_t>(std::max(0, vm.resources.memory_mb));
+    bool check_memory = options_.reserve_mb >= 0;
+    bool check_cpu = options_.max_cpu_busy < 1.0;
+    if (check_memory || check_cpu) {
+        HostLoad load = probe_();
+        if (check_memory) {
+            uint64_t reserve = static_cast<uint64_t>(options_.reserve_mb);
+            uint64_t total = topology_.memory_mb();
+            double budget = total > reserve ? static_cast<double>(total - reserve) * options_.memory_overcommit : 0;
+            if (static_cast<double>(committed_mb_ + memory) > budget) {
+                return refuse("guest RAM budget exhausted (" + std::to_string(committed_mb_) + " of " +
+                              std::to_string(static_cast<uint64_t>(budget)) + " MB committed)");
+            }
+            if (load.available_mb < reserve) {
+                return refuse("only " + std::to_string(load.available_mb) + " MB of host RAM available");
+            }
+        }
+        if (check_cpu && load.cpu_busy > options_.max_cpu_busy) {
+            return refuse("host CPUs " + std::to_string(static_cast<int>(std::lround(load.cpu_busy * 100))) +
+                          "% busy");
+        }
+    }
+    admitted_[vm.vm_name] = static_cast<int>(memory);
+    committed_mb_ += memory;
+    return true;
+}
+
+void ResourceGovernor::release(const VMConfig &vm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = admitted_.find(vm.vm_name);
+    if (it == admitted_.end()) return;
+    committed_mb_ -= static_cast<uint64_t>(it->second);
+    admitted_.erase(it);
+}
+
+uint64_t ResourceGovernor::committed_mb() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return committed_mb_;
+}
+
+} // namespace safebox
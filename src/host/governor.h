@@ -0,0 +1,109 @@
+#pragma once
+
+#include "safebox.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+struct HostNode {
+    int id = 0;
+    std::vector<int> cpus;
+    uint64_t memory_mb = 0;
+};
+
+// NUMA layout from sysfs (devices/system/node/node*/{cpulist,meminfo}); a
+// host without NUMA information is one node holding every online CPU.
+struct HostTopology {
+    std::vector<HostNode> nodes;
+    size_t cpu_count() const;
+    uint64_t memory_mb() const;
+};
+
+bool read_host_topology(HostTopology &topology, const std::string &sysfs = "/sys");
+
+// What admission control looks at before a VM starts.
+struct HostLoad {
+    uint64_t available_mb = 0;  // MemAvailable
+    double cpu_busy = 0;        // share of CPU time not idle, 0..1
+};
+
+// Samples /proc/meminfo and /proc/stat; cpu_busy covers the time since the
+// previous sample (since boot on the first).
+class HostProbe {
+public:
+    explicit HostProbe(std::string proc = "/proc") : proc_(std::move(proc)) {}
+    HostLoad sample();
+
+private:
+    std::string proc_;
+    uint64_t last_busy_ = 0;
+    uint64_t last_total_ = 0;
+    double last_cpu_busy_ = 0;
+};
+
+struct GovernorOptions {
+    // Dedicated cores per VM, taken from one NUMA node, with guest memory
+    // bound to that node. Once every core is handed out, VMs share cores
+    // round robin, still within their node.
+    bool pin = false;
+    // Lowest-numbered cores kept off VM placement for the host itself
+    // (emulator threads, ssh, scp, report writing).
+    int host_cpus = 1;
+    // Guest RAM on hugepages; prepare_host reserves enough on every node.
+    bool hugepages = false;
+    // Turns on KSM so clones of one golden image share identical pages.
+    // KSM does not merge hugepages, so the two only mix across VMs.
+    bool ksm = false;
+    // Admission control: a VM only starts while committed guest RAM plus
+    // its own stays within (total RAM - reserve_mb) * memory_overcommit, at
+    // least reserve_mb is still actually available, and the host's CPUs are
+    // less than max_cpu_busy busy. reserve_mb < 0 turns the RAM checks off.
+    int reserve_mb = -1;
+    double memory_overcommit = 1.0;
+    double max_cpu_busy = 1.0;
+};
+
+// Owns VM placement on the host and decides whether another VM may start.
+// place() and prepare_host() run once before the pool starts; admit() and
+// release() bracket every powered-on period of a VM and are thread-safe.
+class ResourceGovernor {
+public:
+    using ProbeFn = std::function<HostLoad()>;
+
+    // probe defaults to a HostProbe on /proc.
+    ResourceGovernor(GovernorOptions options, HostTopology topology, ProbeFn probe = nullptr);
+
+    const GovernorOptions &options() const { return options_; }
+
+    // Fills in every VM's resources.cpus / numa_node / hugepages: VMs go to
+    // the node with the most unassigned cores (then the most memory left).
+    void place(std::vector<VMConfig> &vms) const;
+
+    // Host-wide setup for placed VMs: hugepages reserved per node (only
+    // ever raised) and KSM switched on. Returns 0, or 1 if a sysfs write
+    // failed (error says which).
+    int prepare_host(const std::vector<VMConfig> &vms, const std::string &sysfs = "/sys",
+                     std::string *error = nullptr) const;
+
+    // True if vm may power on now, and counts its memory as committed until
+    // release(); reason says why not otherwise. Admitting a VM that is
+    // already admitted is a no-op.
+    bool admit(const VMConfig &vm, std::string *reason = nullptr);
+    void release(const VMConfig &vm);
+    uint64_t committed_mb();
+
+private:
+    GovernorOptions options_;
+    HostTopology topology_;
+    ProbeFn probe_;
+    std::mutex mutex_;
+    std::map<std::string, int> admitted_;
+    uint64_t committed_mb_ = 0;
+};
+
+} // namespace safebox
@@ -0,0 +1,242 @@
+#include "hash_index.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace safebox {
+
+namespace {
+
+constexpr char kMagic[4] = {'S', 'B', 'H', 'I'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeader = 24;
+constexpr size_t kFanout = 65536;
+constexpr size_t kRecord = 36;
+constexpr size_t kRecordsAt = kHeader + kFanout * 4;
+
+uint32_t get_u32(const uint8_t *p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t get_u64(const uint8_t *p) {
+    return uint64_t(get_u32(p)) | uint64_t(get_u32(p + 4)) << 32;
+}
+
+void put_u32(std::string &out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(char(v >> (8 * i)));
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parse_digest(const std::string &hex, uint8_t *digest) {
+    if (hex.size() != 64) return false;
+    for (size_t i = 0; i < 32; ++i) {
+        int hi = hex_value(hex[2 * i]), lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        digest[i] = uint8_t(hi << 4 | lo);
+    }
+    return true;
+}
+
+} // namespace
+
+HashIndex::~HashIndex() {
+    close();
+}
+
+void HashIndex::close() {
+    if (base_) munmap(const_cast<uint8_t *>(base_), length_);
+    base_ = records_ = label_table_ = nullptr;
+    length_ = count_ = 0;
+    labels_ = 0;
+}
+
+bool HashIndex::open(const std::string &path, std::string *error) {
+    close();
+    auto fail = [&](const std::string &why) {
+        if (error) *error = path + ": " + why;
+        close();
+        return false;
+    };
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fail(std::strerror(errno));
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < kRecordsAt) {
+        ::close(fd);
+        return fail("not a hash index");
+    }
+    void *map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return fail(std::strerror(errno));
+    base_ = static_cast<const uint8_t *>(map);
+    length_ = size_t(st.st_size);
+    // Lookups touch a fanout entry and a few records; readahead would only
+    // pull in pages nobody asked for.
+    madvise(map, length_, MADV_RANDOM);
+
+    if (std::memcmp(base_, kMagic, 4) != 0) return fail("not a hash index");
+    if (get_u32(base_ + 4) != kVersion) return fail("unsupported hash index version");
+    uint64_t count = get_u64(base_ + 8);
+    labels_ = get_u32(base_ + 16);
+    if (count > (length_ - kRecordsAt) / kRecord) return fail("truncated hash index");
+    count_ = size_t(count);
+    if (get_u32(base_ + kHeader + (kFanout - 1) * 4) != count_) return fail("corrupt fanout table");
+    records_ = base_ + kRecordsAt;
+    label_table_ = records_ + count_ * kRecord;
+    size_t rest = length_ - size_t(label_table_ - base_);
+    if (labels_ == 0 || rest / 4 < size_t(labels_) + 1) return fail("truncated label table");
+    size_t strings = rest - (size_t(labels_) + 1) * 4;
+    if (get_u32(label_table_ + size_t(labels_) * 4) > strings) return fail("truncated label table");
+    return true;
+}
+
+bool HashIndex::lookup(const std::string &sha256, std::string *label) const {
+    uint8_t digest[32];
+    if (!base_ || !parse_digest(sha256, digest)) return false;
+    size_t prefix = size_t(digest[0]) << 8 | digest[1];
+    const uint8_t *fanout = base_ + kHeader;
+    size_t lo = prefix ? get_u32(fanout + (prefix - 1) * 4) : 0;
+    size_t hi = get_u32(fanout + prefix * 4);
+    if (hi > count_ || lo > hi) return false;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const uint8_t *rec = records_ + mid * kRecord;
+        int cmp = std::memcmp(rec, digest, 32);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            if (label) {
+                label->clear();
+                uint32_t id = get_u32(rec + 32);
+                if (id < labels_) {
+                    const uint8_t *offsets = label_table_;
+                    const uint8_t *strings = label_table_ + (size_t(labels_) + 1) * 4;
+                    uint32_t begin = get_u32(offsets + id * 4), end = get_u32(offsets + (id + 1) * 4);
+                    if (begin <= end && end <= get_u32(offsets + size_t(labels_) * 4)) {
+                        label->assign(reinterpret_cast<const char *>(strings + begin), end - begin);
+                    }
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool build_hash_index(std::istream &in, const std::string &path, size_t *count, std::string *error) {
+    struct Entry {
+        std::array<uint8_t, 32> digest;
+        uint32_t label;
+    };
+    std::vector<Entry> entries;
+    std::vector<std::string> labels{""};
+    std::map<std::string, uint32_t> label_ids{{"", 0}};
+
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(in, line)) {
+        ++lineno;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) continue;
+        size_t end = line.find_first_of(" \t\r", begin);
+        std::string hex = line.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        std::string label;
+        if (end != std::string::npos) {
+            size_t lb = line.find_first_not_of(" \t\r", end);
+            size_t le = line.find_last_not_of(" \t\r");
+            if (lb != std::string::npos) label = line.substr(lb, le - lb + 1);
+        }
+        Entry e{};
+        if (!parse_digest(hex, e.digest.data())) {
+            if (error) *error = "line " + std::to_string(lineno) + ": not a SHA-256: " + hex;
+            return false;
+        }
+        auto it = label_ids.emplace(label, uint32_t(labels.size())).first;
+        if (it->second == labels.size()) labels.push_back(label);
+        e.label = it->second;
+        entries.push_back(e);
+    }
+
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) { return a.digest < b.digest; });
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](const Entry &a, const Entry &b) { return a.digest == b.digest; }),
+                  entries.end());
+
+    std::string head(kMagic, 4);
+    put_u32(head, kVersion);
+    put_u32(head, uint32_t(entries.size()));
+    put_u32(head, uint32_t(uint64_t(entries.size()) >> 32));
+    put_u32(head, uint32_t(labels.size()));
+    put_u32(head, 0);
+    std::vector<uint32_t> fanout(kFanout, 0);
+    for (const Entry &e : entries) ++fanout[size_t(e.digest[0]) << 8 | e.digest[1]];
+    for (size_t i = 1; i < kFanout; ++i) fanout[i] += fanout[i - 1];
+    for (uint32_t v : fanout) put_u32(head, v);
+
+    static std::atomic<unsigned> seq{0};
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq++);
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(head.data(), std::streamsize(head.size()));
+        std::string rec;
+        for (const Entry &e : entries) {
+            rec.assign(reinterpret_cast<const char *>(e.digest.data()), 32);
+            put_u32(rec, e.label);
+            out.write(rec.data(), std::streamsize(rec.size()));
+        }
+        std::string table;
+        uint32_t offset = 0;
+        for (const std::string &l : labels) {
+            put_u32(table, offset);
+            offset += uint32_t(l.size());
+        }
+        put_u32(table, offset);
+        for (const std::string &l : labels) table += l;
+        out.write(table.data(), std::streamsize(table.size()));
+        if (!out.flush()) {
+            if (error) *error = "cannot write " + tmp;
+            std::filesystem::remove(tmp);
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        if (error) *error = "cannot replace " + path + ": " + ec.message();
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    if (count) *count = entries.size();
+    return true;
+}
+
+Verdict known_hash_verdict(const std::string &label) {
+    Verdict v;
+    v.detections.push_back("Hash match: " + (label.empty() ? std::string("known malware") : label));
+    v.score = 100;
+    assign_threat_level(v);
+    return v;
+}
+
+} // namespace safebox
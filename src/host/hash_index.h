@@ -0,0 +1,55 @@
+#pragma once
+
+#include "report.h"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+namespace safebox {
+
+// Read-only index of known-malware SHA-256 hashes, built offline with
+// build_hash_index and mapped at startup, so opening it costs nothing and
+// millions of hashes take page cache rather than heap. Layout (SBHI v1,
+// integers little-endian):
+//   "SBHI" u32 version, u64 count, u32 label_count, u32 0
+//   u32 fanout[65536]     records whose first two digest bytes are <= i
+//   count x {u8 digest[32], u32 label}, sorted by digest
+//   u32 offsets[label_count + 1], then the label bytes they point into
+// sandbox/hash_index.py reads and writes the same files.
+class HashIndex {
+public:
+    HashIndex() = default;
+    ~HashIndex();
+    HashIndex(const HashIndex &) = delete;
+    HashIndex &operator=(const HashIndex &) = delete;
+
+    bool open(const std::string &path, std::string *error = nullptr);
+    void close();
+    bool is_open() const { return base_ != nullptr; }
+    size_t size() const { return count_; }
+
+    // True if the hex digest (either case) is in the index; *label gets the
+    // entry's label, which may be empty.
+    bool lookup(const std::string &sha256, std::string *label = nullptr) const;
+
+private:
+    const uint8_t *base_ = nullptr;
+    size_t length_ = 0;
+    size_t count_ = 0;
+    uint32_t labels_ = 0;
+    const uint8_t *records_ = nullptr;
+    const uint8_t *label_table_ = nullptr;
+};
+
+// Builds an index at path from "<sha256> [label]" lines ('#' starts a
+// comment). A hash listed twice keeps its first label. The file is replaced
+// atomically. Returns false with *error on a malformed line or I/O failure.
+bool build_hash_index(std::istream &in, const std::string &path, size_t *count = nullptr,
+                      std::string *error = nullptr);
+
+// The verdict for a sample found in the index, scored like
+// MalwareDetector.analyze_file_hash.
+Verdict known_hash_verdict(const std::string &label);
+
+} // namespace safebox
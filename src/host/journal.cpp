@@ -0,0 +1,292 @@
+#include "journal.h"
+#include "manifest.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+bool write_all(int fd, const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+Json record(const std::string &op, uint64_t seq = 0) {
+    Json r = Json::object();
+    r["op"] = Json(op);
+    if (seq) r["seq"] = Json(static_cast<double>(seq));
+    return r;
+}
+
+std::string line(const Json &r) {
+    return dump_json(r) + "\n";
+}
+
+// Job::submitted is a steady_clock time, which means nothing to the next
+// process; the file holds it as Unix seconds.
+double wall_seconds(std::chrono::steady_clock::time_point t) {
+    auto wall = std::chrono::system_clock::now() -
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - t);
+    return std::chrono::duration<double>(wall.time_since_epoch()).count();
+}
+
+std::chrono::steady_clock::time_point steady_time(double wall_seconds) {
+    auto since = std::chrono::system_clock::now().time_since_epoch() - std::chrono::duration<double>(wall_seconds);
+    // A clock stepped back since: no later than now.
+    if (since.count() < 0) since = std::chrono::system_clock::duration::zero();
+    return std::chrono::steady_clock::now() -
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(since);
+}
+
+} // namespace
+
+Json journal_job_json(const Job &job) {
+    Json entry = Json::object();
+    entry["file"] = Json(job.file_path);
+    entry["report_dir"] = Json(job.report_dir);
+    if (!job.id.empty()) entry["id"] = Json(job.id);
+    if (job.timeout > 0) entry["timeout"] = Json(job.timeout);
+    if (!job.backend.empty()) entry["backend"] = Json(job.backend);
+    Json tags = Json::array();
+    for (const std::string &tag : job.tags) tags.push_back(Json(tag));
+    entry["tags"] = tags;
+    entry["retries"] = Json(job.retries);
+    entry["attempt"] = Json(job.attempt);
+    if (!job.sha256.empty()) entry["sha256"] = Json(job.sha256);
+    if (!job.triage.is_null()) entry["triage"] = job.triage;
+    if (!job.tier.empty()) entry["tier"] = Json(job.tier);
+    entry["priority"] = Json(priority_name(job.priority));
+    if (!job.tenant.empty()) entry["tenant"] = Json(job.tenant);
+    if (job.deadline > 0) entry["deadline"] = Json(job.deadline);
+    if (job.submitted != std::chrono::steady_clock::time_point()) entry["submitted"] = Json(wall_seconds(job.submitted));
+    return entry;
+}
+
+bool parse_journal_job(const Json &entry, Job &job, std::string *error) {
+    if (!parse_job_entry(entry, job, error)) return false;
+    job.report_dir = entry.string_or("report_dir", "");
+    if (job.report_dir.empty()) {
+        if (error) *error = "missing \"report_dir\"";
+        return false;
+    }
+    job.attempt = static_cast<int>(entry.number_or("attempt", 0));
+    job.sha256 = entry.string_or("sha256", "");
+    if (const Json *triage = entry.find("triage")) job.triage = *triage;
+    job.tier = entry.string_or("tier", "");
+    double submitted = entry.number_or("submitted", 0);
+    if (submitted > 0) job.submitted = steady_time(submitted);
+    return true;
+}
+
+bool JobJournal::open(std::string *error) {
+    auto fail = [&](const std::string &what) {
+        if (error) *error = what + " " + path_ + ": " + std::strerror(errno);
+        return false;
+    };
+    close();
+    recovered_ = JournalState();
+    std::map<uint64_t, Job> pending;
+    std::map<uint64_t, std::string> &interrupted = recovered_.interrupted;
+
+    std::ifstream in(path_);
+    std::string text;
+    while (std::getline(in, text)) {
+        if (text.empty()) continue;
+        Json r;
+        if (!parse_json(text, r) || !r.is_object()) {
+            ++recovered_.skipped;
+            continue;
+        }
+        std::string op = r.string_or("op", "");
+        uint64_t seq = static_cast<uint64_t>(r.number_or("seq", 0));
+        next_seq_ = std::max(next_seq_, seq + 1);
+        if (op == "submit") {
+            Job job;
+            const Json *entry = r.find("job");
+            if (!seq || !entry || !parse_journal_job(*entry, job)) {
+                ++recovered_.skipped;
+                continue;
+            }
+            job.journal_seq = seq;
+            recovered_.jobs.insert(job_key(job));
+            interrupted.erase(seq);
+            pending[seq] = std::move(job);
+        } else if ((op == "dispatch" || op == "phase") && pending.count(seq)) {
+            interrupted[seq] = r.string_or("phase", "");
+        } else if (op == "done") {
+            pending.erase(seq);
+            interrupted.erase(seq);
+            recovered_.jobs.insert(r.string_or("key", ""));
+        } else if (op == "vm") {
+            recovered_.vms[r.string_or("vm", "")] = {r.string_or("stage", ""), r.string_or("host", "")};
+        } else if (op == "drained") {
+            int skipped = recovered_.skipped;
+            recovered_ = JournalState();
+            recovered_.skipped = skipped;
+            pending.clear();
+        }
+    }
+    in.close();
+    for (auto &entry : pending) recovered_.pending.push_back(entry.second);
+
+    // Compact to the state just replayed, so the file only grows with the
+    // current run.
+    std::string snapshot;
+    for (const auto &vm : recovered_.vms) {
+        Json r = record("vm");
+        r["vm"] = Json(vm.first);
+        r["stage"] = Json(vm.second.stage);
+        if (!vm.second.host.empty()) r["host"] = Json(vm.second.host);
+        snapshot += line(r);
+    }
+    std::set<std::string> finished = recovered_.jobs;
+    for (const Job &job : recovered_.pending) {
+        finished.erase(job_key(job));
+        Json r = record("submit", job.journal_seq);
+        r["job"] = journal_job_json(job);
+        snapshot += line(r);
+        auto it = interrupted.find(job.journal_seq);
+        if (it == interrupted.end()) continue;
+        Json d = record(it->second.empty() ? "dispatch" : "phase", job.journal_seq);
+        if (!it->second.empty()) d["phase"] = Json(it->second);
+        snapshot += line(d);
+    }
+    for (const std::string &key : finished) {
+        Json r = record("done");
+        r["key"] = Json(key);
+        snapshot += line(r);
+    }
+
+    std::filesystem::path dir = std::filesystem::path(path_).parent_path();
+    std::error_code ec;
+    if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+    std::string tmp = path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return fail("cannot create");
+    bool written = write_all(fd, snapshot) && fsync(fd) == 0;
+    ::close(fd);
+    if (!written || rename(tmp.c_str(), path_.c_str()) != 0) return fail("cannot write");
+    // Make the rename itself durable.
+    int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd_ < 0) return fail("cannot open");
+    closing_ = false;
+    thread_ = std::thread(&JobJournal::writer, this);
+    return true;
+}
+
+void JobJournal::close() {
+    if (fd_ < 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void JobJournal::submitted(Job &job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (job.journal_seq == 0) job.journal_seq = next_seq_++;
+    }
+    Json r = record("submit", job.journal_seq);
+    r["job"] = journal_job_json(job);
+    append(std::move(r));
+}
+
+void JobJournal::dispatched(const Job &job, const std::string &vm) {
+    Json r = record("dispatch", job.journal_seq);
+    r["vm"] = Json(vm);
+    append(std::move(r));
+}
+
+void JobJournal::phase(const Job &job, const std::string &phase) {
+    Json r = record("phase", job.journal_seq);
+    r["phase"] = Json(phase);
+    append(std::move(r));
+}
+
+void JobJournal::completed(const Job &job, int rc) {
+    Json r = record("done", job.journal_seq);
+    r["key"] = Json(job_key(job));
+    r["exit_code"] = Json(rc);
+    append(std::move(r));
+}
+
+void JobJournal::vm_stage(const std::string &vm, const std::string &stage, const std::string &host) {
+    Json r = record("vm");
+    r["vm"] = Json(vm);
+    r["stage"] = Json(stage);
+    if (!host.empty()) r["host"] = Json(host);
+    append(std::move(r));
+}
+
+void JobJournal::drained() {
+    append(record("drained"));
+}
+
+void JobJournal::sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t wanted = appended_;
+    while (!synced_cv_.wait_for(lock, std::chrono::seconds(1), [&] { return synced_ >= wanted; })) {
+    }
+}
+
+void JobJournal::append(Json r) {
+    std::string text = line(r);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ < 0 || closing_) return;
+        buffer_ += text;
+        ++appended_;
+    }
+    cv_.notify_one();
+}
+
+void JobJournal::writer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        while (!cv_.wait_for(lock, std::chrono::seconds(1), [this] { return closing_ || !buffer_.empty(); })) {
+        }
+        if (buffer_.empty()) break;
+        std::string batch;
+        batch.swap(buffer_);
+        uint64_t upto = appended_;
+        lock.unlock();
+        if (batch_hook_) batch_hook_();
+        // Whatever is appended meanwhile goes out with the next fdatasync.
+        if (!write_all(fd_, batch) || fdatasync(fd_) != 0) {
+            std::cerr << "[journal] cannot write " << path_ << ": " << std::strerror(errno) << std::endl;
+        }
+        lock.lock();
+        synced_ = upto;
+        synced_cv_.notify_all();
+    }
+    synced_ = appended_;
+    synced_cv_.notify_all();
+}
+
+} // namespace safebox
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "pool.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace safebox {
+
+// What an interrupted pool left behind, as replayed by JobJournal::open().
+struct JournalState {
+    // Jobs that were queued or running, in submission order, each with its
+    // journal_seq.
+    std::vector<Job> pending;
+    // Of those, the ones a VM had taken, and the phase they last finished.
+    std::map<uint64_t, std::string> interrupted;
+    // Keys (id, else report_dir) of every job, pending or finished, since
+    // the last clean drain.
+    std::set<std::string> jobs;
+    // Last recorded stage of each VM ("ready", "busy", "parked", ...) and,
+    // once ready, the address it was reached at.
+    struct VmState {
+        std::string stage;
+        std::string host;
+    };
+    std::map<std::string, VmState> vms;
+    // Torn records at the end of the file, from a crash mid-write.
+    int skipped = 0;
+};
+
+// Append-only journal of a pool's jobs and VMs, so a host process that dies
+// mid-run can be restarted without losing work or re-warming the pool.
+//
+// One JSON record per line: {"op": "submit", "seq": n, "job": {...}} when a
+// job is queued (again, on a retry or escalation), "dispatch" with the VM
+// that takes it, "phase" as it finishes inject, agent, artifacts and report,
+// "done" once its job.json is written, "vm" on every VM stage change, and
+// "drained" after a clean shutdown, which makes everything before it moot.
+//
+// Records are queued in memory and written by one thread, which fsyncs once
+// per batch: whatever arrived while the previous fsync ran goes out with the
+// next, so a burst costs one disk flush, not one per record. A crash can
+// lose only the batch in flight. open() replays the file and compacts it to
+// the records that still matter.
+class JobJournal {
+public:
+    explicit JobJournal(std::string path) : path_(std::move(path)) {}
+    ~JobJournal() { close(); }
+
+    bool open(std::string *error = nullptr);
+    void close();
+
+    // As the file said at open().
+    const JournalState &recovered() const { return recovered_; }
+
+    // Numbers job on first submission (journal_seq), then records it.
+    void submitted(Job &job);
+    void dispatched(const Job &job, const std::string &vm);
+    void phase(const Job &job, const std::string &phase);
+    void completed(const Job &job, int rc);
+    void vm_stage(const std::string &vm, const std::string &stage, const std::string &host = "");
+    // Every job finished and every VM was left clean.
+    void drained();
+
+    // Waits until every record appended so far is on disk.
+    void sync();
+    // Runs on the writer thread before each batch goes out; tests stall it
+    // to widen the window a crash can fall into. Set before open().
+    void set_batch_hook(std::function<void()> hook) { batch_hook_ = std::move(hook); }
+
+private:
+    void append(Json record);
+    void writer();
+
+    std::string path_;
+    JournalState recovered_;
+    int fd_ = -1;
+    std::thread thread_;
+    std::function<void()> batch_hook_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable synced_cv_;
+    std::string buffer_;
+    uint64_t appended_ = 0;
+    uint64_t synced_ = 0;
+    uint64_t next_seq_ = 1;
+    bool closing_ = false;
+};
+
+// A job as the journal records it: its manifest entry (parse_job_entry)
+// plus report_dir and what the pool learned about it since, and when it
+// was first submitted, so its deadline holds across a restart.
+Json journal_job_json(const Job &job);
+bool parse_journal_job(const Json &entry, Job &job, std::string *error = nullptr);
+
+} // namespace safebox
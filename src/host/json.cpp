@@ -0,0 +1,419 @@
+#include "json.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace safebox {
+
+Json Json::array() {
+    Json j;
+    j.type_ = Type::Array;
+    return j;
+}
+
+Json Json::object() {
+    Json j;
+    j.type_ = Type::Object;
+    return j;
+}
+
+void Json::push_back(Json value) {
+    if (type_ == Type::Null) type_ = Type::Array;
+    items_.push_back(std::move(value));
+}
+
+const Json *Json::find(const std::string &key) const {
+    if (type_ != Type::Object) return nullptr;
+    for (const auto &member : members_) {
+        if (member.first == key) return &member.second;
+    }
+    return nullptr;
+}
+
+Json &Json::operator[](const std::string &key) {
+    if (type_ == Type::Null) type_ = Type::Object;
+    for (auto &member : members_) {
+        if (member.first == key) return member.second;
+    }
+    members_.emplace_back(key, Json());
+    return members_.back().second;
+}
+
+bool Json::erase(const std::string &key) {
+    for (auto it = members_.begin(); it != members_.end(); ++it) {
+        if (it->first == key) {
+            members_.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Json::string_or(const std::string &key, const std::string &fallback) const {
+    const Json *v = find(key);
+    return v && v->is_string() ? v->as_string() : fallback;
+}
+
+double Json::number_or(const std::string &key, double fallback) const {
+    const Json *v = find(key);
+    return v && v->is_number() ? v->as_number() : fallback;
+}
+
+namespace {
+
+void append_utf8(std::string &s, unsigned cp) {
+    if (cp < 0x80) {
+        s += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        s += static_cast<char>(0xC0 | (cp >> 6));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        s += static_cast<char>(0xE0 | (cp >> 12));
+        s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        s += static_cast<char>(0xF0 | (cp >> 18));
+        s += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        s += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Recursive-descent tokenizer behind both parse_json and parse_json_events.
+// Strings are decoded into one reused buffer, so a document of many small
+// records costs no allocation per key once the buffer has grown.
+class Parser {
+public:
+    Parser(const std::string &text, JsonHandler &handler) : text_(text), handler_(handler) {}
+
+    bool parse(std::string *error) {
+        bool ok = value(0);
+        if (ok) {
+            skip_ws();
+            if (pos_ != text_.size()) ok = fail("trailing characters");
+        }
+        if (!ok && error) *error = error_ + " at offset " + std::to_string(pos_);
+        return ok;
+    }
+
+private:
+    static constexpr int kMaxDepth = 256;
+
+    bool fail(const char *msg) {
+        if (error_.empty()) error_ = msg;
+        return false;
+    }
+
+    bool emit(bool handler_ok) { return handler_ok || fail("stopped by handler"); }
+
+    void skip_ws() {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            ++pos_;
+        }
+    }
+
+    bool literal(const char *word) {
+        size_t n = std::char_traits<char>::length(word);
+        if (text_.compare(pos_, n, word) != 0) return fail("invalid literal");
+        pos_ += n;
+        return true;
+    }
+
+    bool value(int depth) {
+        if (depth > kMaxDepth) return fail("nesting too deep");
+        skip_ws();
+        if (pos_ >= text_.size()) return fail("unexpected end of input");
+        char c = text_[pos_];
+        switch (c) {
+        case '{': return object(depth);
+        case '[': return array(depth);
+        case '"': return string(scratch_) && emit(handler_.string_value(scratch_));
+        case 't': return literal("true") && emit(handler_.bool_value(true));
+        case 'f': return literal("false") && emit(handler_.bool_value(false));
+        case 'n': return literal("null") && emit(handler_.null_value());
+        default: return number();
+        }
+    }
+
+    bool object(int depth) {
+        if (!emit(handler_.begin_object())) return false;
+        ++pos_;
+        skip_ws();
+        if (pos_ < text_.size() && text_[pos_] == '}') {
+            ++pos_;
+            return emit(handler_.end_object());
+        }
+        for (;;) {
+            skip_ws();
+            if (pos_ >= text_.size() || text_[pos_] != '"') return fail("expected object key");
+            if (!string(scratch_) || !emit(handler_.key(scratch_))) return false;
+            skip_ws();
+            if (pos_ >= text_.size() || text_[pos_] != ':') return fail("expected ':'");
+            ++pos_;
+            if (!value(depth + 1)) return false;
+            skip_ws();
+            if (pos_ >= text_.size()) return fail("unterminated object");
+            if (text_[pos_] == ',') {
+                ++pos_;
+                continue;
+            }
+            if (text_[pos_] == '}') {
+                ++pos_;
+                return emit(handler_.end_object());
+            }
+            return fail("expected ',' or '}'");
+        }
+    }
+
+    bool array(int depth) {
+        if (!emit(handler_.begin_array())) return false;
+        ++pos_;
+        skip_ws();
+        if (pos_ < text_.size() && text_[pos_] == ']') {
+            ++pos_;
+            return emit(handler_.end_array());
+        }
+        for (;;) {
+            if (!value(depth + 1)) return false;
+            skip_ws();
+            if (pos_ >= text_.size()) return fail("unterminated array");
+            if (text_[pos_] == ',') {
+                ++pos_;
+                continue;
+            }
+            if (text_[pos_] == ']') {
+                ++pos_;
+                return emit(handler_.end_array());
+            }
+            return fail("expected ',' or ']'");
+        }
+    }
+
+    bool hex4(unsigned &out) {
+        if (pos_ + 4 > text_.size()) return fail("truncated \\u escape");
+        out = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text_[pos_++];
+            out <<= 4;
+            if (c >= '0' && c <= '9') out |= static_cast<unsigned>(c - '0');
+            else if (c >= 'a' && c <= 'f') out |= static_cast<unsigned>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') out |= static_cast<unsigned>(c - 'A' + 10);
+            else return fail("invalid \\u escape");
+        }
+        return true;
+    }
+
+    bool string(std::string &out) {
+        out.clear();
+        ++pos_;
+        for (;;) {
+            size_t start = pos_;
+            while (pos_ < text_.size() && text_[pos_] != '"' && text_[pos_] != '\\') ++pos_;
+            out.append(text_, start, pos_ - start);
+            if (pos_ >= text_.size()) return fail("unterminated string");
+            if (text_[pos_] == '"') {
+                ++pos_;
+                return true;
+            }
+            ++pos_;
+            if (pos_ >= text_.size()) return fail("unterminated string");
+            char esc = text_[pos_++];
+            switch (esc) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned cp = 0;
+                if (!hex4(cp)) return false;
+                if (cp >= 0xDC00 && cp <= 0xDFFF) return fail("unpaired surrogate");
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (text_.compare(pos_, 2, "\\u") != 0) return fail("unpaired surrogate");
+                    pos_ += 2;
+                    unsigned low = 0;
+                    if (!hex4(low)) return false;
+                    if (low < 0xDC00 || low > 0xDFFF) return fail("unpaired surrogate");
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: return fail("invalid escape");
+            }
+        }
+    }
+
+    bool digits() {
+        size_t start = pos_;
+        while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') ++pos_;
+        return pos_ > start;
+    }
+
+    // Checks the JSON number grammar before strtod, which would also take
+    // NaN, inf, hex, a leading '+' and leading zeros.
+    bool number() {
+        size_t start = pos_;
+        if (text_[pos_] == '-') ++pos_;
+        if (pos_ >= text_.size() || text_[pos_] < '0' || text_[pos_] > '9') {
+            return fail(pos_ == start ? "unexpected character" : "invalid number");
+        }
+        if (text_[pos_] == '0') ++pos_;
+        else digits();
+        if (pos_ < text_.size() && text_[pos_] == '.') {
+            ++pos_;
+            if (!digits()) return fail("invalid number");
+        }
+        if (pos_ < text_.size() && (text_[pos_] == 'e' || text_[pos_] == 'E')) {
+            ++pos_;
+            if (pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-')) ++pos_;
+            if (!digits()) return fail("invalid number");
+        }
+        const char *begin = text_.c_str() + start;
+        char *end = nullptr;
+        double v = std::strtod(begin, &end);
+        // "0x1p3" matches the grammar only up to the leading "0".
+        if (end != text_.c_str() + pos_) return fail("invalid number");
+        return emit(handler_.number_value(v));
+    }
+
+    const std::string &text_;
+    JsonHandler &handler_;
+    size_t pos_ = 0;
+    std::string scratch_;
+    std::string error_;
+};
+
+void dump_string(const std::string &s, std::string &out) {
+    out += '"';
+    for (char ch : s) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += ch;
+            }
+        }
+    }
+    out += '"';
+}
+
+void dump_number(double v, std::string &out) {
+    if (!std::isfinite(v)) {
+        out += "null";
+        return;
+    }
+    char buf[32];
+    if (v == std::floor(v) && std::fabs(v) < 1e15) {
+        std::snprintf(buf, sizeof(buf), "%.0f", v);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%.17g", v);
+    }
+    out += buf;
+}
+
+void dump(const Json &v, int indent, int level, std::string &out) {
+    auto newline = [&](int lvl) {
+        if (indent < 0) return;
+        out += '\n';
+        out.append(static_cast<size_t>(indent * lvl), ' ');
+    };
+    switch (v.type()) {
+    case Json::Type::Null: out += "null"; break;
+    case Json::Type::Bool: out += v.as_bool() ? "true" : "false"; break;
+    case Json::Type::Number: dump_number(v.as_number(), out); break;
+    case Json::Type::String: dump_string(v.as_string(), out); break;
+    case Json::Type::Array:
+        out += '[';
+        for (size_t i = 0; i < v.items().size(); ++i) {
+            if (i) out += ',';
+            newline(level + 1);
+            dump(v.items()[i], indent, level + 1, out);
+        }
+        if (!v.items().empty()) newline(level);
+        out += ']';
+        break;
+    case Json::Type::Object:
+        out += '{';
+        for (size_t i = 0; i < v.members().size(); ++i) {
+            if (i) out += ',';
+            newline(level + 1);
+            dump_string(v.members()[i].first, out);
+            out += indent < 0 ? ":" : ": ";
+            dump(v.members()[i].second, indent, level + 1, out);
+        }
+        if (!v.members().empty()) newline(level);
+        out += '}';
+        break;
+    }
+}
+
+} // namespace
+
+bool JsonBuilder::insert(Json value) {
+    if (stack_.empty()) {
+        root_ = std::move(value);
+        stack_.push_back(&root_);
+        return true;
+    }
+    Json &parent = *stack_.back();
+    if (parent.is_array()) {
+        parent.push_back(std::move(value));
+        stack_.push_back(&parent.items_.back());
+    } else {
+        Json &slot = parent[key_];
+        slot = std::move(value);
+        stack_.push_back(&slot);
+    }
+    return true;
+}
+
+bool JsonBuilder::scalar(Json value) {
+    insert(std::move(value));
+    stack_.pop_back();
+    return true;
+}
+
+bool JsonBuilder::end_container() {
+    stack_.pop_back();
+    return true;
+}
+
+void JsonBuilder::reset() {
+    root_ = Json();
+    stack_.clear();
+    key_.clear();
+}
+
+bool parse_json_events(const std::string &text, JsonHandler &handler, std::string *error) {
+    Parser parser(text, handler);
+    return parser.parse(error);
+}
+
+bool parse_json(const std::string &text, Json &out, std::string *error) {
+    JsonBuilder builder;
+    if (!parse_json_events(text, builder, error)) return false;
+    out = std::move(builder.root());
+    return true;
+}
+
+std::string dump_json(const Json &value, int indent) {
+    std::string out;
+    dump(value, indent, 0, out);
+    return out;
+}
+
+} // namespace safebox
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace safebox {
+
+// Minimal JSON document type for agent reports and host-side files.
+// Objects keep their keys in insertion order so re-serialized reports read
+// the same as the agent's originals.
+class Json {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Json() = default;
+    Json(bool value) : type_(Type::Bool), bool_(value) {}
+    Json(double value) : type_(Type::Number), number_(value) {}
+    Json(int value) : type_(Type::Number), number_(value) {}
+    Json(long long value) : type_(Type::Number), number_(static_cast<double>(value)) {}
+    Json(const char *value) : type_(Type::String), string_(value) {}
+    Json(std::string value) : type_(Type::String), string_(std::move(value)) {}
+
+    static Json array();
+    static Json object();
+
+    Type type() const { return type_; }
+    bool is_null() const { return type_ == Type::Null; }
+    bool is_number() const { return type_ == Type::Number; }
+    bool is_string() const { return type_ == Type::String; }
+    bool is_array() const { return type_ == Type::Array; }
+    bool is_object() const { return type_ == Type::Object; }
+
+    bool as_bool() const { return bool_; }
+    double as_number() const { return number_; }
+    const std::string &as_string() const { return string_; }
+
+    const std::vector<Json> &items() const { return items_; }
+    const std::vector<std::pair<std::string, Json>> &members() const { return members_; }
+    void push_back(Json value);
+
+    // Object access. find() returns nullptr for missing keys or non-objects;
+    // operator[] turns a null value into an object and inserts the key.
+    const Json *find(const std::string &key) const;
+    Json &operator[](const std::string &key);
+    bool erase(const std::string &key);
+
+    std::string string_or(const std::string &key, const std::string &fallback) const;
+    double number_or(const std::string &key, double fallback) const;
+
+private:
+    friend class JsonBuilder;
+
+    Type type_ = Type::Null;
+    bool bool_ = false;
+    double number_ = 0;
+    std::string string_;
+    std::vector<Json> items_;
+    std::vector<std::pair<std::string, Json>> members_;
+};
+
+// Parses one JSON value; trailing whitespace is allowed, anything else is an
+// error. On failure returns false and, if given, fills error.
+bool parse_json(const std::string &text, Json &out, std::string *error = nullptr);
+
+// Streaming (SAX) interface: parse_json_events reports every token to the
+// handler instead of building a document, so a large report can be reduced
+// to what the caller needs as it is read. String arguments are only valid
+// during the call. Returning false from a callback stops the parse, which
+// then fails with "stopped by handler".
+class JsonHandler {
+public:
+    virtual ~JsonHandler() = default;
+    virtual bool null_value() = 0;
+    virtual bool bool_value(bool value) = 0;
+    virtual bool number_value(double value) = 0;
+    virtual bool string_value(const std::string &value) = 0;
+    virtual bool begin_object() = 0;
+    virtual bool key(const std::string &name) = 0;
+    virtual bool end_object() = 0;
+    virtual bool begin_array() = 0;
+    virtual bool end_array() = 0;
+};
+
+bool parse_json_events(const std::string &text, JsonHandler &handler, std::string *error = nullptr);
+
+// Handler that builds a Json document (what parse_json uses). Handlers
+// that only want some subtrees as documents can forward those events to
+// one and take root() when the subtree closes.
+class JsonBuilder : public JsonHandler {
+public:
+    bool null_value() override { return scalar(Json()); }
+    bool bool_value(bool value) override { return scalar(Json(value)); }
+    bool number_value(double value) override { return scalar(Json(value)); }
+    bool string_value(const std::string &value) override { return scalar(Json(value)); }
+    bool begin_object() override { return insert(Json::object()); }
+    bool key(const std::string &name) override {
+        key_ = name;
+        return true;
+    }
+    bool end_object() override { return end_container(); }
+    bool begin_array() override { return insert(Json::array()); }
+    bool end_array() override { return end_container(); }
+
+    // True once the outermost value is complete.
+    bool done() const { return stack_.empty(); }
+    Json &root() { return root_; }
+    void reset();
+
+private:
+    bool insert(Json value);
+    bool scalar(Json value);
+    bool end_container();
+
+    Json root_;
+    std::vector<Json*> stack_;
+    std::string key_;
+};
+
+// indent < 0 writes the compact form, otherwise pretty-prints with that many
+// spaces per level.
+std::string dump_json(const Json &value, int indent = -1);
+
+} // namespace safebox
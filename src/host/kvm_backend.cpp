@@ -0,0 +1,127 @@
+#include "kvm_backend.h"
+#include <filesystem>
+#include <sstream>
+
+namespace safebox {
+
+namespace {
+
+int create_overlay(const CloneSpec &spec) {
+    std::filesystem::create_directories(spec.overlay_dir);
+    return execute_command({"qemu-img", "create", "-q", "-f", "qcow2", "-F", "qcow2",
+                            "-b", spec.base_image, overlay_path(spec)}).return_code;
+}
+
+} // namespace
+
+int KvmBackend::start(const std::string &vm_name) {
+    if (hot_) {
+        return execute_command({"virsh", "snapshot-revert", vm_name, "hot", "--running", "--force"}).return_code;
+    }
+    return execute_command({"virsh", "start", vm_name}).return_code;
+}
+
+int KvmBackend::destroy(const std::string &vm_name) {
+    int rc = execute_command({"virsh", "destroy", vm_name}).return_code;
+    if (rc == 0) return 0;
+    // virsh fails on a domain that is off already; that one is destroyed.
+    CommandResult state = execute_command({"virsh", "domstate", vm_name});
+    return state.return_code == 0 && state.stdout.find("shut off") != std::string::npos ? 0 : rc;
+}
+
+int KvmBackend::revert(const std::string &vm_name) {
+    int rc = destroy(vm_name);
+    // start() restores the hot snapshot, disk and memory together.
+    if (rc != 0 || hot_) return rc;
+    return execute_command({"virsh", "snapshot-revert", vm_name, "clean"}).return_code;
+}
+
+int KvmBackend::clone(const CloneSpec &spec) {
+    int rc = create_overlay(spec);
+    if (rc != 0) return rc;
+    // --preserve-data makes virt-clone point the new domain at our
+    // overlay instead of copying the golden disk.
+    return execute_command({"virt-clone", "--original", spec.golden, "--name", spec.clone_name,
+                            "--file", overlay_path(spec), "--preserve-data"}).return_code;
+}
+
+int KvmBackend::reset_clone(const CloneSpec &spec) {
+    destroy(spec.clone_name);
+    return create_overlay(spec);
+}
+
+int KvmBackend::delete_clone(const CloneSpec &spec) {
+    destroy(spec.clone_name);
+    int rc = execute_command({"virsh", "undefine", spec.clone_name}).return_code;
+    std::error_code ec;
+    std::filesystem::remove(overlay_path(spec), ec);
+    return rc;
+}
+
+int KvmBackend::configure(const std::string &vm_name, const VMResources &res) {
+    std::vector<Argv> steps;
+    if (res.resize) {
+        std::string vcpus = std::to_string(res.vcpus), memory = std::to_string(res.memory_mb) + "M";
+        steps.push_back({"virsh", "setvcpus", vm_name, vcpus, "--config", "--maximum"});
+        steps.push_back({"virsh", "setvcpus", vm_name, vcpus, "--config"});
+        steps.push_back({"virsh", "setmaxmem", vm_name, memory, "--config"});
+        steps.push_back({"virsh", "setmem", vm_name, memory, "--config"});
+    }
+    for (size_t i = 0; i < res.cpus.size(); ++i) {
+        steps.push_back({"virsh", "vcpupin", vm_name, std::to_string(i), std::to_string(res.cpus[i]), "--config"});
+    }
+    // QEMU's own threads (I/O, migration) stay next to the vCPUs they serve.
+    if (!res.cpus.empty()) {
+        steps.push_back({"virsh", "emulatorpin", vm_name, format_cpu_list(res.cpus), "--config"});
+    }
+    if (res.numa_node >= 0) {
+        steps.push_back({"virsh", "numatune", vm_name, "--mode", "strict", "--nodeset",
+                         std::to_string(res.numa_node), "--config"});
+    }
+    if (res.hugepages) steps.push_back({"virt-xml", vm_name, "--edit", "--memorybacking", "hugepages=on"});
+    for (const Argv &argv : steps) {
+        int rc = execute_command(argv).return_code;
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+int KvmBackend::snapshot(const std::string &vm_name, const SshSession &) {
+    if (!hot_) return 1;
+    execute_command({"virsh", "snapshot-delete", vm_name, "hot"});
+    return execute_command({"virsh", "snapshot-create-as", vm_name, "hot",
+                            "--description", "safebox running state", "--atomic"}).return_code;
+}
+
+std::string KvmBackend::guest_address(const std::string &vm_name) {
+    CommandResult res = execute_command({"virsh", "domifaddr", vm_name, "--source", "lease"});
+    if (res.return_code != 0) return "";
+
+    //  Name       MAC address          Protocol     Address
+    //  vnet0      52:54:00:6b:3c:58    ipv4         192.168.122.45/24
+    std::istringstream lines(res.stdout);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string iface, mac, proto, addr;
+        if (fields >> iface >> mac >> proto >> addr && proto == "ipv4") {
+            return addr.substr(0, addr.find('/'));
+        }
+    }
+    return "";
+}
+
+int KvmBackend::inject(const std::string &vm_name, const SshSession &session,
+                       const std::string &local_path, std::string &remote_path) {
+    std::error_code ec;
+    if (std::filesystem::is_directory(share_dir(vm_name), ec)) {
+        std::string name = share_file(vm_name, local_path);
+        if (!name.empty()) {
+            remote_path = std::string(kGuestShareMount) + "/" + name;
+            return 0;
+        }
+    }
+    return copy_in(session, local_path, remote_path);
+}
+
+} // namespace safebox
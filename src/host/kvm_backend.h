@@ -0,0 +1,49 @@
+#pragma once
+
+#include "backend.h"
+
+namespace safebox {
+
+// KVM guests managed through virsh. Cold starts boot from the "clean"
+// snapshot; the hot variant resumes the running-state snapshot "hot" with
+// `virsh snapshot-revert --running`. Linked clones are qcow2 overlays on the
+// golden's disk, defined with virt-clone.
+class KvmBackend : public Backend {
+public:
+    explicit KvmBackend(bool hot) : hot_(hot) {}
+
+    int start(const std::string &vm_name) override;
+    int revert(const std::string &vm_name) override;
+
+    int clone(const CloneSpec &spec) override;
+    int reset_clone(const CloneSpec &spec) override;
+    int delete_clone(const CloneSpec &spec) override;
+
+    // Edits the persistent domain definition: virsh setvcpus/setmem,
+    // vcpupin and emulatorpin, numatune --mode strict, and virt-xml for
+    // <memoryBacking><hugepages/>. A hot snapshot keeps the definition it
+    // was captured with, so capture it after configuring.
+    int configure(const std::string &vm_name, const VMResources &resources) override;
+
+    bool hot() const override { return hot_; }
+    int snapshot(const std::string &vm_name, const SshSession &session) override;
+
+    // The guest's IPv4 address from its libvirt DHCP lease.
+    std::string guest_address(const std::string &vm_name) override;
+
+    // Shares through a virtiofs <filesystem> in the domain XML whose source
+    // is share_dir(vm_name); used only when that directory exists, since
+    // libvirt cannot hotplug the device itself.
+    int inject(const std::string &vm_name, const SshSession &session,
+               const std::string &local_path, std::string &remote_path) override;
+
+protected:
+    // Hard power-off; a domain that is shut off already counts as destroyed,
+    // so revert() works on parked VMs too.
+    virtual int destroy(const std::string &vm_name);
+
+private:
+    bool hot_;
+};
+
+} // namespace safebox
@@ -0,0 +1,96 @@
+#include "libvirt_backend.h"
+#include <iostream>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+
+namespace safebox {
+
+namespace {
+
+struct Domain {
+    virDomainPtr ptr;
+    ~Domain() {
+        if (ptr) virDomainFree(ptr);
+    }
+};
+
+} // namespace
+
+LibvirtBackend::LibvirtBackend(bool hot, const std::string &uri) : KvmBackend(hot) {
+    conn_ = virConnectOpen(uri.c_str());
+    if (!conn_) {
+        set_error();
+        std::cerr << "[libvirt] cannot connect to " << uri << ": " << last_error_ << std::endl;
+    }
+}
+
+LibvirtBackend::~LibvirtBackend() {
+    if (conn_) virConnectClose(conn_);
+}
+
+void LibvirtBackend::set_error() {
+    const char *msg = virGetLastErrorMessage();
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_error_ = msg ? msg : "unknown libvirt error";
+}
+
+std::string LibvirtBackend::last_error() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_error_;
+}
+
+int LibvirtBackend::start(const std::string &vm_name) {
+    if (!conn_) return 1;
+    if (hot()) return revert_to(vm_name, "hot", true);
+    Domain dom{virDomainLookupByName(conn_, vm_name.c_str())};
+    if (!dom.ptr || virDomainCreate(dom.ptr) != 0) {
+        set_error();
+        std::cerr << "[libvirt] start " << vm_name << ": " << last_error() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int LibvirtBackend::revert(const std::string &vm_name) {
+    if (destroy(vm_name) != 0) {
+        std::cerr << "[libvirt] destroy " << vm_name << ": " << last_error() << std::endl;
+        return 1;
+    }
+    if (hot()) return 0;
+    return revert_to(vm_name, "clean", false);
+}
+
+int LibvirtBackend::destroy(const std::string &vm_name) {
+    if (!conn_) return 1;
+    Domain dom{virDomainLookupByName(conn_, vm_name.c_str())};
+    if (dom.ptr && virDomainDestroy(dom.ptr) == 0) return 0;
+    // Already shut off (a parked VM, or one a crashed pool left off).
+    virErrorPtr err = virGetLastError();
+    if (dom.ptr && err && err->code == VIR_ERR_OPERATION_INVALID) return 0;
+    set_error();
+    return 1;
+}
+
+int LibvirtBackend::revert_to(const std::string &vm_name, const std::string &snapshot, bool running) {
+    if (!conn_) return 1;
+    Domain dom{virDomainLookupByName(conn_, vm_name.c_str())};
+    if (!dom.ptr) {
+        set_error();
+        return 1;
+    }
+    virDomainSnapshotPtr snap = virDomainSnapshotLookupByName(dom.ptr, snapshot.c_str(), 0);
+    if (!snap) {
+        set_error();
+        return 1;
+    }
+    unsigned int flags = running ? (VIR_DOMAIN_SNAPSHOT_REVERT_RUNNING | VIR_DOMAIN_SNAPSHOT_REVERT_FORCE) : 0;
+    int rc = virDomainRevertToSnapshot(snap, flags);
+    if (rc != 0) {
+        set_error();
+        std::cerr << "[libvirt] revert " << vm_name << " to " << snapshot << ": " << last_error() << std::endl;
+    }
+    virDomainSnapshotFree(snap);
+    return rc == 0 ? 0 : 1;
+}
+
+} // namespace safebox
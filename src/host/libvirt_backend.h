@@ -0,0 +1,47 @@
+#pragma once
+
+#include "kvm_backend.h"
+#include <mutex>
+#include <string>
+
+struct _virConnect;
+struct _virDomain;
+
+namespace safebox {
+
+// Drives KVM guests through the libvirt C API over one persistent
+// connection instead of spawning virsh (and opening a new connection) per
+// call. Every call it makes is synchronous (virDomainDestroy returns once
+// the domain is off), so there is no state to poll for. Cloning, snapshot
+// capture and address lookup are inherited from the virsh-based
+// KvmBackend. Only built when libvirt is found (SAFEBOX_WITH_LIBVIRT).
+class LibvirtBackend : public KvmBackend {
+public:
+    explicit LibvirtBackend(bool hot, const std::string &uri = "qemu:///system");
+    ~LibvirtBackend();
+
+    LibvirtBackend(const LibvirtBackend&) = delete;
+    LibvirtBackend &operator=(const LibvirtBackend&) = delete;
+
+    bool connected() const { return conn_ != nullptr; }
+
+    // Return 0 on success, 1 otherwise; last_error() has libvirt's message.
+    int start(const std::string &vm_name) override;
+    int revert(const std::string &vm_name) override;
+
+    std::string last_error();
+
+protected:
+    int destroy(const std::string &vm_name) override;
+
+private:
+    int revert_to(const std::string &vm_name, const std::string &snapshot, bool running);
+    void set_error();
+
+    _virConnect *conn_ = nullptr;
+
+    std::mutex mutex_;
+    std::string last_error_;
+};
+
+} // namespace safebox
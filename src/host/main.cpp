@@ -1,22 +1,151 @@
 #include "safebox.h"
+#include "journal.h"
+#include "manifest.h"
+#include "pool.h"
+#include "sha256.h"
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
 
 using namespace safebox;
 
-int main(int argc, char** argv) {
-    if (argc < 7) {
-        std::cerr << "Usage: safebox-host --backend <virtualbox|kvm> --vm-name <name> --file <path> --user <vmuser> [--ssh-port <port>]" << std::endl;
-        return 1;
+static void print_usage() {
+    std::cerr << "Usage: safebox-host --backend <backend> --vm-name <name> --file <path> --user <vmuser> [--ssh-host <addr>] [--ssh-port <port>] [--ready-channel <socket>]" << std::endl;
+    std::cerr << "       safebox-host --capture-hot-snapshot --backend <backend>-hot --vm-name <name> --user <vmuser> [--ssh-host <addr>] [--ssh-port <port>]" << std::endl;
+    std::cerr << "       safebox-host --serve --backend <backend> --vm [<backend>=]<name>:<ssh-port>[:<ready-channel>] [--vm ...] --user <vmuser> [--ssh-host <addr>]" << std::endl;
+    std::cerr << "       safebox-host --serve --backend <virtualbox|kvm> --clone-from <golden> --clones <n> --user <vmuser>" << std::endl;
+    std::cerr << "                    [--base-image <qcow2>] [--overlay-dir <dir>] [--ssh-port <first-port>]" << std::endl;
+    std::cerr << "       (serve mode reads one sample path or manifest entry per line from stdin, or the jobs of --manifest <jobs.jsonl>;" << std::endl;
+    std::cerr << "        entries may set \"priority\" (interactive, normal, batch), \"tenant\" and a start \"deadline\" in seconds," << std::endl;
+    std::cerr << "        --aging <s> lifts a waiting job one priority class every <s> seconds, default 600," << std::endl;
+    std::cerr << "        --retries <n> re-runs failed jobs, each job reports into ./reports/<job-id>/," << std::endl;
+    std::cerr << "        --threads <n> sizes the pool's blocking-step threads, default 4," << std::endl;
+    std::cerr << "        --min-standby <n> [--max-standby <n>] keeps only as many VMs booted as demand calls for," << std::endl;
+    std::cerr << "        --metrics-port <port> [--metrics-addr <ip>] serves Prometheus /metrics," << std::endl;
+    std::cerr << "        --events-socket <path> streams VM and job state changes to local subscribers (web/live_state.py)," << std::endl;
+    std::cerr << "        --vcpus <n> --memory <MB> resize every VM, --pin-cpus [--host-cpus <n>] gives each VM dedicated cores" << std::endl;
+    std::cerr << "        and binds its memory to their NUMA node, --hugepages backs guest RAM with 2 MiB pages, --ksm shares" << std::endl;
+    std::cerr << "        identical pages across clones, --host-reserve <MB> [--memory-overcommit <x>] [--max-cpu-load <0-1>]" << std::endl;
+    std::cerr << "        only starts VMs while the host has RAM and CPU to spare," << std::endl;
+    std::cerr << "        --stop-score <n> ends a run once its live verdict reaches <n>, --idle-timeout <s> once the" << std::endl;
+    std::cerr << "        sample has done nothing for <s> seconds; either way the VM is reverted at once," << std::endl;
+    std::cerr << "        --escalate-score <n> with --static-triage runs samples scoring below <n> on the container VMs" << std::endl;
+    std::cerr << "        (--vm container=<name>:0) first and only those whose run there reaches <n> on a full VM)" << std::endl;
+    std::cerr << "       safebox-host --score <report.json|.sbr>   (prints the report's summary and resource verdict)" << std::endl;
+    std::cerr << "       safebox-host --export-json <report.sbr>   (prints a binary report as JSON)" << std::endl;
+    std::cerr << "--report-format binary writes compact report-<time>.sbr files instead of JSON" << std::endl;
+    std::cerr << "Finished reports are cached by sample SHA-256 in --cache-dir (default /var/lib/safebox/cache); --no-cache skips it" << std::endl;
+    std::cerr << "--artifact-store <dir> brings back everything the agent left in the guest (logs, dropped files) as one" << std::endl;
+    std::cerr << "zstd tar per job into <report-dir>/artifacts, each distinct file stored once in <dir>" << std::endl;
+    std::cerr << "--journal <path> records every job and VM transition (fsynced in batches); a serve restarted on the same" << std::endl;
+    std::cerr << "journal queues the interrupted jobs again, skips jobs it already has and takes over still-ready VMs" << std::endl;
+    std::cerr << "--hash-index <known.sbhi> answers samples with a known-malware hash without a VM;" << std::endl;
+    std::cerr << "--static-triage checks each sample's type, entropy and strings first; known and non-executable samples skip the VM" << std::endl;
+    std::cerr << "       safebox-host --triage <file>   (prints the static triage of a sample)" << std::endl;
+    std::cerr << "       safebox-host --build-hash-index <hashes.txt> <known.sbhi>   (\"<sha256> [label]\" per line)" << std::endl;
+    std::cerr << "Backends: kvm, virtualbox, libvirt, firecracker, each also as <backend>-hot, and container" << std::endl;
+    std::cerr << "(a cgroup v2 + namespaces sandbox on the host under /sys/fs/cgroup/safebox, no VM; --serve only)" << std::endl;
+    std::cerr << "Samples are shared into the guest from <share-root>/<vm> when the backend supports it" << std::endl;
+    std::cerr << "(--share-root, default /var/lib/safebox/shares), and copied with scp otherwise." << std::endl;
+}
+
+// Cold-boots the VM from its clean snapshot and saves the ready guest as the
+// "hot" snapshot the *-hot backends resume from.
+static int capture(Backend &backend, const VMConfig &vm) {
+    Backend *cold = find_backend(vm.backend.substr(0, vm.backend.size() - 4));
+    if (!cold || cold->start(vm.vm_name) != 0) return 3;
+
+    SshSession session = open_ssh_session(vm.vm_user + "@" + vm.ssh_host, vm.ssh_port);
+    if (!wait_for_guest(vm, session, 120)) {
+        std::cerr << "SSH did not become available within timeout." << std::endl;
+        return 5;
+    }
+    int rc = capture_hot_snapshot(backend, vm.vm_name, session);
+    close_ssh_session(session);
+    if (rc != 0) {
+        std::cerr << "Failed to capture hot snapshot." << std::endl;
+        return 9;
+    }
+    backend.revert(vm.vm_name);
+    std::cout << "Hot snapshot captured for " << vm.vm_name << std::endl;
+    return 0;
+}
+
+// Serve mode: keep every --vm warm and feed them the manifest's jobs, or
+// sample paths from stdin until EOF, then wait for the in-flight jobs.
+static int serve(const std::vector<VMConfig> &vms, const std::vector<Job> &manifest_jobs,
+                 bool from_stdin, PoolOptions options) {
+    VMPool pool(vms, options);
+    pool.start();
+
+    for (const Job &job : manifest_jobs) pool.submit(job);
+    std::string line;
+    int n = 0;
+    while (from_stdin && std::getline(std::cin, line)) {
+        if (line.empty()) continue;
+        Job job;
+        ++n;
+        // A JSON manifest entry, e.g. the web UI's "priority": "interactive".
+        if (line[0] == '{') {
+            Json entry;
+            std::string error;
+            if (!parse_json(line, entry, &error) || !parse_job_entry(entry, job, &error)) {
+                std::cerr << "Ignoring job " << n << ": " << error << std::endl;
+                continue;
+            }
+        } else {
+            job.file_path = line;
+        }
+        if (job.id.empty()) {
+            job.id = std::to_string(n) + "-" + std::filesystem::path(job.file_path).filename().string();
+        }
+        job.report_dir = job_report_dir("./reports", job.id);
+        pool.submit(job);
     }
+    pool.drain();
+
+    std::cout << "Pool finished: " << pool.completed() << " completed, "
+              << pool.failed() << " failed" << std::endl;
+    return pool.failed() == 0 ? 0 : 8;
+}
 
+int main(int argc, char** argv) {
     std::string backend;
     std::string vm_name;
     std::string file_path;
     std::string vm_user = "safebox";
+    std::string ssh_host = "127.0.0.1";
     int ssh_port = 2222;
+    bool serve_mode = false;
+    bool capture_mode = false;
+    std::vector<std::string> pool_vms;
+    std::string ready_channel;
+    std::string clone_from;
+    int clones = 0;
+    std::string base_image;
+    std::string overlay_dir = "/var/lib/safebox/overlays";
+    std::string share_root;
+    std::string manifest;
+    PoolOptions pool_options;
+    std::string cache_dir = "/var/lib/safebox/cache";
+    std::string artifact_dir;
+    std::string journal_path;
+    int metrics_port = 0;
+    std::string events_socket;
+    GovernorOptions governor_options;
+    int vm_vcpus = 0;
+    int vm_memory = 0;
+    std::string metrics_addr = "127.0.0.1";
+    std::string score_path;
+    std::string export_path;
+    std::string hash_index_path;
+    std::string hash_list_path;
+    std::string triage_path;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -24,50 +153,356 @@ int main(int argc, char** argv) {
         else if (arg == "--vm-name") vm_name = argv[++i];
         else if (arg == "--file") file_path = argv[++i];
         else if (arg == "--user") vm_user = argv[++i];
+        else if (arg == "--ssh-host") ssh_host = argv[++i];
         else if (arg == "--ssh-port") ssh_port = std::stoi(argv[++i]);
+        else if (arg == "--serve") serve_mode = true;
+        else if (arg == "--capture-hot-snapshot") capture_mode = true;
+        else if (arg == "--vm") pool_vms.push_back(argv[++i]);
+        else if (arg == "--ready-channel") ready_channel = argv[++i];
+        else if (arg == "--clone-from") clone_from = argv[++i];
+        else if (arg == "--clones") clones = std::stoi(argv[++i]);
+        else if (arg == "--base-image") base_image = argv[++i];
+        else if (arg == "--overlay-dir") overlay_dir = argv[++i];
+        else if (arg == "--share-root") share_root = argv[++i];
+        else if (arg == "--manifest") {
+            manifest = argv[++i];
+            serve_mode = true;
+        }
+        else if (arg == "--retries") pool_options.retries = std::stoi(argv[++i]);
+        else if (arg == "--threads") pool_options.threads = std::stoi(argv[++i]);
+        else if (arg == "--min-standby") pool_options.min_standby = std::stoi(argv[++i]);
+        else if (arg == "--max-standby") pool_options.max_standby = std::stoi(argv[++i]);
+        else if (arg == "--cache-dir") cache_dir = argv[++i];
+        else if (arg == "--no-cache") cache_dir.clear();
+        else if (arg == "--artifact-store") artifact_dir = argv[++i];
+        else if (arg == "--journal") journal_path = argv[++i];
+        else if (arg == "--metrics-port") metrics_port = std::stoi(argv[++i]);
+        else if (arg == "--vcpus") vm_vcpus = std::stoi(argv[++i]);
+        else if (arg == "--memory") vm_memory = std::stoi(argv[++i]);
+        else if (arg == "--pin-cpus") governor_options.pin = true;
+        else if (arg == "--host-cpus") governor_options.host_cpus = std::stoi(argv[++i]);
+        else if (arg == "--hugepages") governor_options.hugepages = true;
+        else if (arg == "--ksm") governor_options.ksm = true;
+        else if (arg == "--host-reserve") governor_options.reserve_mb = std::stoi(argv[++i]);
+        else if (arg == "--memory-overcommit") governor_options.memory_overcommit = std::stod(argv[++i]);
+        else if (arg == "--max-cpu-load") governor_options.max_cpu_busy = std::stod(argv[++i]);
+        else if (arg == "--metrics-addr") metrics_addr = argv[++i];
+        else if (arg == "--events-socket") events_socket = argv[++i];
+        else if (arg == "--score") score_path = argv[++i];
+        else if (arg == "--export-json") export_path = argv[++i];
+        else if (arg == "--hash-index") hash_index_path = argv[++i];
+        else if (arg == "--static-triage") pool_options.static_triage = true;
+        else if (arg == "--aging") pool_options.aging = std::stoi(argv[++i]);
+        else if (arg == "--stop-score") pool_options.stop_score = std::stoi(argv[++i]);
+        else if (arg == "--idle-timeout") pool_options.idle_timeout = std::stoi(argv[++i]);
+        else if (arg == "--escalate-score") pool_options.escalate_score = std::stoi(argv[++i]);
+        else if (arg == "--triage") triage_path = argv[++i];
+        else if (arg == "--build-hash-index" && i + 2 < argc) {
+            hash_list_path = argv[++i];
+            hash_index_path = argv[++i];
+        }
+        else if (arg == "--report-format") {
+            if (!parse_report_format(argv[++i], pool_options.report_format)) {
+                std::cerr << "Unknown report format " << argv[i] << " (json or binary)." << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!hash_list_path.empty()) {
+        std::ifstream in(hash_list_path);
+        size_t count = 0;
+        std::string error;
+        if (!in || !build_hash_index(in, hash_index_path, &count, &error)) {
+            std::cerr << "Cannot build hash index from " << hash_list_path << ": "
+                      << (in ? error : "cannot open") << std::endl;
+            return 1;
+        }
+        std::cout << count << " hashes written to " << hash_index_path << std::endl;
+        return 0;
+    }
+
+    if (!export_path.empty()) {
+        std::ifstream in(export_path, std::ios::binary);
+        std::ostringstream data;
+        data << in.rdbuf();
+        Json report;
+        std::string error;
+        if (!in || !decode_binary_report(data.str(), report, &error)) {
+            std::cerr << "Cannot read report " << export_path << ": " << (in ? error : "cannot open") << std::endl;
+            return 1;
+        }
+        std::cout << dump_json(report, 2) << std::endl;
+        return 0;
+    }
+
+    if (!score_path.empty()) {
+        AgentReport report;
+        std::string error;
+        if (!load_agent_report(score_path, report, &error)) {
+            std::cerr << "Cannot read report " << score_path << ": " << error << std::endl;
+            return 1;
+        }
+        ReportSummary summary = summarize_report(report);
+        Json out = Json::object();
+        out["summary"] = summary_json(summary);
+        out["verdict"] = verdict_json(score_report(summary));
+        std::cout << dump_json(out, 2) << std::endl;
+        return 0;
+    }
+
+    if (!serve_mode && triage_path.empty() && argc < 7) {
+        print_usage();
+        return 1;
+    }
+
+    // Resolved once here; every VM operation below dispatches through it.
+    Backend *vm_backend = backend.empty() ? nullptr : find_backend(backend);
+    if (!backend.empty() && !vm_backend) {
+        std::cerr << "Unknown backend " << backend << "." << std::endl;
+        return 2;
+    }
+    if (vm_backend && !share_root.empty()) vm_backend->set_share_root(share_root);
+    ResultCache cache(cache_dir);
+    if (!cache_dir.empty()) pool_options.cache = &cache;
+    ArtifactStore artifacts(artifact_dir);
+    if (!artifact_dir.empty()) pool_options.artifacts = &artifacts;
+    HashIndex hash_index;
+    if (!hash_index_path.empty()) {
+        std::string error;
+        if (!hash_index.open(hash_index_path, &error)) {
+            std::cerr << "Cannot open hash index " << error << std::endl;
+            return 2;
+        }
+        pool_options.hash_index = &hash_index;
+    }
+
+    if (!triage_path.empty()) {
+        TriageOptions options;
+        options.hash_index = pool_options.hash_index;
+        TriageResult result;
+        std::string error;
+        if (!triage_file(triage_path, options, result, &error)) {
+            std::cerr << "Cannot triage " << error << std::endl;
+            return 1;
+        }
+        std::cout << dump_json(triage_json(result), 2) << std::endl;
+        return 0;
+    }
+
+    if (serve_mode) {
+        if (backend.empty() || (pool_vms.empty() && clones <= 0)) {
+            std::cerr << "Missing required args." << std::endl;
+            return 2;
+        }
+        if (clones > 0 && (clone_from.empty() || (backend == "kvm" && base_image.empty()))) {
+            std::cerr << "--clones needs --clone-from (and --base-image for kvm)." << std::endl;
+            return 2;
+        }
+        std::vector<VMConfig> vms;
+        for (int n = 0; n < clones; ++n) {
+            CloneSpec spec{clone_from, clone_from + "-clone-" + std::to_string(n),
+                           base_image, overlay_dir, ssh_port + n};
+            VMConfig vm{backend, spec.clone_name, "", vm_user, ssh_port + n};
+            // kvm clones get their own DHCP lease on the golden's network,
+            // virtualbox clones a NAT forward of their own on loopback.
+            if (backend == "kvm") {
+                vm.ssh_host = "";
+                vm.ssh_port = 22;
+            }
+            vm.clone = spec;
+            vms.push_back(vm);
+        }
+        for (std::string spec : pool_vms) {
+            std::string vm_backend_name = backend;
+            size_t eq = spec.find('=');
+            if (eq != std::string::npos) {
+                vm_backend_name = spec.substr(0, eq);
+                spec = spec.substr(eq + 1);
+            }
+            size_t colon = spec.find(':');
+            if (colon == std::string::npos || !find_backend(vm_backend_name)) {
+                std::cerr << "Invalid --vm " << spec << ", expected [<backend>=]<name>:<ssh-port>[:<ready-channel>]" << std::endl;
+                return 2;
+            }
+            if (!share_root.empty()) find_backend(vm_backend_name)->set_share_root(share_root);
+            std::string rest = spec.substr(colon + 1);
+            size_t channel_colon = rest.find(':');
+            std::string channel = channel_colon == std::string::npos ? "" : rest.substr(channel_colon + 1);
+            VMConfig vm{vm_backend_name, spec.substr(0, colon), "", vm_user,
+                        std::stoi(rest.substr(0, channel_colon)), channel, ssh_host};
+            // Containers have no sshd: the pool reaches each by its name
+            // (ContainerBackend::guest_address), which also names its cgroup.
+            if (vm_backend_name == "container") vm.ssh_host = "";
+            vms.push_back(vm);
+        }
+
+        if (pool_options.escalate_score >= 0) {
+            auto container = [](const VMConfig &vm) { return vm.backend == "container"; };
+            if (!pool_options.static_triage || std::none_of(vms.begin(), vms.end(), container) ||
+                std::all_of(vms.begin(), vms.end(), container)) {
+                std::cerr << "--escalate-score needs --static-triage, container VMs and VMs to escalate to." << std::endl;
+                return 2;
+            }
+        }
+
+        std::vector<Job> jobs;
+        if (!manifest.empty()) {
+            std::string error;
+            if (!load_manifest(manifest, "./reports", jobs, &error)) {
+                std::cerr << "Invalid manifest: " << error << std::endl;
+                return 2;
+            }
+            for (const Job &job : jobs) {
+                bool served = job.backend.empty() ||
+                              std::any_of(vms.begin(), vms.end(),
+                                          [&](const VMConfig &vm) { return vm.backend == job.backend; });
+                if (!served) {
+                    std::cerr << "Manifest job " << job.id << " wants backend " << job.backend
+                              << ", which no --vm runs." << std::endl;
+                    return 2;
+                }
+            }
+        }
+        std::unique_ptr<ResourceGovernor> governor;
+        bool governed = vm_vcpus > 0 || vm_memory > 0 || governor_options.pin || governor_options.hugepages ||
+                        governor_options.ksm || governor_options.reserve_mb >= 0 || governor_options.max_cpu_busy < 1.0;
+        if (governed) {
+            for (VMConfig &vm : vms) {
+                if (vm_vcpus > 0) vm.resources.vcpus = vm_vcpus;
+                if (vm_memory > 0) vm.resources.memory_mb = vm_memory;
+                vm.resources.resize = vm_vcpus > 0 || vm_memory > 0;
+            }
+            HostTopology topology;
+            read_host_topology(topology);
+            governor = std::make_unique<ResourceGovernor>(governor_options, topology);
+            governor->place(vms);
+            std::string error;
+            if (governor->prepare_host(vms, "/sys", &error) != 0) {
+                std::cerr << "Cannot prepare the host: " << error << std::endl;
+                return 2;
+            }
+            for (const VMConfig &vm : vms) {
+                if (vm.resources.cpus.empty()) continue;
+                std::cout << "[governor] " << vm.vm_name << ": cores " << format_cpu_list(vm.resources.cpus)
+                          << (vm.resources.numa_node >= 0 ? ", node " + std::to_string(vm.resources.numa_node) : "")
+                          << std::endl;
+            }
+            pool_options.governor = governor.get();
+        }
+        MetricsServer metrics;
+        if (metrics_port > 0 && metrics.start(metrics_addr, metrics_port) != 0) return 2;
+        EventPublisher events;
+        if (!events_socket.empty()) {
+            if (events.start(events_socket) != 0) return 2;
+            pool_options.events = &events;
+        }
+        JobJournal journal(journal_path);
+        if (!journal_path.empty()) {
+            std::string error;
+            if (!journal.open(&error)) {
+                std::cerr << "Cannot open journal: " << error << std::endl;
+                return 2;
+            }
+            if (journal.recovered().skipped > 0) {
+                std::cerr << "Skipped " << journal.recovered().skipped << " torn journal records." << std::endl;
+            }
+            pool_options.journal = &journal;
+        }
+        return serve(vms, jobs, manifest.empty(), pool_options);
+    }
+
+    if (capture_mode) {
+        if (!vm_backend || !vm_backend->hot() || vm_name.empty()) {
+            std::cerr << "--capture-hot-snapshot needs a *-hot --backend and --vm-name." << std::endl;
+            return 2;
+        }
+        return capture(*vm_backend, VMConfig{backend, vm_name, "", vm_user, ssh_port, ready_channel, ssh_host});
     }
 
     if (backend.empty() || vm_name.empty() || file_path.empty()) {
         std::cerr << "Missing required args." << std::endl;
         return 2;
     }
+    // A one-shot run talks to the guest over plain ssh; only the pool runs
+    // commands through a backend's own session, probe and guest_command.
+    if (backend == "container") {
+        std::cerr << "The container backend only runs pool VMs: use --serve --vm container=<name>:0." << std::endl;
+        return 2;
+    }
+
+    VMConfig vm{backend, vm_name, file_path, vm_user, ssh_port, ready_channel, ssh_host};
+
+    // 0) Known malware and resubmitted samples are answered without a VM.
+    std::string sha256;
+    std::string fingerprint = analysis_fingerprint(backend, 120, pool_options.report_format);
+    bool hashed = false;
+    std::string label;
+    if (pool_options.static_triage) {
+        TriageOptions options;
+        options.hash_index = pool_options.hash_index;
+        TriageResult triage;
+        std::string error;
+        if (!triage_file(file_path, options, triage, &error)) {
+            std::cerr << "Cannot triage " << error << std::endl;
+            return 1;
+        }
+        hashed = true;
+        sha256 = triage.sha256;
+        if (triage.decision != "dynamic") {
+            std::cout << "Static triage: " << triage.decision << ", no VM needed" << std::endl;
+            std::cout << dump_json(triage_json(triage, false), 2) << std::endl;
+            return 0;
+        }
+    } else {
+        hashed = (pool_options.cache || pool_options.hash_index) && sha256_file(file_path, sha256);
+    }
+    if (hashed && !pool_options.static_triage && pool_options.hash_index && hash_index.lookup(sha256, &label)) {
+        std::cout << "Known malware " << sha256 << std::endl;
+        std::cout << dump_json(verdict_json(known_hash_verdict(label)), 2) << std::endl;
+        return 0;
+    }
+    if (hashed && pool_options.cache) {
+        std::string cached = cache.fetch(sha256, fingerprint, "./reports");
+        if (!cached.empty()) {
+            std::cout << "Cached report for " << sha256 << " written to " << cached << std::endl;
+            return 0;
+        }
+    }
 
     // 1) Start VM
-    if (start_vm(backend, vm_name) != 0) return 3;
+    PhaseTimes phases(backend);
+    if (vm_backend->start(vm_name) != 0) return 3;
+    phases.lap("boot");
 
     // 2) Wait for SSH
-    std::string ssh_target = vm_user + "@127.0.0.1";
-    std::cout << "Waiting for SSH at 127.0.0.1:" << ssh_port << std::endl;
-    if (!wait_for_ssh(ssh_target, ssh_port, 120)) {
+    SshSession session = open_ssh_session(vm_user + "@" + ssh_host, ssh_port);
+    std::cout << "Waiting for SSH at " << ssh_host << ":" << ssh_port << std::endl;
+    if (!wait_for_guest(vm, session, 120)) {
         std::cerr << "SSH did not become available within timeout." << std::endl;
         return 5;
     }
+    phases.lap("ssh");
     std::cout << "SSH reachable. Copying file to VM..." << std::endl;
 
-    // 3) Copy file to VM
-    std::filesystem::path p(file_path);
-    std::string filename = p.filename();
-    if (copy_file_to_vm(file_path, "/home/" + vm_user + "/incoming/" + filename, ssh_target, ssh_port) != 0) {
-        std::cerr << "SCP failed." << std::endl;
-        return 6;
-    }
-
-    // 4) Trigger agent
-    if (trigger_agent(ssh_target, ssh_port, "/home/" + vm_user + "/incoming/" + filename, 
-                      "/home/" + vm_user + "/out", 120) != 0) {
-        std::cerr << "Failed to trigger agent remotely." << std::endl;
-    }
-
-    // 5) Download reports
-    std::cout << "Downloading reports..." << std::endl;
-    download_reports(ssh_target, ssh_port, "/home/" + vm_user + "/out", "./reports");
+    // 3) Copy file, trigger agent and download reports
+    std::string report;
+    int rc = analyze_in_vm(session, vm, file_path, "./reports", 120, &report, &phases, pool_options.report_format);
+    close_ssh_session(session);
+    if (rc != 0) return rc;
+    if (pool_options.cache && !sha256.empty() && !report.empty()) cache.store(sha256, fingerprint, report);
 
-    // 6) Revert VM
-    if (revert_vm(backend, vm_name) != 0) {
+    // 4) Revert VM
+    phases.mark();
+    if (vm_backend->revert(vm_name) != 0) {
         std::cerr << "Failed to revert VM." << std::endl;
         return 7;
     }
+    phases.lap("revert");
 
+    std::cout << "Phases:";
+    for (const auto &phase : phases.phases()) std::cout << " " << phase.first << " " << phase.second << "s";
+    std::cout << std::endl;
     std::cout << "Analysis finished. Reports (if any) are in ./reports/" << std::endl;
     return 0;
 }
@@ -0,0 +1,80 @@
+#include "manifest.h"
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+namespace safebox {
+
+std::string job_report_dir(const std::string &report_root, const std::string &id) {
+    std::string safe;
+    for (char c : id) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                  c == '.' || c == '_' || c == '-';
+        safe += ok ? c : '_';
+    }
+    if (safe.empty() || safe == "." || safe == "..") safe = "job";
+    return (std::filesystem::path(report_root) / safe).string();
+}
+
+bool parse_job_entry(const Json &entry, Job &job, std::string *error) {
+    auto fail = [&](const std::string &msg) {
+        if (error) *error = msg;
+        return false;
+    };
+    if (!entry.is_object()) return fail("expected an object");
+    job.file_path = entry.string_or("file", "");
+    if (job.file_path.empty()) return fail("missing \"file\"");
+    job.id = entry.string_or("id", "");
+    job.timeout = static_cast<int>(entry.number_or("timeout", 0));
+    job.backend = entry.string_or("backend", "");
+    job.retries = static_cast<int>(entry.number_or("retries", -1));
+    if (const Json *tags = entry.find("tags")) {
+        if (!tags->is_array()) return fail("\"tags\" must be an array");
+        for (const Json &tag : tags->items()) {
+            if (!tag.is_string()) return fail("\"tags\" must be strings");
+            job.tags.push_back(tag.as_string());
+        }
+    }
+    std::string priority = entry.string_or("priority", "normal");
+    if (!parse_priority(priority, job.priority)) return fail("unknown priority " + priority);
+    job.tenant = entry.string_or("tenant", "");
+    job.deadline = static_cast<int>(entry.number_or("deadline", 0));
+    return true;
+}
+
+bool load_manifest(const std::string &path, const std::string &report_root,
+                   std::vector<Job> &jobs, std::string *error) {
+    auto fail = [&](int line_no, const std::string &msg) {
+        if (error) *error = path + ":" + std::to_string(line_no) + ": " + msg;
+        return false;
+    };
+
+    std::ifstream in(path);
+    if (!in) return fail(0, "cannot open manifest");
+
+    std::set<std::string> ids;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        Json entry;
+        std::string parse_error;
+        if (!parse_json(line, entry, &parse_error)) return fail(line_no, parse_error);
+
+        Job job;
+        std::string entry_error;
+        if (!parse_job_entry(entry, job, &entry_error)) return fail(line_no, entry_error);
+        if (job.id.empty()) {
+            job.id = std::to_string(line_no) + "-" + std::filesystem::path(job.file_path).filename().string();
+        }
+        job.report_dir = job_report_dir(report_root, job.id);
+        if (!ids.insert(job.report_dir).second) return fail(line_no, "duplicate id " + job.id);
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+} // namespace safebox
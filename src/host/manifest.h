@@ -0,0 +1,27 @@
+#pragma once
+
+#include "pool.h"
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Reads a batch manifest: one JSON object per line,
+//   {"file": "/samples/a.exe", "timeout": 300, "backend": "kvm-hot",
+//    "tags": ["dropper"], "id": "a", "retries": 2,
+//    "priority": "interactive", "tenant": "web", "deadline": 60}
+// where only "file" is required. Blank lines and lines starting with '#' are
+// skipped. Every job reports into its own report_root/<id>; the id defaults
+// to "<line>-<file name>" and is reduced to [A-Za-z0-9._-].
+// Returns false and sets error (with the line number) on the first bad entry,
+// including two entries that would share a report directory.
+// One manifest entry; job.id stays empty unless the entry has one.
+bool parse_job_entry(const Json &entry, Job &job, std::string *error = nullptr);
+
+bool load_manifest(const std::string &path, const std::string &report_root,
+                   std::vector<Job> &jobs, std::string *error = nullptr);
+
+// report_root/<id> with id made safe to use as a single path component.
+std::string job_report_dir(const std::string &report_root, const std::string &id);
+
+} // namespace safebox
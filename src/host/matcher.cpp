@@ -0,0 +1,382 @@
+#include "matcher.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace safebox {
+
+Matcher::Matcher(bool caseless) : caseless_(caseless) {
+    for (int b = 0; b < 256; ++b) {
+        fold_[b] = uint8_t(caseless && b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b);
+    }
+    compile();
+}
+
+bool Matcher::parse(const std::string &pattern, Pattern &p, std::vector<Chunk> &chunks,
+                    std::string *error) const {
+    auto fail = [&](const std::string &why) {
+        if (error) *error = "unsupported pattern '" + pattern + "': " + why;
+        return false;
+    };
+
+    size_t begin = 0, end = pattern.size();
+    bool anchored_start = false, anchored_end = false;
+    if (begin < end && pattern[begin] == '^') {
+        anchored_start = true;
+        ++begin;
+    }
+    if (end > begin && pattern[end - 1] == '$') {
+        size_t slashes = 0;
+        for (size_t i = end - 1; i > begin && pattern[i - 1] == '\\'; --i) ++slashes;
+        if (slashes % 2 == 0) {
+            anchored_end = true;
+            --end;
+        }
+    }
+
+    Gap gap;
+    gap.open = !anchored_start;
+    Chunk chunk;
+    // Closes the current chunk; its trailing wildcards move into the gap
+    // that follows it.
+    auto close = [&](uint32_t extra_min, bool open) {
+        uint32_t trailing = 0;
+        while (!chunk.bytes.empty() && !chunk.literal.back()) {
+            chunk.bytes.pop_back();
+            chunk.literal.pop_back();
+            ++trailing;
+        }
+        if (chunk.bytes.empty()) {
+            gap.min += trailing + extra_min;
+            gap.open = gap.open || open;
+            return;
+        }
+        uint32_t run = 0;
+        while (run < chunk.literal.size() && chunk.literal[chunk.literal.size() - 1 - run]) ++run;
+        chunk.anchor = run;
+        chunk.before = gap;
+        chunks.push_back(chunk);
+        chunk = Chunk();
+        gap.min = trailing + extra_min;
+        gap.open = open;
+    };
+    auto literal = [&](char c) {
+        chunk.bytes.push_back(char(fold_[uint8_t(c)]));
+        chunk.literal.push_back(1);
+    };
+
+    for (size_t i = begin; i < end; ++i) {
+        char c = pattern[i];
+        if (c == '\\') {
+            if (i + 1 >= end) return fail("trailing backslash");
+            char n = pattern[++i];
+            if (std::isalnum(uint8_t(n)) || n == '\n') return fail(std::string("escape \\") + n);
+            literal(n);
+        } else if (c == '.') {
+            char n = i + 1 < end ? pattern[i + 1] : '\0';
+            if (n == '*' || n == '+') {
+                ++i;
+                close(n == '+' ? 1 : 0, true);
+            } else if (n == '?' || n == '{') {
+                return fail("bounded repetition");
+            } else if (chunk.bytes.empty()) {
+                // Leading wildcards of a chunk belong to the gap before it.
+                ++gap.min;
+            } else {
+                chunk.bytes.push_back('\0');
+                chunk.literal.push_back(0);
+            }
+        } else if (c == '\n' || std::string("[](){}|?*+^$").find(c) != std::string::npos) {
+            return fail(std::string("operator ") + c);
+        } else {
+            literal(c);
+        }
+    }
+    close(0, !anchored_end);
+
+    p.chunks = uint32_t(chunks.size());
+    if (p.chunks == 0) {
+        // The lone gap spans the whole line.
+        p.trail.min = gap.min;
+        p.trail.open = gap.open;
+    } else {
+        p.trail = gap;
+    }
+    p.counts_bytes = p.trail.min > 0;
+    for (const Chunk &ch : chunks) {
+        if (ch.before.min > 0 || ch.literal.find('\0') != std::string::npos) p.counts_bytes = true;
+    }
+    return true;
+}
+
+bool Matcher::add(const std::string &pattern, int id, std::string *error) {
+    Pattern p;
+    std::vector<Chunk> chunks;
+    if (!parse(pattern, p, chunks, error)) return false;
+    p.id = id;
+    p.first_chunk = uint32_t(chunks_.size());
+    chunks_.insert(chunks_.end(), chunks.begin(), chunks.end());
+    patterns_.push_back(p);
+    compiled_ = false;
+    return true;
+}
+
+bool Matcher::counts_bytes(size_t index) const {
+    return index < patterns_.size() && patterns_[index].counts_bytes;
+}
+
+void Matcher::compile() {
+    // Every distinct chunk anchor becomes one atom of the automaton.
+    std::unordered_map<std::string, int32_t> atom_ids;
+    std::vector<std::string> atoms;
+    std::vector<std::vector<Ref>> atom_refs;
+    empty_.clear();
+    window_ = 0;
+    for (uint32_t pi = 0; pi < patterns_.size(); ++pi) {
+        const Pattern &p = patterns_[pi];
+        if (p.chunks == 0) empty_.push_back(pi);
+        for (uint32_t ci = 0; ci < p.chunks; ++ci) {
+            const Chunk &c = chunks_[p.first_chunk + ci];
+            window_ = std::max<size_t>(window_, c.bytes.size() + (p.trail.open ? 0 : p.trail.min));
+            std::string atom = c.bytes.substr(c.bytes.size() - c.anchor);
+            auto it = atom_ids.emplace(atom, int32_t(atoms.size())).first;
+            if (size_t(it->second) == atoms.size()) {
+                atoms.push_back(atom);
+                atom_refs.emplace_back();
+            }
+            atom_refs[it->second].push_back(Ref{pi, ci});
+        }
+    }
+
+    ref_begin_.assign(1, 0);
+    refs_.clear();
+    for (const auto &r : atom_refs) {
+        refs_.insert(refs_.end(), r.begin(), r.end());
+        ref_begin_.push_back(uint32_t(refs_.size()));
+    }
+
+    // Bytes that occur in no atom share class 0.
+    uint16_t cls_of[256] = {};
+    classes_ = 1;
+    for (const std::string &a : atoms) {
+        for (char ch : a) {
+            uint8_t b = uint8_t(ch);
+            if (!cls_of[b]) cls_of[b] = uint16_t(classes_++);
+        }
+    }
+    for (int b = 0; b < 256; ++b) class_[b] = cls_of[fold_[b]];
+
+    delta_.assign(classes_, -1);
+    atom_.assign(1, -1);
+    states_ = 1;
+    for (size_t ai = 0; ai < atoms.size(); ++ai) {
+        int32_t s = 0;
+        for (char ch : atoms[ai]) {
+            size_t slot = size_t(s) * classes_ + cls_of[uint8_t(ch)];
+            if (delta_[slot] < 0) {
+                delta_[slot] = int32_t(states_++);
+                delta_.resize(states_ * classes_, -1);
+                atom_.push_back(-1);
+            }
+            s = delta_[slot];
+        }
+        atom_[s] = int32_t(ai);
+    }
+
+    // Breadth-first fill of the failure transitions turns the trie into a
+    // complete DFA.
+    std::vector<int32_t> fail(states_, 0);
+    hit_.assign(states_, -1);
+    next_hit_.assign(states_, -1);
+    std::deque<int32_t> queue;
+    for (size_t c = 0; c < classes_; ++c) {
+        int32_t &t = delta_[c];
+        if (t < 0) {
+            t = 0;
+        } else {
+            fail[t] = 0;
+            queue.push_back(t);
+        }
+    }
+    while (!queue.empty()) {
+        int32_t s = queue.front();
+        queue.pop_front();
+        next_hit_[s] = hit_[fail[s]];
+        hit_[s] = atom_[s] >= 0 ? s : next_hit_[s];
+        for (size_t c = 0; c < classes_; ++c) {
+            int32_t &t = delta_[size_t(s) * classes_ + c];
+            int32_t via_fail = delta_[size_t(fail[s]) * classes_ + c];
+            if (t < 0) {
+                t = via_fail;
+            } else {
+                fail[t] = via_fail;
+                queue.push_back(t);
+            }
+        }
+    }
+    compiled_ = true;
+}
+
+Matcher::Scanner::Scanner(const Matcher &matcher)
+    : m_(matcher), progress_(matcher.patterns_.size()), matched_(matcher.patterns_.size(), 0) {}
+
+Matcher::Scanner::Progress &Matcher::Scanner::progress(size_t pattern) {
+    Progress &g = progress_[pattern];
+    if (g.line != line_) {
+        g = Progress();
+        g.line = line_;
+    }
+    return g;
+}
+
+bool Matcher::Scanner::first_ok(size_t pattern, uint64_t start) const {
+    const Gap &gap = m_.chunks_[m_.patterns_[pattern].first_chunk].before;
+    uint64_t offset = start - line_start_;
+    return gap.open ? offset >= gap.min : offset == gap.min;
+}
+
+bool Matcher::Scanner::chunk_at(size_t chunk, uint64_t start, const char *data,
+                                uint64_t base, bool whole) const {
+    const Chunk &c = m_.chunks_[chunk];
+    size_t checked = whole ? c.bytes.size() : c.bytes.size() - c.anchor;
+    for (size_t i = 0; i < checked; ++i) {
+        if (!c.literal[i]) continue;
+        uint64_t q = start + i;
+        uint8_t b = q >= base ? uint8_t(data[q - base]) : uint8_t(tail_[tail_.size() - (base - q)]);
+        if (m_.fold_[b] != uint8_t(c.bytes[i])) return false;
+    }
+    return true;
+}
+
+void Matcher::Scanner::hit(int atom, uint64_t end, const char *data, uint64_t base) {
+    for (uint32_t r = m_.ref_begin_[atom]; r < m_.ref_begin_[atom + 1]; ++r) {
+        const Ref &ref = m_.refs_[r];
+        if (matched_[ref.pattern]) continue;
+        const Pattern &p = m_.patterns_[ref.pattern];
+        const Chunk &c = m_.chunks_[p.first_chunk + ref.chunk];
+        if (end < line_start_ + c.bytes.size()) continue;
+        uint64_t start = end - c.bytes.size();
+        Progress &g = progress(ref.pattern);
+        bool last = ref.chunk + 1 == p.chunks;
+
+        if (ref.chunk == g.next) {
+            // The earliest fitting occurrence of each chunk leaves the most
+            // room for the rest, as every later gap is open.
+            bool ok = ref.chunk == 0 ? first_ok(ref.pattern, start)
+                                     : start >= g.prev_end + c.before.min;
+            if (!ok || !chunk_at(p.first_chunk + ref.chunk, start, data, base, false)) continue;
+            g.before_last = g.prev_end;
+            g.prev_end = end;
+            ++g.next;
+            if (last) {
+                g.done_end = end;
+                if (m_.settles_at_line_end(p)) {
+                    armed_.push_back(ref.pattern);
+                } else {
+                    matched_[ref.pattern] = 1;
+                }
+            }
+        }
+    }
+}
+
+void Matcher::Scanner::end_line(uint64_t end, const char *data, uint64_t base) {
+    for (uint32_t pi : armed_) {
+        const Pattern &p = m_.patterns_[pi];
+        const Progress &g = progress_[pi];
+        if (p.trail.open) {
+            if (end - g.done_end >= p.trail.min) matched_[pi] = 1;
+            continue;
+        }
+        // An exact trail pins the last chunk to the end of the line; the
+        // greedy run only proved the chunks before it fit.
+        size_t last = p.first_chunk + p.chunks - 1;
+        const Chunk &c = m_.chunks_[last];
+        if (end < line_start_ + c.bytes.size() + p.trail.min) continue;
+        uint64_t start = end - p.trail.min - c.bytes.size();
+        bool ok = p.chunks == 1 ? first_ok(pi, start) : start >= g.before_last + c.before.min;
+        if (ok && chunk_at(last, start, data, base, true)) matched_[pi] = 1;
+    }
+    armed_.clear();
+    uint64_t len = end - line_start_;
+    for (uint32_t pi : m_.empty_) {
+        const Gap &gap = m_.patterns_[pi].trail;
+        if (gap.open ? len >= gap.min : len == gap.min) matched_[pi] = 1;
+    }
+}
+
+void Matcher::Scanner::feed(const char *data, size_t len) {
+    if (!m_.compiled_) return;
+    const int32_t *delta = m_.delta_.data();
+    const size_t classes = m_.classes_;
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t b = uint8_t(data[i]);
+        if (b == '\n') {
+            end_line(pos_ + i, data, pos_);
+            ++line_;
+            line_start_ = pos_ + i + 1;
+            state_ = 0;
+            continue;
+        }
+        state_ = delta[size_t(state_) * classes + m_.class_[b]];
+        for (int32_t h = m_.hit_[state_]; h >= 0; h = m_.next_hit_[h]) {
+            hit(m_.atom_[h], pos_ + i + 1, data, pos_);
+        }
+    }
+    pos_ += len;
+    if (m_.window_ == 0) return;
+    if (len >= m_.window_) {
+        tail_.assign(data + len - m_.window_, m_.window_);
+    } else {
+        tail_.append(data, len);
+        if (tail_.size() > m_.window_) tail_.erase(0, tail_.size() - m_.window_);
+    }
+}
+
+std::vector<int> Matcher::Scanner::finish() {
+    // Only the kept tail of the input is left to look at.
+    if (m_.compiled_) end_line(pos_, nullptr, pos_);
+    std::vector<int> ids;
+    for (size_t i = 0; i < matched_.size(); ++i) {
+        if (matched_[i]) ids.push_back(m_.patterns_[i].id);
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+std::vector<int> Matcher::scan(const char *data, size_t len) const {
+    Scanner s(*this);
+    s.feed(data, len);
+    return s.finish();
+}
+
+std::vector<int> Matcher::scan(const std::string &text) const {
+    return scan(text.data(), text.size());
+}
+
+bool Matcher::scan_file(const std::string &path, std::vector<int> &ids) const {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    Scanner s(*this);
+    char buf[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        s.feed(buf, size_t(n));
+    }
+    ::close(fd);
+    ids = s.finish();
+    return true;
+}
+
+} // namespace safebox
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Matches a whole signature set in one pass over the input. Every pattern is
+// split into literal chunks joined by `.*` gaps, and the last literal of each
+// chunk goes into a single Aho-Corasick automaton, so the scan cost depends
+// on the input length, not on the number of rules. A hit is then checked
+// against the rest of its chunk and the pattern's gap/anchor constraints.
+//
+// Supported syntax is the subset the rule sets use: literal characters,
+// backslash-escaped punctuation, `.`, `.*`, `.+`, a leading `^` and a
+// trailing `$`. Anything else is rejected by add() so the caller can keep
+// the pattern on a regex engine. Matching is re.search applied to every
+// line of the input: `.` never matches '\n' and the anchors bind to line
+// starts and ends. Case folding (caseless) is ASCII only.
+class Matcher {
+public:
+    explicit Matcher(bool caseless = false);
+
+    // Adds `pattern` under `id` (ids may repeat). Returns false with *error
+    // set if the pattern uses syntax outside the subset; the matcher is left
+    // unchanged then. compile() must run again before the next scan.
+    bool add(const std::string &pattern, int id, std::string *error = nullptr);
+    // True if the index-th added pattern has a fixed-width part (`.`, `.+`).
+    // Widths are counted in bytes, so on non-ASCII text such a pattern can
+    // disagree with re, which counts characters.
+    bool counts_bytes(size_t index) const;
+    void compile();
+
+    size_t patterns() const { return patterns_.size(); }
+    size_t states() const { return states_; }
+
+    // Incremental scan for input that arrives in pieces (file contents).
+    class Scanner {
+    public:
+        explicit Scanner(const Matcher &matcher);
+        void feed(const char *data, size_t len);
+        // Ids of the matching patterns, ascending and unique. The scanner
+        // is spent afterwards.
+        std::vector<int> finish();
+
+    private:
+        struct Progress {
+            uint64_t line = 0;
+            uint32_t next = 0;       // chunk waited for
+            uint64_t prev_end = 0;   // end of chunk next - 1
+            uint64_t before_last = 0; // end of the chunk before the last one
+            uint64_t done_end = 0;   // end of the last chunk once complete
+        };
+
+        void hit(int atom, uint64_t end, const char *data, uint64_t base);
+        // Compares the chunk at start with the input, without its atom
+        // unless whole. Bytes before base come from tail_.
+        bool chunk_at(size_t chunk, uint64_t start, const char *data, uint64_t base,
+                      bool whole) const;
+        bool first_ok(size_t pattern, uint64_t start) const;
+        void end_line(uint64_t end, const char *data, uint64_t base);
+        Progress &progress(size_t pattern);
+
+        const Matcher &m_;
+        int32_t state_ = 0;
+        uint64_t pos_ = 0;
+        uint64_t line_ = 1;
+        uint64_t line_start_ = 0;
+        std::string tail_;
+        std::vector<Progress> progress_;
+        std::vector<char> matched_;
+        std::vector<uint32_t> armed_;
+    };
+
+    // Ids of the patterns matching the text, ascending and unique.
+    std::vector<int> scan(const char *data, size_t len) const;
+    std::vector<int> scan(const std::string &text) const;
+    // Streams the file through a Scanner. Returns false if it cannot be read.
+    bool scan_file(const std::string &path, std::vector<int> &ids) const;
+
+private:
+    struct Gap {
+        uint32_t min = 0;
+        bool open = true; // false: exactly min characters
+    };
+    struct Chunk {
+        std::string bytes; // folded; wildcard positions hold 0
+        std::string literal; // mask: 1 where bytes is a literal byte
+        uint32_t anchor = 0; // length of the trailing literal run (the atom)
+        Gap before;
+    };
+    struct Pattern {
+        int id = 0;
+        uint32_t first_chunk = 0;
+        uint32_t chunks = 0;
+        Gap trail;
+        bool counts_bytes = false;
+    };
+    struct Ref {
+        uint32_t pattern;
+        uint32_t chunk; // index within the pattern
+    };
+
+    bool parse(const std::string &pattern, Pattern &p, std::vector<Chunk> &chunks,
+               std::string *error) const;
+    // Patterns that cannot complete on a hit and are settled at line end.
+    bool settles_at_line_end(const Pattern &p) const {
+        return p.trail.min > 0 || !p.trail.open;
+    }
+
+    bool caseless_;
+    bool compiled_ = false;
+    std::vector<Pattern> patterns_;
+    std::vector<Chunk> chunks_;
+    std::vector<uint32_t> empty_; // patterns without any literal
+
+    // Automaton: dense transition table over byte classes.
+    uint8_t fold_[256];
+    uint16_t class_[256];
+    size_t classes_ = 1;
+    size_t states_ = 0;
+    size_t window_ = 0; // bytes a Scanner keeps across feeds to verify chunks
+    std::vector<int32_t> delta_;
+    std::vector<int32_t> hit_;   // first state on the suffix chain ending an atom, or -1
+    std::vector<int32_t> next_hit_;
+    std::vector<int32_t> atom_;  // atom ending at a state, or -1
+    std::vector<uint32_t> ref_begin_;
+    std::vector<Ref> refs_;
+};
+
+} // namespace safebox
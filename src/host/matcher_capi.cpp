@@ -0,0 +1,53 @@
+#include "matcher_capi.h"
+#include "matcher.h"
+#include <algorithm>
+
+struct sbm_matcher {
+    explicit sbm_matcher(bool caseless) : matcher(caseless) {}
+    safebox::Matcher matcher;
+    std::string error;
+};
+
+namespace {
+
+long copy_ids(const std::vector<int> &ids, int *out, size_t max) {
+    std::copy_n(ids.begin(), std::min(max, ids.size()), out);
+    return long(ids.size());
+}
+
+} // namespace
+
+extern "C" {
+
+sbm_matcher *sbm_new(int caseless) {
+    return new sbm_matcher(caseless != 0);
+}
+
+void sbm_free(sbm_matcher *m) {
+    delete m;
+}
+
+int sbm_add(sbm_matcher *m, const char *pattern, int id) {
+    if (!m->matcher.add(pattern, id, &m->error)) return -1;
+    return m->matcher.counts_bytes(m->matcher.patterns() - 1) ? 1 : 0;
+}
+
+const char *sbm_error(const sbm_matcher *m) {
+    return m->error.c_str();
+}
+
+void sbm_compile(sbm_matcher *m) {
+    m->matcher.compile();
+}
+
+long sbm_scan(const sbm_matcher *m, const char *data, size_t len, int *out, size_t max) {
+    return copy_ids(m->matcher.scan(data, len), out, max);
+}
+
+long sbm_scan_file(const sbm_matcher *m, const char *path, int *out, size_t max) {
+    std::vector<int> ids;
+    if (!m->matcher.scan_file(path, ids)) return -1;
+    return copy_ids(ids, out, max);
+}
+
+} // extern "C"
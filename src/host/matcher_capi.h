@@ -0,0 +1,28 @@
+#pragma once
+
+// C interface of Matcher for the libsafebox-match shared library, which the
+// Python detector loads with ctypes (sandbox/native_matcher.py).
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sbm_matcher sbm_matcher;
+
+sbm_matcher *sbm_new(int caseless);
+void sbm_free(sbm_matcher *m);
+// 0: added; 1: added, but fixed widths count bytes (see Matcher::counts_bytes);
+// -1: unsupported syntax, see sbm_error().
+int sbm_add(sbm_matcher *m, const char *pattern, int id);
+const char *sbm_error(const sbm_matcher *m);
+void sbm_compile(sbm_matcher *m);
+// Writes up to max matching ids to out, ascending. Returns the number of
+// matching ids (which may exceed max), or -1 if the file cannot be read.
+long sbm_scan(const sbm_matcher *m, const char *data, size_t len, int *out, size_t max);
+long sbm_scan_file(const sbm_matcher *m, const char *path, int *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,211 @@
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace safebox {
+
+const std::vector<double> &Metrics::buckets() {
+    static const std::vector<double> bounds = {0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300, 600};
+    return bounds;
+}
+
+void Metrics::Histogram::add(double seconds) {
+    const std::vector<double> &bounds = buckets();
+    if (counts.empty()) counts.assign(bounds.size() + 1, 0);
+    size_t i = 0;
+    while (i < bounds.size() && seconds > bounds[i]) ++i;
+    ++counts[i];
+    ++count;
+    sum += seconds;
+}
+
+void Metrics::observe(const std::string &phase, const std::string &backend, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_[{phase, backend}].add(seconds);
+}
+
+void Metrics::observe_queue_wait(const std::string &priority, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_waits_[priority].add(seconds);
+}
+
+void Metrics::count_job(const std::string &backend, const std::string &status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++jobs_[{backend, status}];
+}
+
+void Metrics::count_early_stop(const std::string &backend, const std::string &reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++early_stops_[{backend, reason}];
+}
+
+void Metrics::count_artifact_bytes(const std::string &backend, bool duplicate, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    artifact_bytes_[{backend, duplicate ? "duplicate" : "new"}] += bytes;
+}
+
+namespace {
+
+std::string format_value(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    return buf;
+}
+
+void append_histogram(std::string &out, const std::string &name, const std::string &labels,
+                      const std::vector<uint64_t> &counts, uint64_t count, double sum) {
+    const std::vector<double> &bounds = Metrics::buckets();
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= bounds.size(); ++i) {
+        cumulative += counts[i];
+        std::string le = i < bounds.size() ? format_value(bounds[i]) : "+Inf";
+        out += name + "_bucket{" + labels + ",le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    out += name + "_sum{" + labels + "} " + format_value(sum) + "\n";
+    out += name + "_count{" + labels + "} " + std::to_string(count) + "\n";
+}
+
+} // namespace
+
+std::string Metrics::exposition() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    out += "# HELP safebox_phase_seconds Time spent in each phase of a VM cycle.\n";
+    out += "# TYPE safebox_phase_seconds histogram\n";
+    for (const auto &entry : phases_) {
+        std::string labels = "phase=\"" + entry.first.first + "\",backend=\"" + entry.first.second + "\"";
+        const Histogram &h = entry.second;
+        append_histogram(out, "safebox_phase_seconds", labels, h.counts, h.count, h.sum);
+    }
+    out += "# HELP safebox_queue_wait_seconds Time jobs waited in the queue for a VM.\n";
+    out += "# TYPE safebox_queue_wait_seconds histogram\n";
+    for (const auto &entry : queue_waits_) {
+        const Histogram &h = entry.second;
+        append_histogram(out, "safebox_queue_wait_seconds", "priority=\"" + entry.first + "\"", h.counts, h.count,
+                         h.sum);
+    }
+    out += "# HELP safebox_jobs_total Jobs finished, by outcome.\n";
+    out += "# TYPE safebox_jobs_total counter\n";
+    for (const auto &entry : jobs_) {
+        out += "safebox_jobs_total{backend=\"" + entry.first.first + "\",status=\"" + entry.first.second +
+               "\"} " + std::to_string(entry.second) + "\n";
+    }
+    out += "# HELP safebox_early_stops_total Agent runs ended before their timeout, by reason.\n";
+    out += "# TYPE safebox_early_stops_total counter\n";
+    for (const auto &entry : early_stops_) {
+        out += "safebox_early_stops_total{backend=\"" + entry.first.first + "\",reason=\"" + entry.first.second +
+               "\"} " + std::to_string(entry.second) + "\n";
+    }
+    out += "# HELP safebox_artifact_bytes_total Artifact bytes collected from guests, by whether they were new to the store.\n";
+    out += "# TYPE safebox_artifact_bytes_total counter\n";
+    for (const auto &entry : artifact_bytes_) {
+        out += "safebox_artifact_bytes_total{backend=\"" + entry.first.first + "\",stored=\"" + entry.first.second +
+               "\"} " + std::to_string(entry.second) + "\n";
+    }
+    return out;
+}
+
+Metrics &global_metrics() {
+    static Metrics metrics;
+    return metrics;
+}
+
+double PhaseTimes::lap(const std::string &phase) {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - start_).count();
+    start_ = now;
+    add(phase, seconds);
+    return seconds;
+}
+
+void PhaseTimes::add(const std::string &phase, double seconds) {
+    phases_.emplace_back(phase, seconds);
+    global_metrics().observe(phase, backend_, seconds);
+}
+
+Json PhaseTimes::to_json() const {
+    Json out = Json::object();
+    for (const auto &phase : phases_) {
+        // A phase that ran twice (e.g. ssh after a failed probe) adds up.
+        Json &slot = out[phase.first];
+        slot = Json(slot.is_number() ? slot.as_number() + phase.second : phase.second);
+    }
+    return out;
+}
+
+int MetricsServer::start(const std::string &addr, int port) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) return 1;
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, addr.c_str(), &sa.sin_addr) != 1 ||
+        bind(listen_fd_, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0 || listen(listen_fd_, 16) != 0) {
+        std::cerr << "[metrics] cannot listen on " << addr << ":" << port << std::endl;
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return 1;
+    }
+    socklen_t len = sizeof(sa);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&sa), &len);
+    port_ = ntohs(sa.sin_port);
+
+    running_ = true;
+    thread_ = std::thread(&MetricsServer::serve, this);
+    return 0;
+}
+
+void MetricsServer::stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void MetricsServer::serve() {
+    while (running_) {
+        pollfd p{listen_fd_, POLLIN, 0};
+        if (poll(&p, 1, 200) <= 0) continue;
+        int c = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (c < 0) continue;
+
+        // Scrapers send small requests; the request line is all we need.
+        timeval tv{1, 0};
+        setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char buf[1024];
+        ssize_t n = recv(c, buf, sizeof(buf) - 1, 0);
+        std::string request = n > 0 ? std::string(buf, static_cast<size_t>(n)) : "";
+
+        std::string status = "200 OK";
+        std::string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0) {
+            body = global_metrics().exposition();
+        } else {
+            status = "404 Not Found";
+            body = "not found\n";
+        }
+        std::string response = "HTTP/1.1 " + status + "\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t w = send(c, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0) break;
+            sent += static_cast<size_t>(w);
+        }
+        close(c);
+    }
+}
+
+} // namespace safebox
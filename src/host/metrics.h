@@ -0,0 +1,98 @@
+#pragma once
+
+#include "json.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace safebox {
+
+// Process-wide latency histograms and job counters, exported in the
+// Prometheus text format. Each phase of a VM cycle (boot, address, ready,
+// ssh, inject, agent, artifacts, report, revert) is one histogram per
+// backend, queue wait one per priority class; p50/p99 come from
+// histogram_quantile() on the scraping side.
+class Metrics {
+public:
+    void observe(const std::string &phase, const std::string &backend, double seconds);
+    void count_job(const std::string &backend, const std::string &status);
+    // An agent run the pool ended early, by reason (verdict or idle).
+    void count_early_stop(const std::string &backend, const std::string &reason);
+    // Artifact bytes brought back from guests, by whether the artifact store
+    // already had them (stored "duplicate") or not ("new").
+    void count_artifact_bytes(const std::string &backend, bool duplicate, uint64_t bytes);
+    // Time a job spent queued before a VM took it, by priority class.
+    void observe_queue_wait(const std::string &priority, double seconds);
+    std::string exposition();
+
+    // Upper bounds (seconds) of the histogram buckets, +Inf implied.
+    static const std::vector<double> &buckets();
+
+private:
+    struct Histogram {
+        std::vector<uint64_t> counts;  // one per bucket, not cumulative
+        uint64_t count = 0;
+        double sum = 0;
+
+        void add(double seconds);
+    };
+
+    std::mutex mutex_;
+    std::map<std::pair<std::string, std::string>, Histogram> phases_;
+    std::map<std::pair<std::string, std::string>, uint64_t> jobs_;
+    std::map<std::pair<std::string, std::string>, uint64_t> early_stops_;
+    std::map<std::pair<std::string, std::string>, uint64_t> artifact_bytes_;
+    std::map<std::string, Histogram> queue_waits_;
+};
+
+Metrics &global_metrics();
+
+// Wall-clock breakdown of one job, measured with the monotonic clock.
+// lap() closes the phase that started at the previous mark()/lap(), records
+// it here and in global_metrics(), and starts the next one.
+class PhaseTimes {
+public:
+    explicit PhaseTimes(std::string backend = "") : backend_(std::move(backend)) { mark(); }
+
+    void mark() { start_ = std::chrono::steady_clock::now(); }
+    double lap(const std::string &phase);
+    // Adds a phase measured elsewhere.
+    void add(const std::string &phase, double seconds);
+
+    const std::vector<std::pair<std::string, double>> &phases() const { return phases_; }
+    // {"boot": 1.2, "ssh": 0.4, ...} in the order the phases ran.
+    Json to_json() const;
+
+private:
+    std::string backend_;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<std::pair<std::string, double>> phases_;
+};
+
+// Serves GET /metrics (global_metrics().exposition()) on a background
+// thread for daemon mode.
+class MetricsServer {
+public:
+    ~MetricsServer() { stop(); }
+
+    // Returns 0 once listening on addr:port (port 0 picks one, see port()).
+    int start(const std::string &addr, int port);
+    void stop();
+    int port() const { return port_; }
+
+private:
+    void serve();
+
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
+
+} // namespace safebox
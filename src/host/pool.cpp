@@ -0,0 +1,1085 @@
+#include "pool.h"
+#include "journal.h"
+#include "sha256.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <tuple>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace safebox {
+
+const char *priority_name(Priority priority) {
+    switch (priority) {
+    case Priority::Interactive: return "interactive";
+    case Priority::Normal: return "normal";
+    case Priority::Batch: return "batch";
+    }
+    return "normal";
+}
+
+bool parse_priority(const std::string &name, Priority &priority) {
+    for (Priority p : {Priority::Interactive, Priority::Normal, Priority::Batch}) {
+        if (name == priority_name(p)) {
+            priority = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string job_key(const Job &job) {
+    return job.id.empty() ? job.report_dir : job.id;
+}
+
+JobQueue::JobQueue(int aging, int deadline_slack) : aging_(aging), deadline_slack_(deadline_slack) {}
+
+void JobQueue::push(Job job) {
+    job.queued = Clock::now();
+    if (job.submitted == Clock::time_point()) job.submitted = job.queued;
+    if (!submissions_.try_push(job)) {
+        // Ring full: hand it over directly, behind what is already queued.
+        std::lock_guard<std::mutex> lock(mutex_);
+        collect();
+        insert(std::move(job));
+    }
+    // Pairs with the fence in pop(): either the waiter sees the job, or we
+    // see the waiter and take the lock to wake it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        // Workers may only accept some jobs, so wake them all to look.
+        cv_.notify_all();
+    }
+}
+
+bool JobQueue::pop(Job &job, const AcceptFn &accept) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++waiters_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool found = false;
+    for (;;) {
+        collect();
+        found = take(job, accept);
+        if (found || closed_) break;
+        cv_.wait_for(lock, 1s);
+    }
+    --waiters_;
+    return found;
+}
+
+bool JobQueue::try_pop(Job &job, const AcceptFn &accept) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collect();
+    return take(job, accept);
+}
+
+size_t JobQueue::count(const AcceptFn &accept) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collect();
+    if (!accept) return jobs_.size();
+    return static_cast<size_t>(std::count_if(jobs_.begin(), jobs_.end(),
+                                             [&](const std::pair<const uint64_t, Job> &e) { return accept(e.second); }));
+}
+
+bool JobQueue::closed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+}
+
+void JobQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cv_.notify_all();
+}
+
+size_t JobQueue::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    collect();
+    return jobs_.size();
+}
+
+void JobQueue::collect() {
+    Job job;
+    while (submissions_.try_pop(job)) insert(std::move(job));
+}
+
+void JobQueue::insert(Job job) {
+    uint64_t seq = next_seq_++;
+    if (backlog_[job.tenant]++ == 0) {
+        uint64_t &served = served_[job.tenant];
+        served = std::max(served, virtual_time_);
+    }
+    classes_[static_cast<int>(job.priority)][job.tenant].push_back(seq);
+    if (job.deadline > 0) deadlines_.emplace(job.submitted + std::chrono::seconds(job.deadline), seq);
+    jobs_.emplace(seq, std::move(job));
+}
+
+bool JobQueue::take(Job &job, const AcceptFn &accept) {
+    auto now = Clock::now();
+    auto accepted = [&](uint64_t seq) { return !accept || accept(jobs_.at(seq)); };
+
+    uint64_t best = 0;
+    bool found = false;
+    for (const auto &d : deadlines_) {
+        if (d.first - now > std::chrono::seconds(deadline_slack_)) break;
+        if (accepted(d.second)) {
+            best = d.second;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        // (effective class, tenant's share so far, arrival)
+        std::tuple<int, uint64_t, uint64_t> best_key;
+        for (int c = 0; c < 3; ++c) {
+            for (const auto &tenant : classes_[c]) {
+                auto it = std::find_if(tenant.second.begin(), tenant.second.end(), accepted);
+                if (it == tenant.second.end()) continue;
+                int lifted = c;
+                if (aging_ > 0) {
+                    double waited = std::chrono::duration<double>(now - jobs_.at(*it).queued).count();
+                    lifted = std::max(0, c - static_cast<int>(waited / aging_));
+                }
+                auto key = std::make_tuple(lifted, served_[tenant.first], *it);
+                if (!found || key < best_key) {
+                    best_key = key;
+                    found = true;
+                }
+            }
+        }
+        if (!found) return false;
+        best = std::get<2>(best_key);
+    }
+
+    auto node = jobs_.find(best);
+    job = std::move(node->second);
+    jobs_.erase(node);
+    auto &tenants = classes_[static_cast<int>(job.priority)];
+    auto bucket = tenants.find(job.tenant);
+    bucket->second.erase(std::find(bucket->second.begin(), bucket->second.end(), best));
+    if (bucket->second.empty()) tenants.erase(bucket);
+    if (job.deadline > 0) deadlines_.erase({job.submitted + std::chrono::seconds(job.deadline), best});
+    if (--backlog_[job.tenant] == 0) backlog_.erase(job.tenant);
+    uint64_t &served = served_[job.tenant];
+    virtual_time_ = served;
+    ++served;
+
+    job.queue_wait = std::chrono::duration<double>(now - job.queued).count();
+    global_metrics().observe_queue_wait(priority_name(job.priority), job.queue_wait);
+    return true;
+}
+
+namespace {
+
+// The agent's own timestamp format (UTC, ISO 8601 with a Z).
+std::string utc_timestamp() {
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+    gmtime_r(&now, &tm);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+constexpr const char *kContainerBackend = "container";
+
+// Whether a VM may take the job: its pinned backend, else its tier (see
+// PoolOptions::escalate_score), else any.
+bool takes_job(const VMConfig &vm, const Job &job) {
+    if (!job.backend.empty()) return job.backend == vm.backend;
+    if (job.tier.empty()) return true;
+    return (job.tier == kContainerBackend) == (vm.backend == kContainerBackend);
+}
+
+// Moves a container-tier run's report (and its usage) aside for
+// the VM run that replaces it; triage.json stays.
+void stash_tier_report(const Job &job) {
+    namespace fs = std::filesystem;
+    fs::path stash = fs::path(job.report_dir) / kContainerBackend;
+    std::error_code ec;
+    fs::remove_all(stash, ec);
+    std::vector<fs::path> entries;
+    for (const auto &entry : fs::directory_iterator(job.report_dir, ec)) entries.push_back(entry.path());
+    fs::create_directories(stash, ec);
+    for (const fs::path &entry : entries) {
+        if (entry.filename() == "triage.json") continue;
+        fs::rename(entry, stash / entry.filename(), ec);
+    }
+    if (!job.usage.is_null()) std::ofstream(stash / "usage.json") << dump_json(job.usage, 2) << std::endl;
+}
+
+// Exit status of a run whose agent exited 0 without streaming its end
+// record (the report is partial).
+constexpr int kIncompleteRun = 4;
+
+// Transfers that take longer than this are cut off; what arrived is kept.
+constexpr int kArtifactTimeoutSeconds = 300;
+
+std::string guest_output_dir(const VMConfig &vm) {
+    return "/home/" + vm.vm_user + "/out";
+}
+
+// Writes report_dir/job.json and returns what it holds.
+Json write_job_record(const Job &job, const std::string &vm_name, int rc, bool cached = false,
+                      const PhaseTimes *phases = nullptr, const Verdict *verdict = nullptr) {
+    Json record = Json::object();
+    record["id"] = Json(job.id);
+    record["file"] = Json(job.file_path);
+    record["backend"] = Json(job.backend);
+    Json tags = Json::array();
+    for (const std::string &tag : job.tags) tags.push_back(Json(tag));
+    record["tags"] = tags;
+    record["vm"] = Json(vm_name);
+    record["attempts"] = Json(static_cast<double>(job.attempt + 1));
+    record["status"] = Json(rc == 0 ? "completed" : "failed");
+    record["exit_code"] = Json(static_cast<double>(rc));
+    record["cached"] = Json(cached);
+    if (!job.sha256.empty()) record["sha256"] = Json(job.sha256);
+    if (!job.triage.is_null()) record["triage"] = job.triage;
+    if (!job.tier.empty()) record["tier"] = Json(job.tier);
+    if (!job.usage.is_null()) record["usage"] = job.usage;
+    record["priority"] = Json(priority_name(job.priority));
+    if (!job.tenant.empty()) record["tenant"] = Json(job.tenant);
+    if (!vm_name.empty()) record["queue_wait"] = Json(job.queue_wait);
+    if (phases) record["phases"] = phases->to_json();
+    if (verdict) record["verdict"] = verdict_json(*verdict);
+
+    std::error_code ec;
+    std::filesystem::create_directories(job.report_dir, ec);
+    std::ofstream(job.report_dir + "/job.json") << dump_json(record, 2) << std::endl;
+    return record;
+}
+
+} // namespace
+
+struct VMPool::Slot {
+    VMConfig vm;
+    Backend *backend = nullptr;
+    bool cloned = false;
+    SshSession session;
+    std::string host;
+
+    // Deadline and backoff of whatever the slot is currently waiting for.
+    std::chrono::steady_clock::time_point deadline;
+    int backoff_ms = 0;
+    int ready_fd = -1;
+    int ready_timer = -1;
+    std::string ready_buf;
+
+    // The VM cycle the current (or next) job runs in, from boot onwards.
+    PhaseTimes phases;
+
+    // Only changed on the loop thread. Parking covers everything between
+    // "cleanly off" states: cloning at startup and reverting to park.
+    enum class Stage { Parking, Parked, Warming, Ready, Busy, Retired };
+    Stage stage = Stage::Parking;
+    EventPublisher *events = nullptr;
+    JobJournal *journal = nullptr;
+
+    void set_stage(Stage next) {
+        stage = next;
+        static const char *const names[] = {"parking", "parked", "warming", "ready", "busy", "retired"};
+        // A ready VM is clean and reachable at host; one a restarted pool
+        // finds in any other stage but parked or retired is reverted.
+        if (journal) journal->vm_stage(vm.vm_name, names[static_cast<int>(next)], next == Stage::Ready ? host : "");
+        if (!events) return;
+        Json state = Json::object();
+        state["type"] = Json("vm");
+        state["vm"] = Json(vm.vm_name);
+        state["backend"] = Json(vm.backend);
+        state["stage"] = Json(names[static_cast<int>(next)]);
+        if (next == Stage::Busy) state["job"] = Json(job_key(job));
+        events->publish("vm/" + vm.vm_name, state);
+    }
+    std::chrono::steady_clock::time_point warm_begin;
+
+    Job job;
+    // The job is a container-tier run and may come back for a VM (loop
+    // thread only, as job itself changes under the step thread).
+    bool may_escalate = false;
+    std::string remote_file;
+    std::unique_ptr<ReportAssembler> assembler;
+    // The agent command's exit status; 0 after an early stop.
+    int agent_rc = 0;
+    Verdict verdict;
+
+    // The running agent command, for early termination (loop thread only).
+    int agent_pid = -1;
+    int idle_timer = -1;
+    ReportScorer scorer;
+    std::chrono::steady_clock::time_point last_activity;
+    std::string stop_reason;
+};
+
+VMPool::VMPool(std::vector<VMConfig> vms, PoolOptions options)
+    : vms_(std::move(vms)), options_(options), queue_(options.aging, options.deadline_slack) {}
+
+VMPool::~VMPool() {
+    drain();
+}
+
+void VMPool::start() {
+    if (started_) return;
+    started_ = true;
+    for (const VMConfig &vm : vms_) {
+        auto slot = std::make_unique<Slot>();
+        slot->vm = vm;
+        slot->backend = find_backend(vm.backend);
+        slot->events = options_.events;
+        slot->journal = options_.journal;
+        slots_.push_back(std::move(slot));
+    }
+    if (options_.journal) {
+        const JournalState &state = options_.journal->recovered();
+        for (const Job &job : state.pending) {
+            auto it = state.interrupted.find(job.journal_seq);
+            if (it != state.interrupted.end()) {
+                std::cout << "[pool] " << job.file_path << " was interrupted"
+                          << (it->second.empty() ? "" : " after " + it->second) << ", queued again" << std::endl;
+            }
+            publish_status(job, "queued");
+            queue_.push(job);
+        }
+        if (!state.pending.empty()) {
+            std::cout << "[pool] " << state.pending.size() << " jobs recovered from the journal" << std::endl;
+        }
+    }
+    loop_thread_ = std::thread([this] { loop_.run(); });
+    for (int i = 0; i < std::max(1, options_.threads); ++i) {
+        step_threads_.emplace_back(&VMPool::step_thread, this);
+    }
+
+    for (auto &slot_ptr : slots_) {
+        Slot &slot = *slot_ptr;
+        run_step([this, &slot] {
+            if (!slot.backend) {
+                std::cerr << "[pool] " << slot.vm.vm_name << ": unknown backend " << slot.vm.backend << std::endl;
+                return retire(slot);
+            }
+            if (slot.vm.clone) {
+                if (slot.backend->clone(*slot.vm.clone) != 0) {
+                    std::cerr << "[pool] " << slot.vm.vm_name << ": failed to create linked clone" << std::endl;
+                    return retire(slot);
+                }
+                slot.cloned = true;
+            }
+            if (options_.governor && slot.backend->configure(slot.vm.vm_name, slot.vm.resources) != 0) {
+                std::cerr << "[pool] " << slot.vm.vm_name << ": could not apply its CPU/memory placement" << std::endl;
+            }
+            // Clones are created fresh above; only named VMs live on.
+            if (options_.journal && !slot.vm.clone) return recover(slot);
+            loop_.post([this, &slot] {
+                slot.set_stage(Slot::Stage::Parked);
+                rescale();
+            });
+        });
+    }
+    if (options_.min_standby >= 0) loop_.post([this] { scale_tick(); });
+}
+
+void VMPool::submit(Job job) {
+    if (options_.journal && options_.journal->recovered().jobs.count(job_key(job))) {
+        std::cout << "[pool] " << job_key(job) << ": already in the journal, not queued again" << std::endl;
+        return;
+    }
+    bool hashed = false;
+    std::string label;
+    // Unless triage clears it for the container tier.
+    if (options_.escalate_score >= 0 && job.backend.empty()) job.tier = "vm";
+    if (options_.static_triage) {
+        TriageOptions triage_options;
+        triage_options.hash_index = options_.hash_index;
+        TriageResult triage;
+        std::string error;
+        if (!triage_file(job.file_path, triage_options, triage, &error)) {
+            std::cerr << "[pool] static triage failed: " << error << std::endl;
+        } else {
+            hashed = true;
+            job.sha256 = triage.sha256;
+            job.triage = triage_json(triage, false);
+            if (triage.decision != "dynamic") {
+                std::cout << "[pool] " << job.file_path << ": static triage says " << triage.decision
+                          << ", no VM needed" << std::endl;
+                publish_job(job, write_job_record(job, "", 0, false, nullptr, &triage.verdict));
+                global_metrics().count_job(job.backend, triage.decision);
+                ++completed_;
+                return;
+            }
+            if (!job.tier.empty() && triage.verdict.score < options_.escalate_score &&
+                std::any_of(vms_.begin(), vms_.end(), [](const VMConfig &vm) { return vm.backend == kContainerBackend; })) {
+                job.tier = kContainerBackend;
+            }
+            std::error_code ec;
+            std::filesystem::create_directories(job.report_dir, ec);
+            std::ofstream(job.report_dir + "/triage.json") << dump_json(triage_json(triage), 2) << std::endl;
+        }
+    } else {
+        hashed = (options_.cache || options_.hash_index) && sha256_file(job.file_path, job.sha256);
+    }
+    if (hashed && !options_.static_triage && options_.hash_index &&
+        options_.hash_index->lookup(job.sha256, &label)) {
+        std::cout << "[pool] " << job.file_path << ": known malware"
+                  << (label.empty() ? "" : " (" + label + ")") << ", no VM needed" << std::endl;
+        Verdict verdict = known_hash_verdict(label);
+        publish_job(job, write_job_record(job, "", 0, false, nullptr, &verdict));
+        global_metrics().count_job(job.backend, "known");
+        ++completed_;
+        return;
+    }
+    if (hashed && options_.cache) {
+        std::string cached = options_.cache->fetch(job.sha256, fingerprint(job), job.report_dir);
+        if (!cached.empty()) {
+            std::cout << "[pool] " << job.file_path << ": cached report " << cached << std::endl;
+            AgentReport report;
+            bool scored = load_agent_report(cached, report);
+            Verdict verdict = score_report(summarize_report(report));
+            publish_job(job, write_job_record(job, "", 0, true, nullptr, scored ? &verdict : nullptr));
+            global_metrics().count_job(job.backend, "cached");
+            ++completed_;
+            return;
+        }
+    }
+    if (options_.min_standby >= 0) {
+        std::lock_guard<std::mutex> lock(arrivals_mutex_);
+        arrivals_.push_back(std::chrono::steady_clock::now());
+    }
+    // Stamped here rather than in JobQueue::push, so the journal keeps it.
+    if (job.submitted == std::chrono::steady_clock::time_point()) job.submitted = std::chrono::steady_clock::now();
+    if (options_.journal) options_.journal->submitted(job);
+    publish_status(job, "queued");
+    queue_.push(std::move(job));
+    if (started_) loop_.post([this] { dispatch(); });
+}
+
+void VMPool::publish_status(const Job &job, const std::string &status, const std::string &vm) {
+    if (!options_.events) return;
+    Json state = Json::object();
+    state["id"] = Json(job.id);
+    state["file"] = Json(job.file_path);
+    state["status"] = Json(status);
+    state["priority"] = Json(priority_name(job.priority));
+    if (!job.tenant.empty()) state["tenant"] = Json(job.tenant);
+    state["attempts"] = Json(static_cast<double>(job.attempt + 1));
+    if (!vm.empty()) state["vm"] = Json(vm);
+    publish_job(job, state);
+}
+
+void VMPool::publish_job(const Job &job, const Json &record) {
+    if (!options_.events) return;
+    Json state = record;
+    state["type"] = Json("job");
+    std::string status = state.string_or("status", "");
+    options_.events->publish("job/" + job_key(job), state, status != "queued" && status != "running");
+}
+
+std::string VMPool::fingerprint(const Job &job) const {
+    // A job that may run anywhere is keyed by the pool's backend when every
+    // VM shares one.
+    std::string backend = job.backend;
+    if (backend.empty() && job.tier == kContainerBackend) backend = kContainerBackend;
+    if (backend.empty() && !vms_.empty() &&
+        std::all_of(vms_.begin(), vms_.end(), [&](const VMConfig &vm) { return vm.backend == vms_[0].backend; })) {
+        backend = vms_[0].backend;
+    }
+    int timeout = job.timeout > 0 ? job.timeout : options_.agent_timeout;
+    return analysis_fingerprint(backend, timeout, options_.report_format, options_.stop_score,
+                                options_.idle_timeout);
+}
+
+void VMPool::drain() {
+    queue_.close();
+    bool ran = started_;
+    if (started_) {
+        loop_.post([this] { dispatch(); });
+        std::unique_lock<std::mutex> lock(retired_mutex_);
+        while (!retired_cv_.wait_for(lock, 1s, [this] { return retired_ == slots_.size(); })) {
+        }
+        lock.unlock();
+
+        loop_.stop();
+        loop_thread_.join();
+        {
+            std::lock_guard<std::mutex> steps_lock(steps_mutex_);
+            steps_closed_ = true;
+        }
+        steps_cv_.notify_all();
+        for (std::thread &t : step_threads_) t.join();
+        step_threads_.clear();
+        started_ = false;
+    }
+
+    // Jobs left behind because every VM dropped out of the pool.
+    Job job;
+    while (queue_.pop(job)) {
+        std::cerr << "[pool] no VM left to run " << job.file_path << std::endl;
+        if (options_.journal) options_.journal->completed(job, 1);
+        ++failed_;
+    }
+    if (options_.journal && ran) {
+        options_.journal->drained();
+        options_.journal->sync();
+    }
+}
+
+void VMPool::run_step(std::function<void()> step) {
+    {
+        std::lock_guard<std::mutex> lock(steps_mutex_);
+        steps_.push_back(std::move(step));
+    }
+    steps_cv_.notify_one();
+}
+
+void VMPool::step_thread() {
+    for (;;) {
+        std::function<void()> step;
+        {
+            std::unique_lock<std::mutex> lock(steps_mutex_);
+            while (!steps_cv_.wait_for(lock, 1s, [this] { return steps_closed_ || !steps_.empty(); })) {
+            }
+            if (steps_.empty()) return;
+            step = std::move(steps_.front());
+            steps_.pop_front();
+        }
+        step();
+    }
+}
+
+void VMPool::recover(Slot &slot) {
+    const auto &vms = options_.journal->recovered().vms;
+    auto it = vms.find(slot.vm.vm_name);
+    std::string stage = it == vms.end() ? "" : it->second.stage;
+    if (stage == "ready" && !it->second.host.empty() &&
+        (!options_.governor || options_.governor->admit(slot.vm))) {
+        slot.phases = PhaseTimes(slot.vm.backend);
+        slot.host = it->second.host;
+        slot.session = slot.backend->open_session(slot.vm.vm_user + "@" + slot.host, slot.vm.ssh_port);
+        ExecOptions opts;
+        opts.timeout_seconds = 5;
+        if (slot.backend->probe_guest(slot.session, 1000) &&
+            execute_command(slot.backend->guest_command(slot.session, "echo ok"), opts).return_code == 0) {
+            slot.phases.lap("reattach");
+            std::cout << "[pool] " << slot.vm.vm_name << " reattached" << std::endl;
+            loop_.post([this, &slot] {
+                slot.set_stage(Slot::Stage::Ready);
+                dispatch();
+            });
+            return;
+        }
+        std::cerr << "[pool] " << slot.vm.vm_name << ": no longer answers, reverting it" << std::endl;
+        close_ssh_session(slot.session);
+    }
+    if (!stage.empty() && stage != "parked" && stage != "retired") {
+        if (recycle(slot) != 0) {
+            std::cerr << "[pool] " << slot.vm.vm_name << ": failed to revert VM, retiring it" << std::endl;
+            return retire(slot);
+        }
+        if (options_.governor) options_.governor->release(slot.vm);
+    }
+    loop_.post([this, &slot] {
+        slot.set_stage(Slot::Stage::Parked);
+        rescale();
+    });
+}
+
+void VMPool::boot(Slot &slot) {
+    slot.phases = PhaseTimes(slot.vm.backend);
+    if (slot.backend->start(slot.vm.vm_name) != 0) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": failed to start VM" << std::endl;
+        return retire(slot);
+    }
+    slot.phases.lap("boot");
+    slot.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options_.ssh_timeout);
+    slot.backoff_ms = 50;
+    slot.host = slot.vm.ssh_host;
+    if (slot.host.empty()) return resolve_address(slot);
+
+    slot.session = slot.backend->open_session(slot.vm.vm_user + "@" + slot.host, slot.vm.ssh_port);
+    loop_.post([this, &slot] { await_ready(slot); });
+}
+
+void VMPool::resolve_address(Slot &slot) {
+    slot.host = slot.backend->guest_address(slot.vm.vm_name);
+    if (!slot.host.empty()) {
+        slot.phases.lap("address");
+        slot.session = slot.backend->open_session(slot.vm.vm_user + "@" + slot.host, slot.vm.ssh_port);
+        loop_.post([this, &slot] { await_ready(slot); });
+        return;
+    }
+    if (std::chrono::steady_clock::now() + std::chrono::milliseconds(slot.backoff_ms) >= slot.deadline) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": guest never got an address" << std::endl;
+        return retire(slot);
+    }
+    int delay = slot.backoff_ms;
+    slot.backoff_ms = std::min(slot.backoff_ms * 2, 1000);
+    loop_.post([this, &slot, delay] {
+        loop_.add_timer(delay, [this, &slot] { run_step([this, &slot] { resolve_address(slot); }); });
+    });
+}
+
+void VMPool::await_ready(Slot &slot) {
+    slot.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options_.ssh_timeout);
+    // A restored hot snapshot never boots, so the agent's READY is not resent.
+    if (slot.vm.ready_channel.empty() || slot.backend->hot()) return end_ready_wait(slot, true);
+
+    slot.backoff_ms = 5;
+    slot.ready_buf.clear();
+    connect_ready(slot);
+}
+
+void VMPool::connect_ready(Slot &slot) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        slot.deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0) return end_ready_wait(slot, false);
+
+    // The socket only appears once the hypervisor has started the VM.
+    slot.ready_fd = connect_agent_channel(slot.vm.ready_channel);
+    if (slot.ready_fd < 0) {
+        int delay = static_cast<int>(std::min<long long>(slot.backoff_ms, left));
+        slot.backoff_ms = std::min(slot.backoff_ms * 2, 200);
+        loop_.add_timer(delay, [this, &slot] { connect_ready(slot); });
+        return;
+    }
+
+    slot.ready_timer = loop_.add_timer(static_cast<int>(left), [this, &slot] {
+        slot.ready_timer = -1;
+        end_ready_wait(slot, false);
+    });
+    loop_.add_fd(slot.ready_fd, EPOLLIN, [this, &slot](uint32_t) {
+        char buf[256];
+        for (;;) {
+            ssize_t n = read(slot.ready_fd, buf, sizeof(buf));
+            if (n > 0) {
+                slot.ready_buf.append(buf, static_cast<size_t>(n));
+                if (slot.ready_buf.find("READY") != std::string::npos) return end_ready_wait(slot, true);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            return end_ready_wait(slot, false);
+        }
+    });
+}
+
+void VMPool::end_ready_wait(Slot &slot, bool ready) {
+    if (slot.ready_fd >= 0) {
+        loop_.remove_fd(slot.ready_fd);
+        close(slot.ready_fd);
+        slot.ready_fd = -1;
+    }
+    if (slot.ready_timer >= 0) {
+        loop_.cancel_timer(slot.ready_timer);
+        slot.ready_timer = -1;
+    }
+    if (!slot.vm.ready_channel.empty() && !slot.backend->hot()) slot.phases.lap("ready");
+    if (!ready) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": no agent READY on " << slot.vm.ready_channel
+                  << ", falling back to SSH probing" << std::endl;
+    }
+    slot.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options_.ssh_timeout);
+    slot.backoff_ms = 10;
+    run_step([this, &slot] { probe_ssh(slot); });
+}
+
+void VMPool::probe_ssh(Slot &slot) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        slot.deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": SSH did not become available" << std::endl;
+        return retire(slot);
+    }
+    // Bounded to a second, so a step thread is never held for long.
+    if (slot.backend->probe_guest(slot.session, static_cast<int>(std::min<long long>(left, 1000)))) {
+        loop_.post([this, &slot] { confirm_ssh(slot); });
+    } else {
+        retry_ssh(slot);
+    }
+}
+
+void VMPool::confirm_ssh(Slot &slot) {
+    loop_.spawn(slot.backend->guest_command(slot.session, "echo ok"), {}, [this, &slot](CommandResult res) {
+        if (res.return_code != 0) return retry_ssh(slot);
+        slot.phases.lap("ssh");
+        std::cout << "[pool] " << slot.vm.vm_name << " ready" << std::endl;
+        double warm = std::chrono::duration<double>(std::chrono::steady_clock::now() - slot.warm_begin).count();
+        warm_seconds_ = warm_seconds_ > 0 ? 0.7 * warm_seconds_ + 0.3 * warm : warm;
+        slot.set_stage(Slot::Stage::Ready);
+        dispatch();
+    });
+}
+
+void VMPool::retry_ssh(Slot &slot) {
+    loop_.post([this, &slot] {
+        int delay = slot.backoff_ms;
+        if (std::chrono::steady_clock::now() + std::chrono::milliseconds(delay) >= slot.deadline) {
+            std::cerr << "[pool] " << slot.vm.vm_name << ": SSH did not become available" << std::endl;
+            return run_step([this, &slot] { retire(slot); });
+        }
+        slot.backoff_ms = std::min(slot.backoff_ms * 2, 500);
+        loop_.add_timer(delay, [this, &slot] { run_step([this, &slot] { probe_ssh(slot); }); });
+    });
+}
+
+void VMPool::dispatch() {
+    // Container-tier jobs, queued or running, may still come back for a VM.
+    bool escalations = std::any_of(slots_.begin(), slots_.end(), [](const std::unique_ptr<Slot> &slot) {
+        return slot->stage == Slot::Stage::Busy && slot->may_escalate;
+    }) || queue_.count([](const Job &j) { return j.tier == kContainerBackend; }) > 0;
+    for (auto &slot_ptr : slots_) {
+        Slot &slot = *slot_ptr;
+        auto accept = [&slot](const Job &j) { return takes_job(slot.vm, j); };
+        bool escalation_due = escalations && slot.vm.backend != kContainerBackend;
+        if (slot.stage == Slot::Stage::Ready && queue_.try_pop(slot.job, accept)) {
+            if (options_.journal) options_.journal->dispatched(slot.job, slot.vm.vm_name);
+            publish_status(slot.job, "running", slot.vm.vm_name);
+            slot.may_escalate = slot.job.tier == kContainerBackend;
+            slot.set_stage(Slot::Stage::Busy);
+            run_step([this, &slot] { run_job(slot); });
+        } else if ((slot.stage == Slot::Stage::Ready || slot.stage == Slot::Stage::Parked) &&
+                   queue_.closed() && queue_.count(accept) == 0 && !escalation_due) {
+            slot.set_stage(Slot::Stage::Retired);
+            run_step([this, &slot] { retire(slot); });
+        }
+    }
+    rescale();
+}
+
+void VMPool::rescale() {
+    using Stage = Slot::Stage;
+    auto now = std::chrono::steady_clock::now();
+    size_t queued = queue_.size();
+    int target = static_cast<int>(slots_.size());
+    if (options_.min_standby >= 0) {
+        double rate = 0;
+        {
+            std::lock_guard<std::mutex> lock(arrivals_mutex_);
+            auto window = std::chrono::seconds(std::max(1, options_.scale_window));
+            while (!arrivals_.empty() && now - arrivals_.front() > window) arrivals_.pop_front();
+            rate = static_cast<double>(arrivals_.size()) / std::max(1, options_.scale_window);
+        }
+        // Jobs expected to arrive while a VM warms up, plus those already
+        // waiting.
+        target = static_cast<int>(std::ceil(rate * warm_seconds_)) + static_cast<int>(queued);
+        int upper = options_.max_standby >= 0 ? options_.max_standby : static_cast<int>(slots_.size());
+        target = std::max(options_.min_standby, std::min(target, std::max(1, upper)));
+        if (target != standby_target_) {
+            std::cout << "[pool] standby target " << target << " (" << rate * 60 << " jobs/min, "
+                      << warm_seconds_ << "s to warm a VM)" << std::endl;
+            standby_target_ = target;
+        }
+    }
+    // Nothing is coming any more.
+    if (queue_.closed() && queued == 0) return;
+
+    int warm = 0;
+    for (auto &slot : slots_) {
+        if (slot->stage == Stage::Warming || slot->stage == Stage::Ready) ++warm;
+    }
+    for (auto &slot_ptr : slots_) {
+        Slot &slot = *slot_ptr;
+        if (slot.stage != Stage::Parked) continue;
+        const std::string &backend = slot.vm.backend;
+        auto accept = [&slot](const Job &j) { return takes_job(slot.vm, j); };
+        // A job pinned to this backend must not wait behind warm VMs that
+        // can never take it.
+        bool stranded = queue_.count(accept) > 0 &&
+                        std::none_of(slots_.begin(), slots_.end(), [&](const std::unique_ptr<Slot> &other) {
+                            return other->vm.backend == backend &&
+                                   (other->stage == Stage::Warming || other->stage == Stage::Ready ||
+                                    other->stage == Stage::Busy);
+                        });
+        if (warm < target || stranded) {
+            // Out of host headroom: nothing else starts this round either.
+            if (!wake(slot)) break;
+            ++warm;
+        }
+    }
+    // Ready VMs left over after dispatch() have nothing to run.
+    for (auto &slot_ptr : slots_) {
+        if (warm <= target) break;
+        if (slot_ptr->stage != Stage::Ready) continue;
+        park(*slot_ptr);
+        --warm;
+    }
+}
+
+void VMPool::scale_tick() {
+    rescale();
+    loop_.add_timer(1000, [this] { scale_tick(); });
+}
+
+bool VMPool::wake(Slot &slot) {
+    std::string reason;
+    if (options_.governor && !options_.governor->admit(slot.vm, &reason)) {
+        if (!admission_retry_) {
+            std::cout << "[pool] " << slot.vm.vm_name << " held back: " << reason << std::endl;
+            admission_retry_ = true;
+            loop_.add_timer(1000, [this] {
+                admission_retry_ = false;
+                rescale();
+            });
+        }
+        return false;
+    }
+    slot.set_stage(Slot::Stage::Warming);
+    slot.warm_begin = std::chrono::steady_clock::now();
+    run_step([this, &slot] { boot(slot); });
+    return true;
+}
+
+void VMPool::park(Slot &slot) {
+    std::cout << "[pool] " << slot.vm.vm_name << " parked" << std::endl;
+    slot.set_stage(Slot::Stage::Parking);
+    run_step([this, &slot] {
+        close_ssh_session(slot.session);
+        if (recycle(slot) != 0) {
+            std::cerr << "[pool] " << slot.vm.vm_name << ": failed to revert VM, retiring it" << std::endl;
+            return retire(slot);
+        }
+        if (options_.governor) options_.governor->release(slot.vm);
+        loop_.post([this, &slot] {
+            slot.set_stage(Slot::Stage::Parked);
+            dispatch();
+        });
+    });
+}
+
+void VMPool::run_job(Slot &slot) {
+    std::cout << "[pool] " << slot.vm.vm_name << " <- " << slot.job.file_path << std::endl;
+    // The dispatch and the VM going busy are on disk before the guest is
+    // touched, so a crash from here on gets the VM reverted, not reattached.
+    if (options_.journal) options_.journal->sync();
+    // Time spent idle waiting for this job is not part of its cycle.
+    slot.phases.mark();
+    int rc = inject_sample(slot.session, slot.vm, slot.job.file_path, slot.remote_file);
+    job_lap(slot, "inject");
+    if (rc != 0) return settle(slot, rc, "");
+
+    int timeout = slot.job.timeout > 0 ? slot.job.timeout : options_.agent_timeout;
+    slot.assembler = std::make_unique<ReportAssembler>();
+    slot.scorer = ReportScorer();
+    slot.stop_reason.clear();
+    ExecOptions opts;
+    opts.timeout_seconds = timeout + kAgentGraceSeconds;
+    ReportAssembler *assembler = slot.assembler.get();
+    opts.on_stdout = [assembler](const char *data, size_t len) { assembler->feed(data, len); };
+    if (options_.stop_score > 0 || options_.idle_timeout > 0) {
+        assembler->on_record([this, &slot](const std::string &type, const Json &record) {
+            watch_agent(slot, type, record);
+        });
+    }
+    Argv argv = slot.backend->guest_command(
+        slot.session, agent_stream_command(slot.remote_file, guest_output_dir(slot.vm), timeout));
+
+    loop_.post([this, &slot, argv, opts] {
+        slot.last_activity = std::chrono::steady_clock::now();
+        int pid = loop_.spawn(argv, opts, [this, &slot](CommandResult res) {
+            slot.agent_pid = -1;
+            if (slot.idle_timer >= 0) loop_.cancel_timer(slot.idle_timer);
+            slot.idle_timer = -1;
+            int agent_rc = res.return_code;
+            run_step([this, &slot, agent_rc] { finish_job(slot, agent_rc); });
+        });
+        if (pid < 0) return;
+        slot.agent_pid = pid;
+        if (options_.idle_timeout > 0) {
+            slot.idle_timer = loop_.add_timer(options_.idle_timeout * 1000, [this, &slot] { check_idle(slot); });
+        }
+    });
+}
+
+void VMPool::watch_agent(Slot &slot, const std::string &type, const Json &record) {
+    if (slot.scorer.add(type, record)) slot.last_activity = std::chrono::steady_clock::now();
+    if (options_.stop_score > 0 && slot.scorer.verdict().score >= options_.stop_score) stop_agent(slot, "verdict");
+}
+
+void VMPool::check_idle(Slot &slot) {
+    slot.idle_timer = -1;
+    auto idle_until = slot.last_activity + std::chrono::seconds(options_.idle_timeout);
+    auto now = std::chrono::steady_clock::now();
+    if (now >= idle_until) return stop_agent(slot, "idle");
+    int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(idle_until - now).count());
+    slot.idle_timer = loop_.add_timer(std::max(1, ms), [this, &slot] { check_idle(slot); });
+}
+
+void VMPool::stop_agent(Slot &slot, const std::string &reason) {
+    if (slot.agent_pid < 0 || !slot.stop_reason.empty()) return;
+    slot.stop_reason = reason;
+    std::cout << "[pool] " << slot.vm.vm_name << ": ending " << slot.job.file_path << " early ("
+              << (reason == "idle" ? "idle for " + std::to_string(options_.idle_timeout) + "s"
+                                   : "score " + std::to_string(slot.scorer.verdict().score))
+              << ")" << std::endl;
+    global_metrics().count_early_stop(slot.vm.backend, reason);
+    // Killing the ssh (or vsock) client is enough: the agent left behind in
+    // the guest goes with the revert that follows. The exit callback still
+    // runs as usual and takes the job on to finish_job.
+    kill(-slot.agent_pid, SIGKILL);
+}
+
+void VMPool::finish_job(Slot &slot, int agent_rc) {
+    ReportAssembler &assembler = *slot.assembler;
+    assembler.finish();
+    assembler.on_record(nullptr);
+    if (!slot.stop_reason.empty()) {
+        // Close the report the way the agent would have, so it counts as
+        // complete (and can be cached) and says why it is short.
+        std::string time = utc_timestamp();
+        Json event = Json::object();
+        event["type"] = Json("event");
+        event["time"] = Json(time);
+        event["event"] = Json("early-stop");
+        event["reason"] = Json(slot.stop_reason);
+        Json end = Json::object();
+        end["type"] = Json("end");
+        end["time"] = Json(time);
+        std::string lines = dump_json(event) + "\n" + dump_json(end) + "\n";
+        assembler.feed(lines.data(), lines.size());
+        agent_rc = 0;
+    }
+    if (assembler.malformed() > 0) {
+        std::cerr << "Skipped " << assembler.malformed() << " malformed agent records." << std::endl;
+    }
+    slot.job.usage = slot.backend->usage(slot.vm.vm_name);
+    slot.backend->release(slot.vm.vm_name);
+    job_lap(slot, "agent");
+    if (agent_rc != 0) {
+        std::cerr << "Agent run failed (exit " << agent_rc << ")." << std::endl;
+    }
+    slot.agent_rc = agent_rc;
+    if (options_.artifacts) return loop_.post([this, &slot] { collect_artifacts(slot); });
+    report_job(slot);
+}
+
+void VMPool::collect_artifacts(Slot &slot) {
+    std::string staging = slot.job.report_dir + "/.artifacts";
+    Argv argv = artifact_unpack_command(
+        slot.backend->guest_command(slot.session, artifact_pack_command(guest_output_dir(slot.vm))), staging);
+    ExecOptions opts;
+    opts.timeout_seconds = kArtifactTimeoutSeconds;
+    loop_.spawn(argv, opts, [this, &slot, staging](CommandResult res) {
+        int rc = res.return_code;
+        run_step([this, &slot, staging, rc] { store_artifacts(slot, staging, rc); });
+    });
+}
+
+void VMPool::store_artifacts(Slot &slot, const std::string &staging, int rc) {
+    if (rc != 0) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": artifact transfer failed (exit " << rc
+                  << "), keeping what arrived" << std::endl;
+    }
+    std::vector<Artifact> artifacts;
+    std::string error;
+    if (!import_artifacts(staging, slot.job.report_dir, options_.artifacts, artifacts, &error)) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": " << error << std::endl;
+    }
+    for (const Artifact &artifact : artifacts) {
+        global_metrics().count_artifact_bytes(slot.vm.backend, !artifact.added, artifact.size);
+    }
+    job_lap(slot, "artifacts");
+    report_job(slot);
+}
+
+void VMPool::report_job(Slot &slot) {
+    ReportAssembler &assembler = *slot.assembler;
+    std::string path = write_report(assembler, slot.job.report_dir, &slot.phases, &slot.verdict,
+                                    options_.report_format);
+    job_lap(slot, "report");
+    // The partial report stays for a look, but the run counts as failed (and
+    // is retried) if ssh dropped, the agent timed out or crashed, or its
+    // stream never got to the end.
+    int rc = slot.agent_rc != 0 ? slot.agent_rc : assembler.complete() ? 0 : kIncompleteRun;
+    settle(slot, rc, assembler.complete() ? path : "");
+}
+
+void VMPool::settle(Slot &slot, int rc, const std::string &report) {
+    Job &job = slot.job;
+    bool escalate = job.tier == kContainerBackend &&
+                    (rc != 0 || report.empty() || slot.verdict.score >= options_.escalate_score);
+    if (rc == 0 && options_.cache && !job.sha256.empty() && !report.empty() && !escalate) {
+        options_.cache->store(job.sha256, fingerprint(job), report);
+    }
+    int retries = job.retries >= 0 ? job.retries : options_.retries;
+    if (escalate) {
+        std::cout << "[pool] " << job.file_path << ": escalating to a VM ("
+                  << (rc != 0 || report.empty() ? "container run failed"
+                                                : "score " + std::to_string(slot.verdict.score))
+                  << ")" << std::endl;
+        stash_tier_report(job);
+        job.tier = "vm";
+        job.usage = Json();
+        global_metrics().count_job(slot.vm.backend, "escalated");
+        if (options_.journal) options_.journal->submitted(job);
+        publish_status(job, "queued");
+        queue_.push(job);
+    } else if (rc != 0 && job.attempt < retries) {
+        std::cerr << "[pool] " << job.file_path << " failed (exit " << rc << "), retrying" << std::endl;
+        ++job.attempt;
+        if (options_.journal) options_.journal->submitted(job);
+        publish_status(job, "queued");
+        queue_.push(job);
+    } else {
+        publish_job(job, write_job_record(job, slot.vm.vm_name, rc, false, &slot.phases,
+                                          rc == 0 ? &slot.verdict : nullptr));
+        global_metrics().count_job(slot.vm.backend, rc == 0 ? "completed" : "failed");
+        if (options_.journal) options_.journal->completed(job, rc);
+        if (rc == 0) ++completed_;
+        else ++failed_;
+    }
+
+    close_ssh_session(slot.session);
+    slot.phases.mark();
+    int revert_rc = recycle(slot);
+    slot.phases.lap("revert");
+    if (revert_rc != 0) {
+        std::cerr << "[pool] " << slot.vm.vm_name << ": failed to revert VM, retiring it" << std::endl;
+        return retire(slot);
+    }
+    // Clean and powered off; rescale() decides whether it boots again now.
+    if (options_.governor) options_.governor->release(slot.vm);
+    loop_.post([this, &slot] {
+        slot.set_stage(Slot::Stage::Parked);
+        dispatch();
+    });
+}
+
+void VMPool::job_lap(Slot &slot, const std::string &phase) {
+    slot.phases.lap(phase);
+    if (options_.journal) options_.journal->phase(slot.job, phase);
+}
+
+int VMPool::recycle(Slot &slot) {
+    if (slot.vm.clone) return slot.backend->reset_clone(*slot.vm.clone);
+    return slot.backend->revert(slot.vm.vm_name);
+}
+
+void VMPool::retire(Slot &slot) {
+    close_ssh_session(slot.session);
+    // Leave the VM powered off at its clean snapshot, as the pool found it;
+    // clones only lived for this pool.
+    if (slot.backend) {
+        if (slot.cloned) slot.backend->delete_clone(*slot.vm.clone);
+        else if (!slot.vm.clone) slot.backend->revert(slot.vm.vm_name);
+    }
+    if (options_.governor) options_.governor->release(slot.vm);
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        ++retired_;
+    }
+    retired_cv_.notify_all();
+    // A retry this VM would have taken may now be stranded on the others.
+    loop_.post([this, &slot] {
+        slot.set_stage(Slot::Stage::Retired);
+        dispatch();
+    });
+}
+
+} // namespace safebox
@@ -0,0 +1,304 @@
+#pragma once
+
+#include "artifacts.h"
+#include "event_loop.h"
+#include "events.h"
+#include "governor.h"
+#include "mpmc_queue.h"
+#include "safebox.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace safebox {
+
+// Scheduling classes, most urgent first: interactive submissions (the web
+// UI) go ahead of normal jobs, which go ahead of bulk batch scans.
+enum class Priority { Interactive, Normal, Batch };
+
+const char *priority_name(Priority priority);
+// "interactive", "normal" or "batch"; false for anything else.
+bool parse_priority(const std::string &name, Priority &priority);
+
+struct Job {
+    std::string file_path;
+    std::string report_dir;
+    // Optional, from a manifest entry (see load_manifest).
+    std::string id = "";
+    // Agent timeout in seconds; 0 for PoolOptions::agent_timeout.
+    int timeout = 0;
+    // Only VMs of this backend take the job; empty for any VM.
+    std::string backend = "";
+    std::vector<std::string> tags = {};
+    // Extra attempts after a failure; -1 for PoolOptions::retries.
+    int retries = -1;
+    int attempt = 0;
+    // Filled in by VMPool::submit when a cache or hash index is configured.
+    std::string sha256 = "";
+    // Static triage summary (triage_json without strings), if it ran.
+    Json triage = Json();
+    // Set by VMPool::submit with PoolOptions::escalate_score: "container"
+    // while the job is for the container tier, "vm" once it needs a full VM.
+    std::string tier = "";
+    // Backend::usage() of the run, if the backend accounts for it.
+    Json usage = Json();
+    // Scheduling, see JobQueue. Jobs of one tenant share one fair share;
+    // deadline is the number of seconds after submission by which the job
+    // should have started, 0 for none.
+    Priority priority = Priority::Normal;
+    std::string tenant = "";
+    int deadline = 0;
+    // Set by JobQueue: first submission (retries keep it), the latest push
+    // and the seconds the job then waited before a VM took it.
+    std::chrono::steady_clock::time_point submitted = {};
+    std::chrono::steady_clock::time_point queued = {};
+    double queue_wait = 0;
+    // Set by VMPool::submit when a journal is configured.
+    uint64_t journal_seq = 0;
+};
+
+// The job's id, else its report_dir: how events and the journal name it.
+std::string job_key(const Job &job);
+
+class JobJournal;
+
+// Scheduling queue shared by all pool workers. pop() returns false once the
+// queue has been closed and every queued job (that accept matches) has been
+// handed out.
+//
+// The next job is, among those accept() returns true for:
+//   1. the one with the earliest deadline, if that deadline is less than
+//      deadline_slack seconds away (or already missed);
+//   2. otherwise one of the highest priority class, where every aging
+//      seconds of waiting lifts a job one class so batch work cannot starve;
+//   3. within a class, the oldest job of the tenant that has been served
+//      least. A tenant that was idle starts level with the one served last,
+//      so it cannot claim a burst for the time it had nothing queued.
+// push() goes through a lock-free ring, so submitters neither block on each
+// other nor on the dispatching thread; consumers move the ring's jobs into
+// the schedule under the lock.
+class JobQueue {
+public:
+    using AcceptFn = std::function<bool(const Job&)>;
+
+    explicit JobQueue(int aging = 600, int deadline_slack = 30);
+
+    void push(Job job);
+    // Takes the next job accept() returns true for (any if accept is
+    // empty), waiting for one.
+    bool pop(Job &job, const AcceptFn &accept = nullptr);
+    // Like pop, but returns false instead of waiting.
+    bool try_pop(Job &job, const AcceptFn &accept = nullptr);
+    // Queued jobs accept() returns true for (all if accept is empty).
+    size_t count(const AcceptFn &accept = nullptr);
+    void close();
+    bool closed();
+    size_t size();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Both with mutex_ held.
+    void collect();
+    void insert(Job job);
+    bool take(Job &job, const AcceptFn &accept);
+
+    const int aging_;
+    const int deadline_slack_;
+
+    MpmcQueue<Job> submissions_;
+    std::atomic<int> waiters_{0};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // Queued jobs by arrival; the per-class, per-tenant queues and the
+    // deadline order hold their sequence numbers.
+    std::map<uint64_t, Job> jobs_;
+    std::map<std::string, std::deque<uint64_t>> classes_[3];
+    std::set<std::pair<Clock::time_point, uint64_t>> deadlines_;
+    std::map<std::string, uint64_t> served_;
+    std::map<std::string, size_t> backlog_;
+    uint64_t next_seq_ = 0;
+    uint64_t virtual_time_ = 0;
+    bool closed_ = false;
+};
+
+struct PoolOptions {
+    int ssh_timeout = 120;
+    int agent_timeout = 120;
+    // Failed jobs (the sample could not be injected, the agent command exited
+    // nonzero or its stream ended early) are queued again, for a fresh VM,
+    // up to this many times.
+    int retries = 0;
+    // Jobs whose sample already has a cached report finish in submit()
+    // without touching a VM; completed reports are added to it.
+    const ResultCache *cache = nullptr;
+    // Jobs whose sample is in this index of known-malware hashes finish in
+    // submit() with a hash-match verdict, before the cache or any VM.
+    const HashIndex *hash_index = nullptr;
+    // Runs triage_file on every sample in submit(). Samples it decides are
+    // known or inert finish there; the rest get report_dir/triage.json and
+    // go to a VM.
+    bool static_triage = false;
+    // Threads for the short blocking steps (hypervisor commands, scp,
+    // report writing). Waiting on agents, sshd and READY lines happens on
+    // the pool's single event-loop thread, so this does not grow with the
+    // number of VMs.
+    int threads = 4;
+    // Standby scaling. By default every VM is kept booted and ready. With
+    // min_standby >= 0 only as many VMs are kept warm (booted or booting but
+    // not running a job) as recent demand calls for: the arrival rate over
+    // the last scale_window seconds times the observed time to warm a VM,
+    // plus the queue depth, clamped to [min_standby, max_standby]. The rest
+    // stay reverted and powered off until needed. max_standby < 0 means no
+    // upper bound but the number of VMs.
+    int min_standby = -1;
+    int max_standby = -1;
+    int scale_window = 30;
+    ReportFormat report_format = ReportFormat::Json;
+    // Each VM's resources are applied when the pool starts, and it only
+    // powers on once the governor admits it; refused VMs stay parked and are
+    // retried every second.
+    ResourceGovernor *governor = nullptr;
+    // JobQueue policy: seconds of waiting per class a job is lifted, and how
+    // close a deadline has to be before it overrides priority and fairness.
+    int aging = 600;
+    int deadline_slack = 30;
+    // Early termination. The streamed agent records are scored as they
+    // arrive (ReportScorer), and the run ends, the VM going straight to
+    // revert, once the verdict reaches stop_score or nothing has happened
+    // (ReportScorer::add) for idle_timeout seconds. The report then ends in
+    // an early-stop event. 0 turns either off.
+    int stop_score = 0;
+    int idle_timeout = 0;
+    // Container tier. With escalate_score >= 0 (and static_triage), samples
+    // whose static verdict scores below it run on the pool's "container"
+    // VMs first; those whose container run scores escalate_score or more, or
+    // does not complete, are queued again for a full VM, the container's
+    // report kept in report_dir/container. Everything else, and jobs pinned
+    // to a backend, never touch the container tier.
+    int escalate_score = -1;
+    // Artifact collection. Once the agent is done, everything in the guest's
+    // output dir (its out-/err- logs, dropped files) comes back as one zstd
+    // tar stream, spawned on the event loop so the transfers of many VMs
+    // overlap, and lands in report_dir/artifacts (listed in
+    // artifacts.json), each file stored once here by content.
+    const ArtifactStore *artifacts = nullptr;
+    // Every VM stage change and job transition (queued, running, then the
+    // job.json record once done) is published here as "vm/<name>" and
+    // "job/<id or report_dir>".
+    EventPublisher *events = nullptr;
+    // Crash recovery (JobJournal, opened). start() requeues the jobs an
+    // interrupted pool left queued or running, reverts the VMs that were
+    // running them and takes over ready ones as they are, once a probe and
+    // an "echo ok" show they still answer; submit() ignores jobs the journal
+    // already has. Every job and VM transition is then recorded in it.
+    JobJournal *journal = nullptr;
+};
+
+// Runs jobs on a fixed set of VMs. Each VM is booted once, then repeatedly
+// takes the next job, runs it and reverts + reboots before taking another,
+// so every job lands on a clean guest that is already reachable. VMs with a
+// CloneSpec are created when the pool starts and deleted when it drains.
+// Once a job is finally done its report_dir gets a job.json with its id,
+// tags, attempts and outcome.
+//
+// Every VM is a small state machine (boot -> wait for guest -> idle -> run
+// -> recycle -> park or boot ...) rather than a thread: blocking steps go to
+// PoolOptions::threads step threads and all waiting to one EventLoop, so a
+// single host process can drive dozens of VMs.
+class VMPool {
+public:
+    explicit VMPool(std::vector<VMConfig> vms, PoolOptions options = {});
+    ~VMPool();
+
+    void start();
+    // Queues the job, or finishes it at once from the cache.
+    void submit(Job job);
+    // Closes the queue and waits for the VMs to finish outstanding jobs.
+    void drain();
+
+    int completed() const { return completed_; }
+    int failed() const { return failed_; }
+
+private:
+    struct Slot;
+
+    // Step threads.
+    void run_step(std::function<void()> step);
+    void step_thread();
+
+    // The per-VM state machine. recover, boot, resolve_address, probe_ssh,
+    // run_job, finish_job, store_artifacts, report_job, settle and retire run
+    // on a step thread, the rest on the loop thread.
+    void recover(Slot &slot);
+    void boot(Slot &slot);
+    void resolve_address(Slot &slot);
+    void await_ready(Slot &slot);
+    void connect_ready(Slot &slot);
+    void end_ready_wait(Slot &slot, bool ready);
+    void probe_ssh(Slot &slot);
+    void confirm_ssh(Slot &slot);
+    void retry_ssh(Slot &slot);
+    void dispatch();
+    void rescale();
+    void scale_tick();
+    bool wake(Slot &slot);
+    void park(Slot &slot);
+    void run_job(Slot &slot);
+    void watch_agent(Slot &slot, const std::string &type, const Json &record);
+    void check_idle(Slot &slot);
+    void stop_agent(Slot &slot, const std::string &reason);
+    void finish_job(Slot &slot, int agent_rc);
+    void collect_artifacts(Slot &slot);
+    void store_artifacts(Slot &slot, const std::string &staging, int rc);
+    void report_job(Slot &slot);
+    void settle(Slot &slot, int rc, const std::string &report);
+    void retire(Slot &slot);
+
+    int recycle(Slot &slot);
+    void job_lap(Slot &slot, const std::string &phase);
+    void publish_status(const Job &job, const std::string &status, const std::string &vm = "");
+    void publish_job(const Job &job, const Json &record);
+    std::string fingerprint(const Job &job) const;
+
+    std::vector<VMConfig> vms_;
+    PoolOptions options_;
+    JobQueue queue_;
+    std::atomic<int> completed_{0};
+    std::atomic<int> failed_{0};
+
+    // Standby scaling state; arrivals_ is fed by submit(), the rest lives on
+    // the loop thread.
+    std::mutex arrivals_mutex_;
+    std::deque<std::chrono::steady_clock::time_point> arrivals_;
+    double warm_seconds_ = 0;
+    int standby_target_ = -1;
+    bool admission_retry_ = false;
+
+    std::vector<std::unique_ptr<Slot>> slots_;
+    EventLoop loop_;
+    std::thread loop_thread_;
+    bool started_ = false;
+
+    std::vector<std::thread> step_threads_;
+    std::mutex steps_mutex_;
+    std::condition_variable steps_cv_;
+    std::deque<std::function<void()>> steps_;
+    bool steps_closed_ = false;
+
+    std::mutex retired_mutex_;
+    std::condition_variable retired_cv_;
+    size_t retired_ = 0;
+};
+
+} // namespace safebox
@@ -0,0 +1,248 @@
+#include "process.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace safebox {
+
+namespace {
+
+std::vector<std::string> build_environment(const ExecOptions &options) {
+    std::vector<std::string> env;
+    if (!options.clear_env) {
+        for (char **e = environ; *e; ++e) {
+            std::string entry = *e;
+            std::string name = entry.substr(0, entry.find('='));
+            bool overridden = false;
+            for (const std::string &o : options.env) {
+                if (o.compare(0, name.size() + 1, name + "=") == 0) {
+                    overridden = true;
+                    break;
+                }
+            }
+            if (!overridden) env.push_back(entry);
+        }
+    }
+    env.insert(env.end(), options.env.begin(), options.env.end());
+    return env;
+}
+
+std::vector<char*> to_cstrings(std::vector<std::string> &strings) {
+    std::vector<char*> out;
+    for (std::string &s : strings) out.push_back(&s[0]);
+    out.push_back(nullptr);
+    return out;
+}
+
+using Sink = std::function<void(const char*, size_t)>;
+
+// Reads whatever is available on fd into out, or into sink when one is set.
+// Returns false once the write side has been closed.
+bool drain_pipe(int fd, std::string &out, const Sink &sink = nullptr) {
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            if (sink) sink(buf, static_cast<size_t>(n));
+            else out.append(buf, static_cast<size_t>(n));
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+} // namespace
+
+std::string format_command(const Argv &argv) {
+    std::string out;
+    for (const std::string &arg : argv) {
+        if (!out.empty()) out += ' ';
+        out += arg;
+    }
+    return out;
+}
+
+int spawn_piped(const Argv &argv, const ExecOptions &options, int &stdout_fd, int &stderr_fd,
+                std::string *error) {
+    if (argv.empty()) return -1;
+
+    int out_pipe[2];
+    int err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) return -1;
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+    // The child gets its own process group so a timeout also takes down
+    // anything it forked (ssh ProxyCommands, nohup'd helpers, ...).
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    Argv args = argv;
+    std::vector<std::string> env = build_environment(options);
+    std::vector<char*> c_args = to_cstrings(args);
+    std::vector<char*> c_env = to_cstrings(env);
+
+    pid_t pid = -1;
+    int spawn_rc = posix_spawnp(&pid, c_args[0], &actions, &attr, c_args.data(), c_env.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    if (spawn_rc != 0) {
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        if (error) *error = std::string("failed to spawn ") + argv[0] + ": " + std::strerror(spawn_rc);
+        return -1;
+    }
+
+    fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+    stdout_fd = out_pipe[0];
+    stderr_fd = err_pipe[0];
+    return pid;
+}
+
+int decode_exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+bool read_available(int fd, std::string &out, const std::function<void(const char*, size_t)> &sink) {
+    return drain_pipe(fd, out, sink);
+}
+
+void log_command_failure(const CommandResult &result) {
+    if (result.return_code != 0 && !result.stderr.empty()) {
+        std::cerr << "[cmd] exit " << result.return_code << ": " << result.stderr;
+        if (result.stderr.back() != '\n') std::cerr << std::endl;
+    }
+}
+
+CommandResult execute_command(const Argv &argv, const ExecOptions &options) {
+    CommandResult result{-1, "", ""};
+    std::cerr << "[cmd] " << format_command(argv) << std::endl;
+    if (argv.empty()) return result;
+
+    int out_fd = -1;
+    int err_fd = -1;
+    std::string spawn_error;
+    pid_t pid = spawn_piped(argv, options, out_fd, err_fd, &spawn_error);
+    if (pid < 0) {
+        if (!spawn_error.empty()) {
+            result.return_code = 127;
+            result.stderr = spawn_error;
+        }
+        return result;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.timeout_seconds);
+    bool out_open = true;
+    bool err_open = true;
+    bool reaped = false;
+    int status = 0;
+
+    // Background grandchildren (a remote `cmd &`, a nohup'd helper) can keep
+    // the pipes open after the child itself has exited, so the loop ends on
+    // child exit rather than on EOF.
+    while (!reaped) {
+        int wait_ms = 100;
+        if (options.timeout_seconds > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) {
+                kill(-pid, SIGKILL);
+                result.timed_out = true;
+                waitpid(pid, &status, 0);
+                reaped = true;
+                break;
+            }
+            if (left < wait_ms) wait_ms = static_cast<int>(left);
+        }
+
+        if (out_open || err_open) {
+            pollfd fds[2] = {{out_fd, POLLIN, 0}, {err_fd, POLLIN, 0}};
+            if (!out_open) fds[0].fd = -1;
+            if (!err_open) fds[1].fd = -1;
+            if (poll(fds, 2, wait_ms) > 0) {
+                if (fds[0].revents) out_open = drain_pipe(out_fd, result.stdout, options.on_stdout);
+                if (fds[1].revents) err_open = drain_pipe(err_fd, result.stderr);
+            }
+            pid_t w = waitpid(pid, &status, WNOHANG);
+            if (w == pid) reaped = true;
+        } else {
+            // Both pipes hit EOF; the child is about to exit.
+            if (options.timeout_seconds == 0) {
+                waitpid(pid, &status, 0);
+                reaped = true;
+            } else {
+                pid_t w = waitpid(pid, &status, WNOHANG);
+                if (w == pid) reaped = true;
+                else poll(nullptr, 0, wait_ms);
+            }
+        }
+    }
+
+    if (out_open) drain_pipe(out_fd, result.stdout, options.on_stdout);
+    if (err_open) drain_pipe(err_fd, result.stderr);
+    close(out_fd);
+    close(err_fd);
+
+    result.return_code = result.timed_out ? 124 : decode_exit_status(status);
+    log_command_failure(result);
+    return result;
+}
+
+int spawn_detached(const Argv &argv, const std::string &log_path) {
+    std::cerr << "[cmd] " << format_command(argv) << " &" << std::endl;
+    if (argv.empty()) return -1;
+
+    const char *out = log_path.empty() ? "/dev/null" : log_path.c_str();
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    // A session of its own keeps the daemon out of our timeouts' process
+    // groups and away from our terminal's signals.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+
+    Argv args = argv;
+    std::vector<char*> c_args = to_cstrings(args);
+    pid_t pid = -1;
+    int spawn_rc = posix_spawnp(&pid, c_args[0], &actions, &attr, c_args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (spawn_rc != 0) {
+        std::cerr << "[cmd] failed to spawn " << argv[0] << ": " << std::strerror(spawn_rc) << std::endl;
+        return -1;
+    }
+    return pid;
+}
+
+} // namespace safebox
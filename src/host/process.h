@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+using Argv = std::vector<std::string>;
+
+struct CommandResult {
+    int return_code;
+    std::string stdout;
+    std::string stderr;
+    bool timed_out = false;
+};
+
+struct ExecOptions {
+    // Kill the child with SIGKILL after this many seconds; 0 means no limit.
+    int timeout_seconds = 0;
+    // Extra NAME=value entries, overriding inherited variables of that name.
+    std::vector<std::string> env;
+    // Start the child from an empty environment instead of ours.
+    bool clear_env = false;
+    // When set, stdout is handed over chunk by chunk as it arrives instead of
+    // being collected into CommandResult::stdout.
+    std::function<void(const char *data, size_t len)> on_stdout;
+};
+
+using ExecFn = std::function<CommandResult(const Argv&)>;
+
+// Spawns argv[0] (looked up in PATH) directly, without a shell, and collects
+// its stdout/stderr. return_code is the exit status, 128 + signal number if
+// the child was killed, 124 on timeout and 127 if it could not be started.
+CommandResult execute_command(const Argv &argv, const ExecOptions &options = {});
+
+// Building blocks of execute_command for callers that multiplex children
+// themselves (EventLoop). spawn_piped starts argv like execute_command, in
+// its own process group, and hands back non-blocking read ends of its
+// stdout/stderr; returns the pid, or -1 with *error set if it could not be
+// started. read_available appends what is readable on fd to out (or passes
+// it to sink) and returns false at EOF. decode_exit_status maps a waitpid
+// status to execute_command's return codes.
+int spawn_piped(const Argv &argv, const ExecOptions &options, int &stdout_fd, int &stderr_fd,
+                std::string *error = nullptr);
+bool read_available(int fd, std::string &out,
+                    const std::function<void(const char *data, size_t len)> &sink = nullptr);
+int decode_exit_status(int status);
+// Logs a failed command's stderr the way execute_command does.
+void log_command_failure(const CommandResult &result);
+
+// Starts argv[0] in a new session without waiting for it, for long-lived
+// daemons such as a microVM monitor. stdout/stderr go to log_path (appended)
+// or /dev/null. Returns the child's pid, or -1 if it could not be started.
+int spawn_detached(const Argv &argv, const std::string &log_path = "");
+
+std::string format_command(const Argv &argv);
+
+} // namespace safebox
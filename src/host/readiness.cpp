@@ -0,0 +1,127 @@
+#include "readiness.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace safebox {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int ms_left(Clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+// Reads from a non-blocking fd until `want` has been seen as a prefix of the
+// data (or, with `anywhere`, inside it), the peer hangs up, or time runs out.
+bool read_until(int fd, const std::string &want, bool anywhere, Clock::time_point deadline) {
+    std::string data;
+    for (;;) {
+        int wait_ms = ms_left(deadline);
+        if (wait_ms == 0) return false;
+        pollfd pfd{fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, wait_ms);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) return false;
+
+        char buf[256];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) return false;
+        data.append(buf, static_cast<size_t>(n));
+
+        if (anywhere) {
+            if (data.find(want) != std::string::npos) return true;
+        } else if (data.size() >= want.size()) {
+            return data.compare(0, want.size(), want) == 0;
+        }
+    }
+}
+
+bool connect_nonblocking(int fd, const sockaddr *addr, socklen_t len, Clock::time_point deadline) {
+    if (connect(fd, addr, len) == 0) return true;
+    if (errno != EINPROGRESS) return false;
+
+    pollfd pfd{fd, POLLOUT, 0};
+    if (poll(&pfd, 1, ms_left(deadline)) <= 0) return false;
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    return err == 0;
+}
+
+} // namespace
+
+bool probe_ssh_banner(const std::string &host, int port, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return false;
+
+    bool ok = false;
+    for (addrinfo *ai = res; ai && !ok; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        ok = connect_nonblocking(fd, ai->ai_addr, ai->ai_addrlen, deadline)
+             && read_until(fd, "SSH-", false, deadline);
+        close(fd);
+    }
+    freeaddrinfo(res);
+    return ok;
+}
+
+bool wait_for_agent_ready(const std::string &socket_path, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) return false;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // The socket only appears once the hypervisor has started the VM.
+    auto backoff = std::chrono::milliseconds(5);
+    while (ms_left(deadline) > 0) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        if (connect_nonblocking(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr), deadline)) {
+            bool ready = read_until(fd, "READY", true, deadline);
+            close(fd);
+            return ready;
+        }
+        close(fd);
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(200));
+    }
+    return false;
+}
+
+int connect_agent_channel(const std::string &socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) return -1;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    // Unix-domain connects complete (or fail) immediately.
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace safebox
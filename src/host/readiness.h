@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace safebox {
+
+// Returns true if a TCP connection to host:port completes and the peer sends
+// an SSH identification banner within timeout_ms. User-mode NAT forwarders
+// (VirtualBox NAT, qemu hostfwd) accept connections before the guest is up,
+// so a bare connect() is not enough.
+bool probe_ssh_banner(const std::string &host, int port, int timeout_ms);
+
+using ProbeFn = std::function<bool(const std::string &host, int port, int timeout_ms)>;
+
+// Waits for the agent's "READY" line on the host end of the guest's
+// virtio-serial channel (a unix socket such as the one libvirt creates for
+// <channel type='unix'> with target name org.safebox.agent.0). Connect
+// right after starting the VM: the guest writes the line once, at boot.
+bool wait_for_agent_ready(const std::string &socket_path, int timeout_ms);
+// Non-blocking building block of wait_for_agent_ready for event loops: a
+// connected, non-blocking fd on the channel, or -1 if it is not there yet.
+int connect_agent_channel(const std::string &socket_path);
+
+} // namespace safebox
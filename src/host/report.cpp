@@ -0,0 +1,481 @@
+#include "report.h"
+#include "matcher.h"
+#include "report_codec.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+namespace safebox {
+
+namespace {
+
+int int_or(const Json &record, const std::string &key) {
+    return static_cast<int>(record.number_or(key, 0));
+}
+
+// Fills an AgentReport from the token stream of a report document. Depths:
+// 1 the report object, 2 a section array (events/processes/network), 3 a
+// record, 4 its memory object, cmdline or connections array, 5 a
+// connection. Other top-level keys (phases, summary, ...) stream past.
+class ReportReader : public JsonHandler {
+public:
+    explicit ReportReader(AgentReport &report) : report_(report) {}
+
+    bool null_value() override { return true; }
+    bool bool_value(bool) override { return true; }
+    bool number_value(double v) override {
+        if (depth_ == 3) {
+            if (key_[3] == "pid") sample_.pid = event_.pid = static_cast<int>(v);
+            else if (key_[3] == "cpu_percent") sample_.cpu_percent = v;
+            else if (key_[3] == "returncode") event_.returncode = static_cast<int>(v);
+        } else if (depth_ == 4 && key_[3] == "memory") {
+            if (key_[4] == "rss") sample_.rss_bytes = v;
+            else if (key_[4] == "vms") sample_.vms_bytes = v;
+        } else if (depth_ == 5 && key_[5] == "pid") {
+            conn_.pid = static_cast<int>(v);
+        }
+        return true;
+    }
+    bool string_value(const std::string &v) override {
+        switch (depth_) {
+        case 1:
+            if (key_[1] == "start_time") report_.start_time = v;
+            else if (key_[1] == "end_time") report_.end_time = v;
+            else if (key_[1] == "path") report_.path = v;
+            else if (key_[1] == "error") report_.error = v;
+            break;
+        case 3:
+            if (key_[3] == "time") time_ = v;
+            else if (key_[3] == "event") event_.event = v;
+            break;
+        case 4:
+            if (section_ == Section::Events && key_[3] == "cmdline") {
+                if (!event_.cmdline.empty()) event_.cmdline += ' ';
+                event_.cmdline += v;
+            }
+            break;
+        case 5:
+            if (key_[5] == "family") conn_.family = v;
+            else if (key_[5] == "type") conn_.type = v;
+            else if (key_[5] == "laddr") conn_.laddr = v;
+            else if (key_[5] == "raddr") conn_.raddr = v;
+            else if (key_[5] == "status") conn_.status = v;
+            break;
+        }
+        return true;
+    }
+    bool key(const std::string &name) override {
+        if (depth_ < kDepths) key_[depth_] = name;
+        return true;
+    }
+    bool begin_object() override { return open(false); }
+    bool end_object() override { return close(); }
+    bool begin_array() override { return open(true); }
+    bool end_array() override { return close(); }
+
+private:
+    enum class Section { None, Events, Processes, Network };
+    static constexpr int kDepths = 6;
+
+    bool open(bool array) {
+        ++depth_;
+        if (depth_ == 2 && array) {
+            if (key_[1] == "events") section_ = Section::Events;
+            else if (key_[1] == "processes") section_ = Section::Processes;
+            else if (key_[1] == "network") section_ = Section::Network;
+        } else if (depth_ == 3 && section_ != Section::None) {
+            time_.clear();
+            sample_ = ProcessSample();
+            event_ = ProcessEvent();
+            snapshot_.clear();
+        } else if (depth_ == 5 && section_ == Section::Network && key_[3] == "connections") {
+            conn_ = Connection();
+        }
+        if (depth_ < kDepths) key_[depth_].clear();
+        return true;
+    }
+
+    bool close() {
+        if (depth_ == 2) {
+            section_ = Section::None;
+        } else if (depth_ == 3) {
+            switch (section_) {
+            case Section::Events:
+                event_.time = time_;
+                report_.add_event(std::move(event_));
+                break;
+            case Section::Processes:
+                sample_.time = time_;
+                report_.add_sample(std::move(sample_));
+                break;
+            case Section::Network:
+                report_.add_network(time_, snapshot_);
+                break;
+            case Section::None:
+                break;
+            }
+        } else if (depth_ == 5 && section_ == Section::Network && key_[3] == "connections") {
+            snapshot_.push_back(std::move(conn_));
+        }
+        --depth_;
+        return true;
+    }
+
+    AgentReport &report_;
+    int depth_ = 0;
+    // Key most recently seen at each depth.
+    std::string key_[kDepths];
+    Section section_ = Section::None;
+    std::string time_;
+    ProcessSample sample_;
+    ProcessEvent event_;
+    Connection conn_;
+    std::vector<Connection> snapshot_;
+};
+
+ProcessEvent event_from_json(const Json &record) {
+    ProcessEvent ev;
+    ev.time = record.string_or("time", "");
+    ev.event = record.string_or("event", "");
+    ev.pid = int_or(record, "pid");
+    ev.returncode = int_or(record, "returncode");
+    if (const Json *cmdline = record.find("cmdline")) {
+        for (const Json &arg : cmdline->items()) {
+            if (!arg.is_string()) continue;
+            if (!ev.cmdline.empty()) ev.cmdline += ' ';
+            ev.cmdline += arg.as_string();
+        }
+    }
+    return ev;
+}
+
+ProcessSample sample_from_json(const Json &record) {
+    ProcessSample sample;
+    sample.time = record.string_or("time", "");
+    sample.pid = int_or(record, "pid");
+    sample.cpu_percent = record.number_or("cpu_percent", 0);
+    if (const Json *memory = record.find("memory")) {
+        sample.rss_bytes = memory->number_or("rss", 0);
+        sample.vms_bytes = memory->number_or("vms", 0);
+    }
+    return sample;
+}
+
+std::vector<Connection> snapshot_from_json(const Json &record) {
+    std::vector<Connection> snapshot;
+    if (const Json *conns = record.find("connections")) {
+        for (const Json &c : conns->items()) {
+            Connection conn;
+            conn.family = c.string_or("family", "");
+            conn.type = c.string_or("type", "");
+            conn.laddr = c.string_or("laddr", "");
+            conn.raddr = c.string_or("raddr", "");
+            conn.status = c.string_or("status", "");
+            conn.pid = int_or(c, "pid");
+            snapshot.push_back(std::move(conn));
+        }
+    }
+    return snapshot;
+}
+
+// A socket keeps its identity (and report row) as its status changes.
+std::string connection_key(const Connection &conn) {
+    return conn.family + '|' + conn.type + '|' + conn.laddr + '|' + conn.raddr + '|' + std::to_string(conn.pid);
+}
+
+// Python's str(float): the shortest form that reads back the same, with a
+// trailing ".0" on whole numbers, so detections read like the Python ones.
+std::string python_float(double v) {
+    char buf[32];
+    for (int precision = 1; precision <= 17; ++precision) {
+        std::snprintf(buf, sizeof(buf), "%.*g", precision, v);
+        if (std::strtod(buf, nullptr) == v) break;
+    }
+    std::string s = buf;
+    if (s.find_first_of(".en") == std::string::npos) s += ".0";
+    return s;
+}
+
+std::string one_decimal(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f", v);
+    return buf;
+}
+
+} // namespace
+
+void AgentReport::add(const std::string &type, const Json &record) {
+    if (type == "start") {
+        start_time = record.string_or("time", "");
+        path = record.string_or("path", "");
+    } else if (type == "event") {
+        add_event(event_from_json(record));
+    } else if (type == "process") {
+        add_sample(sample_from_json(record));
+    } else if (type == "network") {
+        add_network(record.string_or("time", ""), snapshot_from_json(record));
+    } else if (type == "error") {
+        error = record.string_or("error", "");
+    } else if (type == "end") {
+        end_time = record.string_or("time", "");
+    }
+}
+
+void AgentReport::add_network(const std::string &time, const std::vector<Connection> &snapshot) {
+    ++network_snapshots;
+    for (const Connection &conn : snapshot) {
+        std::string key = connection_key(conn);
+        auto it = connection_index_.find(key);
+        if (it == connection_index_.end()) {
+            it = connection_index_.emplace(key, connections.size()).first;
+            connections.push_back(conn);
+            connections.back().first_seen = time;
+        }
+        Connection &row = connections[it->second];
+        row.status = conn.status;
+        row.last_seen = time;
+        ++row.snapshots;
+    }
+}
+
+bool parse_agent_report(const std::string &text, AgentReport &report, std::string *error) {
+    ReportReader reader(report);
+    return parse_json_events(text, reader, error);
+}
+
+bool load_agent_report(const std::string &path, AgentReport &report, std::string *error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        if (error) *error = "cannot open " + path;
+        return false;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    std::string data = text.str();
+    if (is_binary_report(data)) return decode_binary_report(data, report, error);
+    return parse_agent_report(data, report, error);
+}
+
+AgentReport agent_report_from_json(const Json &doc) {
+    AgentReport report;
+    report.start_time = doc.string_or("start_time", "");
+    report.end_time = doc.string_or("end_time", "");
+    report.path = doc.string_or("path", "");
+    report.error = doc.string_or("error", "");
+    const std::pair<const char*, const char*> sections[] = {
+        {"events", "event"}, {"processes", "process"}, {"network", "network"}};
+    for (const auto &section : sections) {
+        const Json *records = doc.find(section.first);
+        if (!records) continue;
+        for (const Json &record : records->items()) report.add(section.second, record);
+    }
+    return report;
+}
+
+bool ReportScorer::add(const std::string &type, const Json &record) {
+    if (type == "event") return add_event(event_from_json(record));
+    if (type == "process") return add_sample(sample_from_json(record));
+    if (type == "error") set_error();
+    if (type != "network") return false;
+    bool active = false;
+    for (const Connection &conn : snapshot_from_json(record)) active |= add_connection(conn);
+    return active;
+}
+
+bool ReportScorer::add_sample(const ProcessSample &sample) {
+    ++summary_.samples;
+    summary_.peak_cpu_percent = std::max(summary_.peak_cpu_percent, sample.cpu_percent);
+    summary_.peak_rss_mb = std::max(summary_.peak_rss_mb, sample.rss_bytes / (1024 * 1024));
+    cpu_total_ += sample.cpu_percent;
+    return sample.cpu_percent >= kIdleCpuPercent;
+}
+
+bool ReportScorer::add_event(const ProcessEvent &ev) {
+    if (ev.event == "process-created") {
+        if (!children_.insert(ev.pid).second) return false;
+        for (size_t rule : match_detector_rules(ev.cmdline)) rule_hits_.insert(rule);
+        return true;
+    } else if (ev.event == "process-exited") {
+        summary_.outcome = "exited";
+        summary_.returncode = ev.returncode;
+    } else if (ev.event == "timeout-kill") {
+        summary_.outcome = "timeout";
+    } else if (ev.event == "early-stop") {
+        summary_.outcome = "stopped";
+    }
+    return false;
+}
+
+bool ReportScorer::add_connection(const Connection &conn) {
+    if (!connections_.insert(connection_key(conn)).second) return false;
+    if (!conn.raddr.empty() && conn.raddr != "()") remotes_.insert(conn.raddr);
+    return true;
+}
+
+ReportSummary ReportScorer::summary() const {
+    ReportSummary summary = summary_;
+    if (summary.samples > 0) summary.mean_cpu_percent = cpu_total_ / static_cast<double>(summary.samples);
+    if (error_) summary.outcome = "error";
+    summary.processes = 1 + static_cast<int>(children_.size());
+    summary.connections = connections_.size();
+    summary.remote_endpoints = remotes_.size();
+    summary.rule_hits.assign(rule_hits_.begin(), rule_hits_.end());
+    return summary;
+}
+
+ReportSummary summarize_report(const AgentReport &report) {
+    ReportScorer scorer;
+    for (const ProcessSample &s : report.timeline) scorer.add_sample(s);
+    for (const ProcessEvent &ev : report.events) scorer.add_event(ev);
+    for (const Connection &c : report.connections) scorer.add_connection(c);
+    if (!report.error.empty()) scorer.set_error();
+    return scorer.summary();
+}
+
+Verdict score_resource_usage(double cpu_percent, double memory_mb, int num_processes) {
+    Verdict v;
+    if (cpu_percent > 80) {
+        v.detections.push_back("Excessive CPU usage: " + python_float(cpu_percent) + "%");
+        v.score += 15;
+    }
+    if (memory_mb > 500) {
+        v.detections.push_back("Excessive memory usage: " + one_decimal(memory_mb) + "MB");
+        v.score += 15;
+    }
+    if (num_processes > 20) {
+        v.detections.push_back("Excessive process creation: " + std::to_string(num_processes));
+        v.score += 20;
+    }
+    if (cpu_percent > 70 && memory_mb < 100) {
+        v.detections.push_back("Possible crypto mining activity");
+        v.score += 25;
+    }
+    assign_threat_level(v);
+    return v;
+}
+
+void assign_threat_level(Verdict &v) {
+    if (v.score >= 150) {
+        v.threat_level = "critical";
+        v.risk = "EXTREMELY HIGH RISK - IMMEDIATE ISOLATION RECOMMENDED";
+    } else if (v.score >= 100) {
+        v.threat_level = "dangerous";
+        v.risk = "HIGH RISK - ISOLATION RECOMMENDED";
+    } else if (v.score >= 30) {
+        v.threat_level = "suspicious";
+        v.risk = "MEDIUM RISK - MONITOR CLOSELY";
+    } else {
+        v.threat_level = "safe";
+        v.risk = "LOW RISK - APPEARS SAFE";
+    }
+}
+
+const std::vector<DetectorRule> kDetectorRules = {
+    // MalwareDetector._init_signatures, scored by _threat_score.
+    {".*\\.encrypt.*", "Signature match: Generic Ransomware", 100, false},
+    {".*ransomware.*", "Signature match: Generic Ransomware", 100, false},
+    {".*crypt.*exe", "Signature match: Generic Ransomware", 100, false},
+    {".*wanna.*cry.*", "Signature match: Generic Ransomware", 100, false},
+    {".*trojan.*", "Signature match: Generic Trojan", 100, false},
+    {".*backdoor.*", "Signature match: Generic Trojan", 100, false},
+    {".*remote.*access.*", "Signature match: Generic Trojan", 100, false},
+    {".*rat\\.exe.*", "Signature match: Generic Trojan", 100, false},
+    {".*worm.*", "Signature match: Generic Worm", 50, false},
+    {".*propagat.*", "Signature match: Generic Worm", 50, false},
+    {".*replicate.*", "Signature match: Generic Worm", 50, false},
+    {".*rootkit.*", "Signature match: Generic Rootkit", 100, false},
+    {".*kernel.*hook.*", "Signature match: Generic Rootkit", 100, false},
+    {".*loaddriver.*", "Signature match: Generic Rootkit", 100, false},
+    {".*spy.*", "Signature match: Generic Spyware", 50, false},
+    {".*keystroke.*", "Signature match: Generic Spyware", 50, false},
+    {".*screenlogger.*", "Signature match: Generic Spyware", 50, false},
+    {".*monitor\\.exe.*", "Signature match: Generic Spyware", 50, false},
+    // analyze_behavior: BehaviorIndicator's file, process and network
+    // operations, then the persistence and privilege keywords.
+    {".*\\.exe$", "Suspicious file operation: .*\\.exe$", 15, false},
+    {".*\\.dll$", "Suspicious file operation: .*\\.dll$", 15, false},
+    {".*\\.sys$", "Suspicious file operation: .*\\.sys$", 15, false},
+    {"/proc/mem", "Suspicious file operation: /proc/mem", 15, false},
+    {"/proc/kmem", "Suspicious file operation: /proc/kmem", 15, false},
+    {".*\\.bat$", "Suspicious file operation: .*\\.bat$", 15, false},
+    {".*\\.cmd$", "Suspicious file operation: .*\\.cmd$", 15, false},
+    {".*\\.scr$", "Suspicious file operation: .*\\.scr$", 15, false},
+    {"CreateRemoteThread", "Suspicious process operation: CreateRemoteThread", 20, false},
+    {"WriteProcessMemory", "Suspicious process operation: WriteProcessMemory", 20, false},
+    {"VirtualAllocEx", "Suspicious process operation: VirtualAllocEx", 20, false},
+    {"SetWindowsHookEx", "Suspicious process operation: SetWindowsHookEx", 20, false},
+    {"ShellExecute", "Suspicious process operation: ShellExecute", 20, false},
+    {"WinExec", "Suspicious process operation: WinExec", 20, false},
+    {"cmd.exe.*powershell", "Suspicious network operation: cmd.exe.*powershell", 25, false},
+    {"wget.*http", "Suspicious network operation: wget.*http", 25, false},
+    {"curl.*http", "Suspicious network operation: curl.*http", 25, false},
+    {"nc.*-l.*-p", "Suspicious network operation: nc.*-l.*-p", 25, false},
+    {"telnet.*", "Suspicious network operation: telnet.*", 25, false},
+    {"ssh.*key", "Suspicious network operation: ssh.*key", 25, false},
+    {"scp.*", "Suspicious network operation: scp.*", 25, false},
+    {"auto-start", "Persistence mechanism detected", 30, true},
+    {"startup", "Persistence mechanism detected", 30, true},
+    {"privilege", "Privilege escalation attempt detected", 35, true},
+    {"admin", "Privilege escalation attempt detected", 35, true},
+};
+
+std::vector<size_t> match_detector_rules(const std::string &text) {
+    static const Matcher matcher = [] {
+        Matcher m(true);
+        for (size_t i = 0; i < kDetectorRules.size(); ++i) m.add(kDetectorRules[i].pattern, static_cast<int>(i));
+        m.compile();
+        return m;
+    }();
+    std::vector<size_t> rules;
+    for (int id : matcher.scan(text)) rules.push_back(static_cast<size_t>(id));
+    return rules;
+}
+
+Verdict score_report(const ReportSummary &summary) {
+    Verdict v = score_resource_usage(summary.peak_cpu_percent, summary.peak_rss_mb, summary.processes);
+    std::set<std::string> scored;
+    for (size_t rule : summary.rule_hits) {
+        const DetectorRule &r = kDetectorRules[rule];
+        if (r.once && !scored.insert(r.detection).second) continue;
+        v.detections.push_back(r.detection);
+        v.score += r.points;
+    }
+    if (!summary.rule_hits.empty()) assign_threat_level(v);
+    if (summary.remote_endpoints > kScanEndpoints) {
+        v.detections.push_back("Possible network scan: " + std::to_string(summary.remote_endpoints) +
+                               " remote endpoints");
+        v.score += 30;
+        assign_threat_level(v);
+    }
+    return v;
+}
+
+Json summary_json(const ReportSummary &summary) {
+    Json j = Json::object();
+    j["samples"] = Json(static_cast<double>(summary.samples));
+    j["peak_cpu_percent"] = Json(summary.peak_cpu_percent);
+    j["mean_cpu_percent"] = Json(summary.mean_cpu_percent);
+    j["peak_rss_mb"] = Json(summary.peak_rss_mb);
+    j["processes"] = Json(summary.processes);
+    j["connections"] = Json(static_cast<double>(summary.connections));
+    j["remote_endpoints"] = Json(static_cast<double>(summary.remote_endpoints));
+    j["outcome"] = Json(summary.outcome);
+    if (summary.outcome == "exited") j["returncode"] = Json(summary.returncode);
+    return j;
+}
+
+Json verdict_json(const Verdict &verdict) {
+    Json j = Json::object();
+    j["threat_score"] = Json(verdict.score);
+    j["threat_level"] = Json(verdict.threat_level);
+    j["risk"] = Json(verdict.risk);
+    Json detections = Json::array();
+    for (const std::string &d : verdict.detections) detections.push_back(Json(d));
+    j["detections"] = detections;
+    return j;
+}
+
+} // namespace safebox
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "json.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Compact, typed view of an agent report (see ReportAssembler for the
+// format): the monitored process' resource timeline, new-process and exit
+// events, and one row per distinct connection instead of every snapshot.
+struct ProcessSample {
+    std::string time;
+    int pid = 0;
+    double cpu_percent = 0;
+    double rss_bytes = 0;
+    double vms_bytes = 0;
+};
+
+struct ProcessEvent {
+    std::string time;
+    std::string event;  // process-created, process-exited, timeout-kill, ...
+    int pid = 0;
+    int returncode = 0;  // process-exited only
+    std::string cmdline;  // space-joined, process-created only
+};
+
+struct Connection {
+    std::string family;
+    std::string type;
+    std::string laddr;
+    std::string raddr;
+    std::string status;
+    int pid = 0;
+    std::string first_seen;
+    std::string last_seen;
+    int snapshots = 0;
+};
+
+struct AgentReport {
+    std::string start_time;
+    std::string end_time;
+    std::string path;
+    std::string error;
+    std::vector<ProcessSample> timeline;
+    std::vector<ProcessEvent> events;
+    std::vector<Connection> connections;
+    size_t network_snapshots = 0;
+
+    // Merges one record of the given type (start, event, process, network,
+    // error, end), as streamed by the agent or found in a report file.
+    void add(const std::string &type, const Json &record);
+    void add_sample(ProcessSample sample) { timeline.push_back(std::move(sample)); }
+    void add_event(ProcessEvent event) { events.push_back(std::move(event)); }
+    // One network record: the connections open at `time`. Only family,
+    // type, addresses, status and pid of each are read.
+    void add_network(const std::string &time, const std::vector<Connection> &snapshot);
+
+private:
+    std::map<std::string, size_t> connection_index_;
+};
+
+// Streams a report file's JSON straight into an AgentReport, without
+// building a document for it or for its records. Return false on malformed
+// JSON, with *error set.
+bool parse_agent_report(const std::string &text, AgentReport &report, std::string *error = nullptr);
+// Also reads binary (SBR1) report files, see report_codec.h.
+bool load_agent_report(const std::string &path, AgentReport &report, std::string *error = nullptr);
+// From an assembled report document (ReportAssembler::report()).
+AgentReport agent_report_from_json(const Json &report);
+
+struct ReportSummary {
+    size_t samples = 0;
+    double peak_cpu_percent = 0;
+    double mean_cpu_percent = 0;
+    double peak_rss_mb = 0;
+    // The sample itself plus every process it was seen creating.
+    int processes = 0;
+    size_t connections = 0;
+    size_t remote_endpoints = 0;
+    // exited, timeout, stopped (ended early by the host), error or
+    // incomplete.
+    std::string outcome = "incomplete";
+    int returncode = 0;
+    // Detector rules (kDetectorRules) matched by the command line of a
+    // process the sample created, ascending.
+    std::vector<size_t> rule_hits;
+};
+
+ReportSummary summarize_report(const AgentReport &report);
+
+// Port of MalwareDetector.analyze_resource_usage and its threat levels
+// (sandbox/malware_detector.py); keep the thresholds in step with it.
+struct Verdict {
+    int score = 0;
+    std::string threat_level;  // safe, suspicious, dangerous, critical
+    std::string risk;
+    std::vector<std::string> detections;
+};
+
+Verdict score_resource_usage(double cpu_percent, double memory_mb, int num_processes);
+// Sets threat_level and risk from score (MalwareDetector._score_to_threat).
+void assign_threat_level(Verdict &v);
+// The detector's signature and behavior rules (MalwareDetector's known
+// signatures and analyze_behavior), matched caselessly against command
+// lines. Keep them in step with sandbox/malware_detector.py. Rules marked
+// once score a single time however many of their patterns match, as the
+// detector's keyword checks do.
+struct DetectorRule {
+    const char *pattern;
+    const char *detection;
+    int points;
+    bool once;
+};
+extern const std::vector<DetectorRule> kDetectorRules;
+// Indices into kDetectorRules of the rules matching text, ascending.
+std::vector<size_t> match_detector_rules(const std::string &text);
+
+// Scores the summary's peak CPU, peak RSS and process count and its
+// detector rule hits, plus a host-side network rule the Python detector
+// has no data for: more than kScanEndpoints distinct remote endpoints reads
+// as a port or host scan.
+constexpr size_t kScanEndpoints = 20;
+Verdict score_report(const ReportSummary &summary);
+
+// summarize_report kept current record by record, so a run can be judged
+// while its records still stream in; summarize_report is this fed a whole
+// report.
+class ReportScorer {
+public:
+    // Takes one streamed record (see AgentReport::add). Returns true if it
+    // shows the sample doing something: a new process or connection, or a
+    // CPU sample of at least kIdleCpuPercent. A new process' command line
+    // is matched against kDetectorRules as it arrives.
+    static constexpr double kIdleCpuPercent = 2.0;
+    bool add(const std::string &type, const Json &record);
+    bool add_sample(const ProcessSample &sample);
+    bool add_event(const ProcessEvent &event);
+    bool add_connection(const Connection &conn);
+    void set_error() { error_ = true; }
+
+    ReportSummary summary() const;
+    Verdict verdict() const { return score_report(summary()); }
+
+private:
+    ReportSummary summary_;
+    double cpu_total_ = 0;
+    bool error_ = false;
+    std::set<int> children_;
+    std::set<std::string> connections_;
+    std::set<std::string> remotes_;
+    std::set<size_t> rule_hits_;
+};
+
+Json summary_json(const ReportSummary &summary);
+Json verdict_json(const Verdict &verdict);
+
+} // namespace safebox
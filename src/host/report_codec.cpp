@@ -0,0 +1,744 @@
+#include "report_codec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <vector>
+
+namespace safebox {
+
+namespace {
+
+const char kMagic[4] = {'S', 'B', 'R', '1'};
+const uint64_t kVersion = 1;
+
+void put_uvarint(std::string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+void put_svarint(std::string &out, int64_t v) {
+    put_uvarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+void put_double(std::string &out, double v) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    for (int i = 0; i < 8; ++i) out += static_cast<char>((bits >> (8 * i)) & 0xFF);
+}
+
+// "2024-01-02T03:04:05.123456Z" (datetime.isoformat() + 'Z'; the fraction
+// is left out when it is zero).
+bool parse_time(const std::string &s, int64_t &us) {
+    int year, mon, day, hour, min, sec, n = 0;
+    if (std::sscanf(s.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &mon, &day, &hour, &min, &sec, &n) != 6) {
+        return false;
+    }
+    int64_t frac = 0;
+    size_t pos = static_cast<size_t>(n);
+    if (pos < s.size() && s[pos] == '.') {
+        size_t digits = 0;
+        for (++pos; pos < s.size() && s[pos] >= '0' && s[pos] <= '9'; ++pos, ++digits) {
+            if (digits < 6) frac = frac * 10 + (s[pos] - '0');
+        }
+        if (digits != 6) return false;
+    }
+    if (pos + 1 != s.size() || s[pos] != 'Z') return false;
+    std::tm tm{};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    us = static_cast<int64_t>(timegm(&tm)) * 1000000 + frac;
+    return true;
+}
+
+std::string format_time(int64_t us) {
+    time_t secs = static_cast<time_t>(us >= 0 ? us / 1000000 : (us - 999999) / 1000000);
+    int64_t frac = us - static_cast<int64_t>(secs) * 1000000;
+    std::tm tm{};
+    gmtime_r(&secs, &tm);
+    char buf[40];
+    size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    std::string out(buf, n);
+    if (frac) {
+        std::snprintf(buf, sizeof(buf), ".%06lld", static_cast<long long>(frac));
+        out += buf;
+    }
+    return out + "Z";
+}
+
+class Writer {
+public:
+    uint64_t intern(const std::string &s) {
+        auto it = index_.find(s);
+        if (it != index_.end()) return it->second;
+        uint64_t id = strings_.size();
+        index_.emplace(s, id);
+        strings_.push_back(s);
+        return id;
+    }
+
+    void str(std::string &out, const std::string &s) { put_uvarint(out, intern(s)); }
+
+    void opt_str(std::string &out, const Json *v) {
+        if (!v || !v->is_string()) put_uvarint(out, 0);
+        else put_uvarint(out, intern(v->as_string()) + 1);
+    }
+
+    // Appends the column of times as deltas, starting from base.
+    bool times(std::string &out, const std::vector<const Json*> &records, int64_t base, std::string *error) {
+        int64_t prev = base;
+        for (const Json *r : records) {
+            int64_t us = 0;
+            std::string t = r->string_or("time", "");
+            if (!parse_time(t, us)) {
+                if (error) *error = "unsupported time \"" + t + "\"";
+                return false;
+            }
+            put_svarint(out, us - prev);
+            prev = us;
+        }
+        return true;
+    }
+
+    std::string table() const {
+        std::string out;
+        put_uvarint(out, strings_.size());
+        for (const std::string &s : strings_) {
+            put_uvarint(out, s.size());
+            out += s;
+        }
+        return out;
+    }
+
+private:
+    std::map<std::string, uint64_t> index_;
+    std::vector<std::string> strings_;
+};
+
+std::vector<const Json*> records_of(const Json &report, const char *key) {
+    std::vector<const Json*> records;
+    if (const Json *section = report.find(key)) {
+        for (const Json &r : section->items()) {
+            if (r.is_object()) records.push_back(&r);
+        }
+    }
+    return records;
+}
+
+int64_t to_int(const Json *v) {
+    return v && v->is_number() ? static_cast<int64_t>(std::llround(v->as_number())) : 0;
+}
+
+std::string connection_key(const Json &c) {
+    const Json *pid = c.find("pid");
+    return std::to_string(to_int(c.find("fd"))) + '|' + c.string_or("family", "") + '|' +
+           c.string_or("type", "") + '|' + c.string_or("laddr", "") + '|' + c.string_or("raddr", "") + '|' +
+           (pid && pid->is_number() ? std::to_string(to_int(pid)) : "null");
+}
+
+class Reader {
+public:
+    explicit Reader(const std::string &data) : data_(data) {}
+
+    bool ok() const { return ok_; }
+    size_t left() const { return data_.size() - pos_; }
+
+    uint64_t u() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos_ >= data_.size()) return fail();
+            uint8_t b = static_cast<uint8_t>(data_[pos_++]);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        return fail();
+    }
+
+    int64_t s() {
+        uint64_t v = u();
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    double f64() {
+        if (left() < 8) return static_cast<double>(fail());
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) bits |= static_cast<uint64_t>(static_cast<uint8_t>(data_[pos_++])) << (8 * i);
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    std::string bytes(uint64_t n) {
+        if (n > left()) {
+            fail();
+            return "";
+        }
+        std::string v = data_.substr(pos_, n);
+        pos_ += n;
+        return v;
+    }
+
+    // Element count that cannot be larger than the bytes left, so a corrupt
+    // count fails instead of allocating.
+    uint64_t count() {
+        uint64_t n = u();
+        if (n > left()) return fail();
+        return n;
+    }
+
+    void skip(size_t n) { pos_ += n; }
+
+private:
+    uint64_t fail() {
+        ok_ = false;
+        pos_ = data_.size();
+        return 0;
+    }
+
+    const std::string &data_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+// What the decoder hands its sink for one event; the strings point into the
+// string table.
+struct DecodedEvent {
+    int64_t time = 0;
+    const std::string *name = nullptr;
+    uint64_t flags = 0;
+    int64_t pid = 0;
+    int64_t returncode = 0;
+    std::vector<const std::string*> cmdline;
+};
+
+struct DecodedConnection {
+    int64_t fd = 0;
+    const std::string *family, *type, *laddr, *raddr, *status;
+    bool has_pid = false;
+    int64_t pid = 0;
+};
+
+using MemoryColumns = std::vector<std::pair<const std::string*, std::vector<int64_t>>>;
+
+// Reads the sections in file order and feeds the sink. The sink sees every
+// connection opened (its id is the order of the calls), status changes by
+// id, and each snapshot as the ids open at that point.
+template <typename Sink>
+class Decoder {
+public:
+    Decoder(const std::string &data, Sink &sink) : in_(data), sink_(sink) {}
+
+    bool decode(std::string *error) {
+        in_.skip(sizeof(kMagic));
+        if (in_.u() != kVersion) return fail(error, "unsupported version");
+        uint64_t n = in_.count();
+        strings_.reserve(n);
+        for (uint64_t i = 0; i < n && in_.ok(); ++i) strings_.push_back(in_.bytes(in_.u()));
+
+        const std::string *start = opt_str(), *path = opt_str(), *end = opt_str(), *err = opt_str();
+        base_ = in_.s();
+        std::string extra = in_.bytes(in_.u());
+        if (!in_.ok() || bad_) return fail(error, "truncated or corrupt report");
+        sink_.header(start, path, end, err);
+
+        decode_processes();
+        decode_events();
+        decode_network();
+        if (!in_.ok() || bad_) return fail(error, "truncated or corrupt report");
+        if (in_.left() != 0) return fail(error, "trailing bytes");
+        if (!extra.empty() && !sink_.extra(extra)) return fail(error, "corrupt extra section");
+        return true;
+    }
+
+private:
+    static bool fail(std::string *error, const char *msg) {
+        if (error) *error = msg;
+        return false;
+    }
+
+    const std::string *str(uint64_t id) {
+        static const std::string empty;
+        if (id >= strings_.size()) {
+            bad_ = true;
+            return &empty;
+        }
+        return &strings_[id];
+    }
+
+    const std::string *opt_str() {
+        uint64_t v = in_.u();
+        return v == 0 ? nullptr : str(v - 1);
+    }
+
+    std::vector<int64_t> deltas(uint64_t n, int64_t prev = 0) {
+        std::vector<int64_t> out;
+        out.reserve(n);
+        for (uint64_t i = 0; i < n && in_.ok(); ++i) out.push_back(prev += in_.s());
+        return out;
+    }
+
+    void decode_processes() {
+        uint64_t n = in_.count();
+        std::vector<int64_t> t = deltas(n, base_), pid = deltas(n);
+        std::vector<double> cpu;
+        uint64_t scale = in_.u();
+        if (scale == 0) {
+            for (uint64_t i = 0; i < n && in_.ok(); ++i) cpu.push_back(in_.f64());
+        } else {
+            for (int64_t v : deltas(n)) cpu.push_back(static_cast<double>(v) / static_cast<double>(scale));
+        }
+        uint64_t fields = in_.count();
+        MemoryColumns memory;
+        for (uint64_t f = 0; f < fields && in_.ok(); ++f) {
+            const std::string *name = str(in_.u());
+            memory.emplace_back(name, deltas(n));
+        }
+        if (!in_.ok() || bad_) return;
+        for (uint64_t i = 0; i < n; ++i) sink_.process(t[i], pid[i], cpu[i], memory, i);
+    }
+
+    void decode_events() {
+        uint64_t n = in_.count();
+        std::vector<int64_t> t = deltas(n, base_);
+        std::vector<uint64_t> names;
+        for (uint64_t i = 0; i < n && in_.ok(); ++i) names.push_back(in_.u());
+        DecodedEvent ev;
+        for (uint64_t i = 0; i < n && in_.ok(); ++i) {
+            ev.time = t[i];
+            ev.name = str(names[i]);
+            ev.flags = in_.u();
+            if (ev.flags & 1) ev.pid = in_.s();
+            if (ev.flags & 2) ev.returncode = in_.s();
+            ev.cmdline.clear();
+            if (ev.flags & 4) {
+                uint64_t argc = in_.count();
+                for (uint64_t a = 0; a < argc && in_.ok(); ++a) ev.cmdline.push_back(str(in_.u()));
+            }
+            if (in_.ok() && !bad_) sink_.event(ev);
+        }
+    }
+
+    void decode_network() {
+        uint64_t n = in_.count();
+        std::vector<int64_t> t = deltas(n, base_);
+        uint64_t changes = in_.count();
+        std::vector<uint64_t> open;  // ids, in open order
+        uint64_t opened = 0, done = 0, at = 0;
+        if (changes) at = in_.u();
+        for (uint64_t s = 0; s < n && in_.ok() && !bad_; ++s) {
+            while (done < changes && at == s && in_.ok() && !bad_) {
+                apply_change(open, opened);
+                if (++done < changes) at = s + in_.u();
+            }
+            if (done < changes && at < s) bad_ = true;
+            sink_.snapshot(t[s], open);
+        }
+        if (done < changes) bad_ = true;
+    }
+
+    void apply_change(std::vector<uint64_t> &open, uint64_t &opened) {
+        uint64_t op = in_.u();
+        if (op == 0) {
+            DecodedConnection conn;
+            conn.fd = in_.s();
+            conn.family = str(in_.u());
+            conn.type = str(in_.u());
+            conn.laddr = str(in_.u());
+            conn.raddr = str(in_.u());
+            conn.status = str(in_.u());
+            uint64_t pid = in_.u();
+            conn.has_pid = pid != 0;
+            conn.pid = static_cast<int64_t>(pid) - 1;
+            if (!in_.ok() || bad_) return;
+            sink_.opened(conn);
+            open.push_back(opened++);
+            return;
+        }
+        uint64_t id = in_.u();
+        if (id >= opened) {
+            bad_ = true;
+        } else if (op == 1) {
+            auto it = std::find(open.begin(), open.end(), id);
+            if (it == open.end()) bad_ = true;
+            else open.erase(it);
+        } else if (op == 2) {
+            const std::string *status = str(in_.u());
+            if (!bad_) sink_.status(id, *status);
+        } else {
+            bad_ = true;
+        }
+    }
+
+    Reader in_;
+    Sink &sink_;
+    std::vector<std::string> strings_;
+    int64_t base_ = 0;
+    bool bad_ = false;
+};
+
+// Rebuilds the agent's report document.
+class JsonSink {
+public:
+    explicit JsonSink(Json &report) : report_(report) {}
+
+    void header(const std::string *start, const std::string *path, const std::string *end,
+                const std::string *error) {
+        start_ = start ? Json(*start) : Json();
+        path_ = path ? Json(*path) : Json();
+        end_ = end ? Json(*end) : Json();
+        error_ = error ? Json(*error) : Json();
+    }
+
+    bool extra(const std::string &text) { return parse_json(text, extra_) && extra_.is_object(); }
+
+    void process(int64_t time, int64_t pid, double cpu, const MemoryColumns &memory, size_t i) {
+        Json r = Json::object();
+        r["time"] = Json(format_time(time));
+        r["pid"] = Json(static_cast<long long>(pid));
+        r["cpu_percent"] = Json(cpu);
+        if (!memory.empty()) {
+            Json mem = Json::object();
+            for (const auto &field : memory) mem[*field.first] = Json(static_cast<long long>(field.second[i]));
+            r["memory"] = std::move(mem);
+        }
+        processes_.push_back(std::move(r));
+    }
+
+    void event(const DecodedEvent &ev) {
+        Json r = Json::object();
+        r["time"] = Json(format_time(ev.time));
+        r["event"] = Json(*ev.name);
+        if (ev.flags & 1) r["pid"] = Json(static_cast<long long>(ev.pid));
+        if (ev.flags & 2) r["returncode"] = Json(static_cast<long long>(ev.returncode));
+        if (ev.flags & 4) {
+            Json cmdline = Json::array();
+            for (const std::string *arg : ev.cmdline) cmdline.push_back(Json(*arg));
+            r["cmdline"] = std::move(cmdline);
+        }
+        events_.push_back(std::move(r));
+    }
+
+    void opened(const DecodedConnection &c) {
+        Json conn = Json::object();
+        conn["fd"] = Json(static_cast<long long>(c.fd));
+        conn["family"] = Json(*c.family);
+        conn["type"] = Json(*c.type);
+        conn["laddr"] = Json(*c.laddr);
+        conn["raddr"] = Json(*c.raddr);
+        conn["status"] = Json(*c.status);
+        conn["pid"] = c.has_pid ? Json(static_cast<long long>(c.pid)) : Json();
+        conns_.push_back(std::move(conn));
+    }
+
+    void status(uint64_t id, const std::string &status) { conns_[id]["status"] = Json(status); }
+
+    void snapshot(int64_t time, const std::vector<uint64_t> &open) {
+        Json r = Json::object();
+        r["time"] = Json(format_time(time));
+        Json list = Json::array();
+        for (uint64_t id : open) list.push_back(conns_[id]);
+        r["connections"] = std::move(list);
+        network_.push_back(std::move(r));
+    }
+
+    void finish() {
+        report_ = Json::object();
+        report_["start_time"] = start_;
+        report_["path"] = path_;
+        report_["events"] = std::move(events_);
+        report_["processes"] = std::move(processes_);
+        report_["network"] = std::move(network_);
+        if (!error_.is_null()) report_["error"] = error_;
+        if (!end_.is_null()) report_["end_time"] = end_;
+        for (const auto &member : extra_.members()) report_[member.first] = member.second;
+    }
+
+private:
+    Json &report_;
+    Json start_, path_, end_, error_;
+    Json extra_ = Json::object();
+    Json events_ = Json::array(), processes_ = Json::array(), network_ = Json::array();
+    std::vector<Json> conns_;
+};
+
+// Straight into an AgentReport, as parse_agent_report does for JSON.
+class ReportSink {
+public:
+    explicit ReportSink(AgentReport &report) : report_(report) {}
+
+    void header(const std::string *start, const std::string *path, const std::string *end,
+                const std::string *error) {
+        if (start) report_.start_time = *start;
+        if (path) report_.path = *path;
+        if (end) report_.end_time = *end;
+        if (error) report_.error = *error;
+    }
+
+    bool extra(const std::string &) { return true; }
+
+    void process(int64_t time, int64_t pid, double cpu, const MemoryColumns &memory, size_t i) {
+        ProcessSample sample;
+        sample.time = format_time(time);
+        sample.pid = static_cast<int>(pid);
+        sample.cpu_percent = cpu;
+        for (const auto &field : memory) {
+            if (*field.first == "rss") sample.rss_bytes = static_cast<double>(field.second[i]);
+            else if (*field.first == "vms") sample.vms_bytes = static_cast<double>(field.second[i]);
+        }
+        report_.add_sample(std::move(sample));
+    }
+
+    void event(const DecodedEvent &ev) {
+        ProcessEvent event;
+        event.time = format_time(ev.time);
+        event.event = *ev.name;
+        event.pid = static_cast<int>(ev.pid);
+        event.returncode = static_cast<int>(ev.returncode);
+        for (const std::string *arg : ev.cmdline) {
+            if (!event.cmdline.empty()) event.cmdline += ' ';
+            event.cmdline += *arg;
+        }
+        report_.add_event(std::move(event));
+    }
+
+    void opened(const DecodedConnection &c) {
+        Connection conn;
+        conn.family = *c.family;
+        conn.type = *c.type;
+        conn.laddr = *c.laddr;
+        conn.raddr = *c.raddr;
+        conn.status = *c.status;
+        conn.pid = c.has_pid ? static_cast<int>(c.pid) : 0;
+        conns_.push_back(std::move(conn));
+    }
+
+    void status(uint64_t id, const std::string &status) { conns_[id].status = status; }
+
+    void snapshot(int64_t time, const std::vector<uint64_t> &open) {
+        snapshot_.clear();
+        for (uint64_t id : open) snapshot_.push_back(conns_[id]);
+        report_.add_network(format_time(time), snapshot_);
+    }
+
+private:
+    AgentReport &report_;
+    std::vector<Connection> conns_;
+    std::vector<Connection> snapshot_;
+};
+
+} // namespace
+
+bool parse_report_format(const std::string &name, ReportFormat &format) {
+    if (name == "json") format = ReportFormat::Json;
+    else if (name == "binary") format = ReportFormat::Binary;
+    else return false;
+    return true;
+}
+
+bool is_binary_report(const std::string &data) {
+    return data.size() >= sizeof(kMagic) && std::memcmp(data.data(), kMagic, sizeof(kMagic)) == 0;
+}
+
+bool encode_binary_report(const Json &report, std::string &out, std::string *error) {
+    Writer w;
+    std::string body;
+
+    std::vector<const Json*> processes = records_of(report, "processes");
+    std::vector<const Json*> events = records_of(report, "events");
+    std::vector<const Json*> network = records_of(report, "network");
+
+    int64_t base = 0;
+    for (const auto *section : {&processes, &events, &network}) {
+        if (!section->empty()) {
+            parse_time(section->front()->string_or("time", ""), base);
+            break;
+        }
+    }
+
+    w.opt_str(body, report.find("start_time"));
+    w.opt_str(body, report.find("path"));
+    w.opt_str(body, report.find("end_time"));
+    w.opt_str(body, report.find("error"));
+    put_svarint(body, base);
+
+    Json extra = Json::object();
+    for (const auto &member : report.members()) {
+        static const char *known[] = {"start_time", "path", "events", "processes", "network", "error", "end_time"};
+        bool is_known = false;
+        for (const char *k : known) is_known = is_known || member.first == k;
+        if (!is_known) extra[member.first] = member.second;
+    }
+    std::string extra_text = extra.members().empty() ? "" : dump_json(extra);
+    put_uvarint(body, extra_text.size());
+    body += extra_text;
+
+    // Processes: one column per field.
+    put_uvarint(body, processes.size());
+    if (!w.times(body, processes, base, error)) return false;
+    int64_t prev = 0;
+    for (const Json *r : processes) {
+        int64_t pid = to_int(r->find("pid"));
+        put_svarint(body, pid - prev);
+        prev = pid;
+    }
+    bool tenths = true;
+    for (const Json *r : processes) {
+        double cpu = r->number_or("cpu_percent", 0);
+        tenths = tenths && std::fabs(cpu) < 1e15 && static_cast<double>(std::llround(cpu * 10)) / 10 == cpu;
+    }
+    put_uvarint(body, tenths ? 10 : 0);
+    prev = 0;
+    for (const Json *r : processes) {
+        double cpu = r->number_or("cpu_percent", 0);
+        if (!tenths) {
+            put_double(body, cpu);
+            continue;
+        }
+        int64_t v = std::llround(cpu * 10);
+        put_svarint(body, v - prev);
+        prev = v;
+    }
+    std::vector<std::string> fields;
+    for (const Json *r : processes) {
+        const Json *memory = r->find("memory");
+        if (!memory) continue;
+        for (const auto &member : memory->members()) {
+            bool seen = false;
+            for (const std::string &f : fields) seen = seen || f == member.first;
+            if (!seen) fields.push_back(member.first);
+        }
+    }
+    put_uvarint(body, fields.size());
+    for (const std::string &field : fields) {
+        w.str(body, field);
+        prev = 0;
+        for (const Json *r : processes) {
+            const Json *memory = r->find("memory");
+            int64_t v = memory ? to_int(memory->find(field)) : 0;
+            put_svarint(body, v - prev);
+            prev = v;
+        }
+    }
+
+    // Events.
+    put_uvarint(body, events.size());
+    if (!w.times(body, events, base, error)) return false;
+    for (const Json *r : events) w.str(body, r->string_or("event", ""));
+    for (const Json *r : events) {
+        const Json *pid = r->find("pid");
+        const Json *rc = r->find("returncode");
+        const Json *cmdline = r->find("cmdline");
+        uint64_t flags = (pid && pid->is_number() ? 1 : 0) | (rc && rc->is_number() ? 2 : 0) |
+                         (cmdline && cmdline->is_array() ? 4 : 0);
+        put_uvarint(body, flags);
+        if (flags & 1) put_svarint(body, to_int(pid));
+        if (flags & 2) put_svarint(body, to_int(rc));
+        if (flags & 4) {
+            put_uvarint(body, cmdline->items().size());
+            for (const Json &arg : cmdline->items()) w.str(body, arg.is_string() ? arg.as_string() : dump_json(arg));
+        }
+    }
+
+    // Network: snapshot times, then only what changed between snapshots.
+    put_uvarint(body, network.size());
+    if (!w.times(body, network, base, error)) return false;
+    struct Open {
+        uint64_t id;
+        std::string status;
+    };
+    std::map<std::string, Open> open;
+    std::vector<std::string> open_order;
+    uint64_t next_id = 0;
+    std::string changes;
+    uint64_t change_count = 0;
+    uint64_t last_snapshot = 0;
+    auto change = [&](uint64_t snapshot, uint64_t op) {
+        put_uvarint(changes, snapshot - last_snapshot);
+        put_uvarint(changes, op);
+        last_snapshot = snapshot;
+        ++change_count;
+    };
+    for (uint64_t s = 0; s < network.size(); ++s) {
+        std::map<std::string, const Json*> now;
+        std::vector<std::string> now_order;
+        if (const Json *conns = network[s]->find("connections")) {
+            for (const Json &c : conns->items()) {
+                std::string key = connection_key(c);
+                if (now.emplace(key, &c).second) now_order.push_back(key);
+            }
+        }
+        for (const std::string &key : open_order) {
+            if (now.count(key)) continue;
+            change(s, 1);
+            put_uvarint(changes, open[key].id);
+            open.erase(key);
+        }
+        open_order.erase(std::remove_if(open_order.begin(), open_order.end(),
+                                        [&](const std::string &k) { return !open.count(k); }),
+                         open_order.end());
+        for (const std::string &key : now_order) {
+            const Json &c = *now[key];
+            std::string status = c.string_or("status", "");
+            auto it = open.find(key);
+            if (it == open.end()) {
+                change(s, 0);
+                put_svarint(changes, to_int(c.find("fd")));
+                w.str(changes, c.string_or("family", ""));
+                w.str(changes, c.string_or("type", ""));
+                w.str(changes, c.string_or("laddr", ""));
+                w.str(changes, c.string_or("raddr", ""));
+                w.str(changes, status);
+                const Json *pid = c.find("pid");
+                put_uvarint(changes, pid && pid->is_number() ? static_cast<uint64_t>(to_int(pid)) + 1 : 0);
+                open.emplace(key, Open{next_id++, status});
+                open_order.push_back(key);
+            } else if (it->second.status != status) {
+                change(s, 2);
+                put_uvarint(changes, it->second.id);
+                w.str(changes, status);
+                it->second.status = status;
+            }
+        }
+    }
+    put_uvarint(body, change_count);
+    body += changes;
+
+    out.assign(kMagic, sizeof(kMagic));
+    put_uvarint(out, kVersion);
+    out += w.table();
+    out += body;
+    return true;
+}
+
+bool decode_binary_report(const std::string &data, Json &report, std::string *error) {
+    if (!is_binary_report(data)) {
+        if (error) *error = "not an SBR1 report";
+        return false;
+    }
+    JsonSink sink(report);
+    Decoder<JsonSink> decoder(data, sink);
+    if (!decoder.decode(error)) return false;
+    sink.finish();
+    return true;
+}
+
+bool decode_binary_report(const std::string &data, AgentReport &report, std::string *error) {
+    if (!is_binary_report(data)) {
+        if (error) *error = "not an SBR1 report";
+        return false;
+    }
+    ReportSink sink(report);
+    Decoder<ReportSink> decoder(data, sink);
+    return decoder.decode(error);
+}
+
+} // namespace safebox
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "json.h"
+#include "report.h"
+#include <string>
+
+namespace safebox {
+
+// Compact binary report format ("SBR1"), written by agent.py --format binary
+// and by the host with --report-format binary. The same report as JSON, but
+// columnar: every string (times aside) is interned once, timestamps and
+// counters are zigzag varint deltas down their column, the memory_info dict
+// becomes one column per field, and connections are stored as open / close /
+// status-change events instead of a full table per poll. agent/sbr.py is
+// the Python reader/writer; keep the two in step.
+//
+//   "SBR1" uvarint(version=1)
+//   strings:   uvarint n, n x (uvarint len, bytes)
+//   header:    ostr start_time, ostr path, ostr end_time, ostr error,
+//              uvarint base_us; ostr = uvarint, 0 absent else index + 1
+//   extra:     uvarint len, compact JSON object of other top-level keys
+//   processes: uvarint n, time[n], pid[n] (svarint deltas),
+//              uvarint cpu_scale (10: svarint delta of cpu*10, 0: raw
+//              little-endian doubles), uvarint fields, per field
+//              (uvarint name, svarint delta[n])
+//   events:    uvarint n, time[n], uvarint name[n], then per event
+//              uvarint flags (1 pid, 2 returncode, 4 cmdline) and those
+//              values: svarint pid, svarint returncode,
+//              uvarint argc + argc x uvarint string
+//   network:   uvarint snapshots, time[snapshots],
+//              uvarint changes, per change uvarint snapshot delta,
+//              uvarint op (0 open, 1 close, 2 status); open carries
+//              svarint fd, str family, type, laddr, raddr, status and
+//              uvarint pid + 1 (0 for null); close and status carry the
+//              uvarint id of the connection (in open order), status also
+//              the new str status.
+//
+// Times are microseconds since the epoch, the first against base_us and
+// the rest against their predecessor in the same column.
+
+enum class ReportFormat { Json, Binary };
+
+// "json" or "binary"; false for anything else.
+bool parse_report_format(const std::string &name, ReportFormat &format);
+
+bool is_binary_report(const std::string &data);
+
+// Fails (returning false with *error set) for reports the format cannot
+// represent: times that are not the agent's ISO-8601 UTC form.
+bool encode_binary_report(const Json &report, std::string &out, std::string *error = nullptr);
+// The JSON export: rebuilds the agent's report document. Connection
+// snapshots list the open connections in the order they were opened.
+bool decode_binary_report(const std::string &data, Json &report, std::string *error = nullptr);
+// Straight into an AgentReport, without building the document; top-level
+// keys other than the agent's are skipped, as parse_agent_report does.
+bool decode_binary_report(const std::string &data, AgentReport &report, std::string *error = nullptr);
+
+} // namespace safebox
@@ -0,0 +1,39 @@
+#include "resources.h"
+#include <cstdlib>
+#include <sstream>
+
+namespace safebox {
+
+std::vector<int> parse_cpu_list(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream parts(list);
+    std::string part;
+    while (std::getline(parts, part, ',')) {
+        char *end = nullptr;
+        long first = std::strtol(part.c_str(), &end, 10);
+        if (end == part.c_str() || first < 0) continue;
+        long last = first;
+        if (*end == '-') {
+            const char *from = end + 1;
+            last = std::strtol(from, &end, 10);
+            if (end == from || last < first) continue;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(static_cast<int>(cpu));
+    }
+    return cpus;
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+    std::string out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) ++j;
+        if (!out.empty()) out += ",";
+        out += std::to_string(cpus[i]);
+        if (j > i) out += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+} // namespace safebox
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+// Host resources one VM is given; filled in by ResourceGovernor::place and
+// applied through Backend::configure before the VM first boots. Empty
+// fields leave the VM as it is defined.
+struct VMResources {
+    // Sizes the VM only when resize is set; otherwise they are what
+    // placement and admission control assume the VM uses.
+    int vcpus = 2;
+    int memory_mb = 512;
+    bool resize = false;
+    // Host cores the vCPUs are pinned to, one each in order (empty: float).
+    std::vector<int> cpus;
+    // NUMA node guest memory is bound to, -1 for none.
+    int numa_node = -1;
+    // Guest RAM backed by 2 MiB hugepages instead of 4 KiB pages.
+    bool hugepages = false;
+};
+
+// "0-3,8,10-11" <-> {0, 1, 2, 3, 8, 10, 11}; malformed parts are skipped.
+std::vector<int> parse_cpu_list(const std::string &list);
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+} // namespace safebox
@@ -1,5 +1,8 @@
 #include "safebox.h"
-#include <cstdlib>
+#include "artifacts.h"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -9,99 +12,185 @@ using namespace std::chrono_literals;
 
 namespace safebox {
 
-CommandResult execute_command(const std::string &cmd) {
-    CommandResult result{-1, "", ""};
-    std::cerr << "[cmd] " << cmd << std::endl;
-    int rc = std::system(cmd.c_str());
-    result.return_code = rc;
-    return result;
-}
-
-bool wait_for_ssh(const std::string &host, int port, int timeout_seconds,
-                  std::function<CommandResult(const std::string&)> exec_fn) {
+bool wait_for_ssh(const SshSession &session, int timeout_seconds, ExecFn exec_fn,
+                  ProbeFn probe_fn) {
     if (!exec_fn) {
-        exec_fn = execute_command;
+        if (!probe_fn) probe_fn = probe_ssh_banner;
+        exec_fn = [](const Argv &argv) { return execute_command(argv); };
     }
-    int waited = 0;
-    while (waited < timeout_seconds) {
-        std::ostringstream cmd;
-        cmd << "ssh -o ConnectTimeout=5 -o StrictHostKeyChecking=no -p " << port
-            << " " << host << " echo ok 2>/dev/null";
-        CommandResult res = exec_fn(cmd.str());
-        if (res.return_code == 0) return true;
-        std::this_thread::sleep_for(2s);
-        waited += 2;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_seconds);
+    auto backoff = 10ms;
+    std::string host = ssh_host(session);
+    for (;;) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left <= 0ms) return false;
+
+        int probe_ms = static_cast<int>(std::min<long long>(left.count(), 1000));
+        if (!probe_fn || probe_fn(host, session.port, probe_ms)) {
+            CommandResult res = exec_fn(ssh_command(session, "echo ok"));
+            if (res.return_code == 0) return true;
+        }
+        if (std::chrono::steady_clock::now() + backoff >= deadline) return false;
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(500));
     }
-    return false;
+}
+
+bool wait_for_guest(const VMConfig &vm, const SshSession &session, int timeout_seconds) {
+    // A restored hot snapshot never boots, so the agent's READY is not resent.
+    Backend *backend = find_backend(vm.backend);
+    bool hot = backend && backend->hot();
+    if (!vm.ready_channel.empty() && !hot &&
+        !wait_for_agent_ready(vm.ready_channel, timeout_seconds * 1000)) {
+        std::cerr << "No agent READY on " << vm.ready_channel << ", falling back to SSH probing" << std::endl;
+    }
+    return wait_for_ssh(session, timeout_seconds);
 }
 
 int copy_file_to_vm(const std::string &local_path, const std::string &remote_path,
-                    const std::string &ssh_target, int ssh_port) {
-    std::ostringstream scp_cmd;
-    scp_cmd << "scp -P " << ssh_port << " -o StrictHostKeyChecking=no "
-            << local_path << " " << ssh_target << ":" << remote_path;
-    CommandResult res = execute_command(scp_cmd.str());
+                    const SshSession &session) {
+    CommandResult res = execute_command(scp_to_guest(session, local_path, remote_path));
     return res.return_code;
 }
 
-int trigger_agent(const std::string &ssh_target, int ssh_port,
-                  const std::string &file_path, const std::string &output_dir, int timeout) {
+int trigger_agent(const SshSession &session, const std::string &file_path,
+                  const std::string &output_dir, int timeout) {
     std::ostringstream remote_cmd;
-    remote_cmd << "ssh -p " << ssh_port << " -o StrictHostKeyChecking=no " << ssh_target
-               << " \"nohup python3 /home/safebox/agent/agent.py --file " << file_path
-               << " --output " << output_dir << " --timeout " << timeout << " &> " << output_dir << "/agent-run.log &\"";
-    CommandResult res = execute_command(remote_cmd.str());
+    remote_cmd << "python3 /home/safebox/agent/agent.py --file " << shell_quote(file_path)
+               << " --output " << shell_quote(output_dir) << " --timeout " << timeout;
+
+    // The ssh exits with the agent's own status once the report is on disk,
+    // so callers can fetch it straight away. The agent enforces `timeout` on
+    // the sample; the slack only covers its start-up and report writing.
+    ExecOptions opts;
+    opts.timeout_seconds = timeout + kAgentGraceSeconds;
+    CommandResult res = execute_command(ssh_command(session, remote_cmd.str()), opts);
+    std::cout << res.stdout;
     return res.return_code;
 }
 
-int download_reports(const std::string &ssh_target, int ssh_port,
-                     const std::string &remote_dir, const std::string &local_dir) {
-    std::filesystem::create_directories(local_dir);
-    std::ostringstream scp_cmd;
-    scp_cmd << "scp -P " << ssh_port << " -o StrictHostKeyChecking=no "
-            << ssh_target << ":" << remote_dir << "/report-*.json " << local_dir << "/";
-    CommandResult res = execute_command(scp_cmd.str());
-    return res.return_code;
+std::string agent_stream_command(const std::string &file_path, const std::string &output_dir,
+                                 int timeout) {
+    std::ostringstream remote_cmd;
+    remote_cmd << "python3 /home/safebox/agent/agent.py --stream --file " << shell_quote(file_path)
+               << " --output " << shell_quote(output_dir) << " --timeout " << timeout;
+    return remote_cmd.str();
 }
 
-int revert_vm(const std::string &backend, const std::string &vm_name) {
-    CommandResult res{0, "", ""};
-    if (backend == "virtualbox") {
-        std::ostringstream cmd1;
-        cmd1 << "VBoxManage controlvm " << vm_name << " poweroff";
-        res = execute_command(cmd1.str());
-        if (res.return_code != 0) return res.return_code;
-        
-        std::ostringstream cmd2;
-        cmd2 << "VBoxManage snapshot " << vm_name << " restore clean";
-        res = execute_command(cmd2.str());
-    } else if (backend == "kvm") {
-        std::ostringstream cmd1;
-        cmd1 << "virsh destroy " << vm_name;
-        res = execute_command(cmd1.str());
-        if (res.return_code != 0) return res.return_code;
-        
-        std::ostringstream cmd2;
-        cmd2 << "virsh snapshot-revert " << vm_name << " clean";
-        res = execute_command(cmd2.str());
+int stream_agent(const SshSession &session, const std::string &file_path,
+                 const std::string &output_dir, int timeout, ReportAssembler &assembler) {
+    ExecOptions opts;
+    opts.timeout_seconds = timeout + kAgentGraceSeconds;
+    opts.on_stdout = [&assembler](const char *data, size_t len) { assembler.feed(data, len); };
+    CommandResult res = execute_command(ssh_command(session, agent_stream_command(file_path, output_dir, timeout)), opts);
+    assembler.finish();
+    if (assembler.malformed() > 0) {
+        std::cerr << "Skipped " << assembler.malformed() << " malformed agent records." << std::endl;
     }
     return res.return_code;
 }
 
+int download_reports(const SshSession &session, const std::string &remote_dir,
+                     const std::string &local_dir) {
+    CommandResult res = execute_command(
+        artifact_unpack_command(ssh_command(session, artifact_pack_command(remote_dir)), local_dir));
+    return res.return_code;
+}
+
+int revert_vm(const std::string &backend, const std::string &vm_name) {
+    Backend *b = find_backend(backend);
+    return b ? b->revert(vm_name) : 1;
+}
+
 int start_vm(const std::string &backend, const std::string &vm_name) {
-    CommandResult res{0, "", ""};
-    if (backend == "virtualbox") {
-        std::ostringstream cmd;
-        cmd << "VBoxManage startvm " << vm_name << " --type headless";
-        res = execute_command(cmd.str());
-    } else if (backend == "kvm") {
-        std::ostringstream cmd;
-        cmd << "virsh start " << vm_name;
-        res = execute_command(cmd.str());
-    } else {
-        return 1;
+    Backend *b = find_backend(backend);
+    return b ? b->start(vm_name) : 1;
+}
+
+int inject_sample(const SshSession &session, const VMConfig &vm, const std::string &file_path,
+                  std::string &remote_file) {
+    std::string filename = std::filesystem::path(file_path).filename();
+    remote_file = "/home/" + vm.vm_user + "/incoming/" + filename;
+
+    Backend *backend = find_backend(vm.backend);
+    int copy_rc = backend ? backend->inject(vm.vm_name, session, file_path, remote_file)
+                          : copy_file_to_vm(file_path, remote_file, session);
+    if (copy_rc != 0) {
+        std::cerr << "Copying the sample into the VM failed." << std::endl;
+        return 6;
     }
-    return res.return_code;
+    return 0;
+}
+
+std::string write_report(const ReportAssembler &assembler, const std::string &report_dir,
+                         const PhaseTimes *phases, Verdict *verdict, ReportFormat format) {
+    if (!assembler.complete()) {
+        std::cerr << "Agent stream ended early; report is partial." << std::endl;
+    }
+    std::filesystem::create_directories(report_dir);
+    std::string stem = report_dir + "/report-" + std::to_string(std::time(nullptr));
+    Json report = assembler.report();
+    if (phases) report["phases"] = phases->to_json();
+    ReportSummary summary = summarize_report(agent_report_from_json(assembler.report()));
+    Verdict scored = score_report(summary);
+    report["summary"] = summary_json(summary);
+    report["verdict"] = verdict_json(scored);
+    std::string path = stem + ".json";
+    std::string encoded, error;
+    if (format == ReportFormat::Binary) {
+        if (encode_binary_report(report, encoded, &error)) {
+            path = stem + ".sbr";
+            std::ofstream(path, std::ios::binary) << encoded;
+        } else {
+            std::cerr << "Cannot write a binary report (" << error << "); writing JSON." << std::endl;
+        }
+    }
+    if (encoded.empty()) std::ofstream(path) << dump_json(report, 2) << std::endl;
+    std::cout << "Report written to " << path << " (" << scored.threat_level << ", score " << scored.score << ")"
+              << std::endl;
+    if (verdict) *verdict = scored;
+    return path;
+}
+
+int analyze_in_vm(const SshSession &session, const VMConfig &vm, const std::string &file_path,
+                  const std::string &report_dir, int agent_timeout, std::string *report_path,
+                  PhaseTimes *phases, ReportFormat format) {
+    PhaseTimes own_phases(vm.backend);
+    PhaseTimes &times = phases ? *phases : own_phases;
+    times.mark();
+
+    std::string remote_file;
+    int rc = inject_sample(session, vm, file_path, remote_file);
+    times.lap("inject");
+    if (rc != 0) return rc;
+
+    ReportAssembler assembler;
+    std::string remote_out = "/home/" + vm.vm_user + "/out";
+    int agent_rc = stream_agent(session, remote_file, remote_out, agent_timeout, assembler);
+    if (Backend *backend = find_backend(vm.backend)) backend->release(vm.vm_name);
+    times.lap("agent");
+    if (agent_rc != 0) {
+        std::cerr << "Agent run failed (exit " << agent_rc << ")." << std::endl;
+    }
+
+    std::string path = write_report(assembler, report_dir, &times, nullptr, format);
+    times.lap("report");
+    if (report_path && assembler.complete()) *report_path = path;
+    return 0;
+}
+
+std::string analysis_fingerprint(const std::string &backend, int agent_timeout, ReportFormat format,
+                                 int stop_score, int idle_timeout) {
+    // Bump the version whenever the agent's report format or the way the
+    // host assembles it changes, and the stop-score one whenever the rules
+    // that ReportScorer scores change.
+    std::vector<std::string> parts = {"safebox-report-v2", backend, std::to_string(agent_timeout)};
+    if (format == ReportFormat::Binary) parts.push_back("sbr1");
+    if (stop_score > 0) parts.push_back("stop-score-v2=" + std::to_string(stop_score));
+    if (idle_timeout > 0) parts.push_back("idle-timeout=" + std::to_string(idle_timeout));
+    return config_fingerprint(parts);
 }
 
 } // namespace safebox
@@ -1,8 +1,22 @@
 #pragma once
 
+#include "backend.h"
+#include "cache.h"
+#include "clone.h"
+#include "hash_index.h"
+#include "metrics.h"
+#include "process.h"
+#include "readiness.h"
+#include "report.h"
+#include "report_codec.h"
+#include "resources.h"
+#include "ssh.h"
+#include "telemetry.h"
+#include "triage.h"
 #include <string>
 #include <chrono>
 #include <functional>
+#include <optional>
 
 namespace safebox {
 
@@ -12,24 +26,92 @@ struct VMConfig {
     std::string file_path;
     std::string vm_user;
     int ssh_port;
+    // Host end of the agent's virtio-serial channel; empty for SSH alone.
+    std::string ready_channel = "";
+    // Address sshd listens on; empty to look it up from the hypervisor
+    // (libvirt DHCP lease) after every boot.
+    std::string ssh_host = "127.0.0.1";
+    // Set for linked clones; they are recycled with Backend::reset_clone()
+    // instead of a snapshot revert.
+    std::optional<CloneSpec> clone = std::nullopt;
+    // Placement and sizing, see ResourceGovernor.
+    VMResources resources = {};
 };
 
-struct CommandResult {
-    int return_code;
-    std::string stdout;
-    std::string stderr;
-};
-
-CommandResult execute_command(const std::string &cmd);
-bool wait_for_ssh(const std::string &host, int port, int timeout_seconds, 
-                  std::function<CommandResult(const std::string&)> exec_fn = nullptr);
+// Waits for sshd with a cheap banner probe and short exponential backoff, then
+// confirms with one `echo ok` through the session. An injected exec_fn stands
+// in for all guest I/O, so the socket probe only runs when probe_fn is given
+// too (or neither hook is).
+bool wait_for_ssh(const SshSession &session, int timeout_seconds, ExecFn exec_fn = nullptr,
+                  ProbeFn probe_fn = nullptr);
+// wait_for_agent_ready() on vm.ready_channel when set, then wait_for_ssh().
+bool wait_for_guest(const VMConfig &vm, const SshSession &session, int timeout_seconds);
 int copy_file_to_vm(const std::string &local_path, const std::string &remote_path,
-                    const std::string &ssh_target, int ssh_port);
-int trigger_agent(const std::string &ssh_target, int ssh_port, 
-                  const std::string &file_path, const std::string &output_dir, int timeout);
-int download_reports(const std::string &ssh_target, int ssh_port,
-                     const std::string &remote_dir, const std::string &local_dir);
+                    const SshSession &session);
+// Runs the agent to completion and returns its exit status (ssh's 255 if the
+// connection failed, 124 if it overran timeout plus a grace period).
+int trigger_agent(const SshSession &session, const std::string &file_path,
+                  const std::string &output_dir, int timeout);
+// Slack on top of the agent's own timeout for its start-up and shutdown.
+constexpr int kAgentGraceSeconds = 30;
+// The guest command stream_agent runs, for callers that spawn it themselves.
+std::string agent_stream_command(const std::string &file_path, const std::string &output_dir,
+                                 int timeout);
+// Like trigger_agent, but runs the agent with --stream and feeds its records
+// into assembler while the sample is still running; no report file is left
+// to download afterwards.
+int stream_agent(const SshSession &session, const std::string &file_path,
+                 const std::string &output_dir, int timeout, ReportAssembler &assembler);
+// Copies everything in remote_dir (reports, the agent's out-/err- logs,
+// dropped files) into local_dir as one zstd-compressed tar over a single
+// command on the session (see artifact_pack_command).
+int download_reports(const SshSession &session, const std::string &remote_dir,
+                     const std::string &local_dir);
+// Backends are "kvm" and "virtualbox", which cold-boot from the "clean"
+// snapshot, and "kvm-hot" / "virtualbox-hot", which resume the running-state
+// snapshot "hot" (see Backend::snapshot) so the guest is ready at once.
+// "libvirt" / "libvirt-hot" do the same as the kvm pair through the libvirt
+// C API instead of virsh, when built with SAFEBOX_WITH_LIBVIRT, and
+// "firecracker" / "firecracker-hot" run microVMs (see FirecrackerBackend).
+// Shorthands for find_backend(backend)->revert()/start(); 1 for an unknown
+// backend.
 int revert_vm(const std::string &backend, const std::string &vm_name);
 int start_vm(const std::string &backend, const std::string &vm_name);
 
+// Runs one sample on a VM that is already up and reachable over SSH:
+// injects the file (Backend::inject: a host share when the VM has one, scp
+// otherwise), streams the agent's telemetry and writes the assembled
+// report into report_dir.
+// Returns 0 on success or the safebox-host exit code of the failing step.
+// report_path, when given, is set to the report file if the agent ran to
+// completion (partial reports are not worth caching).
+// Its inject/agent/report phases are lapped on phases (which the report
+// then carries, along with whatever the caller timed before), or on a
+// private PhaseTimes if none is given.
+int analyze_in_vm(const SshSession &session, const VMConfig &vm, const std::string &file_path,
+                  const std::string &report_dir, int agent_timeout,
+                  std::string *report_path = nullptr, PhaseTimes *phases = nullptr,
+                  ReportFormat format = ReportFormat::Json);
+
+// The steps of analyze_in_vm, for callers that run the agent themselves.
+// inject_sample sets remote_file to where the guest sees the sample and
+// returns 0 or 6; write_report saves the assembled report into report_dir
+// and returns its path, with the phase breakdown under "phases" if given,
+// the summary_report() figures under "summary" and the score_report()
+// verdict under "verdict" (also stored in *verdict if given). Binary
+// reports are written as report-<time>.sbr, falling back to JSON for
+// reports the format cannot hold.
+int inject_sample(const SshSession &session, const VMConfig &vm, const std::string &file_path,
+                  std::string &remote_file);
+std::string write_report(const ReportAssembler &assembler, const std::string &report_dir,
+                         const PhaseTimes *phases = nullptr, Verdict *verdict = nullptr,
+                         ReportFormat format = ReportFormat::Json);
+
+// ResultCache fingerprint of a run on `backend` with the given agent timeout,
+// report format and early-stop settings (PoolOptions::stop_score and
+// idle_timeout; 0 when runs always go to the timeout).
+std::string analysis_fingerprint(const std::string &backend, int agent_timeout,
+                                 ReportFormat format = ReportFormat::Json, int stop_score = 0,
+                                 int idle_timeout = 0);
+
 } // namespace safebox
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace safebox {
+
+// Incremental SHA-256 (FIPS 180-4).
+class Sha256 {
+public:
+    Sha256();
+    void update(const void *data, size_t len);
+    // Lowercase hex digest. The object is spent afterwards.
+    std::string hex_digest();
+
+private:
+    void compress(const uint8_t *block);
+
+    uint32_t state_[8];
+    uint8_t buffer_[64];
+    size_t buffered_ = 0;
+    uint64_t length_ = 0;
+};
+
+std::string sha256_hex(const std::string &data);
+// Hashes the file through a sequential read-only mapping (falling back to
+// read() for files that cannot be mapped). Returns false if it cannot be read.
+bool sha256_file(const std::string &path, std::string &hex);
+
+} // namespace safebox
@@ -0,0 +1,71 @@
+#include "ssh.h"
+#include <filesystem>
+
+namespace safebox {
+
+static Argv session_options(const SshSession &session) {
+    return {"-o", "StrictHostKeyChecking=no",
+            "-o", "ConnectTimeout=5",
+            "-o", "ServerAliveInterval=5",
+            "-o", "ControlMaster=auto",
+            "-o", "ControlPersist=300",
+            "-o", "ControlPath=" + session.control_path};
+}
+
+SshSession open_ssh_session(const std::string &target, int port) {
+    // %C is ssh's hash of the connection tuple; it keeps the socket path
+    // well under the sun_path limit whatever the target looks like.
+    std::string control_path = (std::filesystem::temp_directory_path() / "safebox-ssh-%C").string();
+    return SshSession{target, port, control_path};
+}
+
+void close_ssh_session(const SshSession &session) {
+    if (session.control_path.empty()) return;
+    execute_command({"ssh", "-o", "ControlPath=" + session.control_path,
+                     "-p", std::to_string(session.port), "-O", "exit", session.target});
+}
+
+std::string shell_quote(const std::string &s) {
+    std::string out = "'";
+    for (char c : s) {
+        if (c == '\'') out += "'\\''";
+        else out += c;
+    }
+    return out + "'";
+}
+
+std::string ssh_host(const SshSession &session) {
+    size_t at = session.target.find('@');
+    return at == std::string::npos ? session.target : session.target.substr(at + 1);
+}
+
+Argv ssh_command(const SshSession &session, const std::string &remote_cmd) {
+    Argv cmd{"ssh", "-p", std::to_string(session.port)};
+    Argv opts = session_options(session);
+    cmd.insert(cmd.end(), opts.begin(), opts.end());
+    cmd.push_back(session.target);
+    cmd.push_back(remote_cmd);
+    return cmd;
+}
+
+Argv scp_to_guest(const SshSession &session, const std::string &local_path,
+                  const std::string &remote_path) {
+    Argv cmd{"scp", "-P", std::to_string(session.port)};
+    Argv opts = session_options(session);
+    cmd.insert(cmd.end(), opts.begin(), opts.end());
+    cmd.push_back(local_path);
+    cmd.push_back(session.target + ":" + remote_path);
+    return cmd;
+}
+
+Argv scp_from_guest(const SshSession &session, const std::string &remote_path,
+                    const std::string &local_path) {
+    Argv cmd{"scp", "-P", std::to_string(session.port)};
+    Argv opts = session_options(session);
+    cmd.insert(cmd.end(), opts.begin(), opts.end());
+    cmd.push_back(session.target + ":" + remote_path);
+    cmd.push_back(local_path);
+    return cmd;
+}
+
+} // namespace safebox
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "process.h"
+#include <string>
+
+namespace safebox {
+
+// One multiplexed SSH connection to a guest. Every ssh/scp built from the
+// same session shares a ControlMaster, so only the first command pays the
+// TCP + key exchange + auth handshake.
+struct SshSession {
+    std::string target;
+    int port = 0;
+    std::string control_path;
+};
+
+// No connection is made here: the master is started lazily by the first
+// command run through the session and lives until close_ssh_session().
+SshSession open_ssh_session(const std::string &target, int port);
+// Stops the master. Call before the guest goes away (revert, poweroff) so
+// later sessions to the same address do not reuse a dead socket.
+void close_ssh_session(const SshSession &session);
+
+// s as one word of a POSIX shell command line (single-quoted), for paths
+// spliced into the commands that run in the guest's shell.
+std::string shell_quote(const std::string &s);
+
+// Host part of the session target, without the user@ prefix.
+std::string ssh_host(const SshSession &session);
+
+Argv ssh_command(const SshSession &session, const std::string &remote_cmd);
+Argv scp_to_guest(const SshSession &session, const std::string &local_path,
+                  const std::string &remote_path);
+Argv scp_from_guest(const SshSession &session, const std::string &remote_path,
+                    const std::string &local_path);
+
+} // namespace safebox
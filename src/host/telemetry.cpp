@@ -0,0 +1,71 @@
+#include "telemetry.h"
+
+namespace safebox {
+
+ReportAssembler::ReportAssembler() : report_(Json::object()) {
+    report_["start_time"] = Json();
+    report_["path"] = Json();
+    report_["events"] = Json::array();
+    report_["processes"] = Json::array();
+    report_["network"] = Json::array();
+}
+
+void ReportAssembler::feed(const char *data, size_t len) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] != '\n') continue;
+        if (partial_.empty()) {
+            handle_line(std::string(data + start, i - start));
+        } else {
+            partial_.append(data + start, i - start);
+            handle_line(partial_);
+            partial_.clear();
+        }
+        start = i + 1;
+    }
+    partial_.append(data + start, len - start);
+}
+
+void ReportAssembler::finish() {
+    if (!partial_.empty()) {
+        handle_line(partial_);
+        partial_.clear();
+    }
+}
+
+void ReportAssembler::handle_line(const std::string &line) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) return;
+
+    Json record;
+    if (!parse_json(line, record) || !record.is_object()) {
+        ++malformed_;
+        return;
+    }
+    std::string type = record.string_or("type", "");
+    record.erase("type");
+    ++records_;
+
+    if (type == "start") {
+        report_["start_time"] = Json(record.string_or("time", ""));
+        report_["path"] = Json(record.string_or("path", ""));
+    } else if (type == "event") {
+        report_["events"].push_back(record);
+    } else if (type == "process") {
+        report_["processes"].push_back(record);
+    } else if (type == "network") {
+        report_["network"].push_back(record);
+    } else if (type == "error") {
+        report_["error"] = Json(record.string_or("error", ""));
+    } else if (type == "end") {
+        report_["end_time"] = Json(record.string_or("time", ""));
+        complete_ = true;
+    } else {
+        --records_;
+        ++malformed_;
+        return;
+    }
+
+    if (on_record_) on_record_(type, record);
+}
+
+} // namespace safebox
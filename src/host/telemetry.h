@@ -0,0 +1,48 @@
+#pragma once
+
+#include "json.h"
+#include <functional>
+#include <string>
+
+namespace safebox {
+
+// Rebuilds an agent report from the NDJSON records `agent.py --stream`
+// writes to stdout, one complete line at a time as bytes arrive. Each record
+// has a "type" naming the report section it belongs to:
+//   start   {time, path}        -> start_time, path
+//   event   {time, event, ...}  -> events[]
+//   process {time, pid, ...}    -> processes[]
+//   network {time, connections} -> network[]
+//   error   {time, error}       -> error
+//   end     {time}              -> end_time
+// The assembled report has the same shape as the agent's file reports.
+class ReportAssembler {
+public:
+    using RecordFn = std::function<void(const std::string &type, const Json &record)>;
+
+    ReportAssembler();
+
+    void feed(const char *data, size_t len);
+    // Processes a trailing line that was not newline-terminated.
+    void finish();
+
+    // Called for every record after it has been merged into the report.
+    void on_record(RecordFn fn) { on_record_ = std::move(fn); }
+
+    const Json &report() const { return report_; }
+    bool complete() const { return complete_; }
+    size_t records() const { return records_; }
+    size_t malformed() const { return malformed_; }
+
+private:
+    void handle_line(const std::string &line);
+
+    Json report_;
+    std::string partial_;
+    RecordFn on_record_;
+    bool complete_ = false;
+    size_t records_ = 0;
+    size_t malformed_ = 0;
+};
+
+} // namespace safebox
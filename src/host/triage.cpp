@@ -0,0 +1,283 @@
+#include "triage.h"
+#include "sha256.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace safebox {
+
+namespace {
+
+constexpr size_t kMapWindow = 64 << 20;
+constexpr size_t kBlock = 64 << 10;
+constexpr size_t kHeaderBytes = 4096;
+constexpr size_t kMaxStringLength = 256;
+
+bool printable(uint8_t b) {
+    return (b >= 0x20 && b < 0x7f) || b == '\t';
+}
+
+#if defined(__SSE2__)
+// Bit i set if p[i] is printable.
+int printable_mask(const uint8_t *p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    // 0x20..0x7e are exactly the signed bytes in (0x1f, 0x7f).
+    __m128i in_range = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                                     _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    return _mm_movemask_epi8(_mm_or_si128(in_range, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+}
+#endif
+
+uint32_t le32(const std::string &s, size_t at) {
+    if (at + 4 > s.size()) return 0;
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(s.data() + at);
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+class Pass {
+public:
+    Pass(const TriageOptions &options, TriageResult &result) : options_(options), r_(result) {}
+
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t off = 0; off < len; off += kBlock) block(data + off, std::min(kBlock, len - off));
+    }
+
+    void finish();
+
+private:
+    void block(const uint8_t *p, size_t n) {
+        if (header_.size() < kHeaderBytes) {
+            header_.append(reinterpret_cast<const char *>(p), std::min(n, kHeaderBytes - header_.size()));
+        }
+        sha_.update(p, n);
+        count(p, n);
+        strings(p, n);
+        r_.size += n;
+    }
+
+    // Four interleaved tables so consecutive equal bytes do not serialize
+    // on one counter.
+    void count(const uint8_t *p, size_t n) {
+        uint32_t h[4][256] = {};
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            ++h[0][p[i]];
+            ++h[1][p[i + 1]];
+            ++h[2][p[i + 2]];
+            ++h[3][p[i + 3]];
+        }
+        for (; i < n; ++i) ++h[0][p[i]];
+        for (int b = 0; b < 256; ++b) r_.histogram[b] += uint64_t(h[0][b]) + h[1][b] + h[2][b] + h[3][b];
+    }
+
+    void strings(const uint8_t *p, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+#if defined(__SSE2__)
+            // 16 bytes at a time, stepping over whole printable and
+            // unprintable runs of the mask rather than single bytes.
+            if (i + 16 <= n) {
+                unsigned mask = unsigned(printable_mask(p + i)) | 0x10000u;
+                size_t at = 0;
+                while (at < 16) {
+                    size_t len = size_t(__builtin_ctz((mask & (1u << at) ? ~mask : mask) >> at));
+                    len = std::min(len, 16 - at);
+                    if (mask & (1u << at)) {
+                        extend(p + i + at, len);
+                    } else {
+                        end_run();
+                    }
+                    at += len;
+                }
+                i += 16;
+                continue;
+            }
+#endif
+            if (printable(p[i])) {
+                extend(p + i, 1);
+            } else {
+                end_run();
+            }
+            ++i;
+        }
+    }
+
+    void extend(const uint8_t *p, size_t n) {
+        run_ += n;
+        if (current_.size() < kMaxStringLength) {
+            current_.append(reinterpret_cast<const char *>(p), std::min(n, kMaxStringLength - current_.size()));
+        }
+    }
+
+    void end_run() {
+        if (run_ > 0 && run_ >= options_.min_string) {
+            ++r_.string_count;
+            if (r_.strings.size() < options_.max_strings) r_.strings.push_back(current_);
+        }
+        run_ = 0;
+        current_.clear();
+    }
+
+    void detect_type();
+    void decide();
+
+    const TriageOptions &options_;
+    TriageResult &r_;
+    Sha256 sha_;
+    std::string header_;
+    std::string current_;
+    size_t run_ = 0;
+};
+
+void Pass::detect_type() {
+    const std::string &h = header_;
+    auto starts = [&](const char *magic, size_t len) { return h.size() >= len && h.compare(0, len, magic, len) == 0; };
+    if (h.empty()) {
+        r_.file_type = "empty";
+    } else if (starts("\x7f" "ELF", 4)) {
+        r_.file_type = "elf";
+    } else if (starts("MZ", 2)) {
+        uint32_t pe = le32(h, 0x3c);
+        r_.file_type = pe + 4 <= h.size() && h.compare(pe, 4, "PE\0\0", 4) == 0 ? "pe" : "mz";
+    } else if (starts("#!", 2)) {
+        r_.file_type = "script";
+        size_t end = h.find('\n');
+        r_.interpreter = h.substr(2, std::min(end == std::string::npos ? h.size() : end, size_t(130)) - 2);
+        while (!r_.interpreter.empty() && std::isspace(uint8_t(r_.interpreter.back()))) r_.interpreter.pop_back();
+        r_.interpreter.erase(0, r_.interpreter.find_first_not_of(' '));
+    } else if (starts("\xcf\xfa\xed\xfe", 4) || starts("\xce\xfa\xed\xfe", 4) ||
+               starts("\xfe\xed\xfa\xcf", 4) || starts("\xfe\xed\xfa\xce", 4) || starts("\xca\xfe\xba\xbe", 4)) {
+        r_.file_type = "mach-o";
+    } else if (starts("PK\x03\x04", 4)) {
+        r_.file_type = "zip";
+    } else if (starts("\x1f\x8b", 2)) {
+        r_.file_type = "gzip";
+    } else if (starts("%PDF", 4)) {
+        r_.file_type = "pdf";
+    } else if (starts("\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", 8)) {
+        r_.file_type = "ole";
+    } else {
+        r_.file_type = r_.printable >= 0.95 ? "text" : "data";
+    }
+}
+
+void Pass::decide() {
+    Verdict &v = r_.verdict;
+    if (options_.hash_index && options_.hash_index->lookup(r_.sha256, &r_.known_label)) {
+        r_.decision = "known";
+        v = known_hash_verdict(r_.known_label);
+        return;
+    }
+    if (r_.entropy > 7.2 && r_.size >= 1024) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "High entropy content: %.2f bits/byte (packed or encrypted)", r_.entropy);
+        v.detections.push_back(buf);
+        v.score += 15;
+    }
+    if (r_.file_type == "pe" || r_.file_type == "mz") {
+        v.detections.push_back("Windows executable (" + r_.file_type + ")");
+        v.score += 20;
+    }
+    r_.decision = r_.file_type == "elf" || r_.file_type == "script" ? "dynamic" : "inert";
+    if (r_.decision == "inert") v.detections.push_back("Not executable in the guest: " + r_.file_type);
+    assign_threat_level(v);
+}
+
+void Pass::finish() {
+    end_run();
+    r_.sha256 = sha_.hex_digest();
+    uint64_t text = r_.histogram[uint8_t('\n')] + r_.histogram[uint8_t('\r')];
+    double entropy = 0;
+    for (int b = 0; b < 256; ++b) {
+        if (printable(uint8_t(b))) text += r_.histogram[b];
+        if (!r_.histogram[b]) continue;
+        double p = double(r_.histogram[b]) / double(r_.size);
+        entropy -= p * std::log2(p);
+    }
+    r_.entropy = entropy;
+    r_.printable = r_.size ? double(text) / double(r_.size) : 0;
+    detect_type();
+    decide();
+}
+
+} // namespace
+
+bool triage_file(const std::string &path, const TriageOptions &options, TriageResult &result,
+                 std::string *error) {
+    result = TriageResult();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    Pass pass(options, result);
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    bool mapped = ok && S_ISREG(st.st_mode);
+    for (off_t off = 0; mapped && off < st.st_size; off += static_cast<off_t>(kMapWindow)) {
+        size_t len = std::min(kMapWindow, static_cast<size_t>(st.st_size - off));
+        void *map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, off);
+        if (map == MAP_FAILED) {
+            if (off != 0) ok = false;
+            mapped = false;
+            break;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+        pass.feed(static_cast<const uint8_t *>(map), len);
+        munmap(map, len);
+    }
+    if (ok && !mapped) {
+        uint8_t buf[kBlock];
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ok = false;
+                break;
+            }
+            pass.feed(buf, static_cast<size_t>(n));
+        }
+    }
+    int saved = errno;
+    close(fd);
+    if (!ok) {
+        if (error) *error = path + ": " + std::strerror(saved);
+        return false;
+    }
+    pass.finish();
+    return true;
+}
+
+Json triage_json(const TriageResult &result, bool with_strings) {
+    Json j = Json::object();
+    j["size"] = Json(static_cast<double>(result.size));
+    j["sha256"] = Json(result.sha256);
+    j["file_type"] = Json(result.file_type);
+    if (!result.interpreter.empty()) j["interpreter"] = Json(result.interpreter);
+    j["entropy"] = Json(std::round(result.entropy * 1000) / 1000);
+    j["printable"] = Json(std::round(result.printable * 1000) / 1000);
+    j["string_count"] = Json(static_cast<double>(result.string_count));
+    if (with_strings) {
+        Json strings = Json::array();
+        for (const std::string &s : result.strings) strings.push_back(Json(s));
+        j["strings"] = strings;
+    }
+    if (result.decision == "known") j["known_label"] = Json(result.known_label);
+    j["decision"] = Json(result.decision);
+    j["verdict"] = verdict_json(result.verdict);
+    return j;
+}
+
+} // namespace safebox
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "hash_index.h"
+#include "json.h"
+#include "report.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace safebox {
+
+struct TriageOptions {
+    // Printable runs at least this long count as strings.
+    size_t min_string = 6;
+    // Strings kept in the result (each cut at 256 bytes); all are counted.
+    size_t max_strings = 256;
+    // Samples found here are decided "known" without a VM.
+    const HashIndex *hash_index = nullptr;
+};
+
+struct TriageResult {
+    uint64_t size = 0;
+    std::string sha256;
+    // elf, pe, mz, mach-o, script, zip, gzip, pdf, ole, text, data or empty.
+    std::string file_type;
+    std::string interpreter;  // the "#!" line of scripts
+    uint64_t histogram[256] = {};
+    double entropy = 0;       // Shannon entropy, bits per byte
+    double printable = 0;     // share of printable ASCII and whitespace bytes
+    uint64_t string_count = 0;
+    std::vector<std::string> strings;
+    std::string known_label;
+    // known:   the hash index lists the sample
+    // inert:   the guest cannot execute it (neither ELF nor a "#!" script),
+    //          so a VM run would only record the failed exec
+    // dynamic: needs the VM
+    std::string decision;
+    Verdict verdict;          // static detections
+};
+
+// Static triage in one streaming pass: the sample is mapped a window at a
+// time and every 64 KiB block is hashed, counted into the byte histogram and
+// scanned for strings while it is still in cache, so multi-GB samples are
+// never resident at once. Returns false if the file cannot be read.
+bool triage_file(const std::string &path, const TriageOptions &options, TriageResult &result,
+                 std::string *error = nullptr);
+
+// Everything but the histogram; the strings only if with_strings.
+Json triage_json(const TriageResult &result, bool with_strings = true);
+
+} // namespace safebox
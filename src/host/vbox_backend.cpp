@@ -0,0 +1,96 @@
+#include "vbox_backend.h"
+#include <filesystem>
+
+namespace safebox {
+
+int VirtualBoxBackend::start(const std::string &vm_name) {
+    if (hot_) {
+        int rc = execute_command({"VBoxManage", "snapshot", vm_name, "restore", "hot"}).return_code;
+        if (rc != 0) return rc;
+    }
+    return execute_command({"VBoxManage", "startvm", vm_name, "--type", "headless"}).return_code;
+}
+
+int VirtualBoxBackend::revert(const std::string &vm_name) {
+    int rc = execute_command({"VBoxManage", "controlvm", vm_name, "poweroff"}).return_code;
+    if (rc != 0) {
+        // controlvm fails on a VM that is not running; that one is off already.
+        CommandResult info = execute_command({"VBoxManage", "showvminfo", vm_name, "--machinereadable"});
+        bool off = info.return_code == 0 && (info.stdout.find("VMState=\"poweroff\"") != std::string::npos ||
+                                             info.stdout.find("VMState=\"aborted\"") != std::string::npos ||
+                                             info.stdout.find("VMState=\"saved\"") != std::string::npos);
+        if (!off) return rc;
+    }
+    if (hot_) return 0;
+    return execute_command({"VBoxManage", "snapshot", vm_name, "restore", "clean"}).return_code;
+}
+
+int VirtualBoxBackend::clone(const CloneSpec &spec) {
+    int rc = execute_command({"VBoxManage", "clonevm", spec.golden, "--snapshot", "clean",
+                              "--options", "link", "--name", spec.clone_name,
+                              "--register"}).return_code;
+    if (rc != 0) return rc;
+
+    // The forward inherited from the golden would clash between clones.
+    execute_command({"VBoxManage", "modifyvm", spec.clone_name, "--natpf1", "delete", "ssh"});
+    rc = execute_command({"VBoxManage", "modifyvm", spec.clone_name, "--natpf1",
+                          "ssh,tcp,127.0.0.1," + std::to_string(spec.ssh_port) + ",,22"}).return_code;
+    if (rc != 0) return rc;
+
+    // A snapshot of the fresh clone makes reset a differencing-disk swap.
+    return execute_command({"VBoxManage", "snapshot", spec.clone_name, "take", "clean"}).return_code;
+}
+
+int VirtualBoxBackend::reset_clone(const CloneSpec &spec) {
+    execute_command({"VBoxManage", "controlvm", spec.clone_name, "poweroff"});
+    return execute_command({"VBoxManage", "snapshot", spec.clone_name, "restore", "clean"}).return_code;
+}
+
+int VirtualBoxBackend::delete_clone(const CloneSpec &spec) {
+    execute_command({"VBoxManage", "controlvm", spec.clone_name, "poweroff"});
+    return execute_command({"VBoxManage", "unregistervm", spec.clone_name, "--delete"}).return_code;
+}
+
+int VirtualBoxBackend::configure(const std::string &vm_name, const VMResources &res) {
+    Argv argv{"VBoxManage", "modifyvm", vm_name, "--large-pages", res.hugepages ? "on" : "off"};
+    if (res.resize) {
+        argv.insert(argv.end(), {"--cpus", std::to_string(res.vcpus), "--memory", std::to_string(res.memory_mb)});
+    }
+    return execute_command(argv).return_code;
+}
+
+int VirtualBoxBackend::snapshot(const std::string &vm_name, const SshSession &) {
+    if (!hot_) return 1;
+    execute_command({"VBoxManage", "snapshot", vm_name, "delete", "hot"});
+    return execute_command({"VBoxManage", "snapshot", vm_name, "take", "hot", "--live"}).return_code;
+}
+
+int VirtualBoxBackend::inject(const std::string &vm_name, const SshSession &session,
+                              const std::string &local_path, std::string &remote_path) {
+    std::error_code ec;
+    std::filesystem::create_directories(share_dir(vm_name), ec);
+    std::string name = ec ? "" : share_file(vm_name, local_path);
+    if (!name.empty()) {
+        int rc = execute_command({"VBoxManage", "sharedfolder", "add", vm_name, "--name", "safebox",
+                                  "--hostpath", share_dir(vm_name), "--readonly", "--transient",
+                                  "--automount", std::string("--auto-mount-point=") + kGuestShareMount})
+                     .return_code;
+        // Automounting is asynchronous; give the guest a few seconds.
+        std::string shared = std::string(kGuestShareMount) + "/" + name;
+        if (rc == 0 &&
+            exec(session, "for i in $(seq 50); do test -r " + shell_quote(shared) + " && exit 0; sleep 0.1; done; exit 1")
+                    .return_code == 0) {
+            remote_path = shared;
+            return 0;
+        }
+        release(vm_name);
+    }
+    return copy_in(session, local_path, remote_path);
+}
+
+void VirtualBoxBackend::release(const std::string &vm_name) {
+    execute_command({"VBoxManage", "sharedfolder", "remove", vm_name, "--name", "safebox", "--transient"});
+    Backend::release(vm_name);
+}
+
+} // namespace safebox
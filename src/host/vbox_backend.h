@@ -0,0 +1,43 @@
+#pragma once
+
+#include "backend.h"
+
+namespace safebox {
+
+// VirtualBox guests managed through VBoxManage. Cold starts boot from the
+// "clean" snapshot; the hot variant restores the live snapshot "hot", which
+// leaves the VM saved so startvm resumes it. Linked clones come from the
+// golden's "clean" snapshot and get an ssh NAT forward of their own.
+class VirtualBoxBackend : public Backend {
+public:
+    explicit VirtualBoxBackend(bool hot) : hot_(hot) {}
+
+    int start(const std::string &vm_name) override;
+    int revert(const std::string &vm_name) override;
+
+    int clone(const CloneSpec &spec) override;
+    int reset_clone(const CloneSpec &spec) override;
+    int delete_clone(const CloneSpec &spec) override;
+
+    // Sizing and large pages through modifyvm; VirtualBox has no vCPU
+    // pinning or NUMA binding, so those are left to the host scheduler.
+    int configure(const std::string &vm_name, const VMResources &resources) override;
+
+    bool hot() const override { return hot_; }
+    int snapshot(const std::string &vm_name, const SshSession &session) override;
+
+    // Guests are reached through a NAT port forward on loopback.
+    std::string guest_address(const std::string &) override { return "127.0.0.1"; }
+
+    // Hot-adds share_dir(vm_name) as a transient read-only shared folder
+    // that Guest Additions automount; falls back to scp if the guest never
+    // sees the file.
+    int inject(const std::string &vm_name, const SshSession &session,
+               const std::string &local_path, std::string &remote_path) override;
+    void release(const std::string &vm_name) override;
+
+private:
+    bool hot_;
+};
+
+} // namespace safebox
@@ -88,6 +88,91 @@ class TestAgent:
             assert 'network' in report
             assert isinstance(report['network'], list)
     
+    def test_run_monitored_stream(self):
+        """Test NDJSON streaming mode"""
+        import io
+        with tempfile.TemporaryDirectory() as tmpdir:
+            script_path = os.path.join(tmpdir, 'test.sh')
+            with open(script_path, 'w') as f:
+                f.write('#!/bin/bash\nexit 0\n')
+            os.chmod(script_path, 0o755)
+
+            stream = io.StringIO()
+            result = agent.run_monitored(script_path, timeout=5, output_dir=tmpdir,
+                                         sink=agent.StreamReport(stream))
+            assert result is None
+            assert not [f for f in os.listdir(tmpdir) if f.startswith('report-')]
+
+            records = [json.loads(line) for line in stream.getvalue().splitlines()]
+            assert records[0]['type'] == 'start'
+            assert records[0]['path'] == script_path
+            assert records[-1]['type'] == 'end'
+            assert any(r['type'] == 'event' and r['event'] == 'process-exited' for r in records)
+
+    def test_binary_report_round_trip(self):
+        """Test the compact .sbr report decodes back to the JSON report"""
+        import sbr
+        with tempfile.TemporaryDirectory() as tmpdir:
+            script_path = os.path.join(tmpdir, 'test.sh')
+            with open(script_path, 'w') as f:
+                f.write('#!/bin/bash\nsleep 1\nexit 0\n')
+            os.chmod(script_path, 0o755)
+
+            report_file = agent.run_monitored(script_path, timeout=5, output_dir=tmpdir, fmt='binary')
+            assert report_file.endswith('.sbr')
+            with open(report_file, 'rb') as f:
+                report = sbr.decode(f.read())
+            assert report['path'] == script_path
+            assert any(e['event'] == 'process-exited' for e in report['events'])
+
+        conn = {'fd': 3, 'family': 'AddressFamily.AF_INET', 'type': 'SocketKind.SOCK_STREAM',
+                'laddr': "addr(ip='10.0.0.2', port=4000)", 'raddr': "addr(ip='1.2.3.4', port=80)",
+                'status': 'SYN_SENT', 'pid': 101}
+        doc = {'start_time': '2024-05-01T10:00:00Z', 'path': '/x',
+               'events': [{'time': '2024-05-01T10:00:00.500000Z', 'event': 'process-created',
+                           'pid': 101, 'cmdline': ['sh', '-c', 'id']}],
+               'processes': [{'time': '2024-05-01T10:00:00.500000Z', 'pid': 100, 'cpu_percent': 12.5,
+                              'memory': {'rss': 10485760, 'vms': 20971520}},
+                             {'time': '2024-05-01T10:00:01Z', 'pid': 100, 'cpu_percent': 1 / 3,
+                              'memory': {'rss': 10489856, 'vms': 20971520}}],
+               'network': [{'time': '2024-05-01T10:00:00.500000Z', 'connections': [conn]},
+                           {'time': '2024-05-01T10:00:01Z',
+                            'connections': [dict(conn, status='ESTABLISHED'),
+                                            dict(conn, fd=-1, pid=None, raddr='()', status='NONE')]},
+                           {'time': '2024-05-01T10:00:01.500000Z', 'connections': []}],
+               'end_time': '2024-05-01T10:00:02.000001Z'}
+        data = sbr.encode(doc)
+        assert sbr.decode(data) == doc
+        assert len(data) < len(json.dumps(doc)) / 2
+        with pytest.raises(sbr.FormatError):
+            sbr.decode(data[:-2])
+
+    def test_find_collector(self):
+        """Test the native collector is picked up from SAFEBOX_COLLECTOR"""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            collector = os.path.join(tmpdir, 'safebox-collector')
+            with mock.patch.dict(os.environ, {'SAFEBOX_COLLECTOR': collector}):
+                assert agent.find_collector() is None
+                with open(collector, 'w') as f:
+                    f.write('#!/bin/sh\n')
+                os.chmod(collector, 0o755)
+                assert agent.find_collector() == collector
+        argv = agent.collector_argv(collector, '/in/a.bin', '/out', 60)
+        assert argv == [collector, '--file', '/in/a.bin', '--output', '/out', '--timeout', '60']
+
+    def test_notify_ready_writes_marker(self):
+        """Test READY marker on the virtio-serial channel"""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            channel = os.path.join(tmpdir, 'org.safebox.agent.0')
+            open(channel, 'w').close()
+            assert agent.notify_ready(channel)
+            with open(channel) as f:
+                assert f.read() == 'READY\n'
+
+    def test_notify_ready_without_channel(self):
+        """Test notify_ready is a no-op when the port is absent"""
+        assert not agent.notify_ready('/nonexistent/org.safebox.agent.0')
+
     def test_scp_send_mocked(self):
         """Test scp_send wrapper (mocked)"""
         with mock.patch('subprocess.call') as mock_call:
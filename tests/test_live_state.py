@@ -0,0 +1,124 @@
+import json
+import os
+import socket
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '../web'))
+from live_state import HostEventClient, ProcessSampler, StateHub, TTLCache, sse_events
+
+
+def wait_for(predicate, timeout=5.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.02)
+    return False
+
+
+class TestLiveState:
+
+    def test_hub_fans_out_and_resyncs_slow_subscribers(self):
+        """Test every subscriber sees each change, and one that falls behind gets a resync marker"""
+        hub = StateHub()
+        fast = hub.subscribe()
+        hub.update('vm/a', {'stage': 'ready'})
+        assert fast.get_nowait() == {'key': 'vm/a', 'value': {'stage': 'ready'}}
+
+        hub.MAX_PENDING = 3
+        slow = hub.subscribe()
+        for i in range(5):
+            hub.update('job/%d' % i, {'status': 'queued'})
+        # What it missed is replaced by one marker; later changes follow it.
+        assert slow.get_nowait() == {'resync': True}
+        assert slow.get_nowait()['key'] == 'job/4'
+        assert fast.qsize() == 5
+        assert fast.get_nowait()['key'] == 'job/0'
+
+        hub.unsubscribe(fast)
+        hub.unsubscribe(slow)
+        assert hub.subscribers() == 0
+        snapshot = hub.snapshot()
+        assert [v['stage'] for v in snapshot['vms']] == ['ready']
+        assert len(snapshot['jobs']) == 5
+
+    def test_follows_host_event_socket(self):
+        """Test the client mirrors a daemon's snapshot and changes, and drops keys a restarted daemon lost"""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'events.sock')
+            server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            server.bind(path)
+            server.listen(1)
+
+            def line(event):
+                return (json.dumps(event) + '\n').encode()
+
+            hub = StateHub()
+            hub.update('vm/gone', {'stage': 'busy'})
+            client = HostEventClient(hub, path, retry=0.05).start()
+            conn, _ = server.accept()
+            conn.sendall(line({'key': 'vm/a', 'seq': 1, 'stage': 'ready', 'snapshot': True}) +
+                         line({'type': 'synced', 'seq': 1}))
+            assert wait_for(lambda: hub.host_connected)
+            assert hub.get('vm/gone') is None
+            assert hub.get('vm/a')['stage'] == 'ready'
+            assert 'snapshot' not in hub.get('vm/a')
+
+            changes = hub.subscribe()
+            # Split mid-line, as a socket may deliver it.
+            data = line({'key': 'job/j1', 'seq': 2, 'status': 'running', 'vm': 'a'})
+            conn.sendall(data[:10])
+            conn.sendall(data[10:])
+            assert changes.get(timeout=5)['value']['status'] == 'running'
+
+            conn.close()
+            assert wait_for(lambda: not hub.host_connected)
+            client.stop()
+            server.close()
+
+    def test_process_sampler_shares_one_scan(self):
+        """Test many readers inside one interval cost one scan, published to the hub"""
+        scans = []
+
+        def scan():
+            scans.append(time.time())
+            return [{'pid': 1, 'name': 'init', 'cpu_percent': 0.0, 'memory_mb': 1.0}]
+
+        hub = StateHub()
+        sampler = ProcessSampler(hub, interval=60, scan=scan)
+        for _ in range(20):
+            assert sampler.latest()['total'] == 1
+        assert wait_for(lambda: len(scans) >= 1)
+        assert len(scans) <= 2
+        assert hub.snapshot()['processes']['processes'][0]['name'] == 'init'
+
+    def test_sse_stream_starts_with_snapshot(self):
+        """Test the SSE stream opens with the snapshot and names each change by its key"""
+        hub = StateHub()
+        hub.update('vm/a', {'stage': 'ready'})
+        stop = threading.Event()
+        stream = sse_events(hub, heartbeat=0.05, stop=stop)
+        first = next(stream)
+        assert first.startswith('event: snapshot\ndata: ')
+        assert json.loads(first.split('data: ', 1)[1])['vms'] == [{'stage': 'ready'}]
+
+        hub.update('job/j1', {'status': 'completed'})
+        event = next(stream)
+        assert event.startswith('event: job\n')
+        assert json.loads(event.split('data: ', 1)[1])['value']['status'] == 'completed'
+        assert next(stream) == ': keep-alive\n\n'
+        stop.set()
+        stream.close()
+        assert hub.subscribers() == 0
+
+    def test_ttl_cache(self):
+        """Test a cached query runs once per ttl until invalidated"""
+        calls = []
+        cache = TTLCache(60, lambda: calls.append(1) or len(calls))
+        assert cache.get() == 1
+        assert cache.get() == 1
+        cache.invalidate()
+        assert cache.get() == 2
@@ -0,0 +1,56 @@
+import pytest
+import os
+import re
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '../sandbox'))
+import native_matcher
+from malware_detector import MalwareDetector, BehaviorIndicator
+
+PATTERNS = [r'.*wanna.*cry.*', r'.*rat\.exe.*', r'^svchost\.exe$', r'cmd.exe.*powershell',
+            r'.*\.dll$', r'nc.*-l.*-p', r'[0-9]{3}\.exe']
+
+
+class TestMatcher:
+
+    def test_matches_re(self):
+        """Test the compiled matcher agrees with re.search pattern by pattern"""
+        texts = ['wannacry.exe', 'rat.exe', 'ratxexe', 'svchost.exe', 'xsvchost.exe', 'cmd.exe /c powershell',
+                 'nc -l -p 80', 'nc -p -l', 'a.dll b', 'a.dll', '123.exe', 'cmdé exe powershell', '']
+        m = native_matcher.SignatureMatcher(PATTERNS, ignore_case=True)
+        for text in texts:
+            expected = [i for i, p in enumerate(PATTERNS) if re.search(p, text, re.IGNORECASE)]
+            assert m.scan(text) == expected, text
+            assert m.scan(text.upper()) == expected, text
+
+    def test_scan_file(self):
+        """Test contents are matched line by line"""
+        m = native_matcher.SignatureMatcher(PATTERNS)
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, 'sample.bin')
+            with open(path, 'wb') as f:
+                f.write(b'\x7fELF\x00wanna\ncry\nsvchost.exe\n' + b'x' * 70000 + b' 777.exe')
+            assert m.scan_file(path) == [2, 6]
+            assert m.scan_file(os.path.join(tmpdir, 'missing')) is None
+
+    def test_detector_results_unchanged(self):
+        """Test the detector scores exactly as the per-pattern re loop did"""
+        detector = MalwareDetector()
+        filename = 'wanna_cry_rat.exe'
+        expected = [sig.name for sig in detector.known_signatures for p in sig.patterns
+                    if re.search(p, filename.lower(), re.IGNORECASE)]
+        score, detections = detector.analyze_filename(filename)
+        assert [d for d in detections if d.startswith('Signature match')] == \
+            [f'Signature match: {name}' for name in expected]
+
+        behaviors = ['cmd.exe -c powershell', 'wget http://x', 'write /proc/mem', 'drop a.dll']
+        text = ' '.join(behaviors).lower()
+        score, detections = detector.analyze_behavior(behaviors)
+        expected = [p for p in BehaviorIndicator.SUSPICIOUS_FILE_OPS + BehaviorIndicator.SUSPICIOUS_PROC_OPS +
+                    BehaviorIndicator.SUSPICIOUS_NET_OPS if re.search(p, text)]
+        assert [d.split(': ', 1)[1] for d in detections] == expected
+
+
+if __name__ == '__main__':
+    pytest.main([__file__, '-v'])
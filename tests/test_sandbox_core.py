@@ -0,0 +1,71 @@
+import os
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '../sandbox'))
+from sandbox_core import SandboxConfig, SandboxEnvironment, read_cgroup_usage
+
+
+class FakeProcess:
+    """psutil.Process stand-in that records how it was sampled"""
+
+    def __init__(self, pid):
+        self.pid = pid
+        self.intervals = []
+
+    def cpu_percent(self, interval=None):
+        self.intervals.append(interval)
+        return 12.5
+
+    def memory_info(self):
+        class Memory:
+            rss = 64 * 1024 * 1024
+        return Memory()
+
+    def children(self, recursive=False):
+        return []
+
+
+class TestSandboxCore:
+
+    def test_cgroup_limits_and_usage(self):
+        """Test a cgroup sandbox writes its limits and reads usage from the cgroup's stat files"""
+        with tempfile.TemporaryDirectory() as root:
+            env = SandboxEnvironment(SandboxConfig(sandbox_id='cg1', max_cpu_percent=50.0, max_memory_mb=128,
+                                                   processes_allowed=4, cgroup_root=root))
+            cgroup = Path(root) / 'cg1'
+            assert (cgroup / 'cpu.max').read_text() == '50000 100000\n'
+            assert (cgroup / 'memory.max').read_text() == '%d\n' % (128 << 20)
+            assert (cgroup / 'pids.max').read_text() == '4\n'
+
+            (cgroup / 'cpu.stat').write_text('usage_usec 1000000\nuser_usec 900000\n')
+            (cgroup / 'memory.current').write_text('%d\n' % (200 << 20))
+            (cgroup / 'pids.current').write_text('7\n')
+            assert read_cgroup_usage(cgroup) == {'cpu_usec': 1000000, 'memory_bytes': 200 << 20, 'pids': 7}
+            assert env.monitor_resource_usage()['cpu_percent'] == 0.0
+            time.sleep(0.1)
+            (cgroup / 'cpu.stat').write_text('usage_usec 1100000\n')
+            usage = env.monitor_resource_usage()
+            # 0.1 s of CPU in about 0.1 s of wall time.
+            assert 20 < usage['cpu_percent'] <= 100
+            assert usage['memory_mb'] == 200
+            anomalies = env.check_anomalies(usage)
+            assert any('Memory usage exceeds limit' in a for a in anomalies)
+            assert any('Too many processes' in a for a in anomalies)
+            env.terminate()
+
+    def test_monitoring_does_not_block(self):
+        """Test usage is sampled without a blocking cpu_percent interval"""
+        env = SandboxEnvironment(SandboxConfig(sandbox_id='nb1'))
+        env.main_process = FakeProcess(os.getpid())
+        start = time.monotonic()
+        for _ in range(10):
+            usage = env.monitor_resource_usage()
+            env.check_anomalies()
+        assert time.monotonic() - start < 0.5
+        assert usage == {'cpu_percent': 12.5, 'memory_mb': 64, 'num_processes': 1}
+        assert set(env.main_process.intervals) == {None}
+        env.main_process = None
+        env.terminate()
@@ -11,6 +11,8 @@ import os
 import sys
 import json
 
+from live_state import TTLCache, make_blueprint, shared_state
+
 # Set working directory to script location
 script_dir = os.path.dirname(os.path.abspath(__file__)) or '/home/ubuntu/SafeBox/web'
 os.chdir(script_dir)
@@ -35,6 +37,10 @@ except ImportError as e:
 app = Flask(__name__, static_folder=script_dir)
 CORS(app)
 
+# Live state shared by every dashboard: /api/state and /api/events (SSE)
+live_hub, live_sampler = shared_state()
+app.register_blueprint(make_blueprint(live_hub, live_sampler))
+
 # Serve static files
 @app.route('/')
 def index():
@@ -49,33 +55,12 @@ def static_files(path):
 def get_processes():
     """Get all running processes with CPU and memory info"""
     try:
-        processes = []
-        # Get all processes with basic info
-        for proc in psutil.process_iter(['pid', 'name']):
-            try:
-                # Get memory info
-                mem_info = proc.memory_info()
-                memory_mb = mem_info.rss / (1024 * 1024)
-                
-                # Get CPU with non-blocking call
-                cpu_percent = proc.cpu_percent(interval=None) or 0
-                
-                processes.append({
-                    'pid': proc.pid,
-                    'name': proc.name(),
-                    'cpu_percent': float(cpu_percent),
-                    'memory_mb': float(memory_mb)
-                })
-            except (psutil.NoSuchProcess, psutil.AccessDenied, psutil.ZombieProcess):
-                continue
-        
-        # Sort by CPU usage
-        processes.sort(key=lambda x: x['cpu_percent'], reverse=True)
-        
+        # One shared scan every couple of seconds, however many dashboards ask.
+        latest = live_sampler.latest()
         return jsonify({
             'success': True,
-            'processes': processes,
-            'total': len(processes)
+            'processes': latest['processes'],
+            'total': latest['total']
         })
     
     except Exception as e:
@@ -357,6 +342,27 @@ def kvm_status():
     except Exception as e:
         return jsonify({'available': False, 'error': str(e)}), 500
 
+def _query_kvm_vms():
+    kvm = get_kvm_manager()
+    vms = kvm.list_vms()
+    vm_statuses = []
+    
+    for vm_name in vms:
+        status = kvm.get_vm_status(vm_name)
+        if status:
+            vm_statuses.append({
+                'name': status.name,
+                'state': status.state,
+                'uptime': status.uptime,
+                'memory_mb': status.memory_mb,
+                'vcpus': status.vcpus,
+                'disk_usage_gb': status.disk_usage_gb
+            })
+    return {'total_vms': len(vms), 'vms': vm_statuses}
+
+# libvirt is asked at most every few seconds; VM actions below drop the copy.
+kvm_vms_cache = TTLCache(5.0, _query_kvm_vms)
+
 @app.route('/api/kvm/vms', methods=['GET'])
 def list_kvm_vms():
     """List all virtual machines"""
@@ -364,26 +370,11 @@ def list_kvm_vms():
         return jsonify({'success': False, 'error': 'KVM not available'}), 503
     
     try:
-        kvm = get_kvm_manager()
-        vms = kvm.list_vms()
-        vm_statuses = []
-        
-        for vm_name in vms:
-            status = kvm.get_vm_status(vm_name)
-            if status:
-                vm_statuses.append({
-                    'name': status.name,
-                    'state': status.state,
-                    'uptime': status.uptime,
-                    'memory_mb': status.memory_mb,
-                    'vcpus': status.vcpus,
-                    'disk_usage_gb': status.disk_usage_gb
-                })
-        
+        listing = kvm_vms_cache.get()
         return jsonify({
             'success': True,
-            'total_vms': len(vms),
-            'vms': vm_statuses
+            'total_vms': listing['total_vms'],
+            'vms': listing['vms']
         })
     except Exception as e:
         return jsonify({'success': False, 'error': str(e)}), 500
@@ -406,6 +397,7 @@ def create_kvm_vm():
         
         kvm = get_kvm_manager()
         success = kvm.create_vm(config)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -424,6 +416,7 @@ def start_kvm_vm(vm_name):
     try:
         kvm = get_kvm_manager()
         success = kvm.start_vm(vm_name)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -442,6 +435,7 @@ def stop_kvm_vm(vm_name):
     try:
         kvm = get_kvm_manager()
         success = kvm.stop_vm(vm_name)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -460,6 +454,7 @@ def delete_kvm_vm(vm_name):
     try:
         kvm = get_kvm_manager()
         success = kvm.delete_vm(vm_name)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -538,6 +533,7 @@ def restore_kvm_snapshot():
         
         kvm = get_kvm_manager()
         success = kvm.restore_snapshot(vm_name, snapshot_name)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -619,6 +615,7 @@ def create_vm_from_image():
         
         kvm = get_kvm_manager()
         success = kvm.create_vm_from_image(vm_name, image_name, vcpus, memory_mb)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -637,6 +634,7 @@ def cleanup_kvm_vm(vm_name):
     try:
         kvm = get_kvm_manager()
         success = kvm.delete_vm(vm_name)
+        kvm_vms_cache.invalidate()
         
         return jsonify({
             'success': success,
@@ -14,6 +14,7 @@ import sys
 sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'sandbox'))
 
 from sandbox.sandbox_api import sandbox_bp
+from live_state import make_blueprint, shared_state
 
 # Set working directory
 script_dir = os.path.dirname(os.path.abspath(__file__)) or '/home/ubuntu/SafeBox/web'
@@ -25,6 +26,10 @@ CORS(app)
 # Register sandbox blueprint
 app.register_blueprint(sandbox_bp)
 
+# Live state shared by every dashboard: /api/state and /api/events (SSE)
+live_hub, live_sampler = shared_state()
+app.register_blueprint(make_blueprint(live_hub, live_sampler))
+
 # HTML Dashboard Template
 DASHBOARD_HTML = '''
 <!DOCTYPE html>
@@ -176,28 +181,11 @@ def static_files(path):
 def get_processes():
     """Get all running processes"""
     try:
-        processes = []
-        for proc in psutil.process_iter(['pid', 'name']):
-            try:
-                mem_info = proc.memory_info()
-                memory_mb = mem_info.rss / (1024 * 1024)
-                cpu_percent = proc.cpu_percent(interval=None) or 0
-                
-                processes.append({
-                    'pid': proc.pid,
-                    'name': proc.name(),
-                    'cpu_percent': float(cpu_percent),
-                    'memory_mb': float(memory_mb)
-                })
-            except (psutil.NoSuchProcess, psutil.AccessDenied, psutil.ZombieProcess):
-                continue
-        
-        processes.sort(key=lambda x: x['cpu_percent'], reverse=True)
-        
+        latest = live_sampler.latest()
         return jsonify({
             'success': True,
-            'processes': processes,
-            'total': len(processes)
+            'processes': latest['processes'],
+            'total': latest['total']
         })
     
     except Exception as e:
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""
+Shared live state for the dashboards.
+
+Instead of every open dashboard polling endpoints that each walk
+psutil.process_iter() or re-query libvirt, one process-wide StateHub holds
+the current state and pushes every change to subscribers:
+
+  * HostEventClient follows the host daemon's event socket
+    (safebox-host --serve --events-socket <path>): pool VM stages and job
+    transitions, keyed "vm/<name>" and "job/<id>".
+  * ProcessSampler scans host processes once per interval, however many
+    dashboards are watching, and publishes the result under "processes".
+
+The Flask apps serve the hub as GET /api/state (the whole snapshot) and
+GET /api/events (Server-Sent Events: a snapshot, then each change).
+"""
+
+import json
+import os
+import queue
+import socket
+import threading
+import time
+
+DEFAULT_EVENTS_SOCKET = os.environ.get('SAFEBOX_EVENTS_SOCKET', '/run/safebox/events.sock')
+
+
+class StateHub:
+    """Latest state per key plus fan-out of changes to subscribers"""
+
+    # Changes a subscriber may fall behind before it is resynced from a
+    # fresh snapshot instead.
+    MAX_PENDING = 1000
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._state = {}
+        self._subscribers = set()
+        self.host_connected = False
+
+    def update(self, key, value):
+        """Set key to value (None removes it) and notify subscribers"""
+        with self._lock:
+            if value is None:
+                self._state.pop(key, None)
+            else:
+                self._state[key] = value
+            subscribers = list(self._subscribers)
+        change = {'key': key, 'value': value}
+        for q in subscribers:
+            try:
+                q.put_nowait(change)
+            except queue.Full:
+                self._resync(q)
+
+    def replace(self, prefixes, entries):
+        """Swap every key under prefixes for entries (key -> value) at once;
+        used when the host daemon sends a new snapshot"""
+        with self._lock:
+            for key in [k for k in self._state if k.startswith(prefixes)]:
+                del self._state[key]
+            self._state.update(entries)
+            subscribers = list(self._subscribers)
+        for q in subscribers:
+            self._resync(q)
+
+    def get(self, key, default=None):
+        with self._lock:
+            return self._state.get(key, default)
+
+    def snapshot(self):
+        """{'host_connected': bool, 'vms': [...], 'jobs': [...], 'processes': ...}"""
+        with self._lock:
+            state = dict(self._state)
+        return {
+            'host_connected': self.host_connected,
+            'vms': [v for k, v in sorted(state.items()) if k.startswith('vm/')],
+            'jobs': [v for k, v in sorted(state.items()) if k.startswith('job/')],
+            'processes': state.get('processes'),
+        }
+
+    def subscribe(self):
+        q = queue.Queue(maxsize=self.MAX_PENDING)
+        with self._lock:
+            self._subscribers.add(q)
+        return q
+
+    def unsubscribe(self, q):
+        with self._lock:
+            self._subscribers.discard(q)
+
+    def subscribers(self):
+        with self._lock:
+            return len(self._subscribers)
+
+    @staticmethod
+    def _resync(q):
+        # Drop what is pending; the reader sends a whole snapshot instead.
+        try:
+            while True:
+                q.get_nowait()
+        except queue.Empty:
+            pass
+        try:
+            q.put_nowait({'resync': True})
+        except queue.Full:
+            pass
+
+
+class HostEventClient:
+    """Follows the host daemon's event socket and mirrors it into a hub,
+    reconnecting (to a fresh snapshot) whenever the daemon restarts"""
+
+    def __init__(self, hub, path=DEFAULT_EVENTS_SOCKET, retry=2.0):
+        self.hub = hub
+        self.path = path
+        self.retry = retry
+        self._stop = threading.Event()
+        self._thread = None
+
+    def start(self):
+        if self._thread is None:
+            self._thread = threading.Thread(target=self._run, name='host-events', daemon=True)
+            self._thread.start()
+        return self
+
+    def stop(self):
+        self._stop.set()
+
+    def _run(self):
+        while not self._stop.is_set():
+            try:
+                with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                    sock.connect(self.path)
+                    sock.settimeout(1.0)
+                    self._follow(sock)
+            except OSError:
+                pass
+            self.hub.host_connected = False
+            self._stop.wait(self.retry)
+
+    def _follow(self, sock):
+        pending = {}
+        synced = False
+        buf = b''
+        while not self._stop.is_set():
+            try:
+                chunk = sock.recv(65536)
+            except socket.timeout:
+                continue
+            if not chunk:
+                return
+            buf += chunk
+            *lines, buf = buf.split(b'\n')
+            for line in lines:
+                try:
+                    event = json.loads(line)
+                except ValueError:
+                    continue
+                if event.get('type') == 'synced':
+                    # Keys the daemon no longer has (it restarted) go away.
+                    self.hub.replace(('vm/', 'job/'), pending)
+                    self.hub.host_connected = True
+                    synced = True
+                    pending = {}
+                elif 'key' in event:
+                    event.pop('snapshot', None)
+                    if synced:
+                        self.hub.update(event['key'], event)
+                    else:
+                        pending[event['key']] = event
+
+
+def scan_processes():
+    """Every host process with its CPU and memory use, busiest first"""
+    import psutil
+    processes = []
+    for proc in psutil.process_iter(['pid', 'name']):
+        try:
+            processes.append({
+                'pid': proc.pid,
+                'name': proc.name(),
+                'cpu_percent': float(proc.cpu_percent(interval=None) or 0),
+                'memory_mb': float(proc.memory_info().rss / (1024 * 1024)),
+            })
+        except Exception:
+            continue
+    processes.sort(key=lambda p: p['cpu_percent'], reverse=True)
+    return processes
+
+
+class ProcessSampler:
+    """One process scan per interval, shared by every request and stream.
+    The sampler only runs while someone looked at it in the last idle_after
+    seconds, so an unwatched server does not keep scanning."""
+
+    def __init__(self, hub, interval=2.0, idle_after=30.0, scan=scan_processes):
+        self.hub = hub
+        self.interval = interval
+        self.idle_after = idle_after
+        self.scan = scan
+        self._lock = threading.Lock()
+        self._wanted = 0.0
+        self._thread = None
+
+    def latest(self):
+        """The most recent scan, sampling now if there is none that is
+        recent (the sampler may just have woken up from idle)"""
+        self.touch()
+        current = self.hub.get('processes')
+        if current is None or time.time() - current['time'] > 2 * self.interval:
+            current = self._sample()
+        return current
+
+    def touch(self):
+        with self._lock:
+            self._wanted = time.monotonic()
+            if self._thread is None or not self._thread.is_alive():
+                self._thread = threading.Thread(target=self._run, name='process-sampler', daemon=True)
+                self._thread.start()
+
+    def _sample(self):
+        processes = self.scan()
+        value = {'processes': processes, 'total': len(processes), 'time': time.time()}
+        self.hub.update('processes', value)
+        return value
+
+    def _run(self):
+        while True:
+            with self._lock:
+                if time.monotonic() - self._wanted > self.idle_after and not self.hub.subscribers():
+                    self._thread = None
+                    return
+            try:
+                self._sample()
+            except Exception:
+                pass
+            time.sleep(self.interval)
+
+
+def sse_events(hub, sampler=None, heartbeat=15.0, stop=None):
+    """Server-Sent Events for one subscriber: the whole snapshot first,
+    then one event per change, named after the kind of key (vm, job,
+    processes) and a comment line as keep-alive"""
+    q = hub.subscribe()
+    try:
+        yield 'event: snapshot\ndata: %s\n\n' % json.dumps(hub.snapshot())
+        while stop is None or not stop.is_set():
+            if sampler is not None:
+                sampler.touch()
+            try:
+                change = q.get(timeout=heartbeat)
+            except queue.Empty:
+                yield ': keep-alive\n\n'
+                continue
+            if change.get('resync'):
+                yield 'event: snapshot\ndata: %s\n\n' % json.dumps(hub.snapshot())
+                continue
+            kind = change['key'].split('/', 1)[0]
+            yield 'event: %s\ndata: %s\n\n' % (kind, json.dumps(change))
+    finally:
+        hub.unsubscribe(q)
+
+
+class TTLCache:
+    """A value recomputed at most every ttl seconds, shared by all callers
+    (for hypervisor queries that have no event feed)"""
+
+    def __init__(self, ttl, fn):
+        self.ttl = ttl
+        self.fn = fn
+        self._lock = threading.Lock()
+        self._value = None
+        self._at = None
+
+    def get(self):
+        with self._lock:
+            if self._at is None or time.monotonic() - self._at >= self.ttl:
+                self._value = self.fn()
+                self._at = time.monotonic()
+            return self._value
+
+    def invalidate(self):
+        with self._lock:
+            self._at = None
+
+
+_hub = None
+_sampler = None
+_hub_lock = threading.Lock()
+
+
+def shared_state(events_socket=DEFAULT_EVENTS_SOCKET):
+    """The process-wide hub and sampler, started on first use"""
+    global _hub, _sampler
+    with _hub_lock:
+        if _hub is None:
+            _hub = StateHub()
+            _sampler = ProcessSampler(_hub)
+            HostEventClient(_hub, events_socket).start()
+        return _hub, _sampler
+
+
+def make_blueprint(hub, sampler):
+    """/api/state and /api/events for a Flask app"""
+    from flask import Blueprint, Response, jsonify, stream_with_context
+
+    bp = Blueprint('live_state', __name__)
+
+    @bp.route('/api/state', methods=['GET'])
+    def state():
+        sampler.touch()
+        return jsonify(hub.snapshot())
+
+    @bp.route('/api/events', methods=['GET'])
+    def events():
+        sampler.touch()
+        headers = {'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'}
+        return Response(stream_with_context(sse_events(hub, sampler)),
+                        mimetype='text/event-stream', headers=headers)
+
+    return bp
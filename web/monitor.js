@@ -48,6 +48,46 @@ function initSidebar() {
     });
 }
 
+// ===== LIVE STATE =====
+// /api/events pushes the server's shared state; while it is connected the
+// dashboard reads processes and pool changes from it instead of polling.
+let liveConnected = false;
+let liveProcesses = null;
+let vmRefreshTimer = null;
+
+function connectLiveState() {
+    if (!window.EventSource) return;
+    const source = new EventSource('/api/events');
+    source.addEventListener('snapshot', (e) => {
+        const state = JSON.parse(e.data);
+        liveConnected = true;
+        liveProcesses = state.processes ? state.processes.processes : null;
+    });
+    source.addEventListener('processes', (e) => {
+        liveProcesses = JSON.parse(e.data).value.processes;
+    });
+    source.addEventListener('vm', () => {
+        // Coalesce a burst of pool stage changes into one listing.
+        clearTimeout(vmRefreshTimer);
+        vmRefreshTimer = setTimeout(refreshKVMVMs, 1000);
+    });
+    source.addEventListener('job', (e) => {
+        const job = JSON.parse(e.data).value;
+        if (!job || job.status === 'queued' || job.status === 'running') return;
+        const level = job.verdict ? job.verdict.threat_level : 'unknown';
+        addLog(`Job ${job.id || job.file}: ${job.status} (${level})`, job.status === 'completed' ? 'success' : 'error');
+    });
+    // EventSource reconnects by itself; poll until it does.
+    source.onerror = () => { liveConnected = false; };
+}
+
+async function getProcesses() {
+    if (liveConnected && liveProcesses) return liveProcesses;
+    const response = await fetch('/api/processes');
+    const data = await response.json();
+    return data.processes || [];
+}
+
 // ===== CPU MONITORING =====
 function startMonitoring() {
     if (monitoring) return;
@@ -107,9 +147,7 @@ function updateStatus(running) {
 
 async function checkAndKillHighCpuProcesses(threshold) {
     try {
-        const response = await fetch('/api/processes');
-        const data = await response.json();
-        const processes = data.processes || [];
+        const processes = await getProcesses();
 
         document.getElementById('totalProcesses').textContent = processes.length;
 
@@ -179,9 +217,7 @@ async function scanForMalware() {
     if (!document.getElementById('autoDetect').checked) return;
 
     try {
-        const response = await fetch('/api/processes');
-        const data = await response.json();
-        const processes = data.processes || [];
+        const processes = await getProcesses();
 
         // Simulate malware detection (in production, use signature database)
         for (const proc of processes) {
@@ -648,10 +684,11 @@ document.addEventListener('DOMContentLoaded', () => {
     loadTestSamples();
     updateStatus(false);
     initKVM();
+    connectLiveState();
 
     // Continuous malware scanning
     setInterval(scanForMalware, 5000);
 
-    // Refresh KVM status every 30 seconds
-    setInterval(refreshKVMVMs, 30000);
+    // Refresh KVM status every 30 seconds, unless pushed changes already do
+    setInterval(() => { if (!liveConnected) refreshKVMVMs(); }, 30000);
 });
@@ -19,6 +19,32 @@ function switchTab(tabName) {
     }
 }
 
+// ============ LIVE STATE ============
+// /api/events pushes the server's shared process scan; while it is
+// connected the monitor reads it instead of polling /api/processes.
+let liveConnected = false;
+let liveProcesses = null;
+
+function connectLiveState() {
+    if (!window.EventSource) return;
+    const source = new EventSource('/api/events');
+    source.addEventListener('snapshot', (e) => {
+        const state = JSON.parse(e.data);
+        liveConnected = true;
+        liveProcesses = state.processes;
+    });
+    source.addEventListener('processes', (e) => {
+        liveProcesses = JSON.parse(e.data).value;
+    });
+    source.onerror = () => { liveConnected = false; };
+}
+
+async function getProcesses() {
+    if (liveConnected && liveProcesses) return { success: true, ...liveProcesses };
+    const response = await fetch('/api/processes', { timeout: 15000 });
+    return response.json();
+}
+
 // ============ MONITOR TAB ============
 
 function startMonitoring() {
@@ -45,8 +71,7 @@ async function checkAndKillHighCpuProcesses() {
     const threshold = parseFloat(document.getElementById('cpuThreshold').value);
 
     try {
-        const response = await fetch('/api/processes', { timeout: 15000 });
-        const data = await response.json();
+        const data = await getProcesses();
 
         if (!data.success || !data.processes) {
             addLog('❌ Failed to fetch processes', 'error');
@@ -341,4 +366,5 @@ async function preScanFile() {
 // Initialize
 document.addEventListener('DOMContentLoaded', () => {
     addLog('🔒 SafeBox Hypervisor Dashboard loaded', 'info');
+    connectLiveState();
 });